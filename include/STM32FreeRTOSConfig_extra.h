@@ -0,0 +1,20 @@
+#ifndef STM32FREERTOSCONFIG_EXTRA_H
+#define STM32FREERTOSCONFIG_EXTRA_H
+
+/*
+ * Additions to the STM32FreeRTOS default configuration, which includes this file first
+ */
+
+// Every task, queue and mutex is created from the tables in main.cpp with memory reserved at build time, so the RAM
+// they take is in the build's RAM budget (tools/ram_budget.py) rather than found out at run time
+#define configSUPPORT_STATIC_ALLOCATION 1
+
+// For the most stack used by each task, sent over Serial for 's'
+#define INCLUDE_uxTaskGetStackHighWaterMark 1
+#define INCLUDE_xTaskGetIdleTaskHandle 1
+
+// Checks the stack pointer and the end of the stack on every switch away from a task, and calls
+// vApplicationStackOverflowHook() if it has overflowed
+#define configCHECK_FOR_STACK_OVERFLOW 2
+
+#endif
@@ -1,3 +1,5 @@
+// The host build uses the simulated bus in sim_can_bus.cpp instead
+#ifdef ARDUINO
 #include <stm32l4xx_hal_can.h>
 #include <stm32l4xx_hal_rcc.h>
 #include <stm32l4xx_hal_gpio.h>
@@ -11,6 +13,9 @@ extern "C" void CAN1_TX_IRQHandler(void);
 void (*CAN_RX_ISR)() = NULL;
 void (*CAN_TX_ISR)() = NULL;
 
+//Set when the transmit interrupt has been requested from software
+volatile uint8_t CAN_TX_Requested = 0;
+
 //CAN handle struct with initialisation parameters
 //Timing from http://www.bittiming.can-wiki.info/ with bit rate = 125kHz and clock frequency = 80MHz
 CAN_HandleTypeDef CAN_Handle = {
@@ -90,6 +95,26 @@ uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank) {
 }
 
 
+uint32_t clearCANFilter(uint32_t filterBank) {
+
+  //Only the bank and the activation matter when disabling
+  CAN_FilterTypeDef filterInfo = {
+    0,                          //Filter ID
+    0,                          //Filter ID LSBs = 0
+    0,                          //Mask MSBs
+    0,                          //Mask LSBs = 0
+    0,                          //FIFO selection
+    filterBank & 0xf,           //Filter bank selection
+    CAN_FILTERMODE_IDMASK,      //Mask mode
+    CAN_FILTERSCALE_32BIT,      //32 bit IDs
+    CAN_FILTER_DISABLE,         //Disable filter
+    0                           //uint32_t SlaveStartFilterBank
+  };
+
+  return (uint32_t) HAL_CAN_ConfigFilter(&CAN_Handle, &filterInfo);
+}
+
+
 uint32_t CAN_Start() {
   return (uint32_t) HAL_CAN_Start(&CAN_Handle);
 }
@@ -115,6 +140,11 @@ uint32_t CAN_TX(uint32_t ID, uint8_t data[8]) {
 }
 
 
+uint32_t CAN_GetTXFreeLevel() {
+  return HAL_CAN_GetTxMailboxesFreeLevel(&CAN_Handle);
+}
+
+
 uint32_t CAN_CheckRXLevel() {
   return HAL_CAN_GetRxFifoFillLevel(&CAN_Handle, 0);
 }
@@ -166,6 +196,13 @@ uint32_t CAN_RegisterTX_ISR(void(& callback)()) {
 }
 
 
+void CAN_RequestTX_ISR() {
+  //Flag the request, as the HAL handler only calls back for completed mailboxes
+  __atomic_store_n(&CAN_TX_Requested, 1, __ATOMIC_RELAXED);
+  HAL_NVIC_SetPendingIRQ(CAN1_TX_IRQn);
+}
+
+
 void HAL_CAN_RxFifo0MsgPendingCallback (CAN_HandleTypeDef * hcan){
 
   //Call the user ISR if it has been registered
@@ -211,4 +248,10 @@ void CAN1_TX_IRQHandler(void){
 
   //Use the HAL interrupt handler
   HAL_CAN_IRQHandler(&CAN_Handle);
+
+  //Call the user ISR if the interrupt was requested from software
+  if (__atomic_exchange_n(&CAN_TX_Requested, 0, __ATOMIC_RELAXED) && CAN_TX_ISR)
+    CAN_TX_ISR();
 }
+
+#endif
@@ -8,9 +8,15 @@ uint32_t CAN_Start();
 // Defaults to receive everything
 uint32_t setCANFilter(uint32_t filterID = 0, uint32_t maskID = 0, uint32_t filterBank = 0);
 
+// Disable a receive filter bank, so it no longer accepts messages
+uint32_t clearCANFilter(uint32_t filterBank);
+
 // Send a message
 uint32_t CAN_TX(uint32_t ID, uint8_t data[8]);
 
+// Get the number of empty transmit mailboxes
+uint32_t CAN_GetTXFreeLevel();
+
 // Get the number of received messages
 uint32_t CAN_CheckRXLevel();
 
@@ -22,3 +28,6 @@ uint32_t CAN_RegisterRX_ISR(void (&callback)());
 
 // Set up an interrupt on transmitted messages
 uint32_t CAN_RegisterTX_ISR(void (&callback)());
+
+// Call the transmit interrupt from software, e.g. to fill the mailboxes when new messages are ready
+void CAN_RequestTX_ISR();
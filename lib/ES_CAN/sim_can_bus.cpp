@@ -0,0 +1,783 @@
+#ifndef ARDUINO
+#include <cstdint>
+#include <cstring>
+#include <ES_CAN.h>
+#include "sim_can_bus.h"
+
+// Node the ES_CAN functions act on, set by bind() in each task and by the bus thread around a node's interrupts
+static thread_local SimCanNode *currentNode = nullptr;
+
+// Time the interrupt the bus thread is calling was raised, or nullptr outside the interrupts
+static thread_local const std::chrono::steady_clock::time_point *interruptTime = nullptr;
+
+uint32_t simCanFrameBits(uint32_t id, const uint8_t data[8])
+/*
+ * Time on the bus of a standard data frame with 8 bytes, with the stuff bits it actually needs and the interframe space
+ *
+ * :param id: standard CAN ID of the frame
+ *
+ * :param data: the 8 bytes of the frame
+ *
+ * :return: the length in bit times
+ */
+{
+    // Start of frame to the end of the CRC, the part that is stuffed
+    uint8_t bits[98];
+    uint8_t length = 0;
+    auto push = [&bits, &length](uint32_t value, uint8_t width)
+    {
+        for (int8_t b = width - 1; b >= 0; b--)
+        {
+            bits[length++] = (value >> b) & 1;
+        }
+    };
+    push(0, 1);           // Start of frame
+    push(id & 0x7FF, 11); // Identifier
+    push(0, 3);           // Data frame, standard ID, reserved bit
+    push(8, 4);           // Data length
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        push(data[i], 8);
+    }
+    uint16_t crc = 0;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        bool next = bits[i] ^ ((crc >> 14) & 1);
+        crc = (crc << 1) & 0x7FFF;
+        if (next)
+        {
+            crc ^= 0x4599;
+        }
+    }
+    push(crc, 15);
+
+    // After five equal bits the transmitter inserts the opposite one, which starts the next run
+    uint32_t stuffed = 0;
+    uint8_t run = 0;
+    uint8_t last = 2;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        run = bits[i] == last ? run + 1 : 1;
+        last = bits[i];
+        if (run == 5)
+        {
+            stuffed++;
+            last = !last;
+            run = 1;
+        }
+    }
+
+    // CRC delimiter, acknowledge slot and delimiter, end of frame and interframe space are never stuffed
+    return length + stuffed + 13;
+}
+
+SimCanNode *simCanNode()
+/*
+ * :return: node the calling thread is bound to, set for the node's interrupts while they run, or nullptr
+ */
+{
+    return currentNode;
+}
+
+bool SimCanNode::accepts(uint32_t id) const
+/*
+ * :param id: standard CAN ID of a frame on the bus
+ *
+ * :return: true if an enabled filter bank passes the frame
+ */
+{
+    for (uint8_t bank = 0; bank < SIM_CAN_FILTER_BANKS; bank++)
+    {
+        if ((filterEnabled >> bank) & 1 && ((id ^ filterIds[bank]) & filterMasks[bank] & 0x7FF) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+SimCanNode::SimCanNode(SimCanBus &canBus) : bus(canBus)
+/*
+ * Initialiser for the SimCanNode class, attaching it to a bus
+ * The bus must have room for another node, and must be stopped before the node is destroyed
+ *
+ * :param canBus: bus the node transmits and receives on
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    index = bus.count;
+    if (bus.count < SIM_CAN_NODES)
+    {
+        bus.nodes[bus.count++] = this;
+    }
+}
+
+void SimCanNode::bind()
+/*
+ * Makes the ES_CAN functions called from this thread act on this node
+ */
+{
+    currentNode = this;
+}
+
+void SimCanNode::init(bool loopbackMode)
+/*
+ * CAN_Init(), stops the node and sets its mode
+ *
+ * :param loopbackMode: if true the node receives its own frames and nothing from the other nodes
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    started = false;
+    loopback = loopbackMode;
+}
+
+void SimCanNode::start()
+/*
+ * CAN_Start(), the node transmits its mailboxes and receives from then on
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    started = true;
+    bus.changed.notify_one();
+}
+
+void SimCanNode::setFilter(uint32_t filterId, uint32_t maskId, uint32_t filterBank)
+/*
+ * setCANFilter(), a frame is received if its ID matches the filter ID in the bits of the mask, in any enabled bank
+ *
+ * :param filterId: standard ID to match
+ *
+ * :param maskId: bits of the ID that must match
+ *
+ * :param filterBank: filter bank to set and enable
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    uint8_t bank = filterBank % SIM_CAN_FILTER_BANKS;
+    filterIds[bank] = filterId;
+    filterMasks[bank] = maskId;
+    filterEnabled |= 1 << bank;
+}
+
+void SimCanNode::clearFilter(uint32_t filterBank)
+/*
+ * clearCANFilter(), disables a filter bank
+ *
+ * :param filterBank: filter bank to disable
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    filterEnabled &= ~(1 << (filterBank % SIM_CAN_FILTER_BANKS));
+}
+
+void SimCanNode::transmit(uint32_t id, const uint8_t data[8])
+/*
+ * CAN_TX(), waits for an empty mailbox and places the frame in it
+ *
+ * :param id: standard CAN ID of the frame
+ *
+ * :param data: the 8 bytes of the frame, copied into the mailbox
+ */
+{
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(bus.mutex);
+            if (txCount < SIM_CAN_MAILBOXES)
+            {
+                uint8_t mailbox = (txFirst + txCount) % SIM_CAN_MAILBOXES;
+                mailboxes[mailbox].id = id & 0x7FF;
+                memcpy(mailboxes[mailbox].data, data, 8);
+                // An interrupt runs as soon as it is raised, however late the bus thread got to it
+                queued[mailbox] = interruptTime ? *interruptTime : bus.now();
+                txCount++;
+                maxMailboxes = txCount > maxMailboxes ? txCount : maxMailboxes;
+                bus.changed.notify_one();
+                return;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+uint8_t SimCanNode::txFreeLevel()
+/*
+ * CAN_GetTXFreeLevel()
+ *
+ * :return: number of empty transmit mailboxes
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return SIM_CAN_MAILBOXES - txCount;
+}
+
+uint8_t SimCanNode::rxLevel()
+/*
+ * CAN_CheckRXLevel()
+ *
+ * :return: number of frames in the receive FIFO
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return rxCount;
+}
+
+void SimCanNode::receive(uint32_t &id, uint8_t data[8])
+/*
+ * CAN_RX(), waits for a frame in the receive FIFO and takes it
+ *
+ * :param id: set to the standard ID of the frame
+ *
+ * :param data: set to the 8 bytes of the frame
+ */
+{
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(bus.mutex);
+            if (rxCount)
+            {
+                id = rxFifo[rxFirst].id;
+                memcpy(data, rxFifo[rxFirst].data, 8);
+                rxFirst = (rxFirst + 1) % SIM_CAN_RX_FIFO;
+                rxCount--;
+                return;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void SimCanNode::registerRxIsr(void (*callback)())
+/*
+ * CAN_RegisterRX_ISR(), called from the bus thread while the receive FIFO holds a frame
+ *
+ * :param callback: the receive interrupt
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    rxIsr = callback;
+    bus.changed.notify_one();
+}
+
+void SimCanNode::registerTxIsr(void (*callback)())
+/*
+ * CAN_RegisterTX_ISR(), called from the bus thread when a mailbox has been transmitted or the interrupt requested
+ *
+ * :param callback: the transmit interrupt
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    txIsr = callback;
+}
+
+void SimCanNode::requestTxIsr()
+/*
+ * CAN_RequestTX_ISR(), has the bus thread call the transmit interrupt even if no mailbox has completed
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    txPending = true;
+    txRaised = bus.now();
+    bus.changed.notify_one();
+}
+
+void SimCanNode::maskInterrupts()
+/*
+ * Holds back the node's interrupts until unmaskInterrupts(), waiting for one that is running to return
+ * Must not be called from the node's interrupts
+ */
+{
+    interrupts.lock();
+}
+
+void SimCanNode::unmaskInterrupts()
+/*
+ * Lets the interrupts held back by maskInterrupts() run
+ */
+{
+    interrupts.unlock();
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    bus.changed.notify_one();
+}
+
+uint8_t SimCanNode::getIndex() const
+/*
+ * :return: position of the node on its bus, in the order the nodes were attached
+ */
+{
+    return index;
+}
+
+uint32_t SimCanNode::getSent()
+/*
+ * :return: number of frames transmitted
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return sent;
+}
+
+uint32_t SimCanNode::getReceived()
+/*
+ * :return: number of frames placed in the receive FIFO
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return received;
+}
+
+uint32_t SimCanNode::getLost()
+/*
+ * :return: number of frames the filters accepted that were lost on the way, with the bus's loss probability
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return lost;
+}
+
+uint32_t SimCanNode::getOverruns()
+/*
+ * :return: number of frames dropped because the receive FIFO was full
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return overruns;
+}
+
+uint8_t SimCanNode::getMaxMailboxes()
+/*
+ * :return: most transmit mailboxes full at once
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return maxMailboxes;
+}
+
+uint8_t SimCanNode::getMaxRxLevel()
+/*
+ * :return: most frames waiting in the receive FIFO at once
+ */
+{
+    std::lock_guard<std::mutex> lock(bus.mutex);
+    return maxRxLevel;
+}
+
+SimCanBus::SimCanBus(uint32_t bitRate)
+    : bitTime(1000000000 / bitRate), epoch(std::chrono::steady_clock::now()), idle(epoch), virtualNow(epoch)
+/*
+ * Initialiser for the SimCanBus class
+ *
+ * :param bitRate: bits per second on the bus
+ */
+{
+}
+
+SimCanBus::~SimCanBus()
+{
+    stop();
+}
+
+void SimCanBus::start()
+/*
+ * Starts the bus thread, frames already in the mailboxes arbitrate as soon as it runs
+ */
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running)
+    {
+        running = true;
+        thread = std::thread(&SimCanBus::run, this);
+    }
+}
+
+void SimCanBus::stop()
+/*
+ * Stops the bus thread once the frame on the bus has been delivered and the interrupts called
+ */
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+        changed.notify_one();
+    }
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void SimCanBus::setLoss(uint32_t perMillion)
+/*
+ * Sets the probability a receiver misses a frame, independently for each receiver
+ *
+ * :param perMillion: probability in parts per million
+ */
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lossRate = perMillion;
+}
+
+uint32_t SimCanBus::micros()
+/*
+ * The clock of every node, in an interrupt it is the time the interrupt was raised, so the times it records don't
+ * depend on how late the host ran the bus thread
+ *
+ * :return: microseconds since the bus was created
+ */
+{
+    std::chrono::steady_clock::time_point time = interruptTime ? *interruptTime : now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - epoch).count();
+}
+
+uint32_t SimCanBus::getFrames()
+/*
+ * :return: number of frames transmitted
+ */
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames;
+}
+
+uint64_t SimCanBus::getBusyBits()
+/*
+ * :return: bit times the bus has been busy with frames, including their interframe space
+ */
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return busyBits;
+}
+
+bool SimCanBus::runInterrupts(std::unique_lock<std::mutex> &lock)
+/*
+ * Calls the interrupts of every node that has one pending and not masked, with the bus mutex released
+ *
+ * :param lock: the held bus mutex
+ *
+ * :return: true if an interrupt was left pending as it is masked
+ */
+{
+    bool masked = false;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SimCanNode &node = *nodes[i];
+        bool tx = node.txPending && node.txIsr;
+        bool rx = node.rxCount && node.rxIsr;
+        if (!tx && !rx)
+        {
+            continue;
+        }
+        if (!node.interrupts.try_lock())
+        {
+            masked = true;
+            continue;
+        }
+        node.txPending = node.txPending && !tx;
+        SimCanNode *bound = currentNode;
+        void (*txIsr)() = node.txIsr;
+        void (*rxIsr)() = node.rxIsr;
+        std::chrono::steady_clock::time_point txTime = node.txRaised;
+        std::chrono::steady_clock::time_point rxTime = idle;
+
+        // The transmit interrupt has the lower IRQ number, so it goes first when both are pending
+        lock.unlock();
+        currentNode = &node;
+        if (tx)
+        {
+            interruptTime = &txTime;
+            txIsr();
+        }
+        if (rx)
+        {
+            interruptTime = &rxTime;
+            rxIsr();
+        }
+        currentNode = bound;
+        interruptTime = nullptr;
+        node.interrupts.unlock();
+        lock.lock();
+    }
+    return masked;
+}
+
+void SimCanBus::deliver(SimCanNode &sender, const SimCanFrame &frame)
+/*
+ * Places a transmitted frame in the receive FIFO of every node accepting it, must be called with the bus mutex held
+ *
+ * :param sender: node that transmitted the frame
+ *
+ * :param frame: the frame
+ */
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SimCanNode &node = *nodes[i];
+        if (!node.started || node.loopback != (&node == &sender) || !node.accepts(frame.id))
+        {
+            continue;
+        }
+        random = random * 1664525 + 1013904223;
+        if (((uint64_t)random * 1000000 >> 32) < lossRate)
+        {
+            node.lost++;
+            continue;
+        }
+        if (node.rxCount == SIM_CAN_RX_FIFO)
+        {
+            node.overruns++;
+            continue;
+        }
+        node.rxFifo[(node.rxFirst + node.rxCount) % SIM_CAN_RX_FIFO] = frame;
+        node.rxCount++;
+        node.received++;
+        node.maxRxLevel = node.rxCount > node.maxRxLevel ? node.rxCount : node.maxRxLevel;
+    }
+}
+
+std::chrono::steady_clock::time_point SimCanBus::now() const
+/*
+ * :return: the time on the virtual clock once advance() has been called, or else the host's
+ */
+{
+    return virtualTime ? virtualNow : std::chrono::steady_clock::now();
+}
+
+SimCanNode *SimCanBus::arbitrate(std::chrono::steady_clock::time_point &start)
+/*
+ * Picks the next frame, must be called with the bus mutex held
+ * The next frame starts when the bus went idle or, if nothing was waiting then, when the first frame was queued.
+ * The front mailbox of every started node holding a frame by then arbitrates, and the lowest ID is dominant.
+ *
+ * :param start: set to the time the frame starts
+ *
+ * :return: node transmitting it, or nullptr if no mailbox holds a frame
+ */
+{
+    SimCanNode *winner = nullptr;
+    start = std::chrono::steady_clock::time_point::max();
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SimCanNode &node = *nodes[i];
+        if (node.started && node.txCount && node.queued[node.txFirst] < start)
+        {
+            start = node.queued[node.txFirst];
+        }
+    }
+    start = start > idle ? start : idle;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SimCanNode &node = *nodes[i];
+        if (node.started && node.txCount && node.queued[node.txFirst] <= start &&
+            (!winner || node.mailboxes[node.txFirst].id < winner->mailboxes[winner->txFirst].id))
+        {
+            winner = &node;
+        }
+    }
+    return winner;
+}
+
+void SimCanBus::complete(SimCanNode &winner)
+/*
+ * Ends the frame at the front of the winner's mailboxes and delivers it, must be called with the bus mutex held
+ *
+ * :param winner: node from arbitrate(), the frame ended at idle
+ */
+{
+    SimCanFrame frame = winner.mailboxes[winner.txFirst];
+    winner.txFirst = (winner.txFirst + 1) % SIM_CAN_MAILBOXES;
+    winner.txCount--;
+    winner.sent++;
+    winner.txPending = true;
+    winner.txRaised = idle > winner.txRaised ? idle : winner.txRaised;
+    frames++;
+    busyBits += simCanFrameBits(frame.id, frame.data);
+    deliver(winner, frame);
+}
+
+void SimCanBus::run()
+/*
+ * Arbitrates, transmits and delivers frames, and calls the pending interrupts, until stop()
+ */
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle = std::chrono::steady_clock::now();
+    while (running)
+    {
+        bool masked = runInterrupts(lock);
+
+        // The frame starts when it would have, however late the bus thread got to it
+        std::chrono::steady_clock::time_point start;
+        SimCanNode *winner = arbitrate(start);
+        if (!winner)
+        {
+            // A masked interrupt is retried shortly, as nothing else may wake the bus
+            if (masked)
+            {
+                changed.wait_for(lock, std::chrono::microseconds(100));
+            }
+            else if (running)
+            {
+                changed.wait(lock);
+            }
+            continue;
+        }
+
+        // Frames queued while this one is on the bus wait for the next arbitration
+        const SimCanFrame &frame = winner->mailboxes[winner->txFirst];
+        idle = start + std::chrono::nanoseconds((uint64_t)simCanFrameBits(frame.id, frame.data) * bitTime);
+        lock.unlock();
+        std::this_thread::sleep_until(idle);
+        lock.lock();
+        complete(*winner);
+    }
+}
+
+void SimCanBus::advance(uint32_t until)
+/*
+ * Runs the bus on a virtual clock from the calling thread, instead of the bus thread, up to a time
+ * Every frame that ends by then is transmitted and delivered and every interrupt raised by then is called, at the
+ * times they would have happened, and micros() then returns the time. Must not be mixed with start().
+ *
+ * :param until: time to run to in microseconds since the bus was created, earlier times leave the clock as it is
+ */
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    virtualTime = true;
+    std::chrono::steady_clock::time_point end = epoch + std::chrono::microseconds(until);
+    while (true)
+    {
+        // Nothing can be masked, as the tasks run on this thread
+        runInterrupts(lock);
+
+        // A frame that doesn't end in time is arbitrated again on the next call, only frames queued by its start join
+        std::chrono::steady_clock::time_point start;
+        SimCanNode *winner = arbitrate(start);
+        if (!winner)
+        {
+            break;
+        }
+        const SimCanFrame &frame = winner->mailboxes[winner->txFirst];
+        std::chrono::steady_clock::time_point ends =
+            start + std::chrono::nanoseconds((uint64_t)simCanFrameBits(frame.id, frame.data) * bitTime);
+        if (ends > end)
+        {
+            break;
+        }
+        idle = ends;
+        virtualNow = ends > virtualNow ? ends : virtualNow;
+        complete(*winner);
+    }
+    virtualNow = end > virtualNow ? end : virtualNow;
+}
+
+uint32_t CAN_Init(bool loopback)
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->init(loopback);
+    return 0;
+}
+
+uint32_t CAN_Start()
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->start();
+    return 0;
+}
+
+uint32_t setCANFilter(uint32_t filterID, uint32_t maskID, uint32_t filterBank)
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->setFilter(filterID, maskID, filterBank);
+    return 0;
+}
+
+uint32_t clearCANFilter(uint32_t filterBank)
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->clearFilter(filterBank);
+    return 0;
+}
+
+uint32_t CAN_TX(uint32_t ID, uint8_t data[8])
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->transmit(ID, data);
+    return 0;
+}
+
+uint32_t CAN_GetTXFreeLevel()
+{
+    SimCanNode *node = simCanNode();
+    return node ? node->txFreeLevel() : 0;
+}
+
+uint32_t CAN_CheckRXLevel()
+{
+    SimCanNode *node = simCanNode();
+    return node ? node->rxLevel() : 0;
+}
+
+uint32_t CAN_RX(uint32_t &ID, uint8_t data[8])
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->receive(ID, data);
+    return 0;
+}
+
+uint32_t CAN_RegisterRX_ISR(void (&callback)())
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->registerRxIsr(&callback);
+    return 0;
+}
+
+uint32_t CAN_RegisterTX_ISR(void (&callback)())
+{
+    SimCanNode *node = simCanNode();
+    if (!node)
+    {
+        return 1;
+    }
+    node->registerTxIsr(&callback);
+    return 0;
+}
+
+void CAN_RequestTX_ISR()
+{
+    SimCanNode *node = simCanNode();
+    if (node)
+    {
+        node->requestTxIsr();
+    }
+}
+
+#endif
@@ -0,0 +1,371 @@
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifndef SIM_CAN_BUS_H
+#define SIM_CAN_BUS_H
+
+#ifndef ARDUINO
+
+/*
+ * Simulated CAN bus for the host build, behind the same functions as ES_CAN
+ *
+ * Several modules run in one process, each with a SimCanNode in place of its CAN peripheral. A task binds itself to
+ * its module's node, and the ES_CAN functions it calls act on that node. The bus runs in its own thread in real time:
+ * once the bus is idle, the frames at the front of every node's transmit mailboxes arbitrate, the lowest ID wins and
+ * takes its stuffed length in bit times, then it lands in the receive FIFO of every other node whose filters accept it.
+ * The registered interrupts are called from the bus thread, bound to their node, so the interrupts of every node are
+ * serialised as the priority 6 CAN interrupts are on the board, but run alongside the node's tasks as if they preempted
+ * them. A node's tasks mask its interrupts with maskInterrupts() in place of a critical section.
+ * The ES_CAN functions return 0 (HAL_OK) on success and 1 (HAL_ERROR) when the thread is not bound to a node.
+ *
+ * Instead of starting the bus thread, a test can drive the bus from its own thread on a virtual clock with advance().
+ * Nothing then depends on how the host schedules its threads, so the results are the same on every run.
+ */
+
+const uint32_t SIM_CAN_BIT_RATE = 125000; // bit/s of the bus on the board
+const uint8_t SIM_CAN_NODES = 16;          // Nodes on one bus at most
+const uint8_t SIM_CAN_MAILBOXES = 3;       // Transmit mailboxes of the bxCAN peripheral
+const uint8_t SIM_CAN_RX_FIFO = 3;         // Depth of the bxCAN receive FIFO 0
+const uint8_t SIM_CAN_FILTER_BANKS = 14;   // Filter banks of the bxCAN peripheral
+
+struct SimCanFrame
+{
+    uint32_t id;
+    uint8_t data[8];
+};
+
+uint32_t simCanFrameBits(uint32_t id, const uint8_t data[8]);
+/*
+ * Time on the bus of a standard data frame with 8 bytes, with the stuff bits it actually needs and the interframe space
+ *
+ * :param id: standard CAN ID of the frame
+ *
+ * :param data: the 8 bytes of the frame
+ *
+ * :return: the length in bit times
+ */
+
+class SimCanBus;
+
+class SimCanNode
+/*
+ * CAN peripheral of one simulated module, used through the ES_CAN functions by the threads bound to it
+ */
+{
+    friend class SimCanBus;
+
+    SimCanBus &bus;
+    uint8_t index;
+    std::mutex interrupts; // Held while the node's interrupts run, or while they are masked
+
+    // The rest is guarded by the bus mutex
+    bool started = false;
+    bool loopback = false;
+    SimCanFrame mailboxes[SIM_CAN_MAILBOXES]; // Transmitted in the order they were added
+    std::chrono::steady_clock::time_point queued[SIM_CAN_MAILBOXES];
+    uint8_t txFirst = 0;
+    uint8_t txCount = 0;
+    SimCanFrame rxFifo[SIM_CAN_RX_FIFO];
+    uint8_t rxFirst = 0;
+    uint8_t rxCount = 0;
+    uint32_t filterIds[SIM_CAN_FILTER_BANKS] = {0};
+    uint32_t filterMasks[SIM_CAN_FILTER_BANKS] = {0};
+    uint16_t filterEnabled = 0;
+    void (*rxIsr)() = nullptr;
+    void (*txIsr)() = nullptr;
+    bool txPending = false; // A mailbox emptied or the transmit interrupt was requested
+    std::chrono::steady_clock::time_point txRaised; // Latest time it was raised, a frame it loads may be that recent
+
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t lost = 0;
+    uint32_t overruns = 0;
+    uint8_t maxMailboxes = 0;
+    uint8_t maxRxLevel = 0;
+
+    bool accepts(uint32_t id) const;
+    /*
+     * :param id: standard CAN ID of a frame on the bus
+     *
+     * :return: true if an enabled filter bank passes the frame
+     */
+
+public:
+    SimCanNode(SimCanBus &canBus);
+    /*
+     * Initialiser for the SimCanNode class, attaching it to a bus
+     * The bus must have room for another node, and must be stopped before the node is destroyed
+     *
+     * :param canBus: bus the node transmits and receives on
+     */
+
+    void bind();
+    /*
+     * Makes the ES_CAN functions called from this thread act on this node
+     */
+
+    void init(bool loopbackMode);
+    /*
+     * CAN_Init(), stops the node and sets its mode
+     *
+     * :param loopbackMode: if true the node receives its own frames and nothing from the other nodes
+     */
+
+    void start();
+    /*
+     * CAN_Start(), the node transmits its mailboxes and receives from then on
+     */
+
+    void setFilter(uint32_t filterId, uint32_t maskId, uint32_t filterBank);
+    /*
+     * setCANFilter(), a frame is received if its ID matches the filter ID in the bits of the mask, in any enabled bank
+     *
+     * :param filterId: standard ID to match
+     *
+     * :param maskId: bits of the ID that must match
+     *
+     * :param filterBank: filter bank to set and enable
+     */
+
+    void clearFilter(uint32_t filterBank);
+    /*
+     * clearCANFilter(), disables a filter bank
+     *
+     * :param filterBank: filter bank to disable
+     */
+
+    void transmit(uint32_t id, const uint8_t data[8]);
+    /*
+     * CAN_TX(), waits for an empty mailbox and places the frame in it
+     *
+     * :param id: standard CAN ID of the frame
+     *
+     * :param data: the 8 bytes of the frame, copied into the mailbox
+     */
+
+    uint8_t txFreeLevel();
+    /*
+     * CAN_GetTXFreeLevel()
+     *
+     * :return: number of empty transmit mailboxes
+     */
+
+    uint8_t rxLevel();
+    /*
+     * CAN_CheckRXLevel()
+     *
+     * :return: number of frames in the receive FIFO
+     */
+
+    void receive(uint32_t &id, uint8_t data[8]);
+    /*
+     * CAN_RX(), waits for a frame in the receive FIFO and takes it
+     *
+     * :param id: set to the standard ID of the frame
+     *
+     * :param data: set to the 8 bytes of the frame
+     */
+
+    void registerRxIsr(void (*callback)());
+    /*
+     * CAN_RegisterRX_ISR(), called from the bus thread while the receive FIFO holds a frame
+     *
+     * :param callback: the receive interrupt
+     */
+
+    void registerTxIsr(void (*callback)());
+    /*
+     * CAN_RegisterTX_ISR(), called from the bus thread when a mailbox has been transmitted or the interrupt requested
+     *
+     * :param callback: the transmit interrupt
+     */
+
+    void requestTxIsr();
+    /*
+     * CAN_RequestTX_ISR(), has the bus thread call the transmit interrupt even if no mailbox has completed
+     */
+
+    void maskInterrupts();
+    /*
+     * Holds back the node's interrupts until unmaskInterrupts(), waiting for one that is running to return
+     * Must not be called from the node's interrupts
+     */
+
+    void unmaskInterrupts();
+    /*
+     * Lets the interrupts held back by maskInterrupts() run
+     */
+
+    uint8_t getIndex() const;
+    /*
+     * :return: position of the node on its bus, in the order the nodes were attached
+     */
+
+    uint32_t getSent();
+    /*
+     * :return: number of frames transmitted
+     */
+
+    uint32_t getReceived();
+    /*
+     * :return: number of frames placed in the receive FIFO
+     */
+
+    uint32_t getLost();
+    /*
+     * :return: number of frames the filters accepted that were lost on the way, with the bus's loss probability
+     */
+
+    uint32_t getOverruns();
+    /*
+     * :return: number of frames dropped because the receive FIFO was full
+     */
+
+    uint8_t getMaxMailboxes();
+    /*
+     * :return: most transmit mailboxes full at once
+     */
+
+    uint8_t getMaxRxLevel();
+    /*
+     * :return: most frames waiting in the receive FIFO at once
+     */
+};
+
+SimCanNode *simCanNode();
+/*
+ * :return: node the calling thread is bound to, set for the node's interrupts while they run, or nullptr
+ */
+
+class SimCanBus
+/*
+ * Shared bus of the simulated nodes, transmitting from its own thread between start() and stop()
+ */
+{
+    friend class SimCanNode;
+
+    std::mutex mutex;
+    std::condition_variable changed; // Notified when a frame is added, or an interrupt may be able to run
+    std::thread thread;
+    bool running = false;
+
+    SimCanNode *nodes[SIM_CAN_NODES] = {nullptr};
+    uint8_t count = 0;
+    uint32_t bitTime; // nanoseconds
+    uint32_t lossRate = 0;
+    uint32_t random = 1;
+    std::chrono::steady_clock::time_point epoch;
+    std::chrono::steady_clock::time_point idle; // End of the last frame on the bus
+    bool virtualTime = false;                   // Driven by advance() rather than the bus thread
+    std::chrono::steady_clock::time_point virtualNow;
+
+    uint32_t frames = 0;
+    uint64_t busyBits = 0;
+
+    std::chrono::steady_clock::time_point now() const;
+    /*
+     * :return: the time on the virtual clock once advance() has been called, or else the host's
+     */
+
+    SimCanNode *arbitrate(std::chrono::steady_clock::time_point &start);
+    /*
+     * Picks the next frame, must be called with the bus mutex held
+     * The next frame starts when the bus went idle or, if nothing was waiting then, when the first frame was queued.
+     * The front mailbox of every started node holding a frame by then arbitrates, and the lowest ID is dominant.
+     *
+     * :param start: set to the time the frame starts
+     *
+     * :return: node transmitting it, or nullptr if no mailbox holds a frame
+     */
+
+    void complete(SimCanNode &winner);
+    /*
+     * Ends the frame at the front of the winner's mailboxes and delivers it, must be called with the bus mutex held
+     *
+     * :param winner: node from arbitrate(), the frame ended at idle
+     */
+
+    void run();
+    /*
+     * Arbitrates, transmits and delivers frames, and calls the pending interrupts, until stop()
+     */
+
+    bool runInterrupts(std::unique_lock<std::mutex> &lock);
+    /*
+     * Calls the interrupts of every node that has one pending and not masked, with the bus mutex released
+     *
+     * :param lock: the held bus mutex
+     *
+     * :return: true if an interrupt was left pending as it is masked
+     */
+
+    void deliver(SimCanNode &sender, const SimCanFrame &frame);
+    /*
+     * Places a transmitted frame in the receive FIFO of every node accepting it, must be called with the bus mutex held
+     *
+     * :param sender: node that transmitted the frame
+     *
+     * :param frame: the frame
+     */
+
+public:
+    SimCanBus(uint32_t bitRate = SIM_CAN_BIT_RATE);
+    /*
+     * Initialiser for the SimCanBus class
+     *
+     * :param bitRate: bits per second on the bus
+     */
+
+    ~SimCanBus();
+
+    void start();
+    /*
+     * Starts the bus thread, frames already in the mailboxes arbitrate as soon as it runs
+     */
+
+    void stop();
+    /*
+     * Stops the bus thread once the frame on the bus has been delivered and the interrupts called
+     */
+
+    void advance(uint32_t until);
+    /*
+     * Runs the bus on a virtual clock from the calling thread, instead of the bus thread, up to a time
+     * Every frame that ends by then is transmitted and delivered and every interrupt raised by then is called, at the
+     * times they would have happened, and micros() then returns the time. Must not be mixed with start().
+     *
+     * :param until: time to run to in microseconds since the bus was created, earlier times leave the clock as it is
+     */
+
+    void setLoss(uint32_t perMillion);
+    /*
+     * Sets the probability a receiver misses a frame, independently for each receiver
+     *
+     * :param perMillion: probability in parts per million
+     */
+
+    uint32_t micros();
+    /*
+     * The clock of every node, in an interrupt it is the time the interrupt was raised, so the times it records don't
+     * depend on how late the host ran the bus thread
+     *
+     * :return: microseconds since the bus was created
+     */
+
+    uint32_t getFrames();
+    /*
+     * :return: number of frames transmitted
+     */
+
+    uint64_t getBusyBits();
+    /*
+     * :return: bit times the bus has been busy with frames, including their interframe space
+     */
+};
+
+#endif
+
+#endif
@@ -0,0 +1,553 @@
+#include <cstdint>
+
+#ifndef CANPROTO_H
+#define CANPROTO_H
+
+/*
+ * Versioned binary protocol for the CAN messages between modules, header only and hardware independent
+ *
+ * Every message is one 8 byte frame:
+ *   [0] protocol version
+ *   [1] message type
+ *   [2] module ID of the sender
+ *   [3] sequence number, counts every message the sender transmits
+ *   [4-7] payload of the message type, little endian
+ * Encoding and decoding are constexpr and never allocate, so messages can be built at compile time and checked
+ * with static_assert, and the decoder can be fed arbitrary frames.
+ *
+ * The 11 bit CAN ID is the message class in the top 3 bits and the sender's module ID in the low 8 bits. Arbitration
+ * lets the lowest ID through first, so note events (class 0) win over control traffic, and no two modules ever send
+ * the same ID with different data. Receivers filter on the class bits.
+ */
+
+const uint8_t PROTOCOL_VERSION = 2;
+const uint8_t PROTOCOL_HEADER_SIZE = 4;
+
+// Message types, also the index into the dispatch table
+enum MessageType : uint8_t
+{
+    MSG_KEY_EVENTS = 1,  // Key transitions or snapshot of a transmitter
+    MSG_DISCOVERY = 2,   // The sender has taken its place in the chain of modules, or starts the discovery again
+    MSG_TRANSMITTER = 3, // The sender is now the receiver, every other module must become a transmitter
+    MSG_TRACE = 4,       // Transmit times of the sender's last traced key events message
+    MSG_POLYPHONY = 5,   // How the voices are shared between the modules, every module must switch
+    MSG_SYNC = 6,        // Clock sync frame of the clock master, received times are matched with its sync time
+    MSG_SYNC_TIME = 7,   // Shared clock time at which the clock master's last sync frame was sent
+    MSG_TYPES = 8
+};
+
+// Message classes, the top 3 bits of the CAN ID, a lower class wins arbitration
+// Gaps are left so classes can be added between them
+enum MessageClass : uint8_t
+{
+    CLASS_NOTES = 0,   // Key events, the most latency sensitive
+    CLASS_CLOCK = 2,   // Clock sync, timed on arrival so kept ahead of control traffic
+    CLASS_CONTROL = 4, // Connection and role changes
+    CLASS_TRACE = 7,   // Latency tracing, never delays anything else
+};
+
+const uint16_t CLASS_ID_MASK = 0x700; // ID bits holding the class, for the receive filters
+
+constexpr uint16_t messageId(uint8_t messageClass, uint8_t module)
+/*
+ * :param messageClass: class of the message (0-7)
+ *
+ * :param module: module ID of the sender
+ *
+ * :return: the 11 bit CAN ID
+ */
+{
+    return ((messageClass & 0x07) << 8) | module;
+}
+
+constexpr uint8_t idClass(uint16_t id)
+/*
+ * :param id: 11 bit CAN ID
+ *
+ * :return: the message class in the ID
+ */
+{
+    return (id >> 8) & 0x07;
+}
+
+struct Frame
+/*
+ * Raw data of a CAN message
+ */
+{
+    uint8_t data[8];
+};
+
+struct MessageHeader
+{
+    uint8_t version;
+    uint8_t type;
+    uint8_t module;
+    uint8_t sequence;
+};
+
+/* --- Payloads --- */
+
+struct KeyEventsMessage
+/*
+ * Every key transition of one scan of a transmitter's keys, or a snapshot when nothing changed
+ * Payload bits 0-11: pressed mask, 12-23: changed mask, 24-27: octave, 31: traced
+ */
+{
+    static constexpr uint8_t type = MSG_KEY_EVENTS;
+    static constexpr uint8_t messageClass = CLASS_NOTES;
+    uint8_t octave;
+    uint16_t pressed;
+    uint16_t changed;
+    uint8_t traced; // 1 if a trace message with its transmit times follows
+
+    constexpr void encode(uint8_t *payload) const
+    {
+        uint32_t bits = (pressed & 0x0FFFu) | ((changed & 0x0FFFu) << 12) | ((uint32_t)(octave & 0x0F) << 24) |
+                        ((uint32_t)(traced & 0x01) << 31);
+        payload[0] = bits & 0xFF;
+        payload[1] = (bits >> 8) & 0xFF;
+        payload[2] = (bits >> 16) & 0xFF;
+        payload[3] = bits >> 24;
+    }
+
+    static constexpr KeyEventsMessage decode(const uint8_t *payload)
+    {
+        uint32_t bits = payload[0] | (payload[1] << 8) | ((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24);
+        return KeyEventsMessage{(uint8_t)((bits >> 24) & 0x0F), (uint16_t)(bits & 0x0FFF), (uint16_t)((bits >> 12) & 0x0FFF),
+                                (uint8_t)(bits >> 31)};
+    }
+};
+
+struct DiscoveryMessage
+/*
+ * Sent by a module taking its place in the chain (discovery.h), a position of 0xFF starts the discovery again
+ * Payload bytes 0: chain ID (module ID of the westmost module), 1: position from the west, 2: octave, 3: 1 if there are
+ * more modules to the east of the sender
+ */
+{
+    static constexpr uint8_t type = MSG_DISCOVERY;
+    static constexpr uint8_t messageClass = CLASS_CONTROL;
+    uint8_t chain;
+    uint8_t position;
+    uint8_t octave;
+    uint8_t more;
+
+    constexpr void encode(uint8_t *payload) const
+    {
+        payload[0] = chain;
+        payload[1] = position;
+        payload[2] = octave;
+        payload[3] = more & 0x01;
+    }
+
+    static constexpr DiscoveryMessage decode(const uint8_t *payload)
+    {
+        return DiscoveryMessage{payload[0], payload[1], payload[2], (uint8_t)(payload[3] & 0x01)};
+    }
+};
+
+struct TransmitterMessage
+/*
+ * Sent by a module that has become the receiver
+ */
+{
+    static constexpr uint8_t type = MSG_TRANSMITTER;
+    static constexpr uint8_t messageClass = CLASS_CONTROL;
+
+    constexpr void encode(uint8_t *) const
+    {
+    }
+
+    static constexpr TransmitterMessage decode(const uint8_t *)
+    {
+        return TransmitterMessage{};
+    }
+};
+
+struct TraceMessage
+/*
+ * Sent after a traced key events message has been transmitted, with the sender's times of it in microseconds
+ * Payload bytes 0-1: low 16 bits of the sender's clock when the frame was sent, 2-3: time from the key scan to then
+ */
+{
+    static constexpr uint8_t type = MSG_TRACE;
+    static constexpr uint8_t messageClass = CLASS_TRACE;
+    uint16_t sent;
+    uint16_t age;
+
+    constexpr void encode(uint8_t *payload) const
+    {
+        payload[0] = sent & 0xFF;
+        payload[1] = sent >> 8;
+        payload[2] = age & 0xFF;
+        payload[3] = age >> 8;
+    }
+
+    static constexpr TraceMessage decode(const uint8_t *payload)
+    {
+        return TraceMessage{(uint16_t)(payload[0] | (payload[1] << 8)), (uint16_t)(payload[2] | (payload[3] << 8))};
+    }
+};
+
+struct PolyphonyMessage
+/*
+ * Sent by a module when its knob3 button selects a voice allocation policy, every module switches to it
+ */
+{
+    static constexpr uint8_t type = MSG_POLYPHONY;
+    static constexpr uint8_t messageClass = CLASS_CONTROL;
+    uint8_t policy; // an AllocationPolicy (voicealloc.h)
+
+    constexpr void encode(uint8_t *payload) const
+    {
+        payload[0] = policy;
+    }
+
+    static constexpr PolyphonyMessage decode(const uint8_t *payload)
+    {
+        return PolyphonyMessage{payload[0]};
+    }
+};
+
+struct SyncMessage
+/*
+ * Sent by the clock master every clockSyncInterval (clocksync.h), each module times its arrival
+ * Payload bytes 0: 1 if a sync time message follows it, 1-3: bits 24-47 of the master's shared time in microseconds
+ * when it was queued, so the full time can be rebuilt from the 32 bits of the sync time message
+ */
+{
+    static constexpr uint8_t type = MSG_SYNC;
+    static constexpr uint8_t messageClass = CLASS_CLOCK;
+    uint32_t high;  // 24 bits
+    uint8_t traced; // 1 if a sync time message with its send time follows
+
+    constexpr void encode(uint8_t *payload) const
+    {
+        payload[0] = traced & 0x01;
+        payload[1] = high & 0xFF;
+        payload[2] = (high >> 8) & 0xFF;
+        payload[3] = (high >> 16) & 0xFF;
+    }
+
+    static constexpr SyncMessage decode(const uint8_t *payload)
+    {
+        return SyncMessage{payload[1] | ((uint32_t)payload[2] << 8) | ((uint32_t)payload[3] << 16),
+                           (uint8_t)(payload[0] & 0x01)};
+    }
+};
+
+struct SyncTimeMessage
+/*
+ * Sent by the clock master once its last traced sync frame has been transmitted
+ * Payload bytes 0-3: low 32 bits of the master's shared time in microseconds when the sync frame was sent
+ */
+{
+    static constexpr uint8_t type = MSG_SYNC_TIME;
+    static constexpr uint8_t messageClass = CLASS_CLOCK;
+    uint32_t sent;
+
+    constexpr void encode(uint8_t *payload) const
+    {
+        payload[0] = sent & 0xFF;
+        payload[1] = (sent >> 8) & 0xFF;
+        payload[2] = (sent >> 16) & 0xFF;
+        payload[3] = sent >> 24;
+    }
+
+    static constexpr SyncTimeMessage decode(const uint8_t *payload)
+    {
+        return SyncTimeMessage{payload[0] | ((uint32_t)payload[1] << 8) | ((uint32_t)payload[2] << 16) |
+                               ((uint32_t)payload[3] << 24)};
+    }
+};
+
+/* --- Encoding and decoding --- */
+
+template <typename T>
+constexpr Frame encodeMessage(uint8_t module, uint8_t sequence, const T &message)
+/*
+ * Builds the frame of a message
+ *
+ * :param module: module ID of the sender
+ *
+ * :param sequence: sequence number of the message
+ *
+ * :param message: the typed message
+ *
+ * :return: the frame, unused payload bytes are 0
+ */
+{
+    Frame frame{};
+    frame.data[0] = PROTOCOL_VERSION;
+    frame.data[1] = T::type;
+    frame.data[2] = module;
+    frame.data[3] = sequence;
+    message.encode(frame.data + PROTOCOL_HEADER_SIZE);
+    return frame;
+}
+
+constexpr MessageHeader decodeHeader(const uint8_t *data)
+/*
+ * Reads the header of a frame, without checking it
+ *
+ * :param data: the 8 bytes of the frame
+ *
+ * :return: the header
+ */
+{
+    return MessageHeader{data[0], data[1], data[2], data[3]};
+}
+
+constexpr bool isSupported(const MessageHeader &header)
+/*
+ * :param header: the header of a received frame
+ *
+ * :return: true if the frame has this protocol version and a known message type
+ */
+{
+    return header.version == PROTOCOL_VERSION && header.type > 0 && header.type < MSG_TYPES;
+}
+
+template <typename T>
+constexpr T decodeMessage(const uint8_t *data)
+/*
+ * Reads the payload of a frame as a typed message, the header must already have been checked
+ *
+ * :param data: the 8 bytes of the frame
+ *
+ * :return: the typed message
+ */
+{
+    return T::decode(data + PROTOCOL_HEADER_SIZE);
+}
+
+constexpr void setSequence(Frame &frame, uint8_t sequence)
+/*
+ * Stamps the sequence number of a frame, just before it is transmitted
+ *
+ * :param frame: the frame to stamp
+ *
+ * :param sequence: sequence number of the message
+ */
+{
+    frame.data[3] = sequence;
+}
+
+/* --- Sequence tracking --- */
+
+const uint8_t SEQUENCE_MODULES = 8; // Senders tracked at once, the least recently added is replaced
+const uint8_t SEQUENCE_WINDOW = 16; // Sequence numbers this far behind the expected one are duplicates
+
+enum SequenceResult : uint8_t
+{
+    SEQ_FIRST,     // First message from the sender, or it restarted
+    SEQ_IN_ORDER,  // The expected sequence number
+    SEQ_GAP,       // Messages were missed
+    SEQ_DUPLICATE, // Already received, should be dropped
+};
+
+class SequenceTracker
+/*
+ * Checks the sequence numbers received from each sender, counting lost and duplicate messages
+ * Not thread safe, must only be updated from one context
+ */
+{
+    uint8_t modules[SEQUENCE_MODULES] = {0};
+    uint8_t expected[SEQUENCE_MODULES] = {0};
+    uint8_t count = 0;
+    uint8_t replace = 0;
+    uint32_t lost = 0;
+    uint32_t duplicates = 0;
+
+public:
+    SequenceResult update(uint8_t module, uint8_t sequence)
+    /*
+     * Records a received sequence number
+     *
+     * :param module: module ID of the sender
+     *
+     * :param sequence: sequence number of the message
+     *
+     * :return: how the sequence number relates to the previous ones from the sender
+     */
+    {
+        uint8_t i = 0;
+        while (i < count && modules[i] != module)
+        {
+            i++;
+        }
+
+        if (i == count)
+        {
+            // New sender, replacing the oldest once the table is full
+            if (count < SEQUENCE_MODULES)
+            {
+                count++;
+            }
+            else
+            {
+                i = replace;
+                replace = (replace + 1) % SEQUENCE_MODULES;
+            }
+            modules[i] = module;
+            expected[i] = sequence + 1;
+            return SEQ_FIRST;
+        }
+
+        uint8_t ahead = sequence - expected[i];
+        if (ahead == 0)
+        {
+            expected[i] = sequence + 1;
+            return SEQ_IN_ORDER;
+        }
+        if (ahead >= (uint8_t)(256 - SEQUENCE_WINDOW))
+        {
+            duplicates++;
+            return SEQ_DUPLICATE;
+        }
+        if (ahead < 128)
+        {
+            lost += ahead;
+            expected[i] = sequence + 1;
+            return SEQ_GAP;
+        }
+
+        // Far behind, the sender has restarted
+        expected[i] = sequence + 1;
+        return SEQ_FIRST;
+    }
+
+    uint32_t getLost() const
+    /*
+     * :return: number of messages missed, from the gaps in the sequence numbers
+     */
+    {
+        return lost;
+    }
+
+    uint32_t getDuplicates() const
+    /*
+     * :return: number of duplicate messages received
+     */
+    {
+        return duplicates;
+    }
+};
+
+/* --- Dispatch --- */
+
+typedef void (*MessageHandler)(const MessageHeader &header, const uint8_t *data);
+
+template <typename T, void (*Handler)(const MessageHeader &, const T &)>
+void typedHandler(const MessageHeader &header, const uint8_t *data)
+/*
+ * Adapts a handler of a typed message to an entry of the dispatch table
+ */
+{
+    Handler(header, decodeMessage<T>(data));
+}
+
+enum DispatchResult : uint8_t
+{
+    DISPATCH_HANDLED,
+    DISPATCH_UNSUPPORTED, // Unknown version or message type
+    DISPATCH_DUPLICATE,   // Dropped as already received
+    DISPATCH_UNHANDLED,   // No handler for the message type
+};
+
+class MessageDispatcher
+/*
+ * Calls the handler of each received message through a table indexed by message type, dropping duplicates
+ * Not thread safe, must only be used from one context
+ */
+{
+    MessageHandler handlers[MSG_TYPES] = {nullptr};
+    SequenceTracker sequences;
+    uint32_t unsupported = 0;
+
+public:
+    template <typename T, void (*Handler)(const MessageHeader &, const T &)>
+    void on()
+    /*
+     * Registers the handler of a message type, replacing any previous one
+     */
+    {
+        handlers[T::type] = typedHandler<T, Handler>;
+    }
+
+    void on(uint8_t type, MessageHandler handler)
+    /*
+     * Registers a handler of the raw frames of a message type, e.g. to pass them on to another context
+     */
+    {
+        if (type < MSG_TYPES)
+        {
+            handlers[type] = handler;
+        }
+    }
+
+    DispatchResult dispatch(const uint8_t *data)
+    /*
+     * Checks a received frame and calls the handler of its message type
+     *
+     * :param data: the 8 bytes of the frame
+     *
+     * :return: what was done with the frame
+     */
+    {
+        MessageHeader header = decodeHeader(data);
+        if (!isSupported(header))
+        {
+            unsupported++;
+            return DISPATCH_UNSUPPORTED;
+        }
+        if (sequences.update(header.module, header.sequence) == SEQ_DUPLICATE)
+        {
+            return DISPATCH_DUPLICATE;
+        }
+        return handle(data);
+    }
+
+    DispatchResult handle(const uint8_t *data)
+    /*
+     * Calls the handler of a frame's message type without tracking its sequence number, for frames that have already
+     * been through dispatch() in another context
+     *
+     * :param data: the 8 bytes of the frame
+     *
+     * :return: what was done with the frame
+     */
+    {
+        MessageHeader header = decodeHeader(data);
+        if (!isSupported(header))
+        {
+            return DISPATCH_UNSUPPORTED;
+        }
+        MessageHandler handler = handlers[header.type];
+        if (!handler)
+        {
+            return DISPATCH_UNHANDLED;
+        }
+        handler(header, data);
+        return DISPATCH_HANDLED;
+    }
+
+    const SequenceTracker &getSequences() const
+    /*
+     * :return: the sequence numbers received so far, for the lost and duplicate counts
+     */
+    {
+        return sequences;
+    }
+
+    uint32_t getUnsupported() const
+    /*
+     * :return: number of frames dropped for an unknown version or message type
+     */
+    {
+        return unsupported;
+    }
+};
+
+#endif
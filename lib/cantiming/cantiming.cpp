@@ -0,0 +1,75 @@
+#include "cantiming.h"
+
+uint32_t canFrameBits(uint8_t bytes)
+/*
+ * Longest time on the bus of a standard frame, including the worst case of stuff bits and the interframe space
+ *
+ * :param bytes: data length of the frame (0-8)
+ *
+ * :return: the length in bit times
+ */
+{
+    // 47 bits of framing, 34 of which are stuffed along with the data with at most one stuff bit every 4 bits
+    uint32_t data = 8 * (uint32_t)bytes;
+    return data + 47 + (34 + data - 1) / 4;
+}
+
+uint32_t canResponseTime(const CanStream streams[], uint8_t count, uint8_t index, uint32_t bitTime)
+/*
+ * Worst case time from a message of one stream being due to it being received
+ *
+ * :param streams: every stream on the bus, IDs must be unique
+ *
+ * :param count: number of streams
+ *
+ * :param index: the stream to analyse
+ *
+ * :param bitTime: time of one bit on the bus
+ *
+ * :return: the response time, or CAN_UNSCHEDULABLE if it can exceed the period of the stream
+ */
+{
+    const CanStream &stream = streams[index];
+    uint64_t transmission = (uint64_t)canFrameBits(stream.bytes) * bitTime;
+
+    // Blocking by a frame that started just before, including the previous message of the same stream, which keeps
+    // the bound safe without checking every message in a busy period
+    uint64_t blocking = transmission;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint64_t other = (uint64_t)canFrameBits(streams[i].bytes) * bitTime;
+        if (streams[i].id > stream.id && other > blocking)
+        {
+            blocking = other;
+        }
+    }
+
+    // Queuing delay: iterate to the fixed point of the blocking plus every higher priority message queued before
+    // this one wins arbitration (it has to win one bit after the bus goes idle)
+    uint64_t queuing = blocking;
+    while (true)
+    {
+        uint64_t next = blocking;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            if (streams[i].id < stream.id)
+            {
+                uint64_t other = (uint64_t)canFrameBits(streams[i].bytes) * bitTime;
+                uint64_t messages = (queuing + streams[i].jitter + bitTime + streams[i].period - 1) / streams[i].period;
+                next += messages * other;
+            }
+        }
+
+        if (stream.jitter + next + transmission > stream.period)
+        {
+            return CAN_UNSCHEDULABLE;
+        }
+        if (next == queuing)
+        {
+            break;
+        }
+        queuing = next;
+    }
+
+    return (uint32_t)(stream.jitter + queuing + transmission);
+}
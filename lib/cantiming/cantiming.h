@@ -0,0 +1,51 @@
+#include <cstdint>
+
+#ifndef CANTIMING_H
+#define CANTIMING_H
+
+/*
+ * Worst case response time analysis of periodic CAN messages (Tindell, Burns and Wellings; revised by Davis et al.),
+ * used to check the message classes give notes a bounded latency whatever the control traffic
+ *
+ * Each stream of messages has its own ID, so a lower ID can only be delayed by one lower priority frame already on the
+ * bus plus the frames of higher IDs queued before it wins arbitration. Times are in nanoseconds.
+ */
+
+const uint32_t CAN_UNSCHEDULABLE = UINT32_MAX; // Response time of a stream that can miss its period
+
+struct CanStream
+/*
+ * Periodic (or sporadic, with a minimum interval) message sent with one ID
+ */
+{
+    uint16_t id;     // 11 bit CAN ID, the lowest wins arbitration
+    uint32_t period; // Minimum time between two messages
+    uint32_t jitter; // Maximum delay from the message being due to it being queued for transmission
+    uint8_t bytes;   // Data length of the frame
+};
+
+uint32_t canFrameBits(uint8_t bytes);
+/*
+ * Longest time on the bus of a standard frame, including the worst case of stuff bits and the interframe space
+ *
+ * :param bytes: data length of the frame (0-8)
+ *
+ * :return: the length in bit times
+ */
+
+uint32_t canResponseTime(const CanStream streams[], uint8_t count, uint8_t index, uint32_t bitTime);
+/*
+ * Worst case time from a message of one stream being due to it being received
+ *
+ * :param streams: every stream on the bus, IDs must be unique
+ *
+ * :param count: number of streams
+ *
+ * :param index: the stream to analyse
+ *
+ * :param bitTime: time of one bit on the bus
+ *
+ * :return: the response time, or CAN_UNSCHEDULABLE if it can exceed the period of the stream
+ */
+
+#endif
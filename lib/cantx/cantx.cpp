@@ -0,0 +1,185 @@
+#include "cantx.h"
+
+static_assert((CAN_TX_RING_SIZE & (CAN_TX_RING_SIZE - 1)) == 0, "CAN_TX_RING_SIZE must be a power of 2");
+
+CanTxRing::CanTxRing(CanMailboxes &canMailboxes) : mailboxes(canMailboxes)
+/*
+ * Initialiser for the CanTxRing class
+ *
+ * :param canMailboxes: mailboxes the frames are transmitted through
+ */
+{
+    // A cell is free for the producer at position p when its counter is p, ready for the consumer when it is p + 1,
+    // and held by the consumer or update() while it is p + 2
+    for (uint32_t i = 0; i < CAN_TX_RING_SIZE; i++)
+    {
+        cells[i].sequence = i;
+    }
+}
+
+CanTxRing::Cell *CanTxRing::claim(uint32_t &pos)
+/*
+ * Reserves the next free cell for a producer
+ *
+ * :param pos: set to the position of the cell, to be passed to publish()
+ *
+ * :return: the cell to be written, or nullptr if the ring is full
+ */
+{
+    pos = __atomic_load_n(&writePos, __ATOMIC_RELAXED);
+    while (1)
+    {
+        Cell &cell = cells[pos & (CAN_TX_RING_SIZE - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&cell.sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            // Cell is free, claim it unless another producer got there first (pos is then reloaded)
+            if (__atomic_compare_exchange_n(&writePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                return &cell;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Cell still holds the frame from a lap ago
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return nullptr;
+        }
+        else
+        {
+            // Another producer claimed this position
+            pos = __atomic_load_n(&writePos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void CanTxRing::publish(uint32_t pos)
+/*
+ * Hands a written cell to the consumer, and asks for the mailboxes to be refilled
+ *
+ * :param pos: position of the cell, from claim()
+ */
+{
+    __atomic_store_n(&cells[pos & (CAN_TX_RING_SIZE - 1)].sequence, pos + 1, __ATOMIC_RELEASE);
+    mailboxes.requestPump();
+}
+
+uint8_t CanTxRing::pump(uint32_t now)
+/*
+ * Moves published frames into the empty mailboxes, must only be called from the transmit interrupt (or one
+ * context at a time)
+ *
+ * :param now: current time in microseconds, only needed when tracing
+ *
+ * :return: number of frames moved
+ */
+{
+    uint8_t free = mailboxes.freeLevel();
+
+    // Only the ring loads the mailboxes, so any that emptied since the last pump have been transmitted
+    uint8_t completed = free > lastFree ? free - lastFree : 0;
+    for (Trace &trace : traces)
+    {
+        if (__atomic_load_n(&trace.state, __ATOMIC_ACQUIRE) != TRACE_LOADED)
+        {
+            continue;
+        }
+        if (completed >= trace.ahead)
+        {
+            trace.times.sent = now;
+            __atomic_store_n(&trace.state, TRACE_SENT, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            trace.ahead -= completed;
+        }
+    }
+
+    uint8_t moved = 0;
+    while (free)
+    {
+        Cell &cell = cells[readPos & (CAN_TX_RING_SIZE - 1)];
+        uint32_t published = readPos + 1;
+        if (!__atomic_compare_exchange_n(&cell.sequence, &published, readPos + 2, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            // Empty, or the next frame is still being written or updated
+            break;
+        }
+
+        for (Trace &trace : traces)
+        {
+            if (__atomic_load_n(&trace.state, __ATOMIC_ACQUIRE) == TRACE_QUEUED && __atomic_load_n(&trace.pos, __ATOMIC_RELAXED) == readPos)
+            {
+                // Sent once the frames already in the mailboxes and this one have gone
+                trace.times.loaded = now;
+                trace.ahead = CAN_TX_MAILBOXES - free + 1;
+                __atomic_store_n(&trace.state, TRACE_LOADED, __ATOMIC_RELAXED);
+            }
+        }
+
+        // The mailbox takes its own copy, then the cell is free for the producer one lap on
+        mailboxes.add(cell.id, cell.frame.data);
+        __atomic_store_n(&cell.sequence, readPos + CAN_TX_RING_SIZE, __ATOMIC_RELEASE);
+        __atomic_store_n(&readPos, readPos + 1, __ATOMIC_RELAXED);
+        free--;
+        moved++;
+    }
+    lastFree = free;
+    return moved;
+}
+
+bool CanTxRing::takeTrace(TxTrace &times)
+/*
+ * Collects the times of a traced frame once it has been sent, freeing its slot for the next frame
+ * Must be called from the same context as pump(), until it returns false as both slots may be ready
+ *
+ * :param times: set to the times of the frame
+ *
+ * :return: false if no traced frame is waiting to be collected
+ */
+{
+    for (Trace &trace : traces)
+    {
+        if (__atomic_load_n(&trace.state, __ATOMIC_ACQUIRE) == TRACE_SENT)
+        {
+            times = trace.times;
+            __atomic_store_n(&trace.state, TRACE_IDLE, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t CanTxRing::getDropped()
+/*
+ * :return: number of frames dropped because the ring was full
+ */
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+uint32_t CanTxRing::getCoalesced()
+/*
+ * :return: number of frames replaced with update() before they were transmitted
+ */
+{
+    return __atomic_load_n(&coalesced, __ATOMIC_RELAXED);
+}
+
+uint32_t CanTxRing::getUntraced()
+/*
+ * :return: number of sendTraced() messages sent untraced because their slot's frame was still on its way
+ */
+{
+    return __atomic_load_n(&untraced, __ATOMIC_RELAXED);
+}
+
+uint32_t CanTxRing::getQueued()
+/*
+ * :return: number of frames claimed but not yet moved into a mailbox
+ */
+{
+    // Read position first, so it can't have moved past the write position that is read after it
+    uint32_t read = __atomic_load_n(&readPos, __ATOMIC_RELAXED);
+    return __atomic_load_n(&writePos, __ATOMIC_RELAXED) - read;
+}
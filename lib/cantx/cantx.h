@@ -0,0 +1,292 @@
+#include <cstdint>
+#include "canproto.h"
+
+#ifndef CANTX_H
+#define CANTX_H
+
+const uint32_t CAN_TX_RING_SIZE = 32; // Frames waiting for a mailbox, must be a power of 2
+const uint8_t CAN_TX_MAILBOXES = 3;   // Hardware transmit mailboxes of the bxCAN peripheral
+const uint8_t CAN_TX_TRACES = 2;      // Frames followed at once, one for key events and one for the clock class
+
+class CanMailboxes
+/*
+ * Interface to the transmit mailboxes of the CAN controller, implemented with the HAL on the board and modelled in the
+ * tests
+ */
+{
+public:
+    virtual uint8_t freeLevel() = 0;
+    /*
+     * :return: number of empty transmit mailboxes
+     */
+
+    virtual void add(uint32_t id, uint8_t data[8]) = 0;
+    /*
+     * Places a frame in an empty mailbox, it is transmitted in the order it was added
+     *
+     * :param id: standard CAN ID of the frame
+     *
+     * :param data: the 8 bytes of the frame, copied into the mailbox
+     */
+
+    virtual void requestPump() = 0;
+    /*
+     * Asks for CanTxRing::pump() to be called from the transmit interrupt, as no mailbox may be about to complete
+     */
+};
+
+struct TxTrace
+/*
+ * Times of a traced frame on its way out of the transmitter, in microseconds
+ */
+{
+    uint32_t scanned; // the keys were scanned
+    uint32_t queued;  // added to the ring
+    uint32_t loaded;  // moved into a mailbox
+    uint32_t sent;    // transmitted, seen by the first pump() after its mailbox emptied
+    uint8_t type;     // message type of the frame
+};
+
+class CanTxRing
+/*
+ * Lock-free ring of frames waiting to be transmitted, filled by any number of tasks and emptied into the transmit
+ * mailboxes by the transmit interrupt
+ *
+ * Each cell carries a sequence counter (bounded MPSC queue after Vyukov): a producer claims a cell by advancing the
+ * write position with a compare and swap, encodes its message straight into the cell and publishes it by bumping the
+ * cell's counter. The consumer only takes published cells in order, so a producer preempted part way through delays
+ * the frames behind it but never corrupts them. Nothing blocks or spins, a full ring drops the frame and counts it.
+ *
+ * A frame still waiting in the ring can be rewritten in place with update(), so a newer message supersedes it without
+ * taking another cell. The producer unpublishes the cell by moving its counter from p + 1 to p + 2, and the consumer
+ * takes a cell the same way before copying it, so whichever gets there first wins and a frame is never read torn.
+ */
+{
+    struct Cell
+    {
+        uint32_t sequence;
+        uint16_t id;
+        Frame frame;
+    };
+
+    enum TraceState : uint32_t
+    {
+        TRACE_IDLE,    // free for the next traced frame
+        TRACE_CLAIMED, // a producer is queuing the traced frame
+        TRACE_QUEUED,  // in the ring at tracePos
+        TRACE_LOADED,  // in a mailbox, with traceAhead frames to go
+        TRACE_SENT,    // times ready for takeTrace()
+    };
+
+    struct Trace
+    {
+        uint32_t state = TRACE_IDLE;
+        uint32_t pos = 0;
+        TxTrace times;
+        uint8_t ahead = 0; // only used by the consumer
+    };
+
+    CanMailboxes &mailboxes;
+    Cell cells[CAN_TX_RING_SIZE];
+    uint32_t writePos = 0;
+    uint32_t readPos = 0; // only used by the consumer
+    uint32_t dropped = 0;
+    uint32_t coalesced = 0;
+    uint32_t untraced = 0;
+
+    // One frame per slot is followed through the mailboxes, which transmit in the order they were loaded; the clock
+    // class has its own slot so a sync frame never waits on a key events trace
+    Trace traces[CAN_TX_TRACES];
+    uint8_t lastFree = CAN_TX_MAILBOXES; // only used by the consumer
+
+    Cell *claim(uint32_t &pos);
+    /*
+     * Reserves the next free cell for a producer
+     *
+     * :param pos: set to the position of the cell, to be passed to publish()
+     *
+     * :return: the cell to be written, or nullptr if the ring is full
+     */
+
+    void publish(uint32_t pos);
+    /*
+     * Hands a written cell to the consumer, and asks for the mailboxes to be refilled
+     *
+     * :param pos: position of the cell, from claim()
+     */
+
+public:
+    CanTxRing(CanMailboxes &canMailboxes);
+    /*
+     * Initialiser for the CanTxRing class
+     *
+     * :param canMailboxes: mailboxes the frames are transmitted through
+     */
+
+    template <typename T>
+    bool send(uint8_t module, const T &message, uint32_t &ticket)
+    /*
+     * Encodes a message into the ring, safe to call from any task
+     * The sequence number comes from the position in the ring, so the numbers count up in the order the frames are
+     * transmitted even when several tasks send at once. The ring is first in first out whatever the CAN ID, as frames
+     * overtaking each other would break the sequence; the ID's class only sets the priority against other modules.
+     *
+     * :param module: module ID of the sender
+     *
+     * :param message: the typed message
+     *
+     * :param ticket: set to the position of the frame, for update()
+     *
+     * :return: false if the ring was full and the message was dropped
+     */
+    {
+        Cell *cell = claim(ticket);
+        if (!cell)
+        {
+            return false;
+        }
+        cell->id = messageId(T::messageClass, module);
+        cell->frame = encodeMessage(module, (uint8_t)ticket, message);
+        publish(ticket);
+        return true;
+    }
+
+    template <typename T>
+    bool send(uint8_t module, const T &message)
+    /*
+     * Encodes a message into the ring, safe to call from any task
+     * The sequence number comes from the position in the ring, so the numbers count up in the order the frames are
+     * transmitted even when several tasks send at once. The ring is first in first out whatever the CAN ID, as frames
+     * overtaking each other would break the sequence; the ID's class only sets the priority against other modules.
+     *
+     * :param module: module ID of the sender
+     *
+     * :param message: the typed message
+     *
+     * :return: false if the ring was full and the message was dropped
+     */
+    {
+        uint32_t ticket;
+        return send(module, message, ticket);
+    }
+
+    template <typename T>
+    bool update(uint32_t ticket, uint8_t module, const T &message)
+    /*
+     * Replaces a frame that is still waiting in the ring, keeping its place and sequence number, safe to call from the
+     * task that sent it
+     * Must not be used on a traced frame, as its times belong to the message it was sent with.
+     *
+     * :param ticket: position of the frame, from send()
+     *
+     * :param module: module ID of the sender
+     *
+     * :param message: the typed message, of the same class as the frame it replaces
+     *
+     * :return: false if the frame has already been moved into a mailbox, the message must then be sent
+     */
+    {
+        Cell &cell = cells[ticket & (CAN_TX_RING_SIZE - 1)];
+        uint32_t published = ticket + 1;
+        if (!__atomic_compare_exchange_n(&cell.sequence, &published, ticket + 2, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return false;
+        }
+        cell.id = messageId(T::messageClass, module);
+        cell.frame = encodeMessage(module, (uint8_t)ticket, message);
+        __atomic_fetch_add(&coalesced, 1, __ATOMIC_RELAXED);
+
+        // The consumer may have found the cell taken and stopped, so it is asked to look again
+        publish(ticket);
+        return true;
+    }
+
+    template <typename T>
+    bool sendTraced(uint8_t module, T message, uint32_t scanned, uint32_t now)
+    /*
+     * Like send(), also timing the frame through the ring and the mailboxes for takeTrace()
+     * Only one frame per slot is traced at a time, clock class messages use one slot and the rest the other. While the
+     * slot's frame is on its way the message is sent untraced and counted. The message must have a traced flag, which
+     * is set if it is traced.
+     *
+     * :param module: module ID of the sender
+     *
+     * :param message: the typed message
+     *
+     * :param scanned: time the keys of the message were scanned, in microseconds
+     *
+     * :param now: current time in microseconds
+     *
+     * :return: false if the ring was full and the message was dropped
+     */
+    {
+        Trace &trace = traces[T::messageClass == CLASS_CLOCK ? 1 : 0];
+        uint32_t idle = TRACE_IDLE;
+        if (!__atomic_compare_exchange_n(&trace.state, &idle, TRACE_CLAIMED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            __atomic_fetch_add(&untraced, 1, __ATOMIC_RELAXED);
+            return send(module, message);
+        }
+
+        uint32_t pos;
+        Cell *cell = claim(pos);
+        if (!cell)
+        {
+            __atomic_store_n(&trace.state, TRACE_IDLE, __ATOMIC_RELEASE);
+            return false;
+        }
+        message.traced = 1;
+        trace.times.type = T::type;
+        trace.times.scanned = scanned;
+        trace.times.queued = now;
+        __atomic_store_n(&trace.pos, pos, __ATOMIC_RELAXED);
+        __atomic_store_n(&trace.state, TRACE_QUEUED, __ATOMIC_RELEASE);
+
+        cell->id = messageId(T::messageClass, module);
+        cell->frame = encodeMessage(module, (uint8_t)pos, message);
+        publish(pos);
+        return true;
+    }
+
+    uint8_t pump(uint32_t now = 0);
+    /*
+     * Moves published frames into the empty mailboxes, must only be called from the transmit interrupt (or one
+     * context at a time)
+     *
+     * :param now: current time in microseconds, only needed when tracing
+     *
+     * :return: number of frames moved
+     */
+
+    bool takeTrace(TxTrace &times);
+    /*
+     * Collects the times of a traced frame once it has been sent, freeing its slot for the next frame
+     * Must be called from the same context as pump(), until it returns false as both slots may be ready
+     *
+     * :param times: set to the times of the frame
+     *
+     * :return: false if no traced frame is waiting to be collected
+     */
+
+    uint32_t getDropped();
+    /*
+     * :return: number of frames dropped because the ring was full
+     */
+
+    uint32_t getCoalesced();
+    /*
+     * :return: number of frames replaced with update() before they were transmitted
+     */
+
+    uint32_t getUntraced();
+    /*
+     * :return: number of sendTraced() messages sent untraced because their slot's frame was still on its way
+     */
+
+    uint32_t getQueued();
+    /*
+     * :return: number of frames claimed but not yet moved into a mailbox
+     */
+};
+
+#endif
@@ -0,0 +1,32 @@
+#include <cstdint>
+#include <ES_CAN.h>
+#include "hal_can_mailboxes.h"
+
+uint8_t HalCanMailboxes::freeLevel()
+/*
+ * :return: number of empty transmit mailboxes
+ */
+{
+    return CAN_GetTXFreeLevel();
+}
+
+void HalCanMailboxes::add(uint32_t id, uint8_t data[8])
+/*
+ * Places a frame in an empty mailbox, it is transmitted in the order it was added
+ *
+ * :param id: standard CAN ID of the frame
+ *
+ * :param data: the 8 bytes of the frame, copied into the mailbox
+ */
+{
+    // A mailbox is known to be free, so CAN_TX() doesn't wait
+    CAN_TX(id, data);
+}
+
+void HalCanMailboxes::requestPump()
+/*
+ * Sets the CAN TX interrupt pending, which calls the registered TX ISR even if no mailbox has completed
+ */
+{
+    CAN_RequestTX_ISR();
+}
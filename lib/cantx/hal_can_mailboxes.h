@@ -0,0 +1,37 @@
+#include <cstdint>
+#include "cantx.h"
+
+#ifndef HAL_CAN_MAILBOXES_H
+#define HAL_CAN_MAILBOXES_H
+
+class HalCanMailboxes : public CanMailboxes
+/*
+ * Transmit mailboxes of the CAN1 peripheral, through ES_CAN
+ *
+ * Pumps are requested by setting the CAN TX interrupt pending, so the ring is only ever emptied from that interrupt.
+ * The interrupt must be registered with CAN_RegisterTX_ISR() and call CanTxRing::pump().
+ * On the host the ES_CAN functions act on the simulated bus (sim_can_bus.h), so the same mailboxes run there.
+ */
+{
+public:
+    uint8_t freeLevel() override;
+    /*
+     * :return: number of empty transmit mailboxes
+     */
+
+    void add(uint32_t id, uint8_t data[8]) override;
+    /*
+     * Places a frame in an empty mailbox, it is transmitted in the order it was added
+     *
+     * :param id: standard CAN ID of the frame
+     *
+     * :param data: the 8 bytes of the frame, copied into the mailbox
+     */
+
+    void requestPump() override;
+    /*
+     * Sets the CAN TX interrupt pending, which calls the registered TX ISR even if no mailbox has completed
+     */
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "clocksync.h"
+
+int64_t ClockSync::estimate(uint32_t now) const
+/*
+ * :param now: local time in microseconds
+ *
+ * :return: shared time in microseconds with 16 fractional bits
+ */
+{
+    // Signed, a time read just before a sync moved the reference is a little behind it
+    int64_t elapsed = (int32_t)(now - localRef);
+    return sharedRef + elapsed * 65536 + ((elapsed * rate) >> 16);
+}
+
+void ClockSync::lead(uint32_t now)
+/*
+ * Makes this module the clock master, or keeps it one, continuing the shared time from its estimate
+ * Must be called at least every half hour while leading, so the reference never falls half a local clock wrap
+ * behind
+ *
+ * :param now: local time in microseconds
+ */
+{
+    // The rate learnt from the last master is kept, so the other modules carry on with little to correct
+    sharedRef = started ? estimate(now) : (int64_t)now * 65536;
+    started = true;
+    localRef = now;
+    lastSync = now;
+    state = CLOCK_MASTER;
+    master = 0;
+    pending = false;
+    lockCount = 0;
+}
+
+void ClockSync::follow()
+/*
+ * Stops leading, the next sync frame from any module is followed
+ */
+{
+    if (state == CLOCK_MASTER)
+    {
+        state = CLOCK_ACQUIRING;
+    }
+}
+
+void ClockSync::sync(uint8_t module, uint32_t high, uint32_t now)
+/*
+ * Records the arrival of a traced sync frame
+ *
+ * :param module: module ID of the sender
+ *
+ * :param high: bits 24-47 of the master's shared time when the frame was queued
+ *
+ * :param now: local time in microseconds the frame arrived
+ */
+{
+    if (state == CLOCK_MASTER)
+    {
+        return;
+    }
+    if (module != master)
+    {
+        // A new master carried on from the time it had, so it is only stepped to if it is far off
+        master = module;
+        lockCount = 0;
+        state = CLOCK_ACQUIRING;
+    }
+    pending = true;
+    syncHigh = high;
+    syncReceived = now;
+}
+
+bool ClockSync::syncTime(uint8_t module, uint32_t sent, uint32_t now)
+/*
+ * Corrects the clock with the time the last sync frame was sent
+ *
+ * :param module: module ID of the sender
+ *
+ * :param sent: low 32 bits of the master's shared time when the sync frame was sent
+ *
+ * :param now: local time in microseconds
+ *
+ * :return: true if it matched a sync frame and the clock was corrected
+ */
+{
+    // A sync frame missed would pair its time with the arrival of the one before
+    if (state == CLOCK_MASTER || !pending || module != master || now - syncReceived >= clockFollowUpWindow * 1000)
+    {
+        return false;
+    }
+    pending = false;
+    started = true;
+    syncs++;
+
+    // Bits 24-31 are in both, any difference is the low 32 bits wrapping between queuing and sending
+    uint64_t high = syncHigh + (uint8_t)((sent >> 24) - syncHigh);
+    int64_t masterTime = (int64_t)(((high << 24) | (sent & 0xFFFFFF)) << 16);
+
+    int64_t predicted = estimate(syncReceived);
+    int64_t error = masterTime - predicted;
+    int64_t limit = (int64_t)clockStepLimit * 65536;
+    int64_t errorUs = error >> 16;
+    lastError = errorUs > INT32_MAX ? INT32_MAX : errorUs < INT32_MIN ? INT32_MIN : errorUs;
+    if (error > limit || error < -limit)
+    {
+        sharedRef = masterTime;
+        localRef = syncReceived;
+        lastSync = syncReceived;
+        lockCount = 0;
+        state = CLOCK_ACQUIRING;
+        steps++;
+        return true;
+    }
+
+    // PI estimator, the phase takes part of the error now and the rate the rest over the following syncs
+    sharedRef = predicted + (error >> clockKpShift);
+    localRef = syncReceived;
+    uint32_t interval = syncReceived - lastSync;
+    lastSync = syncReceived;
+    if (interval)
+    {
+        int64_t newRate = rate + (error * 65536 >> clockKiShift) / (int64_t)interval;
+        rate = newRate > clockRateLimit ? clockRateLimit : newRate < -clockRateLimit ? -clockRateLimit : newRate;
+    }
+
+    int64_t lockLimit = (int64_t)clockLockError * 65536;
+    if (error < lockLimit && error > -lockLimit)
+    {
+        lockCount = lockCount < clockLockSyncs ? lockCount + 1 : lockCount;
+    }
+    else
+    {
+        lockCount = 0;
+    }
+    state = lockCount >= clockLockSyncs ? CLOCK_LOCKED : CLOCK_ACQUIRING;
+    return true;
+}
+
+uint64_t ClockSync::getTime(uint32_t now) const
+/*
+ * :param now: local time in microseconds
+ *
+ * :return: shared time in microseconds
+ */
+{
+    return estimate(now) >> 16;
+}
+
+uint64_t ClockSync::getSample(uint32_t now) const
+/*
+ * :param now: local time in microseconds
+ *
+ * :return: index of the sample playing at the shared time, at the nominal sample rate
+ */
+{
+    return getTime(now) * clockSampleRate / 1000000;
+}
+
+uint8_t ClockSync::getState() const
+/*
+ * :return: the ClockState
+ */
+{
+    return state;
+}
+
+uint8_t ClockSync::getMaster() const
+/*
+ * :return: module ID of the master followed, 0 when leading
+ */
+{
+    return master;
+}
+
+int32_t ClockSync::getError() const
+/*
+ * :return: error of the estimate at the last sync, in microseconds
+ */
+{
+    return lastError;
+}
+
+int32_t ClockSync::getRate() const
+/*
+ * :return: rate correction in parts per billion, positive when the local clock is slow
+ */
+{
+    return ((int64_t)rate * 1000000000) >> 32;
+}
+
+uint32_t ClockSync::getSyncs() const
+/*
+ * :return: number of syncs used
+ */
+{
+    return syncs;
+}
+
+uint32_t ClockSync::getSteps() const
+/*
+ * :return: number of times the clock was stepped
+ */
+{
+    return steps;
+}
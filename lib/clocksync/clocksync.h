@@ -0,0 +1,158 @@
+#include <cstdint>
+
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+/*
+ * Shared clock of the modules on the bus, hardware independent
+ *
+ * Every module runs its own crystal, so its microsecond clock (and the sample clock from the same crystal) drifts by
+ * up to a few hundred ppm from the others. The clock master, the westmost module of the chain, sends a sync frame every
+ * clockSyncInterval with the top bits of its shared time, then a sync time message with the shared time at which the
+ * sync frame actually left (like the latency trace, timed by the transmit interrupt so the time spent queuing behind
+ * other frames doesn't count). Every other module times the sync frame's arrival on its own clock, and the pair gives
+ * it one sample of the master's time at a known local time.
+ *
+ * Each module keeps a line from its local clock to the shared time: the shared time at a reference local time, and a
+ * rate correction. A PI estimator moves the line at every pair: a quarter of the error corrects the phase and 1/64 of
+ * it, per sync interval, corrects the rate, so the crystal drift is learnt and the jitter of the interrupts is
+ * filtered. An error too large to slew (the first sync after power up, or a master that restarted) steps the clock
+ * instead. A module that becomes the master carries on from its estimate, so the others barely move.
+ * The shared time is 64 bit microseconds, so every module agrees on the sample index as well as its phase.
+ */
+
+const uint32_t clockSyncInterval = 100;   // ms between the sync frames of the clock master
+const uint32_t clockSampleRate = 22000;   // Hz, the nominal sample rate, for the shared sample index
+const uint32_t clockFollowUpWindow = 50;  // ms after a sync frame its sync time must arrive by
+const uint32_t clockStepLimit = 2000;     // us of error beyond which the clock is stepped instead of slewed
+const uint32_t clockLockError = 45;       // us of error within which a sync counts as locked, one sample
+const uint8_t clockLockSyncs = 4;         // Syncs in a row within clockLockError to be locked
+const uint8_t clockKpShift = 2;           // Phase gain of the PI estimator, 1/4
+const uint8_t clockKiShift = 6;           // Rate gain of the PI estimator, 1/64 per sync interval
+const int32_t clockRateLimit = 2147484;   // Largest rate correction, 500ppm as a fraction of 2^32
+
+enum ClockState : uint8_t
+{
+    CLOCK_MASTER,    // Leads the shared clock, its own clock continued
+    CLOCK_ACQUIRING, // Following a master, not yet within clockLockError
+    CLOCK_LOCKED,    // Following a master within clockLockError
+};
+
+class ClockSync
+/*
+ * One module's estimate of the shared clock, fed the sync frames and sync times of the master
+ * Not thread safe, used by the CAN interrupts or with them masked
+ */
+{
+    // Line from the local clock to the shared time
+    int64_t sharedRef = 0; // Shared time at localRef, microseconds with 16 fractional bits
+    uint32_t localRef = 0; // Local time in microseconds
+    int32_t rate = 0;      // Rate correction, as a fraction of 2^32
+
+    bool started = false;
+    uint8_t state = CLOCK_MASTER;
+    uint8_t master = 0; // Module ID of the master followed, 0 when leading
+    uint8_t lockCount = 0;
+
+    // Last sync frame, waiting for its sync time
+    bool pending = false;
+    uint32_t syncHigh = 0;
+    uint32_t syncReceived = 0;
+    uint32_t lastSync = 0; // Local time of the last sync frame used, or of leading
+
+    int32_t lastError = 0;
+    uint32_t syncs = 0;
+    uint32_t steps = 0;
+
+    int64_t estimate(uint32_t now) const;
+    /*
+     * :param now: local time in microseconds
+     *
+     * :return: shared time in microseconds with 16 fractional bits
+     */
+
+public:
+    void lead(uint32_t now);
+    /*
+     * Makes this module the clock master, or keeps it one, continuing the shared time from its estimate
+     * Must be called at least every half hour while leading, so the reference never falls half a local clock wrap
+     * behind
+     *
+     * :param now: local time in microseconds
+     */
+
+    void follow();
+    /*
+     * Stops leading, the next sync frame from any module is followed
+     */
+
+    void sync(uint8_t module, uint32_t high, uint32_t now);
+    /*
+     * Records the arrival of a traced sync frame
+     *
+     * :param module: module ID of the sender
+     *
+     * :param high: bits 24-47 of the master's shared time when the frame was queued
+     *
+     * :param now: local time in microseconds the frame arrived
+     */
+
+    bool syncTime(uint8_t module, uint32_t sent, uint32_t now);
+    /*
+     * Corrects the clock with the time the last sync frame was sent
+     *
+     * :param module: module ID of the sender
+     *
+     * :param sent: low 32 bits of the master's shared time when the sync frame was sent
+     *
+     * :param now: local time in microseconds
+     *
+     * :return: true if it matched a sync frame and the clock was corrected
+     */
+
+    uint64_t getTime(uint32_t now) const;
+    /*
+     * :param now: local time in microseconds
+     *
+     * :return: shared time in microseconds
+     */
+
+    uint64_t getSample(uint32_t now) const;
+    /*
+     * :param now: local time in microseconds
+     *
+     * :return: index of the sample playing at the shared time, at the nominal sample rate
+     */
+
+    uint8_t getState() const;
+    /*
+     * :return: the ClockState
+     */
+
+    uint8_t getMaster() const;
+    /*
+     * :return: module ID of the master followed, 0 when leading
+     */
+
+    int32_t getError() const;
+    /*
+     * :return: error of the estimate at the last sync, in microseconds
+     */
+
+    int32_t getRate() const;
+    /*
+     * :return: rate correction in parts per billion, positive when the local clock is slow
+     */
+
+    uint32_t getSyncs() const;
+    /*
+     * :return: number of syncs used
+     */
+
+    uint32_t getSteps() const;
+    /*
+     * :return: number of times the clock was stepped
+     */
+};
+
+#endif
@@ -0,0 +1,352 @@
+#include "discovery.h"
+
+uint8_t nextChainOctave(uint8_t octave)
+/*
+ * :param octave: octave of a module
+ *
+ * :return: octave of the module to its east
+ */
+{
+    return octave >= CHAIN_OCTAVE_MAX || octave < CHAIN_OCTAVE_MIN ? CHAIN_OCTAVE_MIN : octave + 1;
+}
+
+ChainDiscovery::ChainDiscovery(uint8_t module)
+/*
+ * Initialiser for the ChainDiscovery class
+ *
+ * :param module: module ID of this module, also the chain ID of a chain it starts
+ */
+{
+    setSelf(module);
+}
+
+void ChainDiscovery::setSelf(uint8_t module)
+/*
+ * :param module: module ID of this module
+ */
+{
+    self = module;
+}
+
+bool ChainDiscovery::claim(uint8_t claimChain, uint8_t claimPosition, uint8_t claimOctave, bool more, uint32_t now,
+                           DiscoveryMessage &message)
+/*
+ * Takes a place in the chain
+ *
+ * :param claimChain: chain ID
+ *
+ * :param claimPosition: position from the west
+ *
+ * :param claimOctave: octave of the place
+ *
+ * :param more: true if there is a module to the east
+ *
+ * :param now: current time in ms
+ *
+ * :param message: the claim to send
+ *
+ * :return: true, the claim must be sent
+ */
+{
+    chain = claimChain;
+    position = claimPosition;
+    octave = claimOctave;
+    claimTime = now;
+    lastActivity = now;
+    if (more)
+    {
+        // The token is passed once the claim has had time to reach every module
+        state = DISC_CLAIMED;
+    }
+    else
+    {
+        // Last in the chain, the round is over
+        state = DISC_IDLE;
+        startTime = now;
+        count = position + 1;
+        eastOutput = true;
+        heard = false;
+        resetRound = false;
+    }
+    message = DiscoveryMessage{chain, position, octave, (uint8_t)more};
+    return true;
+}
+
+uint32_t ChainDiscovery::backoff()
+/*
+ * :return: ms this module waits before starting the discovery again, longer further east so the westmost goes first
+ * and the rest hear its reset instead of sending their own
+ */
+{
+    return (position < 32 ? position : 32) * discoveryBackoff;
+}
+
+bool ChainDiscovery::reset(uint32_t now, DiscoveryMessage &message)
+/*
+ * Starts the discovery again on every module
+ *
+ * :param now: current time in ms
+ *
+ * :param message: the reset to send
+ *
+ * :return: true, the reset must be sent
+ */
+{
+    forget(now);
+    message = DiscoveryMessage{0, POSITION_NONE, 0, 0};
+    return true;
+}
+
+void ChainDiscovery::forget(uint32_t now)
+/*
+ * Drops this module's place and waits for a fresh round from the westmost module
+ *
+ * :param now: current time in ms
+ */
+{
+    chain = 0;
+    position = POSITION_NONE;
+    count = 0;
+    state = DISC_WAITING;
+    eastOutput = true;
+    heard = false;
+    resetRound = true;
+    resetPending = false;
+    startTime = now;
+    lastActivity = now;
+}
+
+bool ChainDiscovery::update(bool west, bool east, uint8_t localOctave, uint32_t now, DiscoveryMessage &message)
+/*
+ * Steps the discovery with the debounced detect inputs, the first call starts it
+ *
+ * :param west: true if there is a neighbour on the west detect input
+ *
+ * :param east: true if there is a neighbour on the east detect input
+ *
+ * :param localOctave: this module's octave, the first octave of a chain it starts
+ *
+ * :param now: current time in ms
+ *
+ * :param message: a claim or reset to send
+ *
+ * :return: true if the message must be sent
+ */
+{
+    if (!started)
+    {
+        started = true;
+        startTime = now;
+        lastActivity = now;
+        eastPrev = east;
+        return false;
+    }
+
+    bool eastNew = !eastPrev && east;
+    bool eastGone = eastPrev && !east;
+    eastPrev = east;
+
+    if (resetPending && now - resetTime >= backoff())
+    {
+        return reset(now, message);
+    }
+
+    switch (state)
+    {
+    case DISC_IDLE:
+        if (position == POSITION_NONE)
+        {
+            // Gives the debouncers time to settle, and a round already running time to reach this module; one with a
+            // neighbour to the west waits twice as long, so the westmost module starts the round if they start together
+            if (now - startTime < (west ? 2 * discoveryTimeout : discoveryTimeout))
+            {
+                return false;
+            }
+            if (!west)
+            {
+                return claim(self, 0, localOctave, east, now, message);
+            }
+
+            // A module to the west never passed the token
+            return reset(now, message);
+        }
+        if (!west && position && now - startTime >= discoverySettle)
+        {
+            // Unplugged from the west, even mid-round, this module starts a chain of its own and the modules behind it
+            // follow
+            return claim(self, 0, localOctave, east, now, message);
+        }
+        if (eastNew)
+        {
+            // Only the new modules take places
+            return claim(chain, position, octave, true, now, message);
+        }
+        if (eastGone)
+        {
+            return claim(chain, position, octave, false, now, message);
+        }
+        return false;
+
+    case DISC_WAITING:
+        // The west input means nothing until the debouncers have settled, after starting or a reset
+        if (!west && now - startTime >= discoverySettle)
+        {
+            // Given the token, the claim before it came from the module to the west
+            if (heard)
+            {
+                return claim(lastClaim.chain, lastClaim.position + 1, nextChainOctave(lastClaim.octave), east, now,
+                             message);
+            }
+
+            // After a reset only the westmost module sees nothing to its west, once every east output is high again
+            if (resetRound)
+            {
+                return claim(self, 0, localOctave, east, now, message);
+            }
+        }
+        if (now - lastActivity >= discoveryTimeout + backoff())
+        {
+            return reset(now, message);
+        }
+        return false;
+
+    default:
+        if (eastGone)
+        {
+            // Unplugged from the east mid-round, whether or not the module to the east had claimed
+            return claim(chain, position, octave, false, now, message);
+        }
+        if (eastOutput && now - claimTime >= discoveryHoldoff)
+        {
+            eastOutput = false;
+        }
+
+        // The module to the east never claimed
+        if (now - lastActivity >= discoveryTimeout + backoff())
+        {
+            return reset(now, message);
+        }
+        return false;
+    }
+}
+
+void ChainDiscovery::receive(uint8_t module, const DiscoveryMessage &message, uint32_t now)
+/*
+ * Handles a discovery message from another module
+ *
+ * :param module: module ID of the sender
+ *
+ * :param message: the discovery message
+ *
+ * :param now: current time in ms
+ */
+{
+    if (message.position == POSITION_NONE)
+    {
+        forget(now);
+        return;
+    }
+    lastActivity = now;
+
+    // Another module in this module's place, only a fresh round can sort them out
+    if (state != DISC_WAITING && module != self && message.chain == chain && message.position == position)
+    {
+        resetPending = true;
+        resetTime = now;
+        return;
+    }
+
+    heard = true;
+    lastClaim = message;
+
+    if (!message.more)
+    {
+        // The round is over, a module still waiting without a place starts again once it has settled
+        if (message.chain == chain && position != POSITION_NONE)
+        {
+            count = message.position + 1;
+        }
+        else if (state != DISC_IDLE && position != POSITION_NONE)
+        {
+            // Ended by another chain while this module was placed in the round, a claim must have been lost
+            resetPending = true;
+            resetTime = now;
+        }
+        state = DISC_IDLE;
+        startTime = now;
+        eastOutput = true;
+        heard = false;
+        resetRound = false;
+        return;
+    }
+
+    // The token has moved on past this module
+    if (state == DISC_CLAIMED)
+    {
+        return;
+    }
+
+    // A module west of an extension keeps its place, any other waits for the token
+    if (state == DISC_IDLE && message.chain == chain && position != POSITION_NONE && position <= message.position)
+    {
+        return;
+    }
+    state = DISC_WAITING;
+    resetRound = false;
+}
+
+bool ChainDiscovery::getEastOutput()
+/*
+ * :return: level of the east handshake output, false while passing the token
+ */
+{
+    return eastOutput;
+}
+
+uint8_t ChainDiscovery::getState()
+/*
+ * :return: the DiscoveryState
+ */
+{
+    return state;
+}
+
+bool ChainDiscovery::isSettled()
+/*
+ * :return: true if this module has a place and isn't in a round
+ */
+{
+    return state == DISC_IDLE && position != POSITION_NONE && count;
+}
+
+uint8_t ChainDiscovery::getChain()
+/*
+ * :return: chain ID, the module ID of the westmost module, 0 before a place is claimed
+ */
+{
+    return chain;
+}
+
+uint8_t ChainDiscovery::getPosition()
+/*
+ * :return: position from the west, POSITION_NONE before a place is claimed
+ */
+{
+    return position;
+}
+
+uint8_t ChainDiscovery::getOctave()
+/*
+ * :return: octave given to this module's place
+ */
+{
+    return octave;
+}
+
+uint8_t ChainDiscovery::getCount()
+/*
+ * :return: number of modules in the chain, 0 until the round that placed this module has ended
+ */
+{
+    return count;
+}
@@ -0,0 +1,202 @@
+#include <cstdint>
+#include "canproto.h"
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+/*
+ * Discovery of the chain of modules joined side by side, assigning each its position and octave, hardware independent
+ *
+ * Every module drives its east handshake output high while idle, so each module sees a neighbour on its west and east
+ * detect inputs. A round passes a token from west to east: the westmost module (nothing on its west) claims position
+ * 0 with a discovery message, then drops its east output, so its east neighbour sees nothing to its west and takes the
+ * token. That module claims the position and octave after the last claim it heard, and so on along the chain, until a
+ * module with nothing to its east claims with no more to come. Every module hears every claim on the bus, so a round
+ * of N modules is N frames, and once the last claim is heard every module knows the length of the chain and restores
+ * its east output.
+ *
+ * Hot-plugging only renumbers the modules it has to. A module that finds a new neighbour to its east claims its
+ * position again with more to come and passes the token, so only the new modules (and any chain joined behind them)
+ * take positions; one that loses its east neighbour claims again as the last, one frame. A module left with nothing to
+ * its west and a position other than 0, unplugged while idle or mid-round, starts a new chain at position 0 and the
+ * modules behind it follow. A round that stalls for discoveryTimeout, a module given the token without hearing a claim,
+ * or two modules claiming the same place start the discovery again with a reset message, after which every module
+ * waits for a fresh round from the westmost.
+ *
+ * Claims and resets are the only messages, and a module only passes the token discoveryHoldoff after its claim, so its
+ * neighbour hears the claim before it sees the token even behind a burst of key events.
+ */
+
+const uint8_t POSITION_NONE = 0xFF;  // Position of a module that hasn't claimed one, also the position of a reset
+const uint8_t CHAIN_OCTAVE_MIN = 1;  // Octaves given along the chain, wrapping round after the highest
+const uint8_t CHAIN_OCTAVE_MAX = 7;
+
+const uint32_t discoveryHoldoff = 5;  // ms from a claim to passing the token, longer than the claim can wait for the bus
+const uint32_t discoverySettle = 10;  // ms after a reset or a round for the east outputs to pass the debouncers
+const uint32_t discoveryTimeout = 50; // ms without a claim before a round is given up, also the settling time at start
+const uint32_t discoveryBackoff = 2;  // ms per position a module waits longer before starting the discovery again
+
+enum DiscoveryState : uint8_t
+{
+    DISC_IDLE,    // Not in a round, or kept its place in it
+    DISC_WAITING, // Waiting for the token to claim a place in a round
+    DISC_CLAIMED, // Claimed with more to come, passing the token east until the round ends
+};
+
+uint8_t nextChainOctave(uint8_t octave);
+/*
+ * :param octave: octave of a module
+ *
+ * :return: octave of the module to its east
+ */
+
+class ChainDiscovery
+/*
+ * One module's side of the discovery, fed the debounced detect inputs and the discovery messages it receives
+ * Not thread safe, must only be used from one context at a time
+ */
+{
+    uint8_t self = 0;
+    uint8_t state = DISC_IDLE;
+    bool started = false;
+    bool resetPending = false;
+    bool eastOutput = true;
+    bool eastPrev = false;
+    uint32_t startTime = 0;    // Time every module's outputs last changed: the first update, a reset or a round ending
+    uint32_t claimTime = 0;    // Time of this module's last claim
+    uint32_t resetTime = 0;    // Time a reset was found to be needed
+    uint32_t lastActivity = 0; // Time of the last claim or reset sent or heard
+
+    // This module's place
+    uint8_t chain = 0;
+    uint8_t position = POSITION_NONE;
+    uint8_t octave = 0;
+    uint8_t count = 0;
+
+    // Last claim heard in the current round
+    bool heard = false;
+    bool resetRound = false;
+    DiscoveryMessage lastClaim{};
+
+    bool claim(uint8_t claimChain, uint8_t claimPosition, uint8_t claimOctave, bool more, uint32_t now,
+               DiscoveryMessage &message);
+    /*
+     * Takes a place in the chain
+     *
+     * :param claimChain: chain ID
+     *
+     * :param claimPosition: position from the west
+     *
+     * :param claimOctave: octave of the place
+     *
+     * :param more: true if there is a module to the east
+     *
+     * :param now: current time in ms
+     *
+     * :param message: the claim to send
+     *
+     * :return: true, the claim must be sent
+     */
+
+    uint32_t backoff();
+    /*
+     * :return: ms this module waits before starting the discovery again, longer further east so the westmost goes first
+     * and the rest hear its reset instead of sending their own
+     */
+
+    bool reset(uint32_t now, DiscoveryMessage &message);
+    /*
+     * Starts the discovery again on every module
+     *
+     * :param now: current time in ms
+     *
+     * :param message: the reset to send
+     *
+     * :return: true, the reset must be sent
+     */
+
+    void forget(uint32_t now);
+    /*
+     * Drops this module's place and waits for a fresh round from the westmost module
+     *
+     * :param now: current time in ms
+     */
+
+public:
+    ChainDiscovery(uint8_t module = 0);
+    /*
+     * Initialiser for the ChainDiscovery class
+     *
+     * :param module: module ID of this module, also the chain ID of a chain it starts
+     */
+
+    void setSelf(uint8_t module);
+    /*
+     * :param module: module ID of this module
+     */
+
+    bool update(bool west, bool east, uint8_t localOctave, uint32_t now, DiscoveryMessage &message);
+    /*
+     * Steps the discovery with the debounced detect inputs, the first call starts it
+     *
+     * :param west: true if there is a neighbour on the west detect input
+     *
+     * :param east: true if there is a neighbour on the east detect input
+     *
+     * :param localOctave: this module's octave, the first octave of a chain it starts
+     *
+     * :param now: current time in ms
+     *
+     * :param message: a claim or reset to send
+     *
+     * :return: true if the message must be sent
+     */
+
+    void receive(uint8_t module, const DiscoveryMessage &message, uint32_t now);
+    /*
+     * Handles a discovery message from another module
+     *
+     * :param module: module ID of the sender
+     *
+     * :param message: the discovery message
+     *
+     * :param now: current time in ms
+     */
+
+    bool getEastOutput();
+    /*
+     * :return: level of the east handshake output, false while passing the token
+     */
+
+    uint8_t getState();
+    /*
+     * :return: the DiscoveryState
+     */
+
+    bool isSettled();
+    /*
+     * :return: true if this module has a place and isn't in a round
+     */
+
+    uint8_t getChain();
+    /*
+     * :return: chain ID, the module ID of the westmost module, 0 before a place is claimed
+     */
+
+    uint8_t getPosition();
+    /*
+     * :return: position from the west, POSITION_NONE before a place is claimed
+     */
+
+    uint8_t getOctave();
+    /*
+     * :return: octave given to this module's place
+     */
+
+    uint8_t getCount();
+    /*
+     * :return: number of modules in the chain, 0 until the round that placed this module has ended
+     */
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include <cstring>
+#include "display.h"
+
+bool DisplayFields::operator==(const DisplayFields &other) const
+/*
+ * :param other: the fields to compare with
+ *
+ * :return: true if every field shows the same
+ */
+{
+    return octave == other.octave && volume == other.volume && echo == other.echo && wave == other.wave &&
+           bandLimited == other.bandLimited && playing == other.playing && load == other.load &&
+           overrun == other.overrun && status == other.status &&
+           strncmp(notes, other.notes, DISPLAY_NOTES_LENGTH) == 0;
+}
+
+bool DisplayModel::update(const DisplayFields &fields)
+/*
+ * Records the fields of the next frame
+ *
+ * :param fields: everything the frame shows
+ *
+ * :return: true if anything changed, the frame must then be drawn and passed to flush()
+ */
+{
+    frames++;
+    if (drawn && fields == shown)
+    {
+        skipped++;
+        return false;
+    }
+    shown = fields;
+    drawn = true;
+    return true;
+}
+
+void DisplayModel::invalidate()
+/*
+ * Forgets the fields last shown, after something else has been drawn, so the next update() redraws them
+ */
+{
+    drawn = false;
+}
+
+uint8_t DisplayModel::flush(const uint8_t *buffer, DisplayArea areas[DISPLAY_TILE_ROWS])
+/*
+ * Finds the tiles of a drawn frame that differ from what the display shows, and records them as sent
+ *
+ * :param buffer: the drawn frame, DISPLAY_BUFFER_SIZE bytes in U8g2's full buffer layout
+ *
+ * :param areas: set to the changed tiles of each row of tiles that has any, to be sent in order
+ *
+ * :return: number of areas set, 0 if the frame draws exactly what is shown
+ */
+{
+    uint8_t count = 0;
+    for (uint8_t row = 0; row < DISPLAY_TILE_ROWS; row++)
+    {
+        const uint8_t *drawnRow = buffer + row * DISPLAY_WIDTH;
+        uint8_t *sentRow = sent + row * DISPLAY_WIDTH;
+
+        // One area from the first to the last changed tile, the tiles between are cheaper to resend than to address
+        int8_t first = -1;
+        int8_t last = -1;
+        for (uint8_t tile = 0; tile < DISPLAY_TILE_COLUMNS; tile++)
+        {
+            if (memcmp(drawnRow + tile * 8, sentRow + tile * 8, 8) != 0)
+            {
+                first = first < 0 ? tile : first;
+                last = tile;
+            }
+        }
+        if (first < 0)
+        {
+            continue;
+        }
+
+        areas[count] = DisplayArea{(uint8_t)first, row, (uint8_t)(last - first + 1)};
+        memcpy(sentRow + first * 8, drawnRow + first * 8, areas[count].tileWidth * 8);
+        bytes += areas[count].tileWidth * 8 + DISPLAY_ROW_OVERHEAD;
+        count++;
+    }
+    if (!count)
+    {
+        skipped++;
+    }
+    return count;
+}
+
+uint32_t DisplayModel::getFrames()
+/*
+ * :return: number of frames passed to update()
+ */
+{
+    return frames;
+}
+
+uint32_t DisplayModel::getSkipped()
+/*
+ * :return: number of frames that sent nothing, as nothing changed
+ */
+{
+    return skipped;
+}
+
+uint32_t DisplayModel::getBytes()
+/*
+ * :return: bytes sent to the display over I2C, including each row's commands
+ */
+{
+    return bytes;
+}
@@ -0,0 +1,116 @@
+#include <cstdint>
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+/*
+ * Hardware independent model of what the 128x32 OLED shows, so only what changed is sent over I2C
+ *
+ * The display task fills a DisplayFields with the values it shows each frame. If none changed since the last frame
+ * nothing is drawn or sent. Otherwise the frame is drawn into the U8g2 buffer as before, and flush() compares the
+ * buffer with a copy of what the display already shows, 8x8 pixel tile by tile, returning the span of changed tiles
+ * on each row of tiles for U8g2's updateDisplayArea(). The buffer is laid out as U8g2's full buffer for the SSD1305:
+ * one row of tiles after another, each column of 8 pixels of a row one byte.
+ */
+
+const uint8_t DISPLAY_WIDTH = 128;
+const uint8_t DISPLAY_HEIGHT = 32;
+const uint8_t DISPLAY_TILE_COLUMNS = DISPLAY_WIDTH / 8;
+const uint8_t DISPLAY_TILE_ROWS = DISPLAY_HEIGHT / 8;
+const uint16_t DISPLAY_BUFFER_SIZE = DISPLAY_WIDTH * DISPLAY_TILE_ROWS; // Bytes in a full frame
+const uint8_t DISPLAY_ROW_OVERHEAD = 6; // I2C address, control and position command bytes sent before a row of tiles
+const uint8_t DISPLAY_NOTES_LENGTH = 32; // Longest list of notes shown, including the terminating 0
+
+const uint32_t displayFullFrameBytes = DISPLAY_BUFFER_SIZE + DISPLAY_TILE_ROWS * DISPLAY_ROW_OVERHEAD;
+
+struct DisplayFields
+/*
+ * Everything the display shows, filled by the display task each frame
+ */
+{
+    uint8_t octave;
+    uint8_t volume;
+    uint8_t echo;        // seconds
+    uint8_t wave;        // index of the waveform's name
+    uint8_t bandLimited; // the waveform is band limited, shown with a *
+    uint8_t playing;     // the module plays notes, so the sound settings are shown
+    uint8_t load;        // percent of the CPU in the sample interrupt over the last second
+    uint8_t overrun;     // samples were missed in the last second, shown with a !
+    const char *status;  // Rx, Tx or the voice allocation policy, nullptr on a module on its own
+    char notes[DISPLAY_NOTES_LENGTH];
+
+    bool operator==(const DisplayFields &other) const;
+    /*
+     * :param other: the fields to compare with
+     *
+     * :return: true if every field shows the same
+     */
+};
+
+struct DisplayArea
+/*
+ * Changed tiles on one row of tiles, in the arguments of U8g2's updateDisplayArea() with a height of 1
+ */
+{
+    uint8_t tileX;
+    uint8_t tileY;
+    uint8_t tileWidth;
+};
+
+class DisplayModel
+/*
+ * Decides what of each frame is sent to the display, counting what is sent
+ * Only used by the display task
+ */
+{
+    DisplayFields shown;
+    bool drawn = false;
+    uint8_t sent[DISPLAY_BUFFER_SIZE] = {0}; // What the display shows, cleared by U8g2's begin()
+
+    uint32_t frames = 0;
+    uint32_t skipped = 0;
+    uint32_t bytes = 0;
+
+public:
+    bool update(const DisplayFields &fields);
+    /*
+     * Records the fields of the next frame
+     *
+     * :param fields: everything the frame shows
+     *
+     * :return: true if anything changed, the frame must then be drawn and passed to flush()
+     */
+
+    void invalidate();
+    /*
+     * Forgets the fields last shown, after something else has been drawn, so the next update() redraws them
+     */
+
+    uint8_t flush(const uint8_t *buffer, DisplayArea areas[DISPLAY_TILE_ROWS]);
+    /*
+     * Finds the tiles of a drawn frame that differ from what the display shows, and records them as sent
+     *
+     * :param buffer: the drawn frame, DISPLAY_BUFFER_SIZE bytes in U8g2's full buffer layout
+     *
+     * :param areas: set to the changed tiles of each row of tiles that has any, to be sent in order
+     *
+     * :return: number of areas set, 0 if the frame draws exactly what is shown
+     */
+
+    uint32_t getFrames();
+    /*
+     * :return: number of frames passed to update()
+     */
+
+    uint32_t getSkipped();
+    /*
+     * :return: number of frames that sent nothing, as nothing changed
+     */
+
+    uint32_t getBytes();
+    /*
+     * :return: bytes sent to the display over I2C, including each row's commands
+     */
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include <cstring>
+#include "i2c_queue.h"
+
+static_assert((I2C_TRANSFERS & (I2C_TRANSFERS - 1)) == 0, "I2C_TRANSFERS must be a power of 2");
+
+bool I2cTransferQueue::begin(uint8_t address)
+/*
+ * Starts filling the next transfer, from the producer
+ *
+ * :param address: 8 bit address of the device
+ *
+ * :return: false if the queue is full, begin() must then be called again once a transfer has completed
+ */
+{
+    if (writePos - __atomic_load_n(&readPos, __ATOMIC_ACQUIRE) >= I2C_TRANSFERS)
+    {
+        return false;
+    }
+    I2cTransfer &transfer = transfers[writePos & (I2C_TRANSFERS - 1)];
+    transfer.address = address;
+    transfer.length = 0;
+    filling = true;
+    overlong = false;
+    return true;
+}
+
+void I2cTransferQueue::append(const uint8_t *data, uint8_t length)
+/*
+ * Adds bytes to the transfer being filled, from the producer
+ * Bytes beyond I2C_TRANSFER_SIZE are dropped and the transfer counted as truncated.
+ *
+ * :param data: the bytes
+ *
+ * :param length: number of bytes
+ */
+{
+    if (!filling)
+    {
+        return;
+    }
+    I2cTransfer &transfer = transfers[writePos & (I2C_TRANSFERS - 1)];
+    if (length > I2C_TRANSFER_SIZE - transfer.length)
+    {
+        length = I2C_TRANSFER_SIZE - transfer.length;
+        overlong = true;
+    }
+    memcpy(transfer.data + transfer.length, data, length);
+    transfer.length += length;
+}
+
+void I2cTransferQueue::end()
+/*
+ * Hands the filled transfer to the consumer, from the producer
+ */
+{
+    if (!filling)
+    {
+        return;
+    }
+    filling = false;
+    truncated += overlong;
+    queued++;
+    __atomic_store_n(&writePos, writePos + 1, __ATOMIC_RELEASE);
+}
+
+I2cTransfer *I2cTransferQueue::front()
+/*
+ * The oldest transfer not yet completed, from the consumer
+ *
+ * :return: the transfer, or nullptr if the queue is empty
+ */
+{
+    if (__atomic_load_n(&writePos, __ATOMIC_ACQUIRE) == readPos)
+    {
+        return nullptr;
+    }
+    return &transfers[readPos & (I2C_TRANSFERS - 1)];
+}
+
+void I2cTransferQueue::pop()
+/*
+ * Frees the transfer returned by front() once it has completed, from the consumer
+ */
+{
+    __atomic_store_n(&readPos, readPos + 1, __ATOMIC_RELEASE);
+}
+
+bool I2cTransferQueue::isEmpty()
+/*
+ * :return: true once every transfer handed to the consumer has completed
+ */
+{
+    return __atomic_load_n(&writePos, __ATOMIC_ACQUIRE) == __atomic_load_n(&readPos, __ATOMIC_ACQUIRE);
+}
+
+uint32_t I2cTransferQueue::getQueued()
+/*
+ * :return: number of transfers handed to the consumer
+ */
+{
+    return queued;
+}
+
+uint32_t I2cTransferQueue::getTruncated()
+/*
+ * :return: number of transfers longer than I2C_TRANSFER_SIZE
+ */
+{
+    return truncated;
+}
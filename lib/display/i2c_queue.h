@@ -0,0 +1,96 @@
+#include <cstdint>
+
+#ifndef I2C_QUEUE_H
+#define I2C_QUEUE_H
+
+/*
+ * Queue of I2C transfers between the U8g2 byte callback and the DMA completion interrupt
+ *
+ * U8g2 sends a frame as many short transfers (a few command bytes, or a control byte and 24 bytes of display data),
+ * each started, filled and ended through its byte callback. Each one is copied into a cell here and handed to the DMA
+ * as soon as the transfer before it completes, so the display task only waits when the whole queue is in flight.
+ * One task fills the queue and one interrupt empties it: each side only moves its own position, publishing the cell
+ * with a release store.
+ */
+
+const uint8_t I2C_TRANSFER_SIZE = 32; // Longest transfer, U8g2 splits display data into 24 byte transfers
+const uint8_t I2C_TRANSFERS = 32;     // Transfers queued at once, enough for a whole frame, must be a power of 2
+
+struct I2cTransfer
+/*
+ * One I2C write, from its start to its stop condition
+ */
+{
+    uint8_t address; // 8 bit address, as U8g2 and the HAL use it
+    uint8_t length;
+    uint8_t data[I2C_TRANSFER_SIZE];
+};
+
+class I2cTransferQueue
+/*
+ * Single producer, single consumer ring of I2C transfers
+ */
+{
+    I2cTransfer transfers[I2C_TRANSFERS];
+    uint32_t writePos = 0;
+    uint32_t readPos = 0;
+    bool filling = false;  // only used by the producer
+    bool overlong = false; // only used by the producer
+
+    uint32_t queued = 0;
+    uint32_t truncated = 0;
+
+public:
+    bool begin(uint8_t address);
+    /*
+     * Starts filling the next transfer, from the producer
+     *
+     * :param address: 8 bit address of the device
+     *
+     * :return: false if the queue is full, begin() must then be called again once a transfer has completed
+     */
+
+    void append(const uint8_t *data, uint8_t length);
+    /*
+     * Adds bytes to the transfer being filled, from the producer
+     * Bytes beyond I2C_TRANSFER_SIZE are dropped and the transfer counted as truncated.
+     *
+     * :param data: the bytes
+     *
+     * :param length: number of bytes
+     */
+
+    void end();
+    /*
+     * Hands the filled transfer to the consumer, from the producer
+     */
+
+    I2cTransfer *front();
+    /*
+     * The oldest transfer not yet completed, from the consumer
+     *
+     * :return: the transfer, or nullptr if the queue is empty
+     */
+
+    void pop();
+    /*
+     * Frees the transfer returned by front() once it has completed, from the consumer
+     */
+
+    bool isEmpty();
+    /*
+     * :return: true once every transfer handed to the consumer has completed
+     */
+
+    uint32_t getQueued();
+    /*
+     * :return: number of transfers handed to the consumer
+     */
+
+    uint32_t getTruncated();
+    /*
+     * :return: number of transfers longer than I2C_TRANSFER_SIZE
+     */
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include "u8g2_dma_i2c.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <Wire.h>
+#include <STM32FreeRTOS.h>
+
+// The Wire driver defines the HAL's weak I2C callbacks for its own transfers, so the DMA transfers register theirs on
+// the I2C1 handle instead; the build must set USE_HAL_I2C_REGISTER_CALLBACKS (platformio.ini)
+#if !USE_HAL_I2C_REGISTER_CALLBACKS
+#error "u8g2_dma_i2c needs USE_HAL_I2C_REGISTER_CALLBACKS=1"
+#endif
+
+// I2C1 (the Wire pins) is set up by the Wire driver, then each transfer is written from its cell by DMA1 channel 6
+static I2C_HandleTypeDef *hi2c = nullptr;
+static DMA_HandleTypeDef hdma;
+static I2cTransferQueue queue;
+static volatile bool busy = false;               // A transfer is in flight, set with the transfer interrupts masked
+static volatile TaskHandle_t waiting = nullptr;  // Task waiting for room in the queue
+static uint32_t waits = 0;
+static volatile uint32_t errors = 0;
+
+extern "C" void DMA1_Channel6_IRQHandler(void);
+
+static void maskTransfers()
+/*
+ * Holds back the interrupts that complete transfers, without touching any other interrupt
+ */
+{
+    HAL_NVIC_DisableIRQ(I2C1_EV_IRQn);
+    HAL_NVIC_DisableIRQ(I2C1_ER_IRQn);
+    HAL_NVIC_DisableIRQ(DMA1_Channel6_IRQn);
+    __DSB();
+    __ISB();
+}
+
+static void unmaskTransfers()
+/*
+ * Lets the interrupts held back by maskTransfers() run
+ */
+{
+    HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+    HAL_NVIC_EnableIRQ(I2C1_ER_IRQn);
+    HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
+}
+
+static void startNext()
+/*
+ * Starts the oldest queued transfer, must be called from the completion interrupt or with the transfers masked
+ */
+{
+    while (I2cTransfer *transfer = queue.front())
+    {
+        if (HAL_I2C_Master_Transmit_DMA(hi2c, transfer->address, transfer->data, transfer->length) == HAL_OK)
+        {
+            busy = true;
+            return;
+        }
+        errors++;
+        queue.pop();
+    }
+    busy = false;
+}
+
+static void finishTransfer(bool failed)
+/*
+ * Drops the transfer in flight, starts the next one and wakes the display task if it is waiting for room, must be
+ * called from the transfer interrupts
+ *
+ * :param failed: true if the transfer was given up on, it is counted as an error
+ */
+{
+    if (!busy)
+    {
+        return;
+    }
+    if (failed)
+    {
+        errors++;
+    }
+    queue.pop();
+    startNext();
+
+    if (waiting)
+    {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(waiting, &woken);
+        waiting = nullptr;
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+static void onTransmitted(I2C_HandleTypeDef *handle)
+/*
+ * Called by the HAL from the I2C event interrupt once a transfer's stop condition has been sent
+ *
+ * :param handle: the I2C1 handle
+ */
+{
+    (void)handle;
+    finishTransfer(false);
+}
+
+static void onError(I2C_HandleTypeDef *handle)
+/*
+ * Called by the HAL from the I2C error interrupt after a NACK, a lost arbitration or a bus error, once it has stopped
+ * the DMA
+ *
+ * :param handle: the I2C1 handle
+ */
+{
+    (void)handle;
+    finishTransfer(true);
+}
+
+void DMA1_Channel6_IRQHandler(void)
+/*
+ * DMA interrupt, the HAL then waits for the I2C to send the stop condition
+ */
+{
+    HAL_DMA_IRQHandler(&hdma);
+}
+
+static void begin()
+/*
+ * Sets up I2C1 with the Wire driver at displayI2cClock, then links it to its DMA channel
+ */
+{
+    Wire.begin();
+    Wire.setClock(displayI2cClock);
+    hi2c = Wire.getHandle();
+
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    hdma.Instance = DMA1_Channel6;
+    hdma.Init.Request = DMA_REQUEST_3; // I2C1_TX
+    hdma.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma.Init.MemInc = DMA_MINC_ENABLE;
+    hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma.Init.Mode = DMA_NORMAL;
+    hdma.Init.Priority = DMA_PRIORITY_LOW;
+    HAL_DMA_Init(&hdma);
+    __HAL_LINKDMA(hi2c, hdmatx, hdma);
+    HAL_I2C_RegisterCallback(hi2c, HAL_I2C_MASTER_TX_COMPLETE_CB_ID, onTransmitted);
+    HAL_I2C_RegisterCallback(hi2c, HAL_I2C_ERROR_CB_ID, onError);
+
+    // Below the audio and CAN interrupts, and low enough to notify the display task
+    HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 7, 0);
+    HAL_NVIC_SetPriority(I2C1_EV_IRQn, 7, 0);
+    HAL_NVIC_SetPriority(I2C1_ER_IRQn, 7, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+}
+
+static void recover()
+/*
+ * Drops the transfer in flight if it has been given up on without an error interrupt, so it never completes
+ */
+{
+    maskTransfers();
+    if (busy && HAL_I2C_GetState(hi2c) == HAL_I2C_STATE_READY)
+    {
+        errors++;
+        queue.pop();
+        startNext();
+    }
+    unmaskTransfers();
+}
+
+static void waitForRoom(uint8_t address)
+/*
+ * Starts filling the next transfer, blocking the task until there is room for it
+ *
+ * :param address: 8 bit address of the display
+ */
+{
+    while (1)
+    {
+        waiting = xTaskGetCurrentTaskHandle();
+        if (queue.begin(address))
+        {
+            waiting = nullptr;
+            return;
+        }
+        waits++;
+        if (!ulTaskNotifyTake(pdTRUE, displayI2cTimeout / portTICK_PERIOD_MS))
+        {
+            recover();
+        }
+    }
+}
+
+uint8_t u8x8_byte_stm32_dma_i2c(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr)
+/*
+ * U8g2 byte callback queuing transfers for the DMA
+ *
+ * :param u8x8: the display
+ *
+ * :param msg: U8X8_MSG_BYTE_* message
+ *
+ * :param arg_int: number of bytes for U8X8_MSG_BYTE_SEND
+ *
+ * :param arg_ptr: the bytes for U8X8_MSG_BYTE_SEND
+ *
+ * :return: 1 if the message was handled
+ */
+{
+    bool scheduled = xTaskGetSchedulerState() == taskSCHEDULER_RUNNING;
+    switch (msg)
+    {
+    case U8X8_MSG_BYTE_INIT:
+        begin();
+        break;
+    case U8X8_MSG_BYTE_SET_DC:
+        break;
+    case U8X8_MSG_BYTE_START_TRANSFER:
+        if (scheduled)
+        {
+            waitForRoom(u8x8_GetI2CAddress(u8x8));
+        }
+        else
+        {
+            // Nothing is in flight before the scheduler starts, every transfer is sent as it ends
+            queue.begin(u8x8_GetI2CAddress(u8x8));
+        }
+        break;
+    case U8X8_MSG_BYTE_SEND:
+        queue.append((const uint8_t *)arg_ptr, arg_int);
+        break;
+    case U8X8_MSG_BYTE_END_TRANSFER:
+        queue.end();
+        if (scheduled)
+        {
+            maskTransfers();
+            if (!busy)
+            {
+                startNext();
+            }
+            unmaskTransfers();
+        }
+        else
+        {
+            I2cTransfer *transfer = queue.front();
+            HAL_I2C_Master_Transmit(hi2c, transfer->address, transfer->data, transfer->length, displayI2cTimeout);
+            queue.pop();
+        }
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+bool isDisplayI2cIdle()
+/*
+ * :return: true once every queued transfer has been sent
+ */
+{
+    return queue.isEmpty();
+}
+
+uint32_t getDisplayI2cTransfers()
+/*
+ * :return: number of transfers queued since the display was started
+ */
+{
+    return queue.getQueued();
+}
+
+uint32_t getDisplayI2cWaits()
+/*
+ * :return: number of times the display task waited for room in the queue
+ */
+{
+    return waits;
+}
+
+uint32_t getDisplayI2cErrors()
+/*
+ * :return: number of transfers that failed to start, failed on the bus or never completed, and were dropped
+ */
+{
+    return errors;
+}
+#endif
@@ -0,0 +1,80 @@
+#include <cstdint>
+#include "i2c_queue.h"
+
+#ifndef U8G2_DMA_I2C_H
+#define U8G2_DMA_I2C_H
+
+#ifdef ARDUINO
+#include <U8g2lib.h>
+
+/*
+ * U8g2 display on I2C1 that sends its frames by DMA instead of waiting for every byte to go out
+ *
+ * The byte callback copies each transfer U8g2 makes into an I2cTransferQueue and returns, and the I2C and DMA
+ * interrupts start the next transfer as each one completes or fails. The completion and error callbacks are registered
+ * on the Wire driver's I2C1 handle, as the driver already defines the HAL's weak ones. The display task only waits,
+ * blocked on a notification from the completion interrupt, when it gets a whole queue ahead of the bus. Before the
+ * scheduler starts (U8g2's begin() in setup()) the interrupts are masked by FreeRTOS, so transfers are sent by polling
+ * as the Wire driver did.
+ */
+
+const uint32_t displayI2cClock = 400000;  // Hz, the fastest the SSD1305 supports
+const uint32_t displayI2cTimeout = 10;    // ms without a completion before an in flight transfer is given up on
+
+extern "C" uint8_t u8x8_byte_stm32_dma_i2c(u8x8_t *u8x8, uint8_t msg, uint8_t arg_int, void *arg_ptr);
+/*
+ * U8g2 byte callback queuing transfers for the DMA
+ *
+ * :param u8x8: the display
+ *
+ * :param msg: U8X8_MSG_BYTE_* message
+ *
+ * :param arg_int: number of bytes for U8X8_MSG_BYTE_SEND
+ *
+ * :param arg_ptr: the bytes for U8X8_MSG_BYTE_SEND
+ *
+ * :return: 1 if the message was handled
+ */
+
+class U8G2_SSD1305_128X32_NONAME_F_DMA_I2C : public U8G2
+/*
+ * The SSD1305 128x32 display with a full frame buffer, as U8G2_SSD1305_128X32_NONAME_F_HW_I2C but sent by DMA
+ */
+{
+public:
+    U8G2_SSD1305_128X32_NONAME_F_DMA_I2C(const u8g2_cb_t *rotation, uint8_t reset = U8X8_PIN_NONE) : U8G2()
+    /*
+     * Initialiser for the U8G2_SSD1305_128X32_NONAME_F_DMA_I2C class
+     *
+     * :param rotation: U8g2 rotation of the display
+     *
+     * :param reset: reset pin, if the display has one wired
+     */
+    {
+        u8g2_Setup_ssd1305_i2c_128x32_noname_f(&u8g2, rotation, u8x8_byte_stm32_dma_i2c, u8x8_gpio_and_delay_arduino);
+        u8x8_SetPin_HW_I2C(getU8x8(), reset);
+    }
+};
+
+bool isDisplayI2cIdle();
+/*
+ * :return: true once every queued transfer has been sent
+ */
+
+uint32_t getDisplayI2cTransfers();
+/*
+ * :return: number of transfers queued since the display was started
+ */
+
+uint32_t getDisplayI2cWaits();
+/*
+ * :return: number of times the display task waited for room in the queue
+ */
+
+uint32_t getDisplayI2cErrors();
+/*
+ * :return: number of transfers that failed to start, failed on the bus or never completed, and were dropped
+ */
+#endif
+
+#endif
@@ -0,0 +1,85 @@
+#include "axis_filter.h"
+
+AxisFilter::AxisFilter(uint16_t deadzone, uint8_t smoothing, uint16_t calibrationSamples)
+/*
+ * Initialiser for the AxisFilter class
+ *
+ * :param deadzone: offsets from the centre up to this size read as 0
+ *
+ * :param smoothing: IIR filter shift, each update moves the output 1/2^smoothing of the way to the input
+ *
+ * :param calibrationSamples: number of samples averaged to find the centre
+ */
+    : deadzone(deadzone), smoothing(smoothing), calibrationSamples(calibrationSamples)
+{
+}
+
+int32_t AxisFilter::update(uint16_t sample)
+/*
+ * Adds a sample, used to find the centre until calibration is complete
+ *
+ * :param sample: raw sample of the axis
+ *
+ * :return: the filtered offset from the centre, 0 until calibrated
+ */
+{
+    // Learning the centre
+    if (calibrationCount < calibrationSamples)
+    {
+        calibrationSum += sample;
+        calibrationCount++;
+        if (calibrationCount == calibrationSamples)
+        {
+            centre = (calibrationSum + calibrationSamples / 2) / calibrationSamples;
+        }
+        return 0;
+    }
+
+    // Removing the deadzone
+    int32_t offset = (int32_t)sample - centre;
+    if (offset > deadzone)
+    {
+        offset -= deadzone;
+    }
+    else if (offset < -deadzone)
+    {
+        offset += deadzone;
+    }
+    else
+    {
+        offset = 0;
+    }
+
+    // First order IIR low pass: y += (x - y) / 2^smoothing
+    accumulator += offset - (accumulator >> smoothing);
+    int32_t filtered = accumulator >> smoothing;
+
+    __atomic_store_n(&value, filtered, __ATOMIC_RELAXED);
+    return filtered;
+}
+
+int32_t AxisFilter::getValue()
+/*
+ * Atomically loads the filtered offset from the centre
+ *
+ * :return: the filtered offset, in the units of the samples
+ */
+{
+    return __atomic_load_n(&value, __ATOMIC_RELAXED);
+}
+
+bool AxisFilter::isCalibrated()
+/*
+ * :return: true once the centre has been learnt
+ */
+{
+    return calibrationCount == calibrationSamples;
+}
+
+int32_t AxisFilter::getCentre()
+/*
+ * :return: the learnt centre, 0 until calibrated
+ */
+{
+    return centre;
+}
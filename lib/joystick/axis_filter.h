@@ -0,0 +1,66 @@
+#include <cstdint>
+
+#ifndef AXIS_FILTER_H
+#define AXIS_FILTER_H
+
+class AxisFilter
+/*
+ * Conditions the samples of one joystick axis
+ *
+ * The centre is learnt by averaging the first samples after boot, with the stick at rest. After that each sample is
+ * offset by the centre, has a deadzone removed (shrinking the rest of the range, so there is no jump at its edge) and
+ * is smoothed with a first order IIR filter. Hardware independent, update() must only be called from one context.
+ */
+{
+    uint16_t deadzone;
+    uint8_t smoothing;
+    uint16_t calibrationSamples;
+
+    uint32_t calibrationSum = 0;
+    uint16_t calibrationCount = 0;
+    int32_t centre = 0;
+
+    // Filter state, the filtered value scaled by 2^smoothing
+    int32_t accumulator = 0;
+    volatile int32_t value = 0;
+
+public:
+    AxisFilter(uint16_t deadzone, uint8_t smoothing = 3, uint16_t calibrationSamples = 64);
+    /*
+     * Initialiser for the AxisFilter class
+     *
+     * :param deadzone: offsets from the centre up to this size read as 0
+     *
+     * :param smoothing: IIR filter shift, each update moves the output 1/2^smoothing of the way to the input
+     *
+     * :param calibrationSamples: number of samples averaged to find the centre
+     */
+
+    int32_t update(uint16_t sample);
+    /*
+     * Adds a sample, used to find the centre until calibration is complete
+     *
+     * :param sample: raw sample of the axis
+     *
+     * :return: the filtered offset from the centre, 0 until calibrated
+     */
+
+    int32_t getValue();
+    /*
+     * Atomically loads the filtered offset from the centre
+     *
+     * :return: the filtered offset, in the units of the samples
+     */
+
+    bool isCalibrated();
+    /*
+     * :return: true once the centre has been learnt
+     */
+
+    int32_t getCentre();
+    /*
+     * :return: the learnt centre, 0 until calibrated
+     */
+};
+
+#endif
@@ -1,53 +1,142 @@
 #include <iostream>
-#include <Arduino.h>
 #include <string>
+#include "keymatrix.h"
+#include "joystick.h"
+
+// Only the ADC sampling needs the board, the filtering and decoding are hardware independent
+#ifdef ARDUINO
+#include <Arduino.h>
 #include <STM32FreeRTOS.h>
 #include "main.h"
-#include "joystick.h"
+
+// ADC1 converts both axes over and over, with DMA copying each result into adcBuffer in circular mode
+static ADC_HandleTypeDef hadc;
+static DMA_HandleTypeDef hdma;
+static volatile uint16_t adcBuffer[2]; // x, y
+#endif
 
 using namespace std;
 
 Joystick::Joystick()
-/*
- * class constructor to set the joystick button to correct inital value
- */
+    /*
+     * class constructor to set the joystick button to correct inital value
+     */
+    : xFilter(joystickDeadzone, joystickSmoothing), yFilter(joystickDeadzone, joystickSmoothing)
 {
     button = 1;
-    x = 0;
-    y = 0;
 }
 
-void Joystick::updateJoystickButton()
+#ifdef ARDUINO
+void Joystick::begin()
 /*
- * Gets data from joystic button and stores it in a global variable
+ * Starts sampling both axes continuously with the ADC, must be called once before updateJoystickPosition()
+ * Returns once the first pair of results is in the buffer
  */
 {
-    // Writing to mux to select row for detecting button
-    setRow(5);
+    pinMode(JOYX_PIN, INPUT_ANALOG);
+    pinMode(JOYY_PIN, INPUT_ANALOG);
+    __HAL_RCC_ADC_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    // Continuous scan of both channels, each result is the sum of 16 conversions (12 bit -> 16 bit)
+    // 20MHz ADC clock, 653 cycles per conversion: ~960 results per second for each axis
+    hadc.Instance = ADC1;
+    hadc.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4;
+    hadc.Init.Resolution = ADC_RESOLUTION_12B;
+    hadc.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+    hadc.Init.ScanConvMode = ADC_SCAN_ENABLE;
+    hadc.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    hadc.Init.LowPowerAutoWait = DISABLE;
+    hadc.Init.ContinuousConvMode = ENABLE;
+    hadc.Init.NbrOfConversion = 2;
+    hadc.Init.DiscontinuousConvMode = DISABLE;
+    hadc.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+    hadc.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+    hadc.Init.DMAContinuousRequests = ENABLE;
+    hadc.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+    hadc.Init.OversamplingMode = ENABLE;
+    hadc.Init.Oversampling.Ratio = ADC_OVERSAMPLING_RATIO_16;
+    hadc.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_NONE;
+    hadc.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+    hadc.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
+    HAL_ADC_Init(&hadc);
+
+    // Long sampling time, the joystick potentiometers have a high source impedance
+    ADC_ChannelConfTypeDef channel = {};
+    channel.SamplingTime = ADC_SAMPLETIME_640CYCLES_5;
+    channel.SingleDiff = ADC_SINGLE_ENDED;
+    channel.OffsetNumber = ADC_OFFSET_NONE;
+    channel.Offset = 0;
 
-    // Delay to give time for row to be set
-    delayMicroseconds(3);
+    // JOYX_PIN (PA1) and JOYY_PIN (PA0)
+    channel.Channel = ADC_CHANNEL_6;
+    channel.Rank = ADC_REGULAR_RANK_1;
+    HAL_ADC_ConfigChannel(&hadc, &channel);
+    channel.Channel = ADC_CHANNEL_5;
+    channel.Rank = ADC_REGULAR_RANK_2;
+    HAL_ADC_ConfigChannel(&hadc, &channel);
 
-    // Reading correct pin
-    int8_t localButton = digitalRead(C2_PIN);
+    HAL_ADCEx_Calibration_Start(&hadc, ADC_SINGLE_ENDED);
+
+    // Nothing waits for the DMA, so its interrupts are left disabled in the NVIC
+    hdma.Instance = DMA1_Channel1;
+    hdma.Init.Request = DMA_REQUEST_0;
+    hdma.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma.Init.MemInc = DMA_MINC_ENABLE;
+    hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    hdma.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma.Init.Mode = DMA_CIRCULAR;
+    hdma.Init.Priority = DMA_PRIORITY_LOW;
+    HAL_DMA_Init(&hdma);
+    __HAL_LINKDMA(&hadc, DMA_Handle, hdma);
+
+    HAL_ADC_Start_DMA(&hadc, (uint32_t *)adcBuffer, 2);
+
+    // The centre is calibrated from the first scan frames, so wait for the first pair of results (~1ms) rather than
+    // have it read the buffer's initial zeros. The tick may not run before the scheduler starts, so the wait is
+    // bounded by polls, ~50ms, in case the ADC never delivers.
+    for (uint32_t polls = 0; polls < 1000000 && !__HAL_DMA_GET_FLAG(&hdma, DMA_FLAG_TC1); polls++)
+    {
+    }
+}
+
+void Joystick::updateJoystickPosition()
+/*
+ * Filters the latest ADC samples of both axes and stores the position in global variables x and y
+ */
+{
+    // The DMA keeps the buffer up to date, so this never waits for a conversion
+    updateJoystickPosition(adcBuffer[0], adcBuffer[1]);
+}
+#endif
+
+void Joystick::updateJoystickButton(uint32_t frame)
+/*
+ * Gets data from joystic button and stores it in a global variable
+ *
+ * :param frame: packed matrix state from the scanner
+ */
+{
+    // Reading the button from the matrix frame
+    int8_t localButton = getMatrixBit(frame, JOYB_ROW, JOYB_COL);
 
     // Atomically storing to global variable
     __atomic_store_n(&button, localButton, __ATOMIC_RELAXED);
 }
 
-void Joystick::updateJoystickPosition()
+void Joystick::updateJoystickPosition(uint16_t rawX, uint16_t rawY)
 /*
- * Gets data from joystic pins and stores its position in global variables x and y
+ * Filters a pair of samples and stores the position in global variables x and y
+ *
+ * :param rawX: 16 bit sample of the x axis
+ *
+ * :param rawY: 16 bit sample of the y axis
  */
 {
-    // Reading correct pins
-    uint32_t localX = analogRead(JOYX_PIN);
-    uint32_t localY = analogRead(JOYY_PIN);
-    // Serial.println(localX);
-
-    // Atomically storing to global variables
-    __atomic_store_n(&x, localX, __ATOMIC_RELAXED);
-    __atomic_store_n(&y, localY, __ATOMIC_RELAXED);
+    // The filters store their outputs atomically
+    xFilter.update(rawX);
+    yFilter.update(rawY);
 }
 
 int8_t Joystick::getButton()
@@ -58,18 +147,22 @@ int8_t Joystick::getButton()
     return __atomic_load_n(&button, __ATOMIC_RELAXED);
 }
 
-uint32_t Joystick::getX()
+int32_t Joystick::getX()
 /*
  * Atomically loads the global variable to prevent synchronisation erros
+ *
+ * :return: filtered x offset from the centre, in 10 bit ADC counts
  */
 {
-    return __atomic_load_n(&x, __ATOMIC_RELAXED);
+    return xFilter.getValue() / joystickScale;
 }
 
-uint32_t Joystick::getY()
+int32_t Joystick::getY()
 /*
  * Atomically loads the global variable to prevent synchronisation erros
+ *
+ * :return: filtered y offset from the centre, in 10 bit ADC counts
  */
 {
-    return __atomic_load_n(&y, __ATOMIC_RELAXED);
+    return yFilter.getValue() / joystickScale;
 }
@@ -1,38 +1,71 @@
 #include <iostream>
+#include <cstdint>
+#include "axis_filter.h"
 
 #ifndef JOYSTICK_H
 #define JOYSTICK_H
 
+// Joystick button in the key matrix, as row and column
+const uint8_t JOYB_ROW = 5;
+const uint8_t JOYB_COL = 2;
+
+// Axis conditioning, applied to the 16 bit readings of the oversampled ADC
+const uint16_t joystickDeadzone = 1280; // ~2% of full scale either side of the centre
+const uint8_t joystickSmoothing = 3;    // ~7ms time constant when updated every matrix frame
+const uint8_t joystickScale = 64;       // Divides down to the 10 bit range of analogRead(), which the pitch bend was tuned for
+
 class Joystick
 {
 
     volatile int8_t button;
-    volatile uint32_t x;
-    volatile uint32_t y;
+    AxisFilter xFilter;
+    AxisFilter yFilter;
 
 public:
     Joystick();
     /*
      * class constructor to set the joystick button to correct inital value
      */
-    void updateJoystickButton();
+
+    void begin();
     /*
-     * Gets data from joystic pins and stores it in global variables
+     * Starts sampling both axes continuously with the ADC, must be called once before updateJoystickPosition()
+     * Returns once the first pair of results is in the buffer
+     */
+
+    void updateJoystickButton(uint32_t frame);
+    /*
+     * Gets data from joystic button and stores it in a global variable
+     *
+     * :param frame: packed matrix state from the scanner
      */
 
     void updateJoystickPosition();
     /*
-     * Gets data from joystic pins and stores its position in global variables x and y
+     * Filters the latest ADC samples of both axes and stores the position in global variables x and y
+     */
+
+    void updateJoystickPosition(uint16_t rawX, uint16_t rawY);
+    /*
+     * Filters a pair of samples and stores the position in global variables x and y
+     *
+     * :param rawX: 16 bit sample of the x axis
+     *
+     * :param rawY: 16 bit sample of the y axis
      */
 
-    uint32_t getX();
+    int32_t getX();
     /*
      * Atomically loads the global variable to prevent synchronisation erros
+     *
+     * :return: filtered x offset from the centre, in 10 bit ADC counts
      */
 
-    uint32_t getY();
+    int32_t getY();
     /*
      * Atomically loads the global variable to prevent synchronisation erros
+     *
+     * :return: filtered y offset from the centre, in 10 bit ADC counts
      */
 
     int8_t getButton();
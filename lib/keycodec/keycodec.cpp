@@ -0,0 +1,254 @@
+#include "keycodec.h"
+
+uint8_t keyEventNote(uint16_t &changed)
+/*
+ * Takes the lowest note out of a changed mask, for applying the transitions one at a time
+ *
+ * :param changed: mask of the notes still to be applied, the returned note is cleared from it
+ *
+ * :return: the lowest note in the mask (0-11), must only be called while the mask is not 0
+ */
+{
+    uint8_t note = __builtin_ctz(changed);
+    changed &= changed - 1;
+    return note;
+}
+
+bool coalesceKeyEvents(KeyEventsMessage &queued, const KeyEventsMessage &next)
+/*
+ * Merges a message into one still waiting to be transmitted, so it carries the state of both scans in one frame
+ * A key pressed and released again between the two cancels out, the receiver never sees the superseded pair
+ *
+ * :param queued: message waiting to be transmitted, replaced by the merged message
+ *
+ * :param next: the newer message
+ *
+ * :return: false if the octaves differ and the messages can't be merged, queued is then unchanged
+ */
+{
+    if (queued.octave != next.octave)
+    {
+        return false;
+    }
+
+    // Changes are relative to the message before, so the changes of both compose as an exclusive or
+    queued.pressed = next.pressed;
+    queued.changed ^= next.changed;
+    return true;
+}
+
+bool KeyEventSender::update(KeyEventsMessage &message, uint8_t octave, uint16_t pressed, uint32_t now)
+/*
+ * Fills a message if one should be sent
+ *
+ * :param message: the message to fill
+ *
+ * :param octave: the current octave of the keys (1-7)
+ *
+ * :param pressed: mask of the notes held down
+ *
+ * :param now: current time in ms
+ *
+ * :return: true if the message was filled and should be sent
+ */
+{
+    pressed &= KEY_MASK;
+
+    // A change of octave resends every held key, the receiver releases the old octave when it times out
+    uint16_t changed = (octave == lastOctave) ? (pressed ^ lastPressed) : pressed;
+    bool snapshotDue = !sent || (now - lastSent >= keySnapshotInterval);
+    if (!changed && octave == lastOctave && !snapshotDue)
+    {
+        return false;
+    }
+
+    message = KeyEventsMessage{octave, pressed, changed, 0};
+    lastOctave = octave;
+    lastPressed = pressed;
+    lastSent = now;
+    sent = true;
+    return true;
+}
+
+void KeyEventSender::resend()
+/*
+ * Records that the last message was dropped, so the next update() sends a snapshot whatever the keys do
+ */
+{
+    sent = false;
+}
+
+bool KeyEventSender::isResendDue()
+/*
+ * :return: true while a dropped message still has to be resent
+ */
+{
+    return !sent;
+}
+
+uint8_t KeyStateTracker::slot(uint8_t module, uint32_t now) const
+/*
+ * :param module: module ID of a transmitter
+ *
+ * :param now: current time in ms
+ *
+ * :return: the transmitter's slot, or else an unused one, or else the least recently heard one
+ */
+{
+    uint8_t oldest = 0;
+    for (uint8_t i = 0; i < KEY_SENDERS; i++)
+    {
+        if (senders[i].module == module)
+        {
+            return i;
+        }
+        if (now - senders[i].lastUpdate > now - senders[oldest].lastUpdate)
+        {
+            oldest = i;
+        }
+    }
+    for (uint8_t i = 0; i < KEY_SENDERS; i++)
+    {
+        if (!senders[i].module)
+        {
+            return i;
+        }
+    }
+    return oldest;
+}
+
+void KeyStateTracker::sounding(const Sender senders[KEY_SENDERS], uint16_t held[KEY_OCTAVES])
+/*
+ * :param senders: the transmitters
+ *
+ * :param held: set to the notes held on each octave by any of them
+ */
+{
+    for (uint8_t octave = 0; octave < KEY_OCTAVES; octave++)
+    {
+        held[octave] = 0;
+    }
+    for (uint8_t i = 0; i < KEY_SENDERS; i++)
+    {
+        if (senders[i].module)
+        {
+            held[senders[i].octave] |= senders[i].held;
+        }
+    }
+}
+
+bool KeyStateTracker::reconcile(uint8_t module, uint8_t octave, uint16_t pressed, uint32_t now,
+                                uint16_t toPress[KEY_OCTAVES], uint16_t toRelease[KEY_OCTAVES]) const
+/*
+ * Works out the notes that change if update() is called with a received pressed mask, without recording it
+ * A transmitter that moved octave releases the notes it held on the previous one, and notes held by another
+ * transmitter on the same octave are neither pressed again nor released.
+ *
+ * :param module: module ID of the sender
+ *
+ * :param octave: the octave of the message, messages for octaves outside 0-7 change nothing
+ *
+ * :param pressed: mask of the notes held down
+ *
+ * :param now: current time in ms
+ *
+ * :param toPress: set to the notes that must be started on each octave
+ *
+ * :param toRelease: set to the notes that must be released on each octave
+ *
+ * :return: true if any notes change
+ */
+{
+    // The notes held before and after the message, a replaced transmitter's notes are released with it
+    Sender next[KEY_SENDERS];
+    for (uint8_t i = 0; i < KEY_SENDERS; i++)
+    {
+        next[i] = senders[i];
+    }
+    if (octave < KEY_OCTAVES)
+    {
+        next[slot(module, now)] = Sender{module, octave, (uint16_t)(pressed & KEY_MASK), now};
+    }
+    uint16_t before[KEY_OCTAVES];
+    sounding(senders, before);
+    sounding(next, toPress);
+
+    bool changed = false;
+    for (uint8_t i = 0; i < KEY_OCTAVES; i++)
+    {
+        uint16_t after = toPress[i];
+        toPress[i] = after & ~before[i];
+        toRelease[i] = before[i] & ~after;
+        changed = changed || toPress[i] || toRelease[i];
+    }
+    return changed;
+}
+
+void KeyStateTracker::update(uint8_t module, uint8_t octave, uint16_t pressed, uint32_t now)
+/*
+ * Records a received pressed mask, once the changes from reconcile() have been applied
+ *
+ * :param module: module ID of the sender
+ *
+ * :param octave: the octave of the message, messages for octaves outside 0-7 are ignored
+ *
+ * :param pressed: mask of the notes held down
+ *
+ * :param now: current time in ms
+ */
+{
+    if (octave < KEY_OCTAVES)
+    {
+        senders[slot(module, now)] = Sender{module, octave, (uint16_t)(pressed & KEY_MASK), now};
+    }
+}
+
+bool KeyStateTracker::expire(uint32_t now, uint16_t toRelease[KEY_OCTAVES])
+/*
+ * Releases the notes of every transmitter that hasn't sent a message for keySnapshotTimeout, e.g. when it is
+ * unplugged
+ *
+ * :param now: current time in ms
+ *
+ * :param toRelease: set to the notes that must be released on each octave
+ *
+ * :return: true if any notes must be released
+ */
+{
+    uint16_t before[KEY_OCTAVES];
+    sounding(senders, before);
+    for (uint8_t i = 0; i < KEY_SENDERS; i++)
+    {
+        if (senders[i].held && now - senders[i].lastUpdate > keySnapshotTimeout)
+        {
+            senders[i].held = 0;
+        }
+    }
+    sounding(senders, toRelease);
+
+    bool expired = false;
+    for (uint8_t octave = 0; octave < KEY_OCTAVES; octave++)
+    {
+        toRelease[octave] = before[octave] & ~toRelease[octave];
+        expired = expired || toRelease[octave];
+    }
+    return expired;
+}
+
+uint16_t KeyStateTracker::getHeld(uint8_t octave) const
+/*
+ * :param octave: the octave (0-7)
+ *
+ * :return: mask of the notes held on the octave by any transmitter
+ */
+{
+    uint16_t held = 0;
+    for (uint8_t i = 0; i < KEY_SENDERS; i++)
+    {
+        if (senders[i].module && senders[i].octave == octave)
+        {
+            held |= senders[i].held;
+        }
+    }
+    return held;
+}
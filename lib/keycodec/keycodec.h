@@ -0,0 +1,173 @@
+#include <cstdint>
+#include "canproto.h"
+
+#ifndef KEYCODEC_H
+#define KEYCODEC_H
+
+/*
+ * Hardware independent handling of key events messages (KeyEventsMessage in canproto.h)
+ *
+ * A key events message carries every key transition of one scan of the key matrix: the octave, the mask of notes held
+ * down after the scan and the mask of notes pressed or released in the scan, so a whole chord costs one frame on the
+ * bus instead of one frame per key.
+ *
+ * As every message holds the complete state of its octave, a message with no changes is a snapshot. Transmitters send
+ * one every keySnapshotInterval, and receivers reconcile their notes with the pressed mask of every message rather than
+ * applying the changes, so a lost message or a full queue only leaves a note wrong until the next snapshot.
+ */
+
+const uint16_t KEY_MASK = 0x0FFF;
+const uint8_t KEY_OCTAVES = 8;
+const uint8_t KEY_SENDERS = 8; // Transmitters whose notes are tracked at once, the least recently heard is replaced
+
+const uint32_t keySnapshotInterval = 100; // ms between snapshots from a transmitter, ~1% of the bus at 125kbit/s
+const uint32_t keySnapshotTimeout = 350;  // ms without a message before a transmitter's notes are released
+const uint32_t keyResendInterval = 5;     // ms between attempts to resend a dropped message as a snapshot
+
+uint8_t keyEventNote(uint16_t &changed);
+/*
+ * Takes the lowest note out of a changed mask, for applying the transitions one at a time
+ *
+ * :param changed: mask of the notes still to be applied, the returned note is cleared from it
+ *
+ * :return: the lowest note in the mask (0-11), must only be called while the mask is not 0
+ */
+
+bool coalesceKeyEvents(KeyEventsMessage &queued, const KeyEventsMessage &next);
+/*
+ * Merges a message into one still waiting to be transmitted, so it carries the state of both scans in one frame
+ * A key pressed and released again between the two cancels out, the receiver never sees the superseded pair
+ *
+ * :param queued: message waiting to be transmitted, replaced by the merged message
+ *
+ * :param next: the newer message
+ *
+ * :return: false if the octaves differ and the messages can't be merged, queued is then unchanged
+ */
+
+class KeyEventSender
+/*
+ * Decides when a transmitter sends a key events message: when its keys or octave change, or a snapshot is due
+ */
+{
+    uint8_t lastOctave = 0;
+    uint16_t lastPressed = 0;
+    uint32_t lastSent = 0;
+    bool sent = false;
+
+public:
+    bool update(KeyEventsMessage &message, uint8_t octave, uint16_t pressed, uint32_t now);
+    /*
+     * Fills a message if one should be sent
+     *
+     * :param message: the message to fill
+     *
+     * :param octave: the current octave of the keys (1-7)
+     *
+     * :param pressed: mask of the notes held down
+     *
+     * :param now: current time in ms
+     *
+     * :return: true if the message was filled and should be sent
+     */
+
+    void resend();
+    /*
+     * Records that the last message was dropped, so the next update() sends a snapshot whatever the keys do
+     */
+
+    bool isResendDue();
+    /*
+     * :return: true while a dropped message still has to be resent
+     */
+};
+
+class KeyStateTracker
+/*
+ * Receiver side record of the notes each transmitter holds, reconciled with the pressed mask of every message
+ * Transmitters are told apart by module ID, so two on the same octave don't release each other's notes, and the notes
+ * sounding on an octave are those any of them holds there.
+ */
+{
+    struct Sender
+    {
+        uint8_t module; // 0 for an unused slot, module IDs are never 0
+        uint8_t octave;
+        uint16_t held;
+        uint32_t lastUpdate;
+    };
+    Sender senders[KEY_SENDERS] = {};
+
+    uint8_t slot(uint8_t module, uint32_t now) const;
+    /*
+     * :param module: module ID of a transmitter
+     *
+     * :param now: current time in ms
+     *
+     * :return: the transmitter's slot, or else an unused one, or else the least recently heard one
+     */
+
+    static void sounding(const Sender senders[KEY_SENDERS], uint16_t held[KEY_OCTAVES]);
+    /*
+     * :param senders: the transmitters
+     *
+     * :param held: set to the notes held on each octave by any of them
+     */
+
+public:
+    bool reconcile(uint8_t module, uint8_t octave, uint16_t pressed, uint32_t now, uint16_t toPress[KEY_OCTAVES],
+                   uint16_t toRelease[KEY_OCTAVES]) const;
+    /*
+     * Works out the notes that change if update() is called with a received pressed mask, without recording it
+     * A transmitter that moved octave releases the notes it held on the previous one, and notes held by another
+     * transmitter on the same octave are neither pressed again nor released.
+     *
+     * :param module: module ID of the sender
+     *
+     * :param octave: the octave of the message, messages for octaves outside 0-7 change nothing
+     *
+     * :param pressed: mask of the notes held down
+     *
+     * :param now: current time in ms
+     *
+     * :param toPress: set to the notes that must be started on each octave
+     *
+     * :param toRelease: set to the notes that must be released on each octave
+     *
+     * :return: true if any notes change
+     */
+
+    void update(uint8_t module, uint8_t octave, uint16_t pressed, uint32_t now);
+    /*
+     * Records a received pressed mask, once the changes from reconcile() have been applied
+     *
+     * :param module: module ID of the sender
+     *
+     * :param octave: the octave of the message, messages for octaves outside 0-7 are ignored
+     *
+     * :param pressed: mask of the notes held down
+     *
+     * :param now: current time in ms
+     */
+
+    bool expire(uint32_t now, uint16_t toRelease[KEY_OCTAVES]);
+    /*
+     * Releases the notes of every transmitter that hasn't sent a message for keySnapshotTimeout, e.g. when it is
+     * unplugged
+     *
+     * :param now: current time in ms
+     *
+     * :param toRelease: set to the notes that must be released on each octave
+     *
+     * :return: true if any notes must be released
+     */
+
+    uint16_t getHeld(uint8_t octave) const;
+    /*
+     * :param octave: the octave (0-7)
+     *
+     * :return: mask of the notes held on the octave by any transmitter
+     */
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "debouncer.h"
+
+Debouncer::Debouncer(uint32_t debounceMask) : mask(debounceMask)
+/*
+ * Initialiser for the Debouncer class, all inputs start high (not pressed)
+ *
+ * :param debounceMask: inputs to filter, the rest are passed through
+ */
+{
+}
+
+uint32_t Debouncer::update(uint32_t sample)
+/*
+ * Filters a new sample of every input at once
+ *
+ * :param sample: raw input state
+ *
+ * :return: debounced input state
+ */
+{
+    // Inputs that disagree with the debounced state count up, the others reset to 0
+    uint32_t delta = (sample ^ state) & mask;
+    count1 = (count1 ^ count0) & delta;
+    count0 = ~count0 & delta;
+
+    // Counters that have wrapped back to 0 whilst still disagreeing have seen 4 samples in a row
+    uint32_t toggle = delta & ~(count0 | count1);
+
+    state = ((state ^ toggle) & mask) | (sample & ~mask);
+    return state;
+}
+
+uint32_t Debouncer::getState()
+/*
+ * Gets the current debounced state without sampling
+ *
+ * :return: debounced input state
+ */
+{
+    return state;
+}
@@ -0,0 +1,44 @@
+#include <cstdint>
+
+#ifndef DEBOUNCER_H
+#define DEBOUNCER_H
+
+class Debouncer
+/*
+ * Bit-parallel debouncer for up to 32 inputs using a 2 bit vertical counter per input
+ *
+ * An input only changes state once it has read differently for 4 consecutive samples, any sample agreeing with the
+ * current state resets its counter. Inputs outside the mask are passed through unfiltered.
+ */
+{
+    uint32_t mask;
+    uint32_t state = 0xFFFFFFFF;
+    uint32_t count0 = 0;
+    uint32_t count1 = 0;
+
+public:
+    Debouncer(uint32_t debounceMask = 0xFFFFFFFF);
+    /*
+     * Initialiser for the Debouncer class, all inputs start high (not pressed)
+     *
+     * :param debounceMask: inputs to filter, the rest are passed through
+     */
+
+    uint32_t update(uint32_t sample);
+    /*
+     * Filters a new sample of every input at once
+     *
+     * :param sample: raw input state
+     *
+     * :return: debounced input state
+     */
+
+    uint32_t getState();
+    /*
+     * Gets the current debounced state without sampling
+     *
+     * :return: debounced input state
+     */
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "gpio_matrix_port.h"
+
+GpioMatrixPort::GpioMatrixPort(int ra0, int ra1, int ra2, int ren, int out, int c0, int c1, int c2, int c3, uint32_t settleNs)
+/*
+ * Initialiser for the GpioMatrixPort class
+ *
+ * :param ra0, ra1, ra2: row address pins
+ *
+ * :param ren: row enable pin
+ *
+ * :param out: matrix output pin, latched onto the selected row
+ *
+ * :param c0, c1, c2, c3: column input pins
+ *
+ * :param settleNs: time for the columns to settle after a row is selected
+ */
+{
+    rowPins[0] = ra0;
+    rowPins[1] = ra1;
+    rowPins[2] = ra2;
+    enablePin = ren;
+    outPin = out;
+    colPins[0] = c0;
+    colPins[1] = c1;
+    colPins[2] = c2;
+    colPins[3] = c3;
+
+    // Converted to cycles in begin(), once the clock is known
+    settleCycles = settleNs;
+}
+
+void GpioMatrixPort::begin()
+/*
+ * Looks up the GPIO registers for the pins, must be called after the pins are configured
+ */
+{
+    // Row select: address and output pins on one port, one BSRR word per row (set bits low, reset bits high)
+    rowPort = digitalPinToPort(rowPins[0]);
+    fastRowSelect = (digitalPinToPort(rowPins[1]) == rowPort) && (digitalPinToPort(rowPins[2]) == rowPort) && (digitalPinToPort(outPin) == rowPort);
+    for (uint8_t row = 0; row < 8; row++)
+    {
+        uint32_t set = 0;
+        uint32_t reset = 0;
+        for (uint8_t bit = 0; bit < 3; bit++)
+        {
+            uint32_t mask = digitalPinToBitMask(rowPins[bit]);
+            if (row & (1 << bit))
+            {
+                set |= mask;
+            }
+            else
+            {
+                reset |= mask;
+            }
+        }
+        rowBsrr[row] = set | (reset << 16);
+    }
+    outMask = digitalPinToBitMask(outPin);
+    enablePort = digitalPinToPort(enablePin);
+    enableMask = digitalPinToBitMask(enablePin);
+
+    // Column read: all columns on one port, remapped from their pin positions
+    colPort = digitalPinToPort(colPins[0]);
+    fastColRead = true;
+    for (uint8_t col = 0; col < MATRIX_COLS; col++)
+    {
+        fastColRead &= digitalPinToPort(colPins[col]) == colPort;
+        colShift[col] = __builtin_ctz(digitalPinToBitMask(colPins[col]));
+    }
+
+    // Cycle counter used for the settle time
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    settleCycles = (uint64_t)settleCycles * SystemCoreClock / 1000000000;
+}
+
+void GpioMatrixPort::setOutBit(uint8_t rowIdx, bool value)
+/*
+ * Sets the value written to OUT_PIN whenever a row is selected
+ *
+ * :param rowIdx: index of the row
+ *
+ * :param value: output value
+ */
+{
+    if (value)
+    {
+        __atomic_fetch_or(&outBits, 1 << rowIdx, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_fetch_and(&outBits, ~(1 << rowIdx), __ATOMIC_RELAXED);
+    }
+}
+
+void GpioMatrixPort::selectRow(uint8_t rowIdx)
+/*
+ * Writes to mux to select certain row that can then be read from using readCols()
+ *
+ * :param rowIdx: index of row to be read from
+ */
+{
+    bool out = (__atomic_load_n(&outBits, __ATOMIC_RELAXED) >> rowIdx) & 0x01;
+
+    if (!fastRowSelect)
+    {
+        digitalWrite(enablePin, LOW);
+        digitalWrite(rowPins[0], rowIdx & 0x01);
+        digitalWrite(rowPins[1], (rowIdx & 0x02) >> 1);
+        digitalWrite(rowPins[2], (rowIdx & 0x04) >> 2);
+        digitalWrite(outPin, out);
+        digitalWrite(enablePin, HIGH);
+        return;
+    }
+
+    // Disabling row select, writing address and output in one go, enabling row select
+    enablePort->BSRR = enableMask << 16;
+    rowPort->BSRR = rowBsrr[rowIdx & 0x07] | (out ? outMask : outMask << 16);
+    enablePort->BSRR = enableMask;
+}
+
+void GpioMatrixPort::settle()
+/*
+ * Busy-waits on the cycle counter for the settle time
+ */
+{
+    uint32_t start = DWT->CYCCNT;
+    while (DWT->CYCCNT - start < settleCycles)
+    {
+    }
+}
+
+uint8_t GpioMatrixPort::readCols()
+/*
+ * Reads from all columns and returns a single integer value of all bits, column 0 in the lowest bit
+ *
+ * :return: single integer value of columns
+ */
+{
+    if (!fastColRead)
+    {
+        return digitalRead(colPins[0]) | (digitalRead(colPins[1]) << 1) | (digitalRead(colPins[2]) << 2) | (digitalRead(colPins[3]) << 3);
+    }
+
+    uint32_t idr = colPort->IDR;
+    return ((idr >> colShift[0]) & 0x01) | (((idr >> colShift[1]) & 0x01) << 1) | (((idr >> colShift[2]) & 0x01) << 2) | (((idr >> colShift[3]) & 0x01) << 3);
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <cstdint>
+#include "keymatrix.h"
+
+#ifndef GPIO_MATRIX_PORT_H
+#define GPIO_MATRIX_PORT_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+class GpioMatrixPort : public MatrixPort
+/*
+ * Key matrix port driven directly through the GPIO registers
+ *
+ * The row address and output bit are written with a single BSRR store and all columns are sampled with a single IDR
+ * load, which needs the address pins and OUT_PIN to share a port and the column pins to share a port (true for the
+ * StackSynth board). Otherwise it falls back to digitalWrite() and digitalRead().
+ */
+{
+    int rowPins[3];
+    int enablePin;
+    int outPin;
+    int colPins[MATRIX_COLS];
+
+    // Registers and precomputed values for the fast path
+    bool fastRowSelect = false;
+    bool fastColRead = false;
+    GPIO_TypeDef *rowPort = nullptr;
+    GPIO_TypeDef *enablePort = nullptr;
+    GPIO_TypeDef *colPort = nullptr;
+    uint32_t enableMask = 0;
+    uint32_t outMask = 0;
+    uint32_t rowBsrr[8];
+    uint8_t colShift[MATRIX_COLS];
+
+    // Value latched onto the output of each row as it is selected
+    volatile uint8_t outBits = 0x7F;
+
+    uint32_t settleCycles;
+
+public:
+    GpioMatrixPort(int ra0, int ra1, int ra2, int ren, int out, int c0, int c1, int c2, int c3, uint32_t settleNs = 3000);
+    /*
+     * Initialiser for the GpioMatrixPort class
+     *
+     * :param ra0, ra1, ra2: row address pins
+     *
+     * :param ren: row enable pin
+     *
+     * :param out: matrix output pin, latched onto the selected row
+     *
+     * :param c0, c1, c2, c3: column input pins
+     *
+     * :param settleNs: time for the columns to settle after a row is selected
+     */
+
+    void begin();
+    /*
+     * Looks up the GPIO registers for the pins, must be called after the pins are configured
+     */
+
+    void setOutBit(uint8_t rowIdx, bool value);
+    /*
+     * Sets the value written to OUT_PIN whenever a row is selected
+     *
+     * :param rowIdx: index of the row
+     *
+     * :param value: output value
+     */
+
+    void selectRow(uint8_t rowIdx) override;
+    /*
+     * Writes to mux to select certain row that can then be read from using readCols()
+     *
+     * :param rowIdx: index of row to be read from
+     */
+
+    void settle() override;
+    /*
+     * Busy-waits on the cycle counter for the settle time
+     */
+
+    uint8_t readCols() override;
+    /*
+     * Reads from all columns and returns a single integer value of all bits, column 0 in the lowest bit
+     *
+     * :return: single integer value of columns
+     */
+};
+
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+#include "keymatrix.h"
+
+KeyMatrix::KeyMatrix(MatrixPort &matrixPort) : port(matrixPort)
+/*
+ * Initialiser for the KeyMatrix class
+ *
+ * :param matrixPort: port used to select rows and read the columns
+ */
+{
+}
+
+uint8_t KeyMatrix::readRow(uint8_t rowIdx)
+/*
+ * Selects a row, waits for it to settle and reads the columns
+ *
+ * :param rowIdx: index of row to be read from
+ *
+ * :return: the columns of the row, column 0 in the lowest bit
+ */
+{
+    port.selectRow(rowIdx);
+    port.settle();
+    return port.readCols();
+}
+
+uint32_t KeyMatrix::scan(uint8_t rows)
+/*
+ * Reads rows 0 to rows - 1 in a single pass
+ *
+ * :param rows: number of rows to scan
+ *
+ * :return: the packed matrix state, row r column c in bit (4 * r + c); unscanned rows read as 1 (not pressed)
+ */
+{
+    uint32_t state = 0xFFFFFFFF;
+    for (uint8_t i = 0; i < rows; i++)
+    {
+        uint8_t shift = i * MATRIX_COLS;
+        state &= ~(0xFu << shift);
+        state |= (uint32_t)readRow(i) << shift;
+    }
+    return state;
+}
@@ -0,0 +1,98 @@
+#include <cstdint>
+
+#ifndef KEYMATRIX_H
+#define KEYMATRIX_H
+
+// Size of the key matrix
+const uint8_t MATRIX_ROWS = 7;
+const uint8_t MATRIX_COLS = 4;
+
+class MatrixPort
+/*
+ * Interface to the row select mux and column inputs of the key matrix, implemented with GPIO registers on the board
+ * and stubbed in the tests
+ */
+{
+public:
+    virtual void selectRow(uint8_t rowIdx) = 0;
+    /*
+     * Writes to mux to select certain row that can then be read from using readCols()
+     *
+     * :param rowIdx: index of row to be read from
+     */
+
+    virtual void settle() = 0;
+    /*
+     * Waits for the columns to settle after a row has been selected
+     */
+
+    virtual uint8_t readCols() = 0;
+    /*
+     * Reads from all columns and returns a single integer value of all bits, column 0 in the lowest bit
+     *
+     * :return: single integer value of columns
+     */
+};
+
+class KeyMatrix
+{
+    MatrixPort &port;
+
+public:
+    KeyMatrix(MatrixPort &matrixPort);
+    /*
+     * Initialiser for the KeyMatrix class
+     *
+     * :param matrixPort: port used to select rows and read the columns
+     */
+
+    uint8_t readRow(uint8_t rowIdx);
+    /*
+     * Selects a row, waits for it to settle and reads the columns
+     *
+     * :param rowIdx: index of row to be read from
+     *
+     * :return: the columns of the row, column 0 in the lowest bit
+     */
+
+    uint32_t scan(uint8_t rows = MATRIX_ROWS);
+    /*
+     * Reads rows 0 to rows - 1 in a single pass
+     *
+     * :param rows: number of rows to scan
+     *
+     * :return: the packed matrix state, row r column c in bit (4 * r + c); unscanned rows read as 1 (not pressed)
+     */
+};
+
+inline uint8_t getMatrixRow(uint32_t state, uint8_t rowIdx)
+/*
+ * Extracts a row from a packed matrix state
+ *
+ * :param state: packed matrix state from KeyMatrix::scan()
+ *
+ * :param rowIdx: index of the row
+ *
+ * :return: the columns of the row, column 0 in the lowest bit
+ */
+{
+    return (state >> (rowIdx * MATRIX_COLS)) & 0xF;
+}
+
+inline uint8_t getMatrixBit(uint32_t state, uint8_t rowIdx, uint8_t colIdx)
+/*
+ * Extracts a single input from a packed matrix state
+ *
+ * :param state: packed matrix state from KeyMatrix::scan()
+ *
+ * :param rowIdx: index of the row
+ *
+ * :param colIdx: index of the column
+ *
+ * :return: the input, 0 if it is low (pressed or connected)
+ */
+{
+    return (state >> (rowIdx * MATRIX_COLS + colIdx)) & 0x01;
+}
+
+#endif
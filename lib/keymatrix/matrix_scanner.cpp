@@ -0,0 +1,138 @@
+#include "matrix_scanner.h"
+
+MatrixScanner::MatrixScanner(MatrixPort &matrixPort, uint32_t debounceMask) : port(matrixPort), debouncer(debounceMask)
+/*
+ * Initialiser for the MatrixScanner class
+ *
+ * :param matrixPort: port used to select rows and read the columns
+ *
+ * :param debounceMask: matrix bits to debounce, the rest are published as read
+ */
+{
+}
+
+void MatrixScanner::start()
+/*
+ * Selects the first row, must be called before the first tick
+ */
+{
+    row = 0;
+    building = 0xFFFFFFFF;
+    port.selectRow(0);
+}
+
+bool MatrixScanner::tick(uint32_t now)
+/*
+ * Reads the selected row and selects the next one, called from the scan timer interrupt
+ *
+ * :param now: current time, stored with the frame when it completes
+ *
+ * :return: true if a frame was completed and differs from the previous frame
+ */
+{
+    // The row has had a whole tick to settle
+    uint8_t shift = row * MATRIX_COLS;
+    building = (building & ~(0xFu << shift)) | ((uint32_t)port.readCols() << shift);
+
+    row++;
+    if (row == MATRIX_ROWS)
+    {
+        row = 0;
+    }
+    port.selectRow(row);
+
+    if (row != 0)
+    {
+        return false;
+    }
+
+    // Frame complete - debounce every input at once
+    uint32_t frame = debouncer.update(building);
+
+    // Write the back buffer, then publish it by bumping the sequence
+    uint32_t seq = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+    bool changed = frame != frames[seq & 1];
+    frames[(seq + 1) & 1] = frame;
+    timestamps[(seq + 1) & 1] = now;
+    __atomic_store_n(&sequence, seq + 1, __ATOMIC_RELEASE);
+    return changed;
+}
+
+uint32_t MatrixScanner::getFrame(uint32_t &timestamp)
+/*
+ * Gets a consistent copy of the latest completed frame
+ *
+ * :param timestamp: set to the time the frame was completed
+ *
+ * :return: the packed matrix state, row r column c in bit (4 * r + c)
+ */
+{
+    uint32_t seq;
+    uint32_t frame;
+    do
+    {
+        // Retry if the scanner published in the meantime, it may have been writing this buffer
+        seq = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+        frame = frames[seq & 1];
+        timestamp = timestamps[seq & 1];
+    } while (__atomic_load_n(&sequence, __ATOMIC_ACQUIRE) != seq);
+    return frame;
+}
+
+uint32_t MatrixScanner::getFrame()
+/*
+ * Gets a consistent copy of the latest completed frame
+ *
+ * :return: the packed matrix state, row r column c in bit (4 * r + c)
+ */
+{
+    uint32_t timestamp;
+    return getFrame(timestamp);
+}
+
+uint32_t MatrixScanner::getSequence()
+/*
+ * Atomically loads the number of completed frames
+ *
+ * :return: number of frames completed since start
+ */
+{
+    return __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+}
+
+uint8_t KeyEventDetector::update(uint32_t frame, uint32_t timestamp, KeyEvent events[], uint8_t maxEvents, uint32_t mask)
+/*
+ * Compares a frame with the previous one and records an event for every bit that changed
+ *
+ * :param frame: packed matrix state
+ *
+ * :param timestamp: time the frame was completed
+ *
+ * :param events: array to store the events in, in ascending key order
+ *
+ * :param maxEvents: size of the events array, further changes are left for the next update
+ *
+ * :param mask: matrix bits to generate events for
+ *
+ * :return: number of events stored
+ */
+{
+    uint32_t changes = (frame ^ previous) & mask;
+    uint8_t count = 0;
+
+    while (changes && count < maxEvents)
+    {
+        uint8_t key = __builtin_ctz(changes);
+        uint32_t bit = 1u << key;
+        changes &= ~bit;
+
+        events[count].timestamp = timestamp;
+        events[count].key = key;
+        events[count].pressed = !(frame & bit);
+        count++;
+
+        previous ^= bit;
+    }
+
+    return count;
+}
@@ -0,0 +1,107 @@
+#include <cstdint>
+#include "keymatrix.h"
+#include "debouncer.h"
+
+#ifndef MATRIX_SCANNER_H
+#define MATRIX_SCANNER_H
+
+struct KeyEvent
+{
+    uint32_t timestamp; // time the frame containing the change was completed
+    uint8_t key;        // matrix bit index, row * 4 + column
+    uint8_t pressed;    // 1 if the input went low (pressed), 0 if it went high (released)
+};
+
+class MatrixScanner
+/*
+ * Background key matrix scanner, stepped one row per timer tick
+ *
+ * Each tick reads the row selected on the previous tick and selects the next one, so the settle time is the tick period
+ * and nothing busy-waits. Completed frames are debounced and published in a double buffer with a sequence number.
+ */
+{
+    MatrixPort &port;
+    Debouncer debouncer;
+    uint8_t row = 0;
+    uint32_t building = 0xFFFFFFFF;
+
+    // Double buffer of completed frames, the latest is at index (sequence & 1)
+    volatile uint32_t frames[2] = {0xFFFFFFFF, 0xFFFFFFFF};
+    volatile uint32_t timestamps[2] = {0, 0};
+    volatile uint32_t sequence = 0;
+
+public:
+    MatrixScanner(MatrixPort &matrixPort, uint32_t debounceMask = 0);
+    /*
+     * Initialiser for the MatrixScanner class
+     *
+     * :param matrixPort: port used to select rows and read the columns
+     *
+     * :param debounceMask: matrix bits to debounce, the rest are published as read
+     */
+
+    void start();
+    /*
+     * Selects the first row, must be called before the first tick
+     */
+
+    bool tick(uint32_t now);
+    /*
+     * Reads the selected row and selects the next one, called from the scan timer interrupt
+     *
+     * :param now: current time, stored with the frame when it completes
+     *
+     * :return: true if a frame was completed and differs from the previous frame
+     */
+
+    uint32_t getFrame(uint32_t &timestamp);
+    /*
+     * Gets a consistent copy of the latest completed frame
+     *
+     * :param timestamp: set to the time the frame was completed
+     *
+     * :return: the packed matrix state, row r column c in bit (4 * r + c)
+     */
+
+    uint32_t getFrame();
+    /*
+     * Gets a consistent copy of the latest completed frame
+     *
+     * :return: the packed matrix state, row r column c in bit (4 * r + c)
+     */
+
+    uint32_t getSequence();
+    /*
+     * Atomically loads the number of completed frames
+     *
+     * :return: number of frames completed since start
+     */
+};
+
+class KeyEventDetector
+/*
+ * Converts successive matrix frames into timestamped key events
+ */
+{
+    uint32_t previous = 0xFFFFFFFF;
+
+public:
+    uint8_t update(uint32_t frame, uint32_t timestamp, KeyEvent events[], uint8_t maxEvents, uint32_t mask = 0x0FFFFFFF);
+    /*
+     * Compares a frame with the previous one and records an event for every bit that changed
+     *
+     * :param frame: packed matrix state
+     *
+     * :param timestamp: time the frame was completed
+     *
+     * :param events: array to store the events in, in ascending key order
+     *
+     * :param maxEvents: size of the events array, further changes are left for the next update
+     *
+     * :param mask: matrix bits to generate events for
+     *
+     * :return: number of events stored
+     */
+};
+
+#endif
@@ -1,13 +1,11 @@
 #include <iostream>
-#include <Arduino.h>
 #include <string>
-#include <STM32FreeRTOS.h>
-#include "main.h"
+#include "keymatrix.h"
 #include "knob.h"
 
 using namespace std;
 
-Knob::Knob(uint8_t id, int8_t minVal, int8_t maxVal)
+Knob::Knob(uint8_t id, int8_t minVal, int8_t maxVal, bool accel)
 /*
  * Intiliser for the knob class
  *
@@ -16,6 +14,8 @@ Knob::Knob(uint8_t id, int8_t minVal, int8_t maxVal)
  * :param minVal: minimum value the knob should be able to produce
  *
  * :param maxVal: maximum value the knob should be able to produce
+ *
+ * :param accel: whether fast turns move the value further than slow ones
  */
 {
     // Obtains correct row using id argument
@@ -30,39 +30,39 @@ Knob::Knob(uint8_t id, int8_t minVal, int8_t maxVal)
         buttonRow = 6;
     }
 
-    // Obtains pin address using id argument
+    // Obtains matrix column using id argument
     if ((id == 1) | (id == 3))
     {
-        aRotationAddr = C0_PIN;
-        bRotationAddr = C1_PIN;
-        buttonAddr = C1_PIN;
+        aRotationCol = 0;
+        bRotationCol = 1;
+        buttonCol = 1;
     }
     else
     {
-        aRotationAddr = C2_PIN;
-        bRotationAddr = C3_PIN;
-        buttonAddr = C0_PIN;
+        aRotationCol = 2;
+        bRotationCol = 3;
+        buttonCol = 0;
     }
 
     // assigns lower and upper limit
     lowerLimit = minVal * 2;
     upperLimit = maxVal * 2;
+    accelerate = accel;
 }
 
-void Knob::updateRotationValue()
+void Knob::updateRotation(uint8_t row, uint32_t now)
 /*
- * Obtains readings from knob and updates global knob rotation variable
+ * Decodes a reading of the knob's matrix row and updates global knob rotation variable
+ * Safe to call from the scan interrupt, as long as only one context calls it
+ *
+ * :param row: columns of the knob's rotation row, column 0 in the lowest bit
+ *
+ * :param now: time of the reading in microseconds
  */
 {
-    // Writing to mux to select certain row
-    setRow(rotationRow);
-
-    // Delay to give time for row to be set
-    delayMicroseconds(3);
-
-    // Reading correct pins for a given knob
-    uint8_t bit0 = digitalRead(aRotationAddr);
-    uint8_t bit1 = digitalRead(bRotationAddr);
+    // Reading correct columns for a given knob
+    uint8_t bit0 = (row >> aRotationCol) & 0x01;
+    uint8_t bit1 = (row >> bRotationCol) & 0x01;
 
     // Calculating change caused by knob read
     knobChange = calculateAndAssignval(prevBit0, prevBit1, bit0, bit1, knobChange);
@@ -71,43 +71,76 @@ void Knob::updateRotationValue()
     prevBit0 = bit0;
     prevBit1 = bit1;
 
+    if (knobChange == 0)
+    {
+        return;
+    }
+
     // Atomically loading global knobRotation to local variable
     int8_t localKnobRotation;
     localKnobRotation = __atomic_load_n(&knobRotation, __ATOMIC_RELAXED);
 
-    // Updating localKnobRotation
-    localKnobRotation += knobChange;
-    if (localKnobRotation > upperLimit)
+    // Updating localKnobRotation, in 16 bits as acceleration can overshoot int8_t
+    int16_t rotation = localKnobRotation + applyAcceleration(knobChange, now);
+    if (rotation > upperLimit)
     {
-        localKnobRotation = upperLimit;
+        rotation = upperLimit;
     }
-    if (localKnobRotation < lowerLimit)
+    if (rotation < lowerLimit)
     {
-        localKnobRotation = lowerLimit;
+        rotation = lowerLimit;
     }
+    localKnobRotation = rotation;
 
     // Atomically storing to global knobRotation
     __atomic_store_n(&knobRotation, localKnobRotation, __ATOMIC_RELAXED);
 }
 
-void Knob::updateButtonValue()
+void Knob::updateButton(uint8_t row)
 /*
- * Obtains readings from knob button and updates global knob button variable
+ * Decodes a reading of the knob's button row and updates global knob button variable
+ *
+ * :param row: columns of the knob's button row, column 0 in the lowest bit
  */
 {
-    // Writing to mux to select certain row
-    setRow(buttonRow);
+    // Reading correct column for a given knob
+    uint8_t bit = (row >> buttonCol) & 0x01;
 
-    // Delay to give time for row to be set
-    delayMicroseconds(3);
+    // Atomically storing to global knobButton
+    __atomic_store_n(&knobButton, bit, __ATOMIC_RELAXED);
+}
 
-    // Reading correct pins for a given knob
-    uint8_t bit = digitalRead(buttonAddr);
+void Knob::updateRotationValue(uint32_t frame, uint32_t now)
+/*
+ * Obtains readings from a matrix frame and updates global knob rotation variable
+ *
+ * :param frame: packed matrix state from the scanner
+ *
+ * :param now: time the frame was completed in microseconds
+ */
+{
+    updateRotation(getMatrixRow(frame, rotationRow), now);
+}
 
-    // Atomically storing to global knobRotation
-    __atomic_store_n(&knobButton, bit, __ATOMIC_RELAXED);
+void Knob::updateButtonValue(uint32_t frame)
+/*
+ * Obtains readings from a matrix frame and updates global knob button variable
+ *
+ * :param frame: packed matrix state from the scanner
+ */
+{
+    updateButton(getMatrixRow(frame, buttonRow));
 }
 
+// Change for each transition, indexed by (previous state << 2) | state, where state = bit0 | (bit1 << 1)
+// Transitions where both bits change are impossible in one step and are marked with knobMissedStep
+static const int8_t knobMissedStep = 2;
+static const int8_t knobTransitions[16] = {
+    0, +1, -1, knobMissedStep,
+    -1, 0, knobMissedStep, +1,
+    +1, knobMissedStep, 0, -1,
+    knobMissedStep, -1, +1, 0};
+
 int8_t Knob::calculateAndAssignval(uint8_t prevBit0, uint8_t prevBit1, uint8_t bit0, uint8_t bit1, int8_t prevStep)
 /*
  * Calculates change caused by knob read
@@ -120,62 +153,66 @@ int8_t Knob::calculateAndAssignval(uint8_t prevBit0, uint8_t prevBit1, uint8_t b
  *
  * :param bit1: the current value of the 1st bit
  *
+ * :param prevStep: the previous change, used to recover a missed step when both bits change at once
+ *
  * :return: the change caused by the change in bits
  */
 {
-    if (prevBit0 == bit0 & prevBit1 == bit1)
+    // Direction of the last movement
+    int8_t direction = (prevStep > 0) - (prevStep < 0);
+
+    // Invalid readings: ignore a bad current reading, treat a bad previous reading as a missed step
+    if ((bit0 > 1) | (bit1 > 1))
     {
         return 0;
     }
-    else if ((prevBit0 == 0) & (prevBit1 == 0))
+    if ((prevBit0 > 1) | (prevBit1 > 1))
     {
-        if ((bit0 == 0) & (bit1 == 1))
-        {
-            return -1;
-        }
-        else if ((bit0 == 1) & (bit1 == 0))
-        {
-            return +1;
-        }
+        return direction * 2;
     }
-    else if ((prevBit0 == 0) & (prevBit1 == 1))
+
+    int8_t step = knobTransitions[(prevBit0 << 2) | (prevBit1 << 3) | bit0 | (bit1 << 1)];
+
+    // Both bits changed, so a transition was missed - assume the knob kept turning the same way
+    if (step == knobMissedStep)
     {
-        if ((bit0 == 0) & (bit1 == 0))
-        {
-            return +1;
-        }
-        else if ((bit0 == 1) & (bit1 == 1))
-        {
-            return -1;
-        }
+        return direction * 2;
     }
-    else if ((prevBit0 == 1) & (prevBit1 == 0))
+    return step;
+}
+
+int8_t Knob::applyAcceleration(int8_t step, uint32_t now)
+/*
+ * Scales a change by how quickly the knob is being turned
+ *
+ * :param step: the change from calculateAndAssignval
+ *
+ * :param now: time of the reading in microseconds
+ *
+ * :return: the accelerated change
+ */
+{
+    int8_t direction = (step > 0) - (step < 0);
+    uint32_t interval = now - lastStepTime;
+    bool sameDirection = direction == lastDirection;
+
+    lastDirection = direction;
+    lastStepTime = now;
+
+    // Reversing always starts slow, so fine adjustment is never overshot
+    if (!accelerate || !sameDirection)
     {
-        if ((bit0 == 0) & (bit1 == 0))
-        {
-            return -1;
-        }
-        else if ((bit0 == 1) & (bit1 == 1))
-        {
-            return +1;
-        }
+        return step;
     }
-    else if ((prevBit0 == 1) & (prevBit1 == 1))
+    if (interval < knobFastInterval)
     {
-        if ((bit0 == 0) & (bit1 == 1))
-        {
-            return +1;
-        }
-        else if ((bit0 == 1) & (bit1 == 0))
-        {
-            return -1;
-        }
+        return step * 4;
     }
-    else
+    if (interval < knobMediumInterval)
     {
-        return prevStep * 2;
+        return step * 2;
     }
-    return 0;
+    return step;
 }
 
 int Knob::getRotation()
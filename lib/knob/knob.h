@@ -1,8 +1,13 @@
 #include <iostream>
+#include <cstdint>
 
 #ifndef KNOB_H
 #define KNOB_H
 
+// Knob acceleration: transitions closer together than these intervals (in us) in the same direction count 4x or 2x
+const uint32_t knobFastInterval = 4000;
+const uint32_t knobMediumInterval = 10000;
+
 class Knob
 {
 
@@ -16,14 +21,20 @@ public:
     uint8_t prevBit1 = 0;
     int8_t knobChange = 0;
 
-    int aRotationAddr;
-    int bRotationAddr;
+    // acceleration state
+    bool accelerate;
+    int8_t lastDirection = 0;
+    uint32_t lastStepTime = 0;
+
+    // key matrix columns of the rotation and button inputs
+    uint8_t aRotationCol;
+    uint8_t bRotationCol;
 
-    int buttonAddr;
+    uint8_t buttonCol;
     volatile int8_t knobRotation = 0;
     volatile int8_t knobButton = 0;
 
-    Knob(uint8_t id, int8_t minVal = 0, int8_t maxVal = 16);
+    Knob(uint8_t id, int8_t minVal = 0, int8_t maxVal = 16, bool accel = true);
     /*
      * Intiliser for the knob class
      *
@@ -32,6 +43,8 @@ public:
      * :param minVal: minimum value the knob should be able to produce
      *
      * :param maxVal: maximum value the knob should be able to produce
+     *
+     * :param accel: whether fast turns move the value further than slow ones
      */
 
     int8_t calculateAndAssignval(uint8_t prevBit0, uint8_t prevBit1, uint8_t bit0, uint8_t bit1, int8_t prevStep);
@@ -46,12 +59,46 @@ public:
      *
      * :param bit1: the current value of the 1st bit
      *
+     * :param prevStep: the previous change, used to recover a missed step when both bits change at once
+     *
      * :return: the change caused by the change in bits
      */
 
-    void updateRotationValue();
+    int8_t applyAcceleration(int8_t step, uint32_t now);
+    /*
+     * Scales a change by how quickly the knob is being turned
+     *
+     * :param step: the change from calculateAndAssignval
+     *
+     * :param now: time of the reading in microseconds
+     *
+     * :return: the accelerated change
+     */
+
+    void updateRotation(uint8_t row, uint32_t now);
+    /*
+     * Decodes a reading of the knob's matrix row and updates global knob rotation variable
+     * Safe to call from the scan interrupt, as long as only one context calls it
+     *
+     * :param row: columns of the knob's rotation row, column 0 in the lowest bit
+     *
+     * :param now: time of the reading in microseconds
+     */
+
+    void updateButton(uint8_t row);
     /*
-     * Obtains readings from knob and updates global knob rotation variable
+     * Decodes a reading of the knob's button row and updates global knob button variable
+     *
+     * :param row: columns of the knob's button row, column 0 in the lowest bit
+     */
+
+    void updateRotationValue(uint32_t frame, uint32_t now);
+    /*
+     * Obtains readings from a matrix frame and updates global knob rotation variable
+     *
+     * :param frame: packed matrix state from the scanner
+     *
+     * :param now: time the frame was completed in microseconds
      */
 
     int getRotation();
@@ -66,9 +113,11 @@ public:
      * Atomically stores the global knobRotation to prevent synchronisation errors
      */
 
-    void updateButtonValue();
+    void updateButtonValue(uint32_t frame);
     /*
-     * Obtains readings from knob button and updates global knob button variable
+     * Obtains readings from a matrix frame and updates global knob button variable
+     *
+     * :param frame: packed matrix state from the scanner
      */
 
     int getButton();
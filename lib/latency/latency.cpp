@@ -0,0 +1,308 @@
+#include <cstdio>
+#include "latency.h"
+
+const char *const latencyStageNames[LATENCY_STAGES] = {"scan", "tx ring", "tx mailbox", "transmit", "receive",
+                                                       "note ring", "total"};
+
+void LatencyHistogram::record(uint32_t us)
+/*
+ * Adds a latency
+ *
+ * :param us: the latency in microseconds
+ */
+{
+    uint8_t bucket = us < 2 ? 0 : 31 - __builtin_clz(us);
+    if (bucket >= LATENCY_BUCKETS)
+    {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    __atomic_store_n(&counts[bucket], counts[bucket] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&count, count + 1, __ATOMIC_RELAXED);
+    if (us > max)
+    {
+        __atomic_store_n(&max, us, __ATOMIC_RELAXED);
+    }
+    sum += us;
+}
+
+uint32_t LatencyHistogram::getCount()
+/*
+ * :return: number of latencies recorded
+ */
+{
+    return __atomic_load_n(&count, __ATOMIC_RELAXED);
+}
+
+uint32_t LatencyHistogram::getMean()
+/*
+ * :return: mean latency in microseconds, 0 if none have been recorded
+ */
+{
+    uint32_t localCount = getCount();
+    return localCount ? (uint32_t)(sum / localCount) : 0;
+}
+
+uint32_t LatencyHistogram::getMax()
+/*
+ * :return: longest latency in microseconds
+ */
+{
+    return __atomic_load_n(&max, __ATOMIC_RELAXED);
+}
+
+uint32_t LatencyHistogram::getBucket(uint8_t bucket)
+/*
+ * :param bucket: bucket index, bucket n holds latencies of 2^n to 2^(n+1)-1 microseconds (bucket 0 also holds 0)
+ *
+ * :return: number of latencies in the bucket
+ */
+{
+    return bucket < LATENCY_BUCKETS ? __atomic_load_n(&counts[bucket], __ATOMIC_RELAXED) : 0;
+}
+
+uint32_t LatencyHistogram::getPercentile(uint8_t percent)
+/*
+ * :param percent: percentage of the latencies (1-100)
+ *
+ * :return: upper bound in microseconds of the bucket holding that percentile (at most the maximum), 0 if none have
+ * been recorded
+ */
+{
+    uint32_t localCount = getCount();
+    if (!localCount)
+    {
+        return 0;
+    }
+    uint64_t target = ((uint64_t)localCount * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++)
+    {
+        seen += getBucket(bucket);
+        if (seen >= target)
+        {
+            uint32_t bound = (2u << bucket) - 1;
+            return bound < getMax() ? bound : getMax();
+        }
+    }
+    return getMax();
+}
+
+uint32_t LatencyHistogram::format(char *buffer, uint32_t size, const char *name)
+/*
+ * Writes a one line summary, for printing over Serial
+ *
+ * :param buffer: buffer for the line, always terminated
+ *
+ * :param size: size of the buffer
+ *
+ * :param name: name of the histogram at the start of the line
+ *
+ * :return: length of the line
+ */
+{
+    int length = snprintf(buffer, size, "%-10s n=%u mean=%uus p50<=%uus p99<=%uus max=%uus", name, (unsigned)getCount(),
+                          (unsigned)getMean(), (unsigned)getPercentile(50), (unsigned)getPercentile(99),
+                          (unsigned)getMax());
+    if (length < 0)
+    {
+        buffer[0] = 0;
+        return 0;
+    }
+    return (uint32_t)length < size ? length : size - 1;
+}
+
+void LatencyHistogram::reset()
+/*
+ * Clears every count
+ */
+{
+    for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    {
+        __atomic_store_n(&counts[bucket], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&max, 0, __ATOMIC_RELAXED);
+    sum = 0;
+}
+
+void ClockOffset::update(uint16_t remote, uint16_t local)
+/*
+ * Adds a sample
+ *
+ * :param remote: time a message was sent, by the remote clock
+ *
+ * :param local: time the message was received, by the local clock
+ */
+{
+    uint16_t sample = local - remote;
+    if (samples == 0 || (int16_t)(sample - current) < 0)
+    {
+        current = sample;
+    }
+    if (++samples == CLOCK_OFFSET_WINDOW)
+    {
+        previous = current;
+        samples = 0;
+        if (windows < 2)
+        {
+            windows++;
+        }
+    }
+}
+
+bool ClockOffset::isValid()
+/*
+ * :return: true once there has been a sample
+ */
+{
+    return samples || windows;
+}
+
+uint16_t ClockOffset::get()
+/*
+ * :return: the offset to add to a remote time to get the local time
+ */
+{
+    // Until the current window has a sample it still holds the last window's minimum
+    if (!windows)
+    {
+        return current;
+    }
+    return (int16_t)(current - previous) < 0 ? current : previous;
+}
+
+ClockOffset &LatencyTracer::getOffset(uint8_t module)
+/*
+ * :param module: module ID of a transmitter
+ *
+ * :return: the clock offset of the transmitter, replacing the oldest if it is new and the table is full
+ */
+{
+    uint8_t i = 0;
+    while (i < moduleCount && modules[i] != module)
+    {
+        i++;
+    }
+    if (i == moduleCount)
+    {
+        if (moduleCount < LATENCY_MODULES)
+        {
+            moduleCount++;
+        }
+        else
+        {
+            i = replace;
+            replace = (replace + 1) % LATENCY_MODULES;
+        }
+        modules[i] = module;
+        offsets[i] = ClockOffset();
+    }
+    return offsets[i];
+}
+
+void LatencyTracer::sent(uint32_t scanned, uint32_t queued, uint32_t loaded, uint32_t sentAt)
+/*
+ * Records the stages of a traced frame on the transmitter, from the transmit interrupt
+ *
+ * :param scanned: time the keys were scanned
+ *
+ * :param queued: time the message was queued
+ *
+ * :param loaded: time the frame was loaded into a mailbox
+ *
+ * :param sentAt: time the frame was sent
+ */
+{
+    stages[STAGE_SCAN].record(queued - scanned);
+    stages[STAGE_TX_RING].record(loaded - queued);
+    stages[STAGE_TX_MAILBOX].record(sentAt - loaded);
+}
+
+void LatencyTracer::received(uint8_t module, uint32_t now, bool notes)
+/*
+ * A traced key events frame has arrived, from the receive interrupt
+ *
+ * :param module: module ID of the sender
+ *
+ * :param now: current time in microseconds, also the timestamp of the notes queued for it
+ *
+ * :param notes: true if notes were queued for it, false if it changed nothing
+ */
+{
+    pendingModule = module;
+    pendingReceived = now;
+    pendingNotes = notes;
+    pending = 1;
+
+    // The sample interrupt stops looking before the timestamp changes, and only starts again once it has
+    __atomic_store_n(&awaitingPlay, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&playedValid, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&playTimestamp, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&awaitingPlay, notes ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+void LatencyTracer::notePlayed(uint32_t timestamp, uint32_t now)
+/*
+ * Notes queued at a time have been played, from the sample interrupt
+ *
+ * :param timestamp: the timestamp the notes were queued with
+ *
+ * :param now: current time in microseconds
+ */
+{
+    if (__atomic_load_n(&awaitingPlay, __ATOMIC_ACQUIRE) && timestamp == __atomic_load_n(&playTimestamp, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&played, now, __ATOMIC_RELAXED);
+        __atomic_store_n(&playedValid, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&awaitingPlay, 0, __ATOMIC_RELAXED);
+    }
+}
+
+void LatencyTracer::traced(uint8_t module, uint16_t sentAt, uint16_t age)
+/*
+ * The trace message of a traced frame has arrived, from the receive interrupt
+ *
+ * :param module: module ID of the sender
+ *
+ * :param sentAt: time the frame was sent, low 16 bits of the sender's clock
+ *
+ * :param age: time from the key scan to the frame being sent
+ */
+{
+    if (!pending || pendingModule != module)
+    {
+        // The traced frame was lost, or replaced by another module's
+        return;
+    }
+    pending = 0;
+
+    // The send time is stamped when the transmitter sees its mailbox empty, and the frame is received at the same
+    // moment, so the shortest delay seen is close to zero and anything above it is interrupt latency
+    ClockOffset &offset = getOffset(module);
+    offset.update(sentAt, (uint16_t)pendingReceived);
+    uint16_t receive = (uint16_t)pendingReceived - (uint16_t)(sentAt + offset.get());
+    stages[STAGE_TRANSMIT].record(age);
+    stages[STAGE_RECEIVE].record(receive);
+
+    // Notes usually play within a sample, long before the trace message arrives
+    if (pendingNotes && __atomic_load_n(&playedValid, __ATOMIC_ACQUIRE))
+    {
+        uint32_t noteRing = __atomic_load_n(&played, __ATOMIC_RELAXED) - pendingReceived;
+        if ((int32_t)noteRing >= 0)
+        {
+            stages[STAGE_NOTE_RING].record(noteRing);
+            stages[STAGE_TOTAL].record(age + receive + noteRing);
+        }
+    }
+    __atomic_store_n(&awaitingPlay, 0, __ATOMIC_RELAXED);
+}
+
+LatencyHistogram &LatencyTracer::getStage(uint8_t stage)
+/*
+ * :param stage: a LatencyStage
+ *
+ * :return: the histogram of the stage
+ */
+{
+    return stages[stage < LATENCY_STAGES ? stage : (uint8_t)STAGE_TOTAL];
+}
@@ -0,0 +1,225 @@
+#include <cstdint>
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/*
+ * Tracing of the time from a key being scanned on a transmitter to its note being played by the receiver
+ *
+ * The transmitter times one key events message at a time through its transmit ring and mailboxes, then sends a trace
+ * message with the time it was sent and how long it took since the scan. The receiver times the frame from its
+ * arrival to the first sample playing its notes, and converts the transmitter's send time into its own clock with an
+ * estimate of the offset between the clocks. Each stage is collected in a histogram, every call is short enough for
+ * an interrupt.
+ */
+
+const uint8_t LATENCY_BUCKETS = 16;     // Powers of 2 microseconds, the last also counts anything longer
+const uint8_t LATENCY_MODULES = 8;      // Transmitters with a clock offset at once, the oldest is replaced
+const uint8_t CLOCK_OFFSET_WINDOW = 16; // Samples in each window of the clock offset minimum
+
+const uint32_t latencyTraceInterval = 20; // Minimum ms between the traced key events messages of a transmitter
+
+enum LatencyStage : uint8_t
+{
+    STAGE_SCAN,       // Key scan to the message being queued, on the transmitter
+    STAGE_TX_RING,    // Queued to being loaded into a mailbox, on the transmitter
+    STAGE_TX_MAILBOX, // Loaded to sent, arbitration and the frame on the bus, on the transmitter
+    STAGE_TRANSMIT,   // Key scan to sent, from the trace message, on the receiver
+    STAGE_RECEIVE,    // Sent to received, beyond the shortest seen, on the receiver
+    STAGE_NOTE_RING,  // Received to the first sample playing the notes, on the receiver
+    STAGE_TOTAL,      // Key scan on the transmitter to the first sample on the receiver
+    LATENCY_STAGES
+};
+
+extern const char *const latencyStageNames[LATENCY_STAGES];
+
+class LatencyHistogram
+/*
+ * Counts of latencies in power of 2 buckets, with their mean and maximum
+ * Recorded from one context at a time, read from any (a read racing a record may be off by one sample)
+ */
+{
+    uint32_t counts[LATENCY_BUCKETS] = {0};
+    uint32_t count = 0;
+    uint32_t max = 0;
+    uint64_t sum = 0;
+
+public:
+    void record(uint32_t us);
+    /*
+     * Adds a latency
+     *
+     * :param us: the latency in microseconds
+     */
+
+    uint32_t getCount();
+    /*
+     * :return: number of latencies recorded
+     */
+
+    uint32_t getMean();
+    /*
+     * :return: mean latency in microseconds, 0 if none have been recorded
+     */
+
+    uint32_t getMax();
+    /*
+     * :return: longest latency in microseconds
+     */
+
+    uint32_t getBucket(uint8_t bucket);
+    /*
+     * :param bucket: bucket index, bucket n holds latencies of 2^n to 2^(n+1)-1 microseconds (bucket 0 also holds 0)
+     *
+     * :return: number of latencies in the bucket
+     */
+
+    uint32_t getPercentile(uint8_t percent);
+    /*
+     * :param percent: percentage of the latencies (1-100)
+     *
+     * :return: upper bound in microseconds of the bucket holding that percentile (at most the maximum), 0 if none have
+     * been recorded
+     */
+
+    uint32_t format(char *buffer, uint32_t size, const char *name);
+    /*
+     * Writes a one line summary, for printing over Serial
+     *
+     * :param buffer: buffer for the line, always terminated
+     *
+     * :param size: size of the buffer
+     *
+     * :param name: name of the histogram at the start of the line
+     *
+     * :return: length of the line
+     */
+
+    void reset();
+    /*
+     * Clears every count
+     */
+};
+
+class ClockOffset
+/*
+ * Estimate of the offset between another module's clock and the local one, from the smallest delay seen
+ * Delays only ever add to (local receive time - remote send time), so its minimum is the offset plus the shortest
+ * path. The minimum is taken over the last two windows of samples, so the estimate follows the clocks drifting apart.
+ * Timestamps are the low 16 bits of microseconds as sent in trace messages, so delays must be under 32ms.
+ */
+{
+    uint16_t current = 0;
+    uint16_t previous = 0;
+    uint8_t samples = 0;
+    uint8_t windows = 0;
+
+public:
+    void update(uint16_t remote, uint16_t local);
+    /*
+     * Adds a sample
+     *
+     * :param remote: time a message was sent, by the remote clock
+     *
+     * :param local: time the message was received, by the local clock
+     */
+
+    bool isValid();
+    /*
+     * :return: true once there has been a sample
+     */
+
+    uint16_t get();
+    /*
+     * :return: the offset to add to a remote time to get the local time
+     */
+};
+
+class LatencyTracer
+/*
+ * Collects the latency histograms of every stage, on the transmitter and the receiver
+ * Only one traced frame is followed at a time on the receiver, one arriving while another waits for its trace
+ * message replaces it.
+ */
+{
+    LatencyHistogram stages[LATENCY_STAGES];
+
+    // Clock offset of each transmitter, updated in the receive interrupt
+    uint8_t modules[LATENCY_MODULES] = {0};
+    ClockOffset offsets[LATENCY_MODULES];
+    uint8_t moduleCount = 0;
+    uint8_t replace = 0;
+
+    // Traced frame waiting for its trace message
+    uint8_t pendingModule = 0;
+    uint8_t pending = 0;
+    uint8_t pendingNotes = 0;
+    uint32_t pendingReceived = 0;
+
+    // Handed between the receive and sample interrupts
+    uint32_t awaitingPlay = 0; // 1 while the sample interrupt should look for playTimestamp
+    uint32_t playTimestamp = 0;
+    uint32_t played = 0;
+    uint32_t playedValid = 0;
+
+    ClockOffset &getOffset(uint8_t module);
+    /*
+     * :param module: module ID of a transmitter
+     *
+     * :return: the clock offset of the transmitter, replacing the oldest if it is new and the table is full
+     */
+
+public:
+    void sent(uint32_t scanned, uint32_t queued, uint32_t loaded, uint32_t sentAt);
+    /*
+     * Records the stages of a traced frame on the transmitter, from the transmit interrupt
+     *
+     * :param scanned: time the keys were scanned
+     *
+     * :param queued: time the message was queued
+     *
+     * :param loaded: time the frame was loaded into a mailbox
+     *
+     * :param sentAt: time the frame was sent
+     */
+
+    void received(uint8_t module, uint32_t now, bool notes);
+    /*
+     * A traced key events frame has arrived, from the receive interrupt
+     *
+     * :param module: module ID of the sender
+     *
+     * :param now: current time in microseconds, also the timestamp of the notes queued for it
+     *
+     * :param notes: true if notes were queued for it, false if it changed nothing
+     */
+
+    void notePlayed(uint32_t timestamp, uint32_t now);
+    /*
+     * Notes queued at a time have been played, from the sample interrupt
+     *
+     * :param timestamp: the timestamp the notes were queued with
+     *
+     * :param now: current time in microseconds
+     */
+
+    void traced(uint8_t module, uint16_t sentAt, uint16_t age);
+    /*
+     * The trace message of a traced frame has arrived, from the receive interrupt
+     *
+     * :param module: module ID of the sender
+     *
+     * :param sentAt: time the frame was sent, low 16 bits of the sender's clock
+     *
+     * :param age: time from the key scan to the frame being sent
+     */
+
+    LatencyHistogram &getStage(uint8_t stage);
+    /*
+     * :param stage: a LatencyStage
+     *
+     * :return: the histogram of the stage
+     */
+};
+
+#endif
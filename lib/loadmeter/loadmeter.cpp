@@ -0,0 +1,159 @@
+#include "loadmeter.h"
+
+static_assert(loadIdleGap > 0, "loadIdleGap must count some gaps as idle");
+
+void LoadMeter::begin(uint32_t period)
+/*
+ * Sets the sample period, before the sample interrupt starts
+ *
+ * :param period: cycles between samples
+ */
+{
+    samplePeriod = period;
+}
+
+void LoadMeter::sampled(uint32_t start, uint32_t end, uint8_t voices)
+/*
+ * Records a sample, from the end of the sample interrupt
+ *
+ * :param start: cycle counter at the start of the interrupt
+ *
+ * :param end: cycle counter at the end of the interrupt
+ *
+ * :param voices: voices mixed into the sample
+ */
+{
+    // Each late period is a sample the timer fired for while the previous interrupt was still pending
+    uint32_t gap = start - lastStart;
+    if (samples && gap > samplePeriod + samplePeriod / 2)
+    {
+        __atomic_store_n(&overruns, overruns + (gap + samplePeriod / 2) / samplePeriod - 1, __ATOMIC_RELAXED);
+    }
+    lastStart = start;
+
+    __atomic_store_n(&audio, audio + (end - start), __ATOMIC_RELAXED);
+    __atomic_store_n(&samples, samples + 1, __ATOMIC_RELAXED);
+    // A compare and swap, so a peak raised while read() resets it isn't lost or written over the reset
+    uint8_t peak = __atomic_load_n(&peakVoices, __ATOMIC_RELAXED);
+    while (voices > peak &&
+           !__atomic_compare_exchange_n(&peakVoices, &peak, voices, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void LoadMeter::idled(uint32_t now)
+/*
+ * Records a pass of the idle task, from the idle hook
+ *
+ * :param now: cycle counter
+ */
+{
+    // A longer gap had something else running in it, which is not idle time
+    uint32_t gap = now - lastIdle;
+    lastIdle = now;
+    if (gap <= loadIdleGap)
+    {
+        __atomic_store_n(&idle, idle + gap, __ATOMIC_RELAXED);
+    }
+}
+
+LoadTotals LoadMeter::read(uint32_t now)
+/*
+ * Reads the running totals, and starts a new peak of the voices
+ *
+ * :param now: cycle counter
+ *
+ * :return: the totals
+ */
+{
+    LoadTotals totals;
+    totals.cycles = now;
+    totals.audio = __atomic_load_n(&audio, __ATOMIC_RELAXED);
+    totals.idle = __atomic_load_n(&idle, __ATOMIC_RELAXED);
+    totals.samples = __atomic_load_n(&samples, __ATOMIC_RELAXED);
+    totals.overruns = __atomic_load_n(&overruns, __ATOMIC_RELAXED);
+
+    // Reset in one atomic exchange, so a peak the sample interrupt raises goes into this read or the next
+    totals.peakVoices = __atomic_exchange_n(&peakVoices, 0, __ATOMIC_RELAXED);
+    return totals;
+}
+
+static uint16_t share(uint32_t part, uint32_t whole)
+/*
+ * :param part: cycles of the part
+ *
+ * :param whole: cycles of the whole
+ *
+ * :return: the part in LOAD_SCALE of the whole, at most LOAD_SCALE
+ */
+{
+    if (!whole)
+    {
+        return 0;
+    }
+    uint64_t scaled = (uint64_t)part * LOAD_SCALE / whole;
+    return scaled > LOAD_SCALE ? LOAD_SCALE : scaled;
+}
+
+static uint16_t saturate(uint32_t count)
+/*
+ * :param count: a count
+ *
+ * :return: the count, at most the largest 16 bit number
+ */
+{
+    return count > UINT16_MAX ? UINT16_MAX : count;
+}
+
+LoadReport loadReport(const LoadTotals &from, const LoadTotals &to)
+/*
+ * Load between two reads of the meter
+ *
+ * :param from: the earlier totals
+ *
+ * :param to: the later totals
+ *
+ * :return: the load, with the peak of the voices of the later read
+ */
+{
+    uint32_t elapsed = to.cycles - from.cycles;
+    LoadReport report;
+    report.audio = share(to.audio - from.audio, elapsed);
+    report.idle = share(to.idle - from.idle, elapsed);
+    report.samples = saturate(to.samples - from.samples);
+    report.overruns = saturate(to.overruns - from.overruns);
+    report.peakVoices = to.peakVoices;
+    return report;
+}
+
+void encodeTelemetry(const LoadReport &report, uint8_t sequence, uint8_t frame[TELEMETRY_FRAME_SIZE])
+/*
+ * Packs a report into a telemetry frame for Serial, decoded on the host by tools/telemetry.py
+ * TELEMETRY_SYNC and its inverse, the sequence number, the audio and idle loads, the samples and overruns (each 16 bit
+ * little endian), the peak voices, then the sum of the bytes after the sync bytes.
+ *
+ * :param report: the report
+ *
+ * :param sequence: counts up with every frame, so the decoder can tell when a frame was lost
+ *
+ * :param frame: set to the frame
+ */
+{
+    const uint16_t fields[] = {report.audio, report.idle, report.samples, report.overruns};
+    frame[0] = TELEMETRY_SYNC;
+    frame[1] = (uint8_t)~TELEMETRY_SYNC;
+    frame[2] = sequence;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        frame[3 + 2 * i] = fields[i] & 0xFF;
+        frame[4 + 2 * i] = fields[i] >> 8;
+    }
+    frame[11] = report.peakVoices;
+
+    uint8_t sum = 0;
+    for (uint8_t i = 2; i < TELEMETRY_FRAME_SIZE - 1; i++)
+    {
+        sum += frame[i];
+    }
+    frame[TELEMETRY_FRAME_SIZE - 1] = sum;
+}
@@ -0,0 +1,127 @@
+#include <cstdint>
+
+#ifndef LOADMETER_H
+#define LOADMETER_H
+
+/*
+ * Meter of how close the audio path is to running out of time, from cycle counter stamps
+ *
+ * The sample interrupt stamps its start and end: the cycles between them are the audio load, and a start more than
+ * one and a half sample periods after the previous one means samples were never delivered (the timer's interrupt was
+ * still pending when the next one was due, so the two became one). The idle hook stamps every pass of the idle task:
+ * the gaps between passes are idle time, unless they are long enough that a task or interrupt ran in between. Each
+ * writer keeps its own running totals, so the meter never masks an interrupt, and the display task turns the
+ * difference of two reads into the report of the second between them.
+ */
+
+const uint32_t loadIdleGap = 256;   // Most cycles between passes of the idle task still counted as idle
+const uint16_t LOAD_SCALE = 1000;   // Loads are in tenths of a percent
+const uint8_t TELEMETRY_SYNC = 0xA5; // First byte of a telemetry frame, followed by its inverse
+const uint8_t TELEMETRY_FRAME_SIZE = 13;
+
+struct LoadTotals
+/*
+ * Running totals of the meter at one time, all wrapping
+ */
+{
+    uint32_t cycles;     // Cycle counter when they were read
+    uint32_t audio;      // Cycles spent in the sample interrupt
+    uint32_t idle;       // Cycles spent in the idle task
+    uint32_t samples;    // Samples delivered
+    uint32_t overruns;   // Samples never delivered
+    uint8_t peakVoices;  // Most voices mixed into one sample since the previous read
+};
+
+struct LoadReport
+/*
+ * Load over the time between two reads of the meter, usually a second
+ */
+{
+    uint16_t audio;     // Share of the time in the sample interrupt, in LOAD_SCALE
+    uint16_t idle;      // Share of the time in the idle task, in LOAD_SCALE
+    uint16_t samples;   // Samples delivered
+    uint16_t overruns;  // Samples never delivered
+    uint8_t peakVoices; // Most voices mixed into one sample
+};
+
+class LoadMeter
+/*
+ * Totals of the audio and idle time, written by the sample interrupt and the idle hook and read by one task
+ */
+{
+    uint32_t samplePeriod = 0; // Cycles between samples
+
+    // Only written by the sample interrupt
+    uint32_t audio = 0;
+    uint32_t samples = 0;
+    uint32_t overruns = 0;
+    uint32_t lastStart = 0;
+
+    // Raised by the sample interrupt and reset by read()
+    uint8_t peakVoices = 0;
+
+    // Only written by the idle hook
+    uint32_t idle = 0;
+    uint32_t lastIdle = 0;
+
+public:
+    void begin(uint32_t period);
+    /*
+     * Sets the sample period, before the sample interrupt starts
+     *
+     * :param period: cycles between samples
+     */
+
+    void sampled(uint32_t start, uint32_t end, uint8_t voices);
+    /*
+     * Records a sample, from the end of the sample interrupt
+     *
+     * :param start: cycle counter at the start of the interrupt
+     *
+     * :param end: cycle counter at the end of the interrupt
+     *
+     * :param voices: voices mixed into the sample
+     */
+
+    void idled(uint32_t now);
+    /*
+     * Records a pass of the idle task, from the idle hook
+     *
+     * :param now: cycle counter
+     */
+
+    LoadTotals read(uint32_t now);
+    /*
+     * Reads the running totals, and starts a new peak of the voices
+     *
+     * :param now: cycle counter
+     *
+     * :return: the totals
+     */
+};
+
+LoadReport loadReport(const LoadTotals &from, const LoadTotals &to);
+/*
+ * Load between two reads of the meter
+ *
+ * :param from: the earlier totals
+ *
+ * :param to: the later totals
+ *
+ * :return: the load, with the peak of the voices of the later read
+ */
+
+void encodeTelemetry(const LoadReport &report, uint8_t sequence, uint8_t frame[TELEMETRY_FRAME_SIZE]);
+/*
+ * Packs a report into a telemetry frame for Serial, decoded on the host by tools/telemetry.py
+ * TELEMETRY_SYNC and its inverse, the sequence number, the audio and idle loads, the samples and overruns (each 16 bit
+ * little endian), the peak voices, then the sum of the bytes after the sync bytes.
+ *
+ * :param report: the report
+ *
+ * :param sequence: counts up with every frame, so the decoder can tell when a frame was lost
+ *
+ * :param frame: set to the frame
+ */
+
+#endif
@@ -2,12 +2,17 @@
 #include <Arduino.h>
 #include <string>
 #include <STM32FreeRTOS.h>
+#include "tuning.h"
+#include "canproto.h"
+#include "loadmeter.h"
 
 #ifndef MAIN_H
 #define MAIN_H
 
 // Constants
-const uint32_t interval = 100; // Display update interval
+const uint32_t interval = 100;          // Display update interval
+const uint32_t scanTickFrequency = 8000; // Key matrix row rate, one frame every 7 ticks (~1.1kHz)
+const uint32_t debounceMask = 0x0FF00FFF; // Keys (rows 0-2), knob/joystick buttons and handshakes (rows 5-6); not the knob encoders
 
 // Pin definitions
 // Row select and enable
@@ -31,57 +36,198 @@ const int OUTR_PIN = A3;
 const int JOYY_PIN = A0;
 const int JOYX_PIN = A1;
 
+// Handshake inputs in the key matrix, as row and column (the knobs and joystick know their own)
+const uint8_t HKIW_ROW = 5; // West detect
+const uint8_t HKIW_COL = 3;
+const uint8_t HKIE_ROW = 6; // East detect
+const uint8_t HKIE_COL = 3;
+
+// RTOS objects, created with statically allocated memory from the tables in main.cpp
+struct TaskConfig
+{
+  TaskFunction_t function;
+  const char *name;
+  uint16_t stackWords;  // Stack size in words, not bytes
+  UBaseType_t priority;
+  TaskHandle_t *handle; // Set to the task's handle, if anything needs it
+};
+
+struct QueueConfig
+{
+  const char *name;
+  UBaseType_t length;   // Items the queue holds
+  UBaseType_t itemSize; // Bytes in an item
+  QueueHandle_t *handle;
+};
+
+struct MutexConfig
+{
+  const char *name;
+  SemaphoreHandle_t *handle;
+};
+
 // Output multiplexer bits
 const int DEN_BIT = 3;
 const int DRST_BIT = 4;
 const int HKOW_BIT = 5;
 const int HKOE_BIT = 6;
 
-// Step sizes
-const int32_t stepSizes[] = {51076056, 54113197, 57330935, 60740010, 64351798, 68178356, 72232452, 76527617, 81078186, 85899345, 91007186, 96418755};
+void setOutMuxBit(const uint8_t bitIdx, const bool value);
 
-// Notes
-const std::string notes[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+uint8_t getIndx(uint8_t key);
+/*
+ * Given a specific key value from readCols() it will return a indx value for accessing stepSizes array
+ *
+ * :param key: discrete integer value refereeing to a key from a specific row
+ *
+ * :return: discrete integer value refereeing to part of an index into the stepSizes array
+ */
 
-// Frequencies
-const int16_t sampleFrequency = 22000;
-const int32_t frequencies[] = {262, 277, 294, 311, 330, 349, 370, 392, 415, 440, 466, 494};
+void cpyKeyArray(volatile uint32_t localKeyArray[7]);
+/*
+ * Copies a local array of key values to the global keyArray using a mutex to prevent any synchronisation bug
+ *
+ * :param localKeyArray: array locally created in the scanKeysTask used to temporarlity store key values
+ */
 
-void setOutMuxBit(const uint8_t bitIdx, const bool value);
+void applyKeyChanges(uint8_t octave, uint16_t toPress, uint16_t toRelease);
+/*
+ * Starts and releases notes of another module in the SoundGenerator
+ *
+ * :param octave: the octave of the notes
+ *
+ * :param toPress: mask of the notes to start
+ *
+ * :param toRelease: mask of the notes to release, they echo like a local key release
+ */
 
-uint8_t readCols();
+bool playKeyEvents(uint8_t module, const KeyEventsMessage &message, uint32_t now);
 /*
- * Reads from all columns and returns a single integer value of all bits in form 0b bit0 bit1 bit2 bit3
+ * Reconciles this module's share of an octave with a key events message, queuing the notes that differ for the next
+ * sample, must be called from CAN_RX_ISR or with it masked
+ *
+ * :param module: module ID of the sender
+ *
+ * :param message: the key events message
+ *
+ * :param now: current time in microseconds, the timestamp of the queued notes
  *
- * :return: single integer value of columns
+ * :return: true if notes were queued, false if none changed or the queue was full
  */
 
-void setRow(uint8_t rowIdx);
+uint8_t getModuleId();
 /*
- * Writes to mux to select certain row that can then be read from using readCols()
+ * Folds the 96 bit unique ID of the MCU into the module ID used in the message headers
  *
- * :param rowIdx: index of row to be read from
+ * :return: the module ID, never 0
  */
 
-uint8_t getIndx(uint8_t key);
+bool isRendering();
 /*
- * Given a specific key value from readCols() it will return a indx value for accessing stepSizes array
+ * :return: true if this module plays notes, as the receiver or as one of the modules sharing the voices
+ */
+
+void updateFilters();
+/*
+ * Sets the CAN filters of the note and trace classes to match the role, must be called in a critical section
+ */
+
+void setReceiver(uint8_t value);
+/*
+ * Makes this module a receiver or a transmitter, and sets the CAN filters to match
+ * Only a module that plays the notes of other modules accepts the note and trace classes of IDs; a transmitter's
+ * hardware filter rejects them without interrupting, unless the modules share the voices. The control and clock
+ * classes are always accepted.
  *
- * :param key: discrete integer value refereeing to a key from a specific row
+ * :param value: 1 to become a receiver, 0 to become a transmitter
+ */
+
+void setPolyphony(uint8_t policy);
+/*
+ * Selects how the voices are shared between the modules, and sets the CAN filters to match
+ * Under a shared policy every module sends its keys and plays its share of every module's notes, so every module
+ * accepts the note class of IDs whether it is the receiver or not. Like the octave, it should be changed with no keys
+ * held: notes held across the change are moved to their new owners by the next message of their octave.
  *
- * :return: discrete integer value refereeing to part of an index into the stepSizes array
+ * :param policy: an AllocationPolicy
  */
 
-void cpyKeyArray(volatile uint32_t localKeyArray[7]);
+void applyTopology();
 /*
- * Copies a local array of key values to the global keyArray using a mutex to prevent any synchronisation bug
+ * Takes the role and octave of this module's place in the chain once the discovery has settled, connectionMutex must
+ * be taken
+ * The westmost module is the receiver and the rest transmit, each at the octave given along the chain; the role and
+ * octave are only set when the place changes, so Tx/Rx and the octave knob still work between rounds.
+ */
+
+void discoveryTask(void *pvParameters);
+/*
+ * Task to find this module's place in the chain from the handshake inputs, and pass the discovery token east
+ * Also leads or follows the shared clock every clockSyncInterval
  *
- * :param localKeyArray: array locally created in the scanKeysTask used to temporarlity store key values
+ * :param pvParameters: Thread parameter information
+ */
+
+void updateSharedClock();
+/*
+ * Leads or follows the shared clock by this module's place in the chain, connectionMutex must be taken
+ * The westmost module, or a module on its own, leads; in a chain it sends a traced sync frame, and CAN_TX_ISR follows it
+ * with the time it was sent.
+ */
+
+uint64_t getSharedSample();
+/*
+ * :return: index of the sample playing now on the clock shared by the modules, the same on every module in the chain
+ */
+
+void printClock();
+/*
+ * Prints the state of the shared clock over Serial, blocking until it has been sent
+ */
+
+void printLatency();
+/*
+ * Prints the latency histogram of every stage over Serial, blocking until it has been sent
+ */
+
+void printStacks();
+/*
+ * Prints the most stack every task has used over Serial, blocking until it has been sent
+ */
+
+void createRtosObjects();
+/*
+ * Creates every task, queue and mutex in the tables, from statically allocated memory
+ * Must be called before the scheduler starts
+ */
+
+bool updateLoad(LoadReport &report);
+/*
+ * Reads the load meter once a second, and streams the report of the second over Serial if telemetry is on
+ * Must be called from the displayUpdateTask
+ *
+ * :param report: set to the report of the last second, if a second has passed
+ *
+ * :return: true if the report was set
+ */
+
+void sendDisplay();
+/*
+ * Sends the tiles of the frame drawn in the U8g2 buffer that differ from what the display shows
+ * Must be called from the displayUpdateTask
+ */
+
+void drawAudioView(uint8_t view);
+/*
+ * Draws and sends the latest output samples as an oscilloscope trace or a spectrum
+ * Must be called from the displayUpdateTask
+ *
+ * :param view: VIEW_SCOPE or VIEW_SPECTRUM
  */
 
 void scanKeysTask(void *pvParameters);
 /*
- * Function to be run on its own thread that:
+ * Function to be run on its own thread, woken by scanISR whenever the key matrix changes, that:
  *   reads from all keys and knobs,
  *   stores relevant data in global variables
  *   produces correct note at the correct volume
@@ -98,10 +244,25 @@ void displayUpdateTask(void *pvParameters);
  * :param pvParameters: Thread parameter information
  */
 
+void decodeTask(void *pvParameters);
+/*
+ * Function to be run on its own thread that handles the connection messages deferred by CAN_RX_ISR, and releases the
+ * notes of octaves that have gone quiet
+ *
+ * :param pvParameters: Thread parameter information
+ */
+
 /* ####################### */
 /* ###### Interupts ###### */
 /* ####################### */
 
+void scanISR();
+/*
+ * Function that gets called by the scan timer interrupt
+ * Steps the key matrix scanner by one row, decodes the knob rotations and joystick on every completed frame
+ * and wakes scanKeysTask when a frame has changed
+ */
+
 void sampleISR();
 /*
  * Function that gets called by an interrupt
@@ -0,0 +1,101 @@
+#include "noteevents.h"
+
+static_assert((NOTE_EVENT_RING_SIZE & (NOTE_EVENT_RING_SIZE - 1)) == 0, "NOTE_EVENT_RING_SIZE must be a power of 2");
+
+bool NoteEventRing::push(const NoteEvent &event)
+/*
+ * Adds an event, must only be called from the producer
+ *
+ * :param event: the note event
+ *
+ * :return: false if the ring was full and the event was dropped
+ */
+{
+    uint32_t localHead = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    if (localHead - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == NOTE_EVENT_RING_SIZE)
+    {
+        __atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    events[localHead & (NOTE_EVENT_RING_SIZE - 1)] = event;
+    __atomic_store_n(&head, localHead + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool NoteEventRing::pushKeyChanges(uint8_t octave, uint16_t toPress, uint16_t toRelease, uint32_t timestamp)
+/*
+ * Adds an event for every note of a key events message, all of them or none, must only be called from the producer
+ *
+ * :param octave: the octave of the notes
+ *
+ * :param toPress: mask of the notes to start
+ *
+ * :param toRelease: mask of the notes to release
+ *
+ * :param timestamp: time the message was received, in microseconds
+ *
+ * :return: false if there wasn't space for every event, nothing is added and the changes should be retried
+ */
+{
+    if ((uint32_t)__builtin_popcount(toPress | toRelease) > getSpace())
+    {
+        __atomic_store_n(&dropped, dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    // Releases first, so a note that is released and pressed again in one message ends up held
+    uint32_t localHead = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        if (toRelease & (1 << note))
+        {
+            events[localHead++ & (NOTE_EVENT_RING_SIZE - 1)] = NoteEvent{timestamp, octave, note, 0};
+        }
+    }
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        if (toPress & (1 << note))
+        {
+            events[localHead++ & (NOTE_EVENT_RING_SIZE - 1)] = NoteEvent{timestamp, octave, note, 1};
+        }
+    }
+
+    // All the events become visible to the consumer at once
+    __atomic_store_n(&head, localHead, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool NoteEventRing::pop(NoteEvent &event)
+/*
+ * Takes the oldest event, must only be called from the consumer
+ *
+ * :param event: set to the event
+ *
+ * :return: false if the ring was empty
+ */
+{
+    uint32_t localTail = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    if (localTail == __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    event = events[localTail & (NOTE_EVENT_RING_SIZE - 1)];
+    __atomic_store_n(&tail, localTail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t NoteEventRing::getSpace()
+/*
+ * :return: number of events that can be pushed without dropping any
+ */
+{
+    return NOTE_EVENT_RING_SIZE - (__atomic_load_n(&head, __ATOMIC_RELAXED) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+}
+
+uint32_t NoteEventRing::getDropped()
+/*
+ * :return: number of events, or groups of key changes, dropped because the ring was full
+ */
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,74 @@
+#include <cstdint>
+
+#ifndef NOTEEVENTS_H
+#define NOTEEVENTS_H
+
+const uint32_t NOTE_EVENT_RING_SIZE = 32; // Must be a power of 2
+
+struct NoteEvent
+{
+    uint32_t timestamp; // time the event was received, in microseconds
+    uint8_t octave;
+    uint8_t note;    // 0-11
+    uint8_t pressed; // 1 to start the note, 0 to release it
+};
+
+class NoteEventRing
+/*
+ * Single producer, single consumer ring of note events for the audio engine, lock-free and never blocking
+ *
+ * Filled by the CAN receive interrupt (or a task while it is masked, so producers never overlap) and drained by the
+ * sample interrupt before each sample, so a remote key takes effect at the next sample instead of waiting for a task.
+ */
+{
+    NoteEvent events[NOTE_EVENT_RING_SIZE];
+    uint32_t head = 0; // written by the producer
+    uint32_t tail = 0; // written by the consumer
+    uint32_t dropped = 0;
+
+public:
+    bool push(const NoteEvent &event);
+    /*
+     * Adds an event, must only be called from the producer
+     *
+     * :param event: the note event
+     *
+     * :return: false if the ring was full and the event was dropped
+     */
+
+    bool pushKeyChanges(uint8_t octave, uint16_t toPress, uint16_t toRelease, uint32_t timestamp);
+    /*
+     * Adds an event for every note of a key events message, all of them or none, must only be called from the producer
+     *
+     * :param octave: the octave of the notes
+     *
+     * :param toPress: mask of the notes to start
+     *
+     * :param toRelease: mask of the notes to release
+     *
+     * :param timestamp: time the message was received, in microseconds
+     *
+     * :return: false if there wasn't space for every event, nothing is added and the changes should be retried
+     */
+
+    bool pop(NoteEvent &event);
+    /*
+     * Takes the oldest event, must only be called from the consumer
+     *
+     * :param event: set to the event
+     *
+     * :return: false if the ring was empty
+     */
+
+    uint32_t getSpace();
+    /*
+     * :return: number of events that can be pushed without dropping any
+     */
+
+    uint32_t getDropped();
+    /*
+     * :return: number of events, or groups of key changes, dropped because the ring was full
+     */
+};
+
+#endif
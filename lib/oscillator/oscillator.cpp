@@ -0,0 +1,114 @@
+#include "oscillator.h"
+
+int32_t polyBlep(uint32_t phase, uint32_t stepSize)
+/*
+ * Fixed point PolyBLEP residual for a unit step discontinuity at phase 0
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :param stepSize: phase increment per sample, must be below half a cycle (Nyquist)
+ *
+ * :return: Q15 correction in [-32768, 32768], 0 unless the phase is within one step of the discontinuity
+ */
+{
+    // Steps this small put the whole correction within a single sample - nothing to smooth
+    // Steps of half a cycle or more (above Nyquist, or a negative pitch bend) have no meaningful correction
+    uint32_t stepQ15 = stepSize >> 15;
+    if ((stepQ15 == 0) | (stepSize >= 0x80000000))
+    {
+        return 0;
+    }
+
+    if (phase < stepSize)
+    {
+        // Just after the discontinuity: x = t / dt, residual = 2x - x^2 - 1
+        int32_t x = phase / stepQ15;
+        if (x > 32768)
+        {
+            x = 32768;
+        }
+        return 2 * x - ((x * x) >> 15) - 32768;
+    }
+
+    uint32_t distance = 0u - phase;
+    if (distance < stepSize)
+    {
+        // Just before the discontinuity: y = (1 - t) / dt, residual = (1 - y)^2
+        int32_t y = distance / stepQ15;
+        if (y > 32768)
+        {
+            y = 32768;
+        }
+        return ((32768 - y) * (32768 - y)) >> 15;
+    }
+
+    return 0;
+}
+
+int32_t sawNaive(uint32_t phase)
+/*
+ * Naive sawtooth, rising through the cycle and jumping from max to min as the phase wraps
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :return: full scale output sample
+ */
+{
+    return (int32_t)(phase ^ 0x80000000);
+}
+
+int32_t sawPolyBlep(uint32_t phase, uint32_t stepSize)
+/*
+ * Band-limited sawtooth, the naive sawtooth with a PolyBLEP correction at the wrap
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :param stepSize: phase increment per sample
+ *
+ * :return: full scale output sample
+ */
+{
+    // Working in Q15 keeps the correction within a 32 bit multiply
+    int32_t out = (sawNaive(phase) >> 16) - polyBlep(phase, stepSize);
+    return out * 65536;
+}
+
+int32_t squareNaive(uint32_t phase)
+/*
+ * Naive square, high for the first half of the cycle and low for the second half
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :return: full scale output sample
+ */
+{
+    return (phase & 0x80000000) ? -2147483647 - 1 : 2147483647;
+}
+
+int32_t squarePolyBlep(uint32_t phase, uint32_t stepSize)
+/*
+ * Band-limited square, the naive square with PolyBLEP corrections at the rising and falling edges
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :param stepSize: phase increment per sample
+ *
+ * :return: full scale output sample
+ */
+{
+    int32_t out = (phase & 0x80000000) ? -32768 : 32767;
+
+    // Rising edge at phase 0, falling edge half a cycle later
+    out += polyBlep(phase, stepSize);
+    out -= polyBlep(phase + 0x80000000, stepSize);
+
+    if (out > 32767)
+    {
+        out = 32767;
+    }
+    if (out < -32768)
+    {
+        out = -32768;
+    }
+    return out * 65536;
+}
@@ -0,0 +1,64 @@
+#include <cstdint>
+
+#ifndef OSCILLATOR_H
+#define OSCILLATOR_H
+
+/*
+ * Hardware independent oscillator kernels shared by the SoundGenerator and the host tests.
+ *
+ * Phases are unsigned 32 bit accumulators (a full cycle is 2^32) and step sizes are the per-sample phase increment,
+ * i.e. the same values as the stepSizes array. Outputs use the full int32_t range, the same scale as Voice::phaseAcc.
+ */
+
+int32_t polyBlep(uint32_t phase, uint32_t stepSize);
+/*
+ * Fixed point PolyBLEP residual for a unit step discontinuity at phase 0
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :param stepSize: phase increment per sample, must be below half a cycle (Nyquist)
+ *
+ * :return: Q15 correction in [-32768, 32768], 0 unless the phase is within one step of the discontinuity
+ */
+
+int32_t sawNaive(uint32_t phase);
+/*
+ * Naive sawtooth, rising through the cycle and jumping from max to min as the phase wraps
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :return: full scale output sample
+ */
+
+int32_t sawPolyBlep(uint32_t phase, uint32_t stepSize);
+/*
+ * Band-limited sawtooth, the naive sawtooth with a PolyBLEP correction at the wrap
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :param stepSize: phase increment per sample
+ *
+ * :return: full scale output sample
+ */
+
+int32_t squareNaive(uint32_t phase);
+/*
+ * Naive square, high for the first half of the cycle and low for the second half
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :return: full scale output sample
+ */
+
+int32_t squarePolyBlep(uint32_t phase, uint32_t stepSize);
+/*
+ * Band-limited square, the naive square with PolyBLEP corrections at the rising and falling edges
+ *
+ * :param phase: current phase of the oscillator
+ *
+ * :param stepSize: phase increment per sample
+ *
+ * :return: full scale output sample
+ */
+
+#endif
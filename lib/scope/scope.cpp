@@ -0,0 +1,216 @@
+#include <cmath>
+#include "scope.h"
+
+static_assert((AUDIO_TAP_SIZE & (AUDIO_TAP_SIZE - 1)) == 0, "AUDIO_TAP_SIZE must be a power of 2");
+
+const int16_t scopeFloor = 256; // Smallest peak scaled to the full height, so silence and hiss stay flat
+
+bool AudioTap::read(int16_t *dest, uint16_t count)
+/*
+ * Copies out the latest samples, oldest first
+ *
+ * :param dest: set to the samples
+ *
+ * :param count: number of samples, at most AUDIO_TAP_SIZE / 2 so the copy has time to finish
+ *
+ * :return: false if fewer samples have been stored or the producer overwrote them during the copy
+ */
+{
+    uint32_t end = __atomic_load_n(&writePos, __ATOMIC_ACQUIRE);
+    if (end < count)
+    {
+        return false;
+    }
+    for (uint16_t i = 0; i < count; i++)
+    {
+        dest[i] = samples[(end - count + i) & (AUDIO_TAP_SIZE - 1)];
+    }
+
+    // The copy is good if the producer hasn't come round to the oldest sample copied
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&writePos, __ATOMIC_RELAXED) - end <= (uint32_t)(AUDIO_TAP_SIZE - count);
+}
+
+uint16_t findTrigger(const int16_t *samples, uint16_t count, uint16_t span)
+/*
+ * Finds the first rising edge through the middle of the samples, so repeated traces of a steady note line up
+ * The samples must first fall below the middle by an eighth of their range, so noise around it doesn't trigger.
+ *
+ * :param samples: the samples
+ *
+ * :param count: number of samples
+ *
+ * :param span: samples that must follow the trigger
+ *
+ * :return: index of the first sample at or above the middle after the edge, or 0 if there is none
+ */
+{
+    if (count <= span)
+    {
+        return 0;
+    }
+    int16_t low = samples[0];
+    int16_t high = samples[0];
+    for (uint16_t i = 1; i < count; i++)
+    {
+        low = samples[i] < low ? samples[i] : low;
+        high = samples[i] > high ? samples[i] : high;
+    }
+    int32_t middle = ((int32_t)low + high) / 2;
+    int32_t armed = middle - ((int32_t)high - low) / 8;
+
+    bool below = false;
+    for (uint16_t i = 0; i < count - span; i++)
+    {
+        if (samples[i] < armed)
+        {
+            below = true;
+        }
+        else if (below && samples[i] >= middle)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+void scopeTrace(const int16_t *samples, uint8_t height, uint8_t rows[SCOPE_WIDTH])
+/*
+ * Scales SCOPE_WIDTH samples to display rows, to the larger of their peak and a floor so silence stays flat
+ *
+ * :param samples: the samples from the trigger
+ *
+ * :param height: rows in the display
+ *
+ * :param rows: set to the row of each sample, 0 at the top
+ */
+{
+    int32_t peak = scopeFloor;
+    for (uint8_t i = 0; i < SCOPE_WIDTH; i++)
+    {
+        int32_t magnitude = samples[i] < 0 ? -(int32_t)samples[i] : samples[i];
+        peak = magnitude > peak ? magnitude : peak;
+    }
+
+    // -peak at the bottom row, +peak at the top
+    int32_t centre = (height - 1) / 2;
+    for (uint8_t i = 0; i < SCOPE_WIDTH; i++)
+    {
+        int32_t row = centre - (int32_t)samples[i] * centre / peak;
+        rows[i] = row < 0 ? 0 : (row >= height ? height - 1 : row);
+    }
+}
+
+uint8_t spectrumBar(uint16_t magnitude, uint8_t height)
+/*
+ * Height of a bin's bar on a log scale, in quarters of a doubling (1.5dB)
+ *
+ * :param magnitude: magnitude of the bin, from Spectrum::analyse()
+ *
+ * :param height: rows of the tallest bar
+ *
+ * :return: rows of the bar, 0 for silence
+ */
+{
+    if (magnitude < 2)
+    {
+        return 0;
+    }
+
+    // The top bit gives the doubling, the two bits below it the quarter, up to 15 doublings
+    uint8_t top = 31 - __builtin_clz(magnitude);
+    uint8_t quarter = top >= 2 ? (magnitude >> (top - 2)) & 3 : (magnitude << (2 - top)) & 3;
+    uint16_t level = (top - 1) * 4 + quarter;
+    uint16_t bar = level * height / (14 * 4);
+    return bar > height ? height : bar;
+}
+
+Spectrum::Spectrum()
+/*
+ * Initialiser for the Spectrum class, fills the window and twiddle tables
+ */
+{
+    const double pi = 3.14159265358979323846;
+    for (uint16_t i = 0; i < FFT_SIZE; i++)
+    {
+        window[i] = (int16_t)lround(32767 * 0.5 * (1 - cos(2 * pi * i / FFT_SIZE)));
+
+        uint8_t reverse = 0;
+        for (uint8_t bit = 0; bit < FFT_BITS; bit++)
+        {
+            reverse |= ((i >> bit) & 1) << (FFT_BITS - 1 - bit);
+        }
+        reversed[i] = reverse;
+    }
+    for (uint16_t k = 0; k < FFT_SIZE / 2; k++)
+    {
+        cosines[k] = (int16_t)lround(32767 * cos(2 * pi * k / FFT_SIZE));
+        sines[k] = (int16_t)lround(32767 * sin(2 * pi * k / FFT_SIZE));
+    }
+}
+
+void Spectrum::analyse(const int16_t samples[FFT_SIZE], uint16_t bins[FFT_BINS])
+/*
+ * Computes the magnitude spectrum of a block of samples
+ *
+ * :param samples: the samples, oldest first
+ *
+ * :param bins: set to the magnitude of each bin, from 0Hz up, in Q15 of a sine at full scale after the input is shifted up
+ */
+{
+    // Block floating point: shift the input up until its peak uses the top bit below the sign
+    int32_t peak = 1;
+    for (uint16_t i = 0; i < FFT_SIZE; i++)
+    {
+        int32_t magnitude = samples[i] < 0 ? -(int32_t)samples[i] : samples[i];
+        peak = magnitude > peak ? magnitude : peak;
+    }
+    uint8_t shift = 0;
+    while ((peak << (shift + 1)) < 32768)
+    {
+        shift++;
+    }
+
+    // Windowed, into bit reversed order for the in place butterflies
+    for (uint16_t i = 0; i < FFT_SIZE; i++)
+    {
+        int32_t sample = (int32_t)samples[i] << shift;
+        sample = sample > 32767 ? 32767 : (sample < -32767 ? -32767 : sample);
+        re[reversed[i]] = (int16_t)((sample * window[i]) >> 15);
+        im[reversed[i]] = 0;
+    }
+
+    // log2(FFT_SIZE) stages, each halving its outputs
+    for (uint16_t size = 2; size <= FFT_SIZE; size <<= 1)
+    {
+        uint16_t half = size >> 1;
+        uint16_t step = FFT_SIZE / size;
+        for (uint16_t start = 0; start < FFT_SIZE; start += size)
+        {
+            for (uint16_t k = 0; k < half; k++)
+            {
+                // Twiddle e^(-j 2 pi k / size)
+                int32_t wr = cosines[k * step];
+                int32_t wi = -sines[k * step];
+                uint16_t a = start + k;
+                uint16_t b = a + half;
+                int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+                int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+                re[b] = (int16_t)((re[a] - tr) >> 1);
+                im[b] = (int16_t)((im[a] - ti) >> 1);
+                re[a] = (int16_t)((re[a] + tr) >> 1);
+                im[a] = (int16_t)((im[a] + ti) >> 1);
+            }
+        }
+    }
+
+    // Alpha max plus beta min, within 7% of the magnitude without a square root, doubled for the bin's negative twin
+    // and again for the window's gain of a half
+    for (uint8_t k = 0; k < FFT_BINS; k++)
+    {
+        uint32_t x = re[k] < 0 ? -(int32_t)re[k] : re[k];
+        uint32_t y = im[k] < 0 ? -(int32_t)im[k] : im[k];
+        uint32_t magnitude = (x > y ? x + (y * 3 >> 3) : y + (x * 3 >> 3)) * 4;
+        bins[k] = magnitude > 65535 ? 65535 : magnitude;
+    }
+}
@@ -0,0 +1,129 @@
+#include <cstdint>
+
+#ifndef SCOPE_H
+#define SCOPE_H
+
+/*
+ * Oscilloscope and spectrum views of the audio output
+ *
+ * The sample interrupt stores every output sample in an AudioTap, a ring it overwrites continuously without ever
+ * waiting for the reader. The display task copies out the latest samples when it draws a frame, and either finds a
+ * rising edge to hold the trace still for the oscilloscope, or runs a 128 point fixed point FFT for 64 bins of
+ * spectrum up to half the sample rate.
+ */
+
+const uint16_t AUDIO_TAP_SIZE = 512; // Samples kept, ~23ms at 22kHz, must be a power of 2
+const uint8_t SCOPE_WIDTH = 128;     // Samples across the display
+const uint8_t FFT_BITS = 7;
+const uint16_t FFT_SIZE = 1 << FFT_BITS; // Samples per spectrum
+const uint8_t FFT_BINS = FFT_SIZE / 2;   // Bins from 0 to half the sample rate, ~172Hz apart at 22kHz
+
+enum DisplayView : uint8_t
+{
+    VIEW_STATUS,   // Settings and held notes
+    VIEW_SCOPE,    // Triggered oscilloscope trace
+    VIEW_SPECTRUM, // Magnitude spectrum
+    DISPLAY_VIEWS
+};
+
+class AudioTap
+/*
+ * Lock-free single producer, single consumer ring of the latest output samples
+ * The producer never waits: it overwrites the oldest sample, and a reader that is overtaken while copying is told to
+ * try again.
+ */
+{
+    int16_t samples[AUDIO_TAP_SIZE] = {0};
+    uint32_t writePos = 0;
+
+public:
+    void push(int16_t sample)
+    /*
+     * Stores a sample, from the sample interrupt
+     *
+     * :param sample: the output sample
+     */
+    {
+        samples[writePos & (AUDIO_TAP_SIZE - 1)] = sample;
+        __atomic_store_n(&writePos, writePos + 1, __ATOMIC_RELEASE);
+    }
+
+    bool read(int16_t *dest, uint16_t count);
+    /*
+     * Copies out the latest samples, oldest first
+     *
+     * :param dest: set to the samples
+     *
+     * :param count: number of samples, at most AUDIO_TAP_SIZE / 2 so the copy has time to finish
+     *
+     * :return: false if fewer samples have been stored or the producer overwrote them during the copy
+     */
+};
+
+uint16_t findTrigger(const int16_t *samples, uint16_t count, uint16_t span);
+/*
+ * Finds the first rising edge through the middle of the samples, so repeated traces of a steady note line up
+ * The samples must first fall below the middle by an eighth of their range, so noise around it doesn't trigger.
+ *
+ * :param samples: the samples
+ *
+ * :param count: number of samples
+ *
+ * :param span: samples that must follow the trigger
+ *
+ * :return: index of the first sample at or above the middle after the edge, or 0 if there is none
+ */
+
+void scopeTrace(const int16_t *samples, uint8_t height, uint8_t rows[SCOPE_WIDTH]);
+/*
+ * Scales SCOPE_WIDTH samples to display rows, to the larger of their peak and a floor so silence stays flat
+ *
+ * :param samples: the samples from the trigger
+ *
+ * :param height: rows in the display
+ *
+ * :param rows: set to the row of each sample, 0 at the top
+ */
+
+uint8_t spectrumBar(uint16_t magnitude, uint8_t height);
+/*
+ * Height of a bin's bar on a log scale, in quarters of a doubling (1.5dB)
+ *
+ * :param magnitude: magnitude of the bin, from Spectrum::analyse()
+ *
+ * :param height: rows of the tallest bar
+ *
+ * :return: rows of the bar, 0 for silence
+ */
+
+class Spectrum
+/*
+ * Radix-2 decimation in time FFT in Q15 fixed point, of FFT_SIZE real samples with a Hann window
+ * The input is first shifted up so its peak is near full scale, and each stage halves its outputs so nothing
+ * overflows, so the magnitudes are relative to the loudest sample.
+ */
+{
+    int16_t window[FFT_SIZE];
+    int16_t cosines[FFT_SIZE / 2]; // Twiddle factors, cos and sin of 2 pi k / FFT_SIZE in Q15
+    int16_t sines[FFT_SIZE / 2];
+    uint8_t reversed[FFT_SIZE];    // Bit reversed index of each sample
+    int16_t re[FFT_SIZE];          // Working arrays of analyse(), kept here rather than on the caller's stack
+    int16_t im[FFT_SIZE];
+
+public:
+    Spectrum();
+    /*
+     * Initialiser for the Spectrum class, fills the window and twiddle tables
+     */
+
+    void analyse(const int16_t samples[FFT_SIZE], uint16_t bins[FFT_BINS]);
+    /*
+     * Computes the magnitude spectrum of a block of samples
+     *
+     * :param samples: the samples, oldest first
+     *
+     * :param bins: set to the magnitude of each bin, from 0Hz up, in Q15 of a sine at full scale after the input is shifted up
+     */
+};
+
+#endif
@@ -1,9 +1,16 @@
-#include <STM32FreeRTOS.h>
-#include <Arduino.h>
+#include <cstring>
 #include "sound.h"
-#include "joystick.h"
-#include "knob.h"
-#include "main.h"
+#include "oscillator.h"
+#include "tuning.h"
+
+// The tasks mask the sample interrupt while they change the voices, the host tests drive each SoundGenerator from
+// one thread so there is nothing to mask
+#ifdef ARDUINO
+#include <STM32FreeRTOS.h>
+#else
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+#endif
 
 SoundGenerator::SoundGenerator()
 /*
@@ -17,6 +24,7 @@ SoundGenerator::SoundGenerator()
     voices[i].note = 0;
     voices[i].octave = 0;
     voices[i].phaseAcc = 0;
+    voices[i].phase = 0;
     voices[i].intensityRightShift = 24;
     voices[i].cyclesPerHalfPeriod = 0;
     voices[i].waveCount = 0;
@@ -38,7 +46,19 @@ void SoundGenerator::addKey(uint8_t octave, uint8_t note)
 {
   // Register the key press in the first available voice
   taskENTER_CRITICAL();
+  startVoice(octave, note);
+  taskEXIT_CRITICAL();
+}
 
+void SoundGenerator::startVoice(uint8_t octave, uint8_t note)
+/*
+ * Starts a note in the first free voice, the caller must stop getVout() running at the same time
+ *
+ * :param octave: the octave of the key (1-7)
+ *
+ * :param note: the note of the key (0-11)
+ */
+{
   for (uint8_t i = 0; i < 12; i++)
   {
     // Check if voice is free
@@ -50,6 +70,7 @@ void SoundGenerator::addKey(uint8_t octave, uint8_t note)
       voices[i].intensityRightShift = 24;
       voices[i].upOrDown = 1;
       voices[i].waveCount = 0;
+      voices[i].phase = 0;
 
       if (octave > 4)
       {
@@ -65,8 +86,6 @@ void SoundGenerator::addKey(uint8_t octave, uint8_t note)
       break;
     }
   }
-
-  taskEXIT_CRITICAL();
 }
 
 void SoundGenerator::echoKey(uint8_t octave, uint8_t note)
@@ -80,7 +99,19 @@ void SoundGenerator::echoKey(uint8_t octave, uint8_t note)
  */
 {
   taskENTER_CRITICAL();
+  echoVoice(octave, note);
+  taskEXIT_CRITICAL();
+}
 
+void SoundGenerator::echoVoice(uint8_t octave, uint8_t note)
+/*
+ * Starts the echo of every voice playing a note, the caller must stop getVout() running at the same time
+ *
+ * :param octave: the octave of the key (1-7)
+ *
+ * :param note: the note of the key (0-11)
+ */
+{
   for (uint8_t i = 0; i < 12; i++)
   {
     if ((voices[i].status != 0) && voices[i].octave == octave && voices[i].note == note)
@@ -90,8 +121,93 @@ void SoundGenerator::echoKey(uint8_t octave, uint8_t note)
       // break;
     }
   }
+}
 
+bool SoundGenerator::queueKeyChanges(uint8_t octave, uint16_t toPress, uint16_t toRelease, uint32_t timestamp)
+/*
+ * Queues the notes of a key events message from another module, applied by getVout() before the next sample
+ * Lock-free, for the CAN receive interrupt; a task must mask that interrupt while calling it
+ *
+ * :param octave: the octave of the notes
+ *
+ * :param toPress: mask of the notes to start
+ *
+ * :param toRelease: mask of the notes to release, they echo like a local key release
+ *
+ * :param timestamp: time the message was received, in microseconds
+ *
+ * :return: false if the queue was full and none of the notes were queued
+ */
+{
+  return noteEvents.pushKeyChanges(octave, toPress, toRelease, timestamp);
+}
+
+uint32_t SoundGenerator::getDroppedNoteEvents()
+/*
+ * :return: number of queueKeyChanges() calls that were dropped because the queue was full
+ */
+{
+  return noteEvents.getDropped();
+}
+
+uint32_t SoundGenerator::getLastApplied()
+/*
+ * Atomically loads the timestamp of the last queued note getVout() applied
+ *
+ * :return: the timestamp passed to queueKeyChanges() with the note
+ */
+{
+  return __atomic_load_n(&lastApplied, __ATOMIC_RELAXED);
+}
+
+uint8_t SoundGenerator::getVoicesPlaying()
+/*
+ * Atomically loads the number of voices getVout() mixed into the last sample, without masking it
+ *
+ * :return: voices in the last sample, including the echoes
+ */
+{
+  return __atomic_load_n(&voicesPlaying, __ATOMIC_RELAXED);
+}
+
+uint8_t SoundGenerator::getVoiceCount()
+/*
+ * :return: number of voices in use, including the echoes
+ */
+{
+  uint8_t count = 0;
+  taskENTER_CRITICAL();
+  for (uint8_t i = 0; i < 12; i++)
+  {
+    if (voices[i].status != 0)
+    {
+      count++;
+    }
+  }
+  taskEXIT_CRITICAL();
+  return count;
+}
+
+bool SoundGenerator::isPlaying(uint8_t octave, uint8_t note)
+/*
+ * :param octave: the octave of the key (1-7)
+ *
+ * :param note: the note of the key (0-11)
+ *
+ * :return: true if a voice is playing the note and it hasn't been released
+ */
+{
+  bool playing = false;
+  taskENTER_CRITICAL();
+  for (uint8_t i = 0; i < 12; i++)
+  {
+    if (voices[i].status == 2 && voices[i].octave == octave && voices[i].note == note)
+    {
+      playing = true;
+    }
+  }
   taskEXIT_CRITICAL();
+  return playing;
 }
 
 void SoundGenerator::removeKey(uint8_t octave, uint8_t note)
@@ -115,6 +231,7 @@ void SoundGenerator::removeKey(uint8_t octave, uint8_t note)
       voices[i].note = 0;
       voices[i].octave = 0;
       voices[i].phaseAcc = 0;
+      voices[i].phase = 0;
       voices[i].lifeTime = 0;
       voices[i].cyclesPerHalfPeriod = 0;
       voices[i].fOverfs = 0;
@@ -130,25 +247,51 @@ void SoundGenerator::removeKey(uint8_t octave, uint8_t note)
 
 int32_t SoundGenerator::getVout()
 /*
- * Calculates the output voltage for the sound based on the keys pressed and waveform
+ * Applies the queued notes of other modules, then calculates the output voltage for the sound based on the keys
+ * pressed and waveform
  *
  * :return: the output voltage (pre volume shifting and dc-offset addition)
  */
 {
+  // Runs in the sample interrupt, which the tasks mask while they change the voices
+  NoteEvent event;
+  while (noteEvents.pop(event))
+  {
+    if (event.pressed)
+    {
+      startVoice(event.octave, event.note);
+    }
+    else
+    {
+      echoVoice(event.octave, event.note);
+    }
+    __atomic_store_n(&lastApplied, event.timestamp, __ATOMIC_RELAXED);
+  }
+
   uint8_t wf = __atomic_load_n(&waveform, __ATOMIC_RELAXED);
+  uint8_t bl = __atomic_load_n(&bandLimited, __ATOMIC_RELAXED);
   int32_t Vout = 0;
+  uint8_t playing = 0;
 
   for (uint8_t i = 0; i < 12; i++)
   {
     // Checking not free voice
     if (voices[i].status != 0)
     {
+      playing++;
 
       switch (wf)
       {
       // Sawtooth wave
       case 0:
-        sawtooth(i);
+        if (bl & 0x01)
+        {
+          sawtoothBandLimited(i);
+        }
+        else
+        {
+          sawtooth(i);
+        }
         break;
 
       // sine wave
@@ -158,7 +301,14 @@ int32_t SoundGenerator::getVout()
 
       // square wave
       case 2:
-        square(i);
+        if (bl & 0x04)
+        {
+          squareBandLimited(i);
+        }
+        else
+        {
+          square(i);
+        }
         break;
 
       // traingular wave
@@ -186,6 +336,7 @@ int32_t SoundGenerator::getVout()
           voices[i].note = 0;
           voices[i].octave = 0;
           voices[i].phaseAcc = 0;
+          voices[i].phase = 0;
           voices[i].lifeTime = 0;
           voices[i].cyclesPerHalfPeriod = 0;
           voices[i].fOverfs = 0;
@@ -213,6 +364,7 @@ int32_t SoundGenerator::getVout()
     }
   }
 
+  __atomic_store_n(&voicesPlaying, playing, __ATOMIC_RELAXED);
   return Vout;
 }
 
@@ -236,6 +388,37 @@ void SoundGenerator::setWaveform(uint8_t wf)
   __atomic_store_n(&waveform, wf, __ATOMIC_RELAXED);
 }
 
+bool SoundGenerator::getBandLimited(uint8_t wf)
+/*
+ * Atomically loads whether a waveform uses its band-limited variant
+ *
+ * :param wf: the waveform id number (0-3)
+ *
+ * :return: true if the band-limited variant is selected
+ */
+{
+  return (__atomic_load_n(&bandLimited, __ATOMIC_RELAXED) >> wf) & 0x01;
+}
+
+void SoundGenerator::setBandLimited(uint8_t wf, bool enabled)
+/*
+ * Atomically selects the band-limited or naive variant of a waveform, only sawtooth (0) and square (2) have one
+ *
+ * :param wf: the waveform id number (0-3)
+ *
+ * :param enabled: true to select the band-limited variant
+ */
+{
+  if (enabled)
+  {
+    __atomic_fetch_or(&bandLimited, 1 << wf, __ATOMIC_RELAXED);
+  }
+  else
+  {
+    __atomic_fetch_and(&bandLimited, ~(1 << wf), __ATOMIC_RELAXED);
+  }
+}
+
 uint32_t SoundGenerator::getGlobalLifeTime()
 /*
  * Atomically loads the current globalLifeTime
@@ -256,6 +439,26 @@ void SoundGenerator::setGlobalLifeTime(uint16_t lifeTime)
   __atomic_store_n(&globalLifetime, (lifeTime * 22000), __ATOMIC_RELAXED);
 }
 
+int32_t SoundGenerator::getPitchBend()
+/*
+ * Atomically loads the current pitch bend
+ *
+ * :return: the joystick x offset from its centre, in 10 bit ADC counts
+ */
+{
+  return __atomic_load_n(&pitchBend, __ATOMIC_RELAXED);
+}
+
+void SoundGenerator::setPitchBend(int32_t bend)
+/*
+ * Atomically stores the pitch bend
+ *
+ * :param bend: the joystick x offset from its centre, in 10 bit ADC counts
+ */
+{
+  __atomic_store_n(&pitchBend, bend, __ATOMIC_RELAXED);
+}
+
 void SoundGenerator::sawtooth(uint8_t voiceIndx)
 /*
  * Produces a sawtooth Vout for a specific note related to a specific voice
@@ -267,20 +470,46 @@ void SoundGenerator::sawtooth(uint8_t voiceIndx)
 {
 
   // Creating note shift using joystick
-  // int32_t shift = getShift(voices[voiceIndx].stepSize);
+  int32_t shift = getStepSize(voiceIndx);
+  voices[voiceIndx].phaseAcc += shift;
+  // Serial.println(voices[voiceIndx].phaseAcc);
+}
+
+void SoundGenerator::sawtoothBandLimited(uint8_t voiceIndx)
+/*
+ * Produces a PolyBLEP band-limited sawtooth Vout for a specific note related to a specific voice
+ *
+ * :param voiceIndx: index of the specific voice that has already been checked if free
+ *
+ * :return: Vout for that specific voice that needs shifting and volume adjustment
+ */
+{
+  uint32_t shift = getStepSize(voiceIndx);
+  voices[voiceIndx].phase += shift;
+  voices[voiceIndx].phaseAcc = sawPolyBlep(voices[voiceIndx].phase, shift);
+}
+
+int32_t SoundGenerator::getStepSize(uint8_t voiceIndx)
+/*
+ * Gets the phase step size of a voice's note and octave, including the joystick pitch shift
+ *
+ * :param voiceIndx: index of the specific voice that has already been checked if free
+ *
+ * :return: shifted step size
+ */
+{
+  // The table is octave 4, every octave above doubles the step and every octave below halves it
   int32_t stepSize = stepSizes[voices[voiceIndx].note];
-  if (voices[voiceIndx].octave > 4)
+  int8_t shift = (int8_t)voices[voiceIndx].octave - 4;
+  if (shift > 0)
   {
-    stepSize = stepSize << voices[voiceIndx].octave - 4;
+    stepSize = stepSize << shift;
   }
   else
   {
-    stepSize = stepSize >> 4 - voices[voiceIndx].octave;
-
+    stepSize = stepSize >> -shift;
   }
-  int32_t shift = getShift(stepSize);
-  voices[voiceIndx].phaseAcc += shift;
-  // Serial.println(voices[voiceIndx].phaseAcc);
+  return getShift(stepSize, getPitchBend());
 }
 
 void SoundGenerator::sine(uint8_t voiceIndx)
@@ -292,10 +521,9 @@ void SoundGenerator::sine(uint8_t voiceIndx)
  * :return: Vout for that specific voice that needs shifting and volume adjustment
  */
 {
-  extern Joystick joystick;
   // int32_t amplitude = 2147483647; // to be tuned
 
-  int32_t shift = voices[voiceIndx].fOverfs + ((joystick.getX() / 100) - 5);
+  int32_t shift = voices[voiceIndx].fOverfs + (getPitchBend() / 100);
 
   float x = voices[voiceIndx].waveCount * shift;
 
@@ -322,14 +550,12 @@ void SoundGenerator::square(uint8_t voiceIndx)
  */
 {
 
-  extern Joystick joystick;
-
   if (voices[voiceIndx].phaseAcc == 0)
   {
     voices[voiceIndx].phaseAcc = 2147483647;
   }
 
-  int32_t shift = voices[voiceIndx].cyclesPerHalfPeriod + ((joystick.getX() / 100) - 5);
+  int32_t shift = voices[voiceIndx].cyclesPerHalfPeriod + (getPitchBend() / 100);
 
   if (voices[voiceIndx].waveCount == shift)
   {
@@ -341,6 +567,21 @@ void SoundGenerator::square(uint8_t voiceIndx)
     voices[voiceIndx].waveCount += 1;
   }
 }
+
+void SoundGenerator::squareBandLimited(uint8_t voiceIndx)
+/*
+ * Produces a PolyBLEP band-limited square Vout for a specific note related to a specific voice
+ *
+ * :param voiceIndx: index of the specific voice that has already been checked if free
+ *
+ * :return: Vout for that specific voice that needs shifting and volume adjustment
+ */
+{
+  uint32_t shift = getStepSize(voiceIndx);
+  voices[voiceIndx].phase += shift;
+  voices[voiceIndx].phaseAcc = squarePolyBlep(voices[voiceIndx].phase, shift);
+}
+
 void SoundGenerator::triangular(uint8_t voiceIndx)
 /*
  * Produces a triangular Vout for a specific note related to a specific voice
@@ -369,45 +610,94 @@ void SoundGenerator::triangular(uint8_t voiceIndx)
 
   voices[voiceIndx].waveCount += 1;
 
-  int32_t shift = getShift(voices[voiceIndx].stepSize);
+  int32_t shift = getShift(voices[voiceIndx].stepSize, getPitchBend());
   voices[voiceIndx].phaseAcc += (voices[voiceIndx].upOrDown * shift);
 }
 
-int32_t getShift(int32_t currentVoiceStepSize)
+int32_t getShift(int32_t currentVoiceStepSize, int32_t pitchBend)
 /*
  * Gets shift caused by movement in joystick x axis, applies shift to the current step size.
- * Note: function only gets called from a the interupt function sampleISR(), and therefore global variables can be accessed with no worry about synchronisation erros
+ *
+ * :param currentVoiceStepSize: step size of the voice without any pitch bend
+ *
+ * :param pitchBend: the joystick x offset from its centre, in 10 bit ADC counts
  *
  * :return: shifted step size.
  */
 {
-  extern Joystick joystick;
-
-  return currentVoiceStepSize + (-(joystick.getX() - 532) * 10000);
+  return currentVoiceStepSize - pitchBend * 10000;
 }
 
-std::string SoundGenerator::getCurrentNotes()
+void SoundGenerator::getStatus(SoundStatus &status)
 /*
- * Gets the names of the current notes being played
+ * Takes a snapshot of the notes being played, masking the sample interrupt only for one pass over the voices
  *
- * :return: string of current notes, space separated
+ * :param status: set to the snapshot
  */
 {
-  std::string notesStr = "";
+  for (uint8_t octave = 0; octave < SOUND_OCTAVES; octave++)
+  {
+    status.held[octave] = 0;
+  }
+  status.voices = 0;
+  status.waveform = getWaveform();
+  status.bandLimited = getBandLimited(status.waveform);
 
+  // Names are only looked up once the interrupt can run again, by formatNotes()
   taskENTER_CRITICAL();
-
   for (uint8_t i = 0; i < 12; i++)
   {
-    if (voices[i].status == 2)
+    if (voices[i].status != 0)
     {
-      notesStr += notes[voices[i].note] + std::to_string(voices[i].octave) + " ";
+      status.voices++;
+    }
+    if (voices[i].status == 2 && voices[i].octave < SOUND_OCTAVES)
+    {
+      status.held[voices[i].octave] |= 1 << voices[i].note;
     }
   }
-
   taskEXIT_CRITICAL();
+}
 
-  return notesStr;
+uint8_t formatNotes(const SoundStatus &status, char *dest, uint8_t size)
+/*
+ * Writes the names of the held notes, lowest first and each followed by a space (e.g. "C4 E4 G4 ")
+ * Names that don't fit whole are left out.
+ *
+ * :param status: snapshot from SoundGenerator::getStatus()
+ *
+ * :param dest: set to the names, always terminated
+ *
+ * :param size: size of dest, including the terminator
+ *
+ * :return: number of characters written, excluding the terminator
+ */
+{
+  uint8_t length = 0;
+  for (uint8_t octave = 0; octave < SOUND_OCTAVES; octave++)
+  {
+    for (uint8_t note = 0; note < 12; note++)
+    {
+      if (!((status.held[octave] >> note) & 1))
+      {
+        continue;
+      }
+
+      // The note, the octave digit, a space and the terminator
+      uint8_t nameLength = notes[note][1] ? 2 : 1;
+      if (length + nameLength + 3 > size)
+      {
+        dest[length] = '\0';
+        return length;
+      }
+      memcpy(dest + length, notes[note], nameLength);
+      length += nameLength;
+      dest[length++] = '0' + octave;
+      dest[length++] = ' ';
+    }
+  }
+  dest[length] = '\0';
+  return length;
 }
 
 int32_t AsinXLookUpTable(uint16_t x)
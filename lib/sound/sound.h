@@ -2,6 +2,20 @@
 #define SOUND_H
 
 #include <cstdint>
+#include "noteevents.h"
+
+const uint8_t SOUND_OCTAVES = 8; // Octaves 0-7 in a SoundStatus, the keys play 1-7
+
+struct SoundStatus
+/*
+ * Snapshot of what the SoundGenerator is playing, a plain copy so taking it never allocates
+ */
+{
+  uint16_t held[SOUND_OCTAVES]; // Notes held (not echoing) in each octave, bit n for note n (0 = C)
+  uint8_t voices;               // Voices in use, including the echoes
+  uint8_t waveform;             // 0 = sawtooth
+  bool bandLimited;             // The waveform uses its band-limited variant
+};
 
 struct Voice
 {
@@ -22,6 +36,9 @@ struct Voice
   int32_t phaseAcc;
   int32_t stepSize;
 
+  // Band-limited sawtooth and square (phaseAcc holds the output)
+  uint32_t phase;
+
   // Square
   uint16_t cyclesPerHalfPeriod;
   uint8_t waveCount;
@@ -46,8 +63,41 @@ private:
   // What waveform to produce - 0 = sawtooth
   volatile uint8_t waveform = 0;
 
+  // Which waveforms use their band-limited variant - bit n set for waveform n
+  volatile uint8_t bandLimited = 0;
+
   volatile uint32_t globalLifetime;
 
+  // Joystick x offset from its centre, in 10 bit ADC counts - positive bends the pitch down
+  volatile int32_t pitchBend = 0;
+
+  // Notes of other modules, applied at the start of each sample
+  NoteEventRing noteEvents;
+
+  // Timestamp of the last note event applied, for latency tracing
+  volatile uint32_t lastApplied = 0;
+
+  // Voices mixed into the last sample, for the load meter
+  volatile uint8_t voicesPlaying = 0;
+
+  void startVoice(uint8_t octave, uint8_t note);
+  /*
+   * Starts a note in the first free voice, the caller must stop getVout() running at the same time
+   *
+   * :param octave: the octave of the key (1-7)
+   *
+   * :param note: the note of the key (0-11)
+   */
+
+  void echoVoice(uint8_t octave, uint8_t note);
+  /*
+   * Starts the echo of every voice playing a note, the caller must stop getVout() running at the same time
+   *
+   * :param octave: the octave of the key (1-7)
+   *
+   * :param note: the note of the key (0-11)
+   */
+
 public:
   SoundGenerator();
   /*
@@ -83,10 +133,60 @@ public:
    *
    */
 
+  bool queueKeyChanges(uint8_t octave, uint16_t toPress, uint16_t toRelease, uint32_t timestamp);
+  /*
+   * Queues the notes of a key events message from another module, applied by getVout() before the next sample
+   * Lock-free, for the CAN receive interrupt; a task must mask that interrupt while calling it
+   *
+   * :param octave: the octave of the notes
+   *
+   * :param toPress: mask of the notes to start
+   *
+   * :param toRelease: mask of the notes to release, they echo like a local key release
+   *
+   * :param timestamp: time the message was received, in microseconds
+   *
+   * :return: false if the queue was full and none of the notes were queued
+   */
+
+  uint32_t getDroppedNoteEvents();
+  /*
+   * :return: number of queueKeyChanges() calls that were dropped because the queue was full
+   */
+
+  uint32_t getLastApplied();
+  /*
+   * Atomically loads the timestamp of the last queued note getVout() applied
+   *
+   * :return: the timestamp passed to queueKeyChanges() with the note
+   */
+
+  uint8_t getVoiceCount();
+  /*
+   * :return: number of voices in use, including the echoes
+   */
+
+  uint8_t getVoicesPlaying();
+  /*
+   * Atomically loads the number of voices getVout() mixed into the last sample, without masking it
+   *
+   * :return: voices in the last sample, including the echoes
+   */
+
+  bool isPlaying(uint8_t octave, uint8_t note);
+  /*
+   * :param octave: the octave of the key (1-7)
+   *
+   * :param note: the note of the key (0-11)
+   *
+   * :return: true if a voice is playing the note and it hasn't been released
+   */
+
   // Should only be called from an ISR
   int32_t getVout();
   /*
-   * Calculates the output voltage for the sound based on the keys pressed and waveform
+   * Applies the queued notes of other modules, then calculates the output voltage for the sound based on the keys
+   * pressed and waveform
    *
    * :return: the output voltage (pre volume shifting and dc-offset addition)
    */
@@ -105,6 +205,24 @@ public:
    * :param wf: the waveform id number (0-0)
    */
 
+  bool getBandLimited(uint8_t wf);
+  /*
+   * Atomically loads whether a waveform uses its band-limited variant
+   *
+   * :param wf: the waveform id number (0-3)
+   *
+   * :return: true if the band-limited variant is selected
+   */
+
+  void setBandLimited(uint8_t wf, bool enabled);
+  /*
+   * Atomically selects the band-limited or naive variant of a waveform, only sawtooth (0) and square (2) have one
+   *
+   * :param wf: the waveform id number (0-3)
+   *
+   * :param enabled: true to select the band-limited variant
+   */
+
   uint32_t getGlobalLifeTime();
   /*
    * Atomically loads the current globalLifeTime
@@ -119,6 +237,20 @@ public:
    * :param wf: the life time in seconds
    */
 
+  int32_t getPitchBend();
+  /*
+   * Atomically loads the current pitch bend
+   *
+   * :return: the joystick x offset from its centre, in 10 bit ADC counts
+   */
+
+  void setPitchBend(int32_t bend);
+  /*
+   * Atomically stores the pitch bend
+   *
+   * :param bend: the joystick x offset from its centre, in 10 bit ADC counts
+   */
+
   void sawtooth(uint8_t voiceIndx);
   /*
    * Produces a sawtooth Vout for a specific note related to a specific voice
@@ -128,6 +260,15 @@ public:
    * :return: Vout for that specific voice that needs shifting and volume adjustment
    */
 
+  void sawtoothBandLimited(uint8_t voiceIndx);
+  /*
+   * Produces a PolyBLEP band-limited sawtooth Vout for a specific note related to a specific voice
+   *
+   * :param voiceIndx: index of the specific voice that has already been checked if free
+   *
+   * :return: Vout for that specific voice that needs shifting and volume adjustment
+   */
+
   void sine(uint8_t voiceIndx);
   /*
    * Produces a sine Vout for a specific note related to a specific voice
@@ -146,6 +287,24 @@ public:
    * :return: Vout for that specific voice that needs shifting and volume adjustment
    */
 
+  void squareBandLimited(uint8_t voiceIndx);
+  /*
+   * Produces a PolyBLEP band-limited square Vout for a specific note related to a specific voice
+   *
+   * :param voiceIndx: index of the specific voice that has already been checked if free
+   *
+   * :return: Vout for that specific voice that needs shifting and volume adjustment
+   */
+
+  int32_t getStepSize(uint8_t voiceIndx);
+  /*
+   * Gets the phase step size of a voice's note and octave, including the joystick pitch shift
+   *
+   * :param voiceIndx: index of the specific voice that has already been checked if free
+   *
+   * :return: shifted step size
+   */
+
   void triangular(uint8_t voiceIndx);
   /*
    * Produces a triangular Vout for a specific note related to a specific voice
@@ -155,18 +314,35 @@ public:
    * :return: Vout for that specific voice that needs shifting and volume adjustment
    */
 
-  std::string getCurrentNotes();
+  void getStatus(SoundStatus &status);
   /*
-   * Gets the names of the current notes being played
+   * Takes a snapshot of the notes being played, masking the sample interrupt only for one pass over the voices
    *
-   * :return: string of current notes, space separated
+   * :param status: set to the snapshot
    */
 };
 
-int32_t getShift(int32_t currentVoiceStepSize);
+uint8_t formatNotes(const SoundStatus &status, char *dest, uint8_t size);
+/*
+ * Writes the names of the held notes, lowest first and each followed by a space (e.g. "C4 E4 G4 ")
+ * Names that don't fit whole are left out.
+ *
+ * :param status: snapshot from SoundGenerator::getStatus()
+ *
+ * :param dest: set to the names, always terminated
+ *
+ * :param size: size of dest, including the terminator
+ *
+ * :return: number of characters written, excluding the terminator
+ */
+
+int32_t getShift(int32_t currentVoiceStepSize, int32_t pitchBend);
 /*
  * Gets shift caused by movement in joystick x axis, applies shift to the current step size.
- * Note: function only gets called from a the interupt function sampleISR(), and therefore global variables can be accessed with no worry about synchronisation erros
+ *
+ * :param currentVoiceStepSize: step size of the voice without any pitch bend
+ *
+ * :param pitchBend: the joystick x offset from its centre, in 10 bit ADC counts
  *
  * :return: shifted step size.
  */
@@ -0,0 +1,20 @@
+#include <cstdint>
+
+#ifndef TUNING_H
+#define TUNING_H
+
+/*
+ * Tuning tables of the 12 notes of octave 4, shared by the SoundGenerator on the board and the host tests
+ */
+
+// Step sizes
+const int32_t stepSizes[] = {51076056, 54113197, 57330935, 60740010, 64351798, 68178356, 72232452, 76527617, 81078186, 85899345, 91007186, 96418755};
+
+// Notes
+const char *const notes[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+
+// Frequencies
+const int16_t sampleFrequency = 22000;
+const int32_t frequencies[] = {262, 277, 294, 311, 330, 349, 370, 392, 415, 440, 466, 494};
+
+#endif
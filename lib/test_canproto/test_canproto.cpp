@@ -0,0 +1,413 @@
+#include <unity.h>
+#include <cstdio>
+#include "canproto.h"
+#include "test_random.h"
+#include "test_canproto.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+// Messages built at compile time, the encoder is usable in constant expressions
+constexpr Frame discoveryFrame = encodeMessage(0x2A, 7, DiscoveryMessage{0x2A, 3, 6, 1});
+static_assert(discoveryFrame.data[0] == PROTOCOL_VERSION, "version is the first byte");
+static_assert(discoveryFrame.data[1] == MSG_DISCOVERY && discoveryFrame.data[2] == 0x2A && discoveryFrame.data[3] == 7, "header");
+static_assert(decodeMessage<DiscoveryMessage>(discoveryFrame.data).position == 3, "position round trip");
+static_assert(isSupported(decodeHeader(discoveryFrame.data)), "own frames are supported");
+static_assert(decodeMessage<KeyEventsMessage>(encodeMessage(1, 0, KeyEventsMessage{5, 0x0011, 0x0810, 0}).data).changed == 0x0810,
+              "key events round trip");
+
+void test_CanProto(void)
+/*
+ * Tests all CAN protocol testing functions
+ */
+{
+    RUN_TEST(test_messageRoundTrip);
+    RUN_TEST(test_messageLayout);
+    RUN_TEST(test_messageIds);
+    RUN_TEST(test_sequenceTracker);
+    RUN_TEST(test_sequenceTrackerReplacement);
+    RUN_TEST(test_messageDispatcher);
+    RUN_TEST(test_dispatcherFuzz);
+    RUN_TEST(test_decodeCost);
+}
+
+void test_messageRoundTrip(void)
+/*
+ * tests every message type survives encoding and decoding with random fields
+ */
+{
+    uint32_t random = 42;
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        uint8_t module = nextRandom(random);
+        uint8_t sequence = nextRandom(random);
+
+        KeyEventsMessage keys{(uint8_t)(nextRandom(random) & 0x0F), (uint16_t)(nextRandom(random) & 0x0FFF),
+                              (uint16_t)(nextRandom(random) & 0x0FFF), 0};
+        Frame frame = encodeMessage(module, sequence, keys);
+        MessageHeader header = decodeHeader(frame.data);
+        TEST_ASSERT_TRUE(isSupported(header));
+        TEST_ASSERT_EQUAL_UINT8(MSG_KEY_EVENTS, header.type);
+        TEST_ASSERT_EQUAL_UINT8(module, header.module);
+        TEST_ASSERT_EQUAL_UINT8(sequence, header.sequence);
+        KeyEventsMessage keysOut = decodeMessage<KeyEventsMessage>(frame.data);
+        TEST_ASSERT_EQUAL_UINT8(keys.octave, keysOut.octave);
+        TEST_ASSERT_EQUAL_HEX16(keys.pressed, keysOut.pressed);
+        TEST_ASSERT_EQUAL_HEX16(keys.changed, keysOut.changed);
+        TEST_ASSERT_EQUAL_UINT8(0, keysOut.traced);
+
+        DiscoveryMessage discovery{(uint8_t)nextRandom(random), (uint8_t)nextRandom(random), (uint8_t)nextRandom(random),
+                                   (uint8_t)(nextRandom(random) & 0x01)};
+        frame = encodeMessage(module, sequence, discovery);
+        TEST_ASSERT_EQUAL_UINT8(MSG_DISCOVERY, decodeHeader(frame.data).type);
+        DiscoveryMessage discoveryOut = decodeMessage<DiscoveryMessage>(frame.data);
+        TEST_ASSERT_EQUAL_UINT8(discovery.chain, discoveryOut.chain);
+        TEST_ASSERT_EQUAL_UINT8(discovery.position, discoveryOut.position);
+        TEST_ASSERT_EQUAL_UINT8(discovery.octave, discoveryOut.octave);
+        TEST_ASSERT_EQUAL_UINT8(discovery.more, discoveryOut.more);
+
+        frame = encodeMessage(module, sequence, TransmitterMessage{});
+        TEST_ASSERT_EQUAL_UINT8(MSG_TRANSMITTER, decodeHeader(frame.data).type);
+        TEST_ASSERT_EQUAL_UINT8(module, decodeHeader(frame.data).module);
+
+        TraceMessage trace{(uint16_t)nextRandom(random), (uint16_t)nextRandom(random)};
+        frame = encodeMessage(module, sequence, trace);
+        TEST_ASSERT_EQUAL_UINT8(MSG_TRACE, decodeHeader(frame.data).type);
+        TEST_ASSERT_EQUAL_UINT16(trace.sent, decodeMessage<TraceMessage>(frame.data).sent);
+        TEST_ASSERT_EQUAL_UINT16(trace.age, decodeMessage<TraceMessage>(frame.data).age);
+
+        uint8_t policy = nextRandom(random);
+        frame = encodeMessage(module, sequence, PolyphonyMessage{policy});
+        TEST_ASSERT_EQUAL_UINT8(MSG_POLYPHONY, decodeHeader(frame.data).type);
+        TEST_ASSERT_EQUAL_UINT8(policy, decodeMessage<PolyphonyMessage>(frame.data).policy);
+
+        SyncMessage sync{nextRandom(random) & 0xFFFFFF, (uint8_t)(nextRandom(random) & 0x01)};
+        frame = encodeMessage(module, sequence, sync);
+        TEST_ASSERT_EQUAL_UINT8(MSG_SYNC, decodeHeader(frame.data).type);
+        TEST_ASSERT_EQUAL_HEX32(sync.high, decodeMessage<SyncMessage>(frame.data).high);
+        TEST_ASSERT_EQUAL_UINT8(sync.traced, decodeMessage<SyncMessage>(frame.data).traced);
+
+        uint32_t sent = nextRandom(random) ^ (nextRandom(random) << 24);
+        frame = encodeMessage(module, sequence, SyncTimeMessage{sent});
+        TEST_ASSERT_EQUAL_UINT8(MSG_SYNC_TIME, decodeHeader(frame.data).type);
+        TEST_ASSERT_EQUAL_HEX32(sent, decodeMessage<SyncTimeMessage>(frame.data).sent);
+    }
+
+    // Bits above the 12 notes are dropped
+    KeyEventsMessage keysOut = decodeMessage<KeyEventsMessage>(encodeMessage(1, 0, KeyEventsMessage{4, 0xFFFF, 0xF001, 0}).data);
+    TEST_ASSERT_EQUAL_HEX16(0x0FFF, keysOut.pressed);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, keysOut.changed);
+
+    // The traced flag is the top bit, so untraced frames are unchanged
+    keysOut = decodeMessage<KeyEventsMessage>(encodeMessage(1, 0, KeyEventsMessage{4, 0x0011, 0x0010, 1}).data);
+    TEST_ASSERT_EQUAL_UINT8(1, keysOut.traced);
+    TEST_ASSERT_EQUAL_UINT8(4, keysOut.octave);
+    TEST_ASSERT_EQUAL_HEX16(0x0011, keysOut.pressed);
+}
+
+void test_messageLayout(void)
+/*
+ * tests the byte layout of the header and of a key events message
+ */
+{
+    // C and E held, E and B changed (B released)
+    Frame frame = encodeMessage(0x5C, 200, KeyEventsMessage{5, 0x0011, 0x0810, 0});
+    const uint8_t expected[8] = {PROTOCOL_VERSION, MSG_KEY_EVENTS, 0x5C, 200, 0x11, 0x00, 0x81, 0x05};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, frame.data, 8);
+
+    // The sequence number is stamped last, without touching the rest of the frame
+    setSequence(frame, 201);
+    TEST_ASSERT_EQUAL_UINT8(201, frame.data[3]);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected + 4, frame.data + 4, 4);
+
+    // Unused payload bytes are 0
+    frame = encodeMessage(0x5C, 0, TransmitterMessage{});
+    const uint8_t empty[4] = {0, 0, 0, 0};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(empty, frame.data + 4, 4);
+
+    // Other versions, unknown types and the frames of the old protocol are not supported
+    frame.data[0] = PROTOCOL_VERSION + 1;
+    TEST_ASSERT_FALSE(isSupported(decodeHeader(frame.data)));
+    const uint8_t unknown[8] = {PROTOCOL_VERSION, MSG_TYPES, 1, 0, 0, 0, 0, 0};
+    TEST_ASSERT_FALSE(isSupported(decodeHeader(unknown)));
+    const uint8_t legacy[8] = {'P', 4, 3, 0, 0, 0, 0, 0};
+    TEST_ASSERT_FALSE(isSupported(decodeHeader(legacy)));
+}
+
+void test_messageIds(void)
+/*
+ * tests the class and module are packed into the CAN ID, and notes win arbitration over control messages
+ */
+{
+    TEST_ASSERT_EQUAL_HEX16(0x02A, messageId(KeyEventsMessage::messageClass, 0x2A));
+    TEST_ASSERT_EQUAL_HEX16(0x42A, messageId(DiscoveryMessage::messageClass, 0x2A));
+    TEST_ASSERT_EQUAL_UINT8(CLASS_CONTROL, idClass(messageId(TransmitterMessage::messageClass, 0xFF)));
+    TEST_ASSERT_EQUAL_UINT8(CLASS_NOTES, idClass(messageId(KeyEventsMessage::messageClass, 0xFF)));
+
+    // Every module's notes have a lower ID than any control message, and the filter mask only looks at the class
+    TEST_ASSERT_LESS_THAN_UINT16(messageId(CLASS_CONTROL, 0), messageId(CLASS_NOTES, 0xFF));
+    TEST_ASSERT_LESS_THAN_UINT16(messageId(CLASS_CONTROL, 0), messageId(SyncMessage::messageClass, 0xFF));
+    TEST_ASSERT_LESS_THAN_UINT16(messageId(CLASS_CLOCK, 0), messageId(CLASS_NOTES, 0xFF));
+    TEST_ASSERT_EQUAL_HEX16(messageId(CLASS_CONTROL, 0), messageId(CLASS_CONTROL, 0x55) & CLASS_ID_MASK);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT16(0x7FF, messageId(7, 0xFF));
+}
+
+void test_sequenceTracker(void)
+/*
+ * tests gaps, duplicates and restarts in the sequence numbers of each sender
+ */
+{
+    SequenceTracker tracker;
+
+    TEST_ASSERT_EQUAL(SEQ_FIRST, tracker.update(1, 250));
+    TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(1, 251));
+
+    // Senders are independent
+    TEST_ASSERT_EQUAL(SEQ_FIRST, tracker.update(2, 10));
+    TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(2, 11));
+
+    // Wrapping around is in order, skipping 3 numbers is a gap
+    for (uint16_t sequence = 252; sequence <= 256 + 3; sequence++)
+    {
+        TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(1, sequence & 0xFF));
+    }
+    TEST_ASSERT_EQUAL(SEQ_GAP, tracker.update(1, 7));
+    TEST_ASSERT_EQUAL_UINT32(3, tracker.getLost());
+
+    // Repeats within the window are duplicates, and leave the expected number alone
+    TEST_ASSERT_EQUAL(SEQ_DUPLICATE, tracker.update(1, 7));
+    TEST_ASSERT_EQUAL(SEQ_DUPLICATE, tracker.update(1, 8 - SEQUENCE_WINDOW));
+    TEST_ASSERT_EQUAL_UINT32(2, tracker.getDuplicates());
+    TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(1, 8));
+
+    // Far behind means the sender restarted, counting starts again from there
+    TEST_ASSERT_EQUAL(SEQ_FIRST, tracker.update(1, 9 - SEQUENCE_WINDOW - 1));
+    TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(1, 9 - SEQUENCE_WINDOW));
+    TEST_ASSERT_EQUAL_UINT32(3, tracker.getLost());
+    TEST_ASSERT_EQUAL_UINT32(2, tracker.getDuplicates());
+}
+
+void test_sequenceTrackerReplacement(void)
+/*
+ * tests the oldest sender is replaced once the table is full
+ */
+{
+    SequenceTracker tracker;
+
+    for (uint8_t module = 0; module < SEQUENCE_MODULES; module++)
+    {
+        TEST_ASSERT_EQUAL(SEQ_FIRST, tracker.update(module, 0));
+    }
+    for (uint8_t module = 0; module < SEQUENCE_MODULES; module++)
+    {
+        TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(module, 1));
+    }
+
+    // A new sender takes the place of module 0, which is new again when it next sends
+    TEST_ASSERT_EQUAL(SEQ_FIRST, tracker.update(SEQUENCE_MODULES, 0));
+    TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(1, 2));
+    TEST_ASSERT_EQUAL(SEQ_FIRST, tracker.update(0, 2));
+    TEST_ASSERT_EQUAL(SEQ_IN_ORDER, tracker.update(SEQUENCE_MODULES, 1));
+
+    // Module 0 in turn replaced module 1, the next oldest
+    TEST_ASSERT_EQUAL(SEQ_FIRST, tracker.update(1, 3));
+    TEST_ASSERT_EQUAL_UINT32(0, tracker.getLost());
+}
+
+static uint32_t keyEventsHandled;
+static uint32_t discoveryHandled;
+static KeyEventsMessage lastKeyEvents;
+static MessageHeader lastHeader;
+
+static void onKeyEvents(const MessageHeader &header, const KeyEventsMessage &message)
+{
+    keyEventsHandled++;
+    lastHeader = header;
+    lastKeyEvents = message;
+}
+
+static void onDiscovery(const MessageHeader &header, const DiscoveryMessage &message)
+{
+    discoveryHandled++;
+    lastHeader = header;
+}
+
+static uint32_t rawHandled;
+
+static void onRawFrame(const MessageHeader &header, const uint8_t *data)
+{
+    rawHandled++;
+    lastHeader = header;
+}
+
+void test_messageDispatcher(void)
+/*
+ * tests frames reach the handler of their type, and unsupported frames and duplicates are dropped
+ */
+{
+    MessageDispatcher dispatcher;
+    dispatcher.on<KeyEventsMessage, onKeyEvents>();
+    dispatcher.on<DiscoveryMessage, onDiscovery>();
+    keyEventsHandled = 0;
+    discoveryHandled = 0;
+
+    Frame frame = encodeMessage(9, 0, KeyEventsMessage{3, 0x0100, 0x0100, 0});
+    TEST_ASSERT_EQUAL(DISPATCH_HANDLED, dispatcher.dispatch(frame.data));
+    TEST_ASSERT_EQUAL_UINT32(1, keyEventsHandled);
+    TEST_ASSERT_EQUAL_UINT8(9, lastHeader.module);
+    TEST_ASSERT_EQUAL_UINT8(3, lastKeyEvents.octave);
+    TEST_ASSERT_EQUAL_HEX16(0x0100, lastKeyEvents.pressed);
+
+    frame = encodeMessage(9, 1, DiscoveryMessage{9, 0, 3, 1});
+    TEST_ASSERT_EQUAL(DISPATCH_HANDLED, dispatcher.dispatch(frame.data));
+    TEST_ASSERT_EQUAL_UINT32(1, discoveryHandled);
+
+    // The same frame again is dropped before reaching the handler
+    TEST_ASSERT_EQUAL(DISPATCH_DUPLICATE, dispatcher.dispatch(frame.data));
+    TEST_ASSERT_EQUAL_UINT32(1, discoveryHandled);
+    TEST_ASSERT_EQUAL_UINT32(1, dispatcher.getSequences().getDuplicates());
+
+    // No handler registered for transmitter messages
+    frame = encodeMessage(9, 2, TransmitterMessage{});
+    TEST_ASSERT_EQUAL(DISPATCH_UNHANDLED, dispatcher.dispatch(frame.data));
+
+    // Frames from the old protocol are counted and dropped, without affecting the sequence numbers
+    const uint8_t legacy[8] = {'K', 4, 0x11, 0, 0x10, 0, 0, 0};
+    TEST_ASSERT_EQUAL(DISPATCH_UNSUPPORTED, dispatcher.dispatch(legacy));
+    TEST_ASSERT_EQUAL_UINT32(1, dispatcher.getUnsupported());
+    TEST_ASSERT_EQUAL_UINT32(1, keyEventsHandled);
+
+    // A lost frame shows as a gap
+    frame = encodeMessage(9, 5, KeyEventsMessage{3, 0, 0x0100, 0});
+    TEST_ASSERT_EQUAL(DISPATCH_HANDLED, dispatcher.dispatch(frame.data));
+    TEST_ASSERT_EQUAL_UINT32(2, dispatcher.getSequences().getLost());
+
+    // Raw handlers receive the frame itself, e.g. to defer it to a task
+    dispatcher.on(MSG_TRANSMITTER, onRawFrame);
+    rawHandled = 0;
+    frame = encodeMessage(9, 6, TransmitterMessage{});
+    TEST_ASSERT_EQUAL(DISPATCH_HANDLED, dispatcher.dispatch(frame.data));
+    TEST_ASSERT_EQUAL_UINT32(1, rawHandled);
+    TEST_ASSERT_EQUAL_UINT8(MSG_TRANSMITTER, lastHeader.type);
+
+    // Handling a deferred frame again skips the sequence check, so it isn't a duplicate
+    TEST_ASSERT_EQUAL(DISPATCH_HANDLED, dispatcher.handle(frame.data));
+    TEST_ASSERT_EQUAL_UINT32(2, rawHandled);
+    TEST_ASSERT_EQUAL_UINT32(1, dispatcher.getSequences().getDuplicates());
+    TEST_ASSERT_EQUAL(DISPATCH_UNSUPPORTED, dispatcher.handle(legacy));
+}
+
+void test_dispatcherFuzz(void)
+/*
+ * feeds random frames to the dispatcher, checking every frame is accounted for
+ */
+{
+#ifdef ARDUINO
+    const uint32_t frames = 20000;
+#else
+    const uint32_t frames = 1000000;
+#endif
+    MessageDispatcher dispatcher;
+    dispatcher.on<KeyEventsMessage, onKeyEvents>();
+    dispatcher.on<DiscoveryMessage, onDiscovery>();
+    keyEventsHandled = 0;
+    discoveryHandled = 0;
+
+    uint32_t counts[4] = {0};
+    uint32_t random = 7;
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        uint8_t data[8];
+        for (uint8_t b = 0; b < 8; b++)
+        {
+            data[b] = nextRandom(random);
+        }
+        // Half the frames get a valid version and a small set of senders, so the handlers and tracker are exercised
+        if (nextRandom(random) & 1)
+        {
+            data[0] = PROTOCOL_VERSION;
+            data[1] = data[1] % (MSG_TYPES + 1);
+            data[2] = data[2] % (SEQUENCE_MODULES + 4);
+        }
+
+        DispatchResult result = dispatcher.dispatch(data);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(DISPATCH_UNHANDLED, result);
+        counts[result]++;
+        if (result == DISPATCH_HANDLED && data[1] == MSG_KEY_EVENTS)
+        {
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(0x0F, lastKeyEvents.octave);
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(0x0FFF, lastKeyEvents.pressed);
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(0x0FFF, lastKeyEvents.changed);
+        }
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u frames: %u handled, %u unsupported, %u duplicate, %u unhandled, %u lost",
+             (unsigned)frames, (unsigned)counts[DISPATCH_HANDLED], (unsigned)counts[DISPATCH_UNSUPPORTED],
+             (unsigned)counts[DISPATCH_DUPLICATE], (unsigned)counts[DISPATCH_UNHANDLED],
+             (unsigned)dispatcher.getSequences().getLost());
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(frames, counts[0] + counts[1] + counts[2] + counts[3]);
+    TEST_ASSERT_EQUAL_UINT32(counts[DISPATCH_HANDLED], keyEventsHandled + discoveryHandled);
+    TEST_ASSERT_EQUAL_UINT32(counts[DISPATCH_UNSUPPORTED], dispatcher.getUnsupported());
+    TEST_ASSERT_EQUAL_UINT32(counts[DISPATCH_DUPLICATE], dispatcher.getSequences().getDuplicates());
+    TEST_ASSERT_GREATER_THAN(0, keyEventsHandled);
+    TEST_ASSERT_GREATER_THAN(0, counts[DISPATCH_DUPLICATE]);
+}
+
+void test_decodeCost(void)
+/*
+ * benchmarks the cost of checking and dispatching one frame
+ */
+{
+#ifdef ARDUINO
+    const uint32_t frames = 2000;
+    const char *unit = "cycles";
+#else
+    const uint32_t frames = 200000;
+    const char *unit = "ns";
+#endif
+
+    // A chord's worth of key events from four transmitters, in order
+    Frame pending[16];
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        pending[i] = encodeMessage(i % 4 + 1, 0, KeyEventsMessage{(uint8_t)(i % 4 + 2), (uint16_t)(0x0091 << (i % 3)), 0x0001, 0});
+    }
+    MessageDispatcher dispatcher;
+    dispatcher.on<KeyEventsMessage, onKeyEvents>();
+    keyEventsHandled = 0;
+
+#ifdef ARDUINO
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t start = DWT->CYCCNT;
+#else
+    auto start = std::chrono::steady_clock::now();
+#endif
+
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        Frame &frame = pending[i % 16];
+        setSequence(frame, i / 4);
+        dispatcher.dispatch(frame.data);
+    }
+
+#ifdef ARDUINO
+    uint64_t elapsed = DWT->CYCCNT - start;
+#else
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+    uint32_t cost = (uint32_t)(elapsed * 100 / frames);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s per frame: %u.%02u", unit, (unsigned)(cost / 100), (unsigned)(cost % 100));
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(frames, keyEventsHandled);
+    TEST_ASSERT_EQUAL_UINT32(0, dispatcher.getSequences().getLost());
+}
@@ -0,0 +1,51 @@
+#include <cstdint>
+
+#ifndef TEST_CANPROTO_H
+#define TEST_CANPROTO_H
+
+void test_CanProto(void);
+/*
+ * Tests all CAN protocol testing functions
+ */
+
+void test_messageRoundTrip(void);
+/*
+ * tests every message type survives encoding and decoding with random fields
+ */
+
+void test_messageLayout(void);
+/*
+ * tests the byte layout of the header and of a key events message
+ */
+
+void test_messageIds(void);
+/*
+ * tests the class and module are packed into the CAN ID, and notes win arbitration over control messages
+ */
+
+void test_sequenceTracker(void);
+/*
+ * tests gaps, duplicates and restarts in the sequence numbers of each sender
+ */
+
+void test_sequenceTrackerReplacement(void);
+/*
+ * tests the oldest sender is replaced once the table is full
+ */
+
+void test_messageDispatcher(void);
+/*
+ * tests frames reach the handler of their type, and unsupported frames and duplicates are dropped
+ */
+
+void test_dispatcherFuzz(void);
+/*
+ * feeds random frames to the dispatcher, checking every frame is accounted for
+ */
+
+void test_decodeCost(void);
+/*
+ * benchmarks the cost of checking and dispatching one frame
+ */
+
+#endif
@@ -0,0 +1,616 @@
+#include <unity.h>
+#include <cstdio>
+#include "test_random.h"
+#include "test_cansim.h"
+
+#ifndef ARDUINO
+#include <chrono>
+#include <thread>
+#include <ES_CAN.h>
+#include "sim_can_bus.h"
+#include "canproto.h"
+#include "cantiming.h"
+#include "cantx.h"
+#include "hal_can_mailboxes.h"
+#include "latency.h"
+
+static bool simWaitSent(SimCanNode &node, uint32_t frames)
+/*
+ * Waits for a node to have transmitted a number of frames, each delivered as it completes
+ *
+ * :param node: the transmitting node
+ *
+ * :param frames: frames it must have transmitted
+ *
+ * :return: false if it took more than a second
+ */
+{
+    for (uint32_t i = 0; i < 10000 && node.getSent() < frames; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return node.getSent() >= frames;
+}
+
+static void simStartNode(SimCanNode &node, bool loopback = false)
+/*
+ * Binds the calling thread to a node and starts it, as setup() starts the CAN peripheral
+ *
+ * :param node: the node
+ *
+ * :param loopback: starts the node in loopback mode
+ */
+{
+    node.bind();
+    CAN_Init(loopback);
+    CAN_Start();
+}
+
+/* --- Modules --- */
+
+struct SimSynth
+/*
+ * The CAN side of one module as in main.cpp: a node, the transmit ring filled by the key scan and emptied by the
+ * transmit interrupt, and the receive interrupt dispatching key events
+ */
+{
+    SimCanNode node;
+    HalCanMailboxes mailboxes;
+    CanTxRing txRing;
+    MessageDispatcher dispatcher;
+    uint8_t module;
+    uint32_t scanned[256]; // Time each key events message was scanned, by sequence number
+    uint32_t messages = 0; // Key events messages queued
+    uint32_t maxQueued = 0;
+
+    SimSynth(SimCanBus &bus, uint8_t moduleId) : node(bus), txRing(mailboxes), module(moduleId)
+    {
+    }
+};
+
+// Set before the bus starts, the histograms and count are only used by the receive interrupts on the bus thread
+static SimCanBus *simBus;
+static SimSynth *simSynths[SIM_CAN_NODES];
+static uint8_t simLowest;                // Index of the module with the lowest priority
+static LatencyHistogram simLatency;      // Scan to the receive interrupt, every transmitter and receiver
+static LatencyHistogram simLowestLatency; // Scan to the receive interrupt, frames of the lowest priority module
+static uint32_t simEvents;
+static uint32_t simBound; // Analysed worst case latency of the lowest priority module
+static uint32_t simLate;  // Frames of the lowest priority module received later than simBound
+
+static void simOnKeyEvents(const MessageHeader &header, const KeyEventsMessage &message)
+/*
+ * Times a key events message from its scan on the transmitter, runs in the receive interrupt
+ */
+{
+    uint8_t transmitter = header.module - 1;
+    uint32_t latency = simBus->micros() - simSynths[transmitter]->scanned[header.sequence];
+    simLatency.record(latency);
+    if (transmitter == simLowest)
+    {
+        simLowestLatency.record(latency);
+        simLate += latency > simBound;
+    }
+    simEvents++;
+}
+
+static void simRxIsr()
+/*
+ * Receive interrupt of every module, like CAN_RX_ISR
+ */
+{
+    SimSynth &synth = *simSynths[simCanNode()->getIndex()];
+    uint8_t data[8];
+    uint32_t id;
+    while (CAN_CheckRXLevel())
+    {
+        CAN_RX(id, data);
+        synth.dispatcher.dispatch(data);
+    }
+}
+
+static void simTxIsr()
+/*
+ * Transmit interrupt of every module, like CAN_TX_ISR without tracing
+ */
+{
+    simSynths[simCanNode()->getIndex()]->txRing.pump(simBus->micros());
+}
+
+static void simScan(SimSynth &synth, uint32_t &random, uint16_t &pressed)
+/*
+ * One key scan of a module, queuing a key events message with random keys
+ *
+ * :param synth: the module, bound to the calling thread
+ *
+ * :param random: generator state of the module, updated
+ *
+ * :param pressed: keys pressed at the last scan, updated
+ */
+{
+    uint16_t keys = nextRandom(random) & 0x0FFF;
+    synth.scanned[(uint8_t)synth.messages] = simBus->micros();
+    if (synth.txRing.send(synth.module, KeyEventsMessage{4, keys, (uint16_t)(keys ^ pressed), 0}))
+    {
+        synth.messages++;
+    }
+    pressed = keys;
+    uint32_t queued = synth.txRing.getQueued();
+    synth.maxQueued = queued > synth.maxQueued ? queued : synth.maxQueued;
+}
+
+static void simScanTask(SimSynth *synth, uint32_t interval, volatile bool *running)
+/*
+ * Key scan of a module on its own thread, every interval of the host's clock
+ *
+ * :param synth: the module
+ *
+ * :param interval: time between messages in microseconds
+ *
+ * :param running: the task returns once it is cleared
+ */
+{
+    synth->node.bind();
+    uint32_t random = synth->module;
+    uint16_t pressed = 0;
+
+    // The modules' scans are not in step, so they start at a random point of the interval
+    std::chrono::steady_clock::time_point next =
+        std::chrono::steady_clock::now() + std::chrono::microseconds(nextRandom(random) % interval);
+    while (__atomic_load_n(running, __ATOMIC_RELAXED))
+    {
+        next += std::chrono::microseconds(interval);
+        std::this_thread::sleep_until(next);
+        simScan(*synth, random, pressed);
+    }
+}
+
+static bool simIdle(SimSynth *synths[], uint8_t count)
+/*
+ * :return: true once every module's transmit ring and mailboxes are empty
+ */
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (synths[i]->txRing.getQueued() || synths[i]->node.txFreeLevel() != SIM_CAN_MAILBOXES)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct SimRun
+/*
+ * Results of running modules on the bus
+ */
+{
+    uint32_t messages;  // Key events messages queued by every module
+    uint32_t dropped;   // Messages dropped from full transmit rings
+    uint32_t framesPerSecond;
+    uint32_t load;      // Percent of the time the bus was busy
+    uint32_t maxQueued; // Most frames waiting in one transmit ring
+    uint8_t maxMailboxes;
+    uint8_t maxRxLevel;
+    uint32_t overruns;
+    uint32_t highestDropped; // Messages dropped by the module with the highest priority
+    uint32_t lowestDropped;  // Messages dropped by the module with the lowest priority
+};
+
+static void simModules(uint8_t count, uint32_t interval, uint32_t duration, SimRun &run, bool realTime = false)
+/*
+ * Runs modules sending key events to each other on a bus at 125kbit/s, until every queued message is delivered
+ *
+ * :param count: number of modules
+ *
+ * :param interval: time between the messages of each module in microseconds
+ *
+ * :param duration: time the modules send for in milliseconds
+ *
+ * :param run: set to the results
+ *
+ * :param realTime: runs the bus and every scan task on their own threads on the host's clock, rather than on a
+ *                  virtual clock from the calling thread, so the results depend on how the host schedules them
+ */
+{
+    SimCanBus bus;
+    simBus = &bus;
+    simLowest = count - 1;
+    simLatency.reset();
+    simLowestLatency.reset();
+    simEvents = 0;
+    simLate = 0;
+
+    // Worst case response of the lowest priority module, on the host's clock allowing for the scan tasks waking up a
+    // little late
+    CanStream streams[SIM_CAN_NODES];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        streams[i] = CanStream{messageId(CLASS_NOTES, i + 1), interval, realTime ? 200u : 0u, 8};
+    }
+    simBound = canResponseTime(streams, count, count - 1, 1000000 / SIM_CAN_BIT_RATE);
+
+    // Module IDs in order of the nodes, so the first has the highest priority
+    SimSynth *synths[SIM_CAN_NODES];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        synths[i] = simSynths[i] = new SimSynth(bus, i + 1);
+        synths[i]->dispatcher.on<KeyEventsMessage, simOnKeyEvents>();
+        simStartNode(synths[i]->node);
+        setCANFilter(messageId(CLASS_NOTES, 0), CLASS_ID_MASK, 0);
+        CAN_RegisterRX_ISR(simRxIsr);
+        CAN_RegisterTX_ISR(simTxIsr);
+    }
+
+    uint32_t frames;
+    uint64_t busyBits;
+    if (realTime)
+    {
+        bus.start();
+        volatile bool running = true;
+        std::thread tasks[SIM_CAN_NODES];
+        for (uint8_t i = 0; i < count; i++)
+        {
+            tasks[i] = std::thread(simScanTask, synths[i], interval, &running);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+        frames = bus.getFrames();
+        busyBits = bus.getBusyBits();
+        __atomic_store_n(&running, false, __ATOMIC_RELAXED);
+        for (uint8_t i = 0; i < count; i++)
+        {
+            tasks[i].join();
+        }
+
+        // Let every ring and mailbox empty before stopping the bus
+        for (uint32_t wait = 0; wait < 3000 && !simIdle(synths, count); wait++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        bus.stop();
+    }
+    else
+    {
+        // Each scan runs on this thread once the bus has caught up with it, in the order they are due
+        uint32_t random[SIM_CAN_NODES];
+        uint16_t pressed[SIM_CAN_NODES] = {0};
+        uint32_t next[SIM_CAN_NODES];
+        for (uint8_t i = 0; i < count; i++)
+        {
+            random[i] = synths[i]->module;
+            next[i] = nextRandom(random[i]) % interval + interval;
+        }
+        while (true)
+        {
+            uint8_t due = 0;
+            for (uint8_t i = 1; i < count; i++)
+            {
+                due = next[i] < next[due] ? i : due;
+            }
+            if (next[due] > duration * 1000)
+            {
+                break;
+            }
+            bus.advance(next[due]);
+            synths[due]->node.bind();
+            simScan(*synths[due], random[due], pressed[due]);
+            next[due] += interval;
+        }
+        bus.advance(duration * 1000);
+        frames = bus.getFrames();
+        busyBits = bus.getBusyBits();
+        for (uint32_t wait = 1; wait <= 3000 && !simIdle(synths, count); wait++)
+        {
+            bus.advance((duration + wait) * 1000);
+        }
+    }
+
+    run = SimRun{};
+    run.framesPerSecond = (uint64_t)frames * 1000 / duration;
+    run.load = busyBits * 1000000 / SIM_CAN_BIT_RATE / 10 / duration;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SimSynth &synth = *synths[i];
+        run.messages += synth.messages;
+        run.dropped += synth.txRing.getDropped();
+        run.maxQueued = synth.maxQueued > run.maxQueued ? synth.maxQueued : run.maxQueued;
+        uint8_t mailboxes = synth.node.getMaxMailboxes();
+        run.maxMailboxes = mailboxes > run.maxMailboxes ? mailboxes : run.maxMailboxes;
+        uint8_t rxLevel = synth.node.getMaxRxLevel();
+        run.maxRxLevel = rxLevel > run.maxRxLevel ? rxLevel : run.maxRxLevel;
+        run.overruns += synth.node.getOverruns();
+    }
+    run.highestDropped = synths[0]->txRing.getDropped();
+    run.lowestDropped = synths[count - 1]->txRing.getDropped();
+    for (uint8_t i = 0; i < count; i++)
+    {
+        simSynths[i] = nullptr;
+        delete synths[i];
+    }
+}
+
+#endif
+
+void test_CanSim(void)
+/*
+ * Tests all simulated CAN bus testing functions, only on the host
+ */
+{
+#ifndef ARDUINO
+    RUN_TEST(test_simCanFrameBits);
+    RUN_TEST(test_simCanArbitration);
+    RUN_TEST(test_simCanFilters);
+    RUN_TEST(test_simCanLoss);
+    RUN_TEST(test_simCanModules);
+#endif
+}
+
+#ifndef ARDUINO
+void test_simCanFrameBits(void)
+/*
+ * tests the stuffed length of a frame is within the fixed and the worst case lengths
+ */
+{
+    // Alternating bits are barely stuffed, a run of zeros is stuffed every 5 bits
+    uint8_t alternating[8] = {0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55};
+    uint8_t zeros[8] = {0};
+    TEST_ASSERT_LESS_THAN_UINT32(simCanFrameBits(0x000, zeros), simCanFrameBits(0x555, alternating));
+    TEST_ASSERT_EQUAL_UINT32(98 + 16 + 13, simCanFrameBits(0x000, zeros));
+
+    uint32_t random = 1;
+    uint32_t shortest = UINT32_MAX;
+    uint32_t longest = 0;
+    uint64_t total = 0;
+    const uint32_t frames = 10000;
+    for (uint32_t n = 0; n < frames; n++)
+    {
+        uint8_t data[8];
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            data[i] = nextRandom(random);
+        }
+        uint32_t bits = simCanFrameBits(nextRandom(random) & 0x7FF, data);
+        shortest = bits < shortest ? bits : shortest;
+        longest = bits > longest ? bits : longest;
+        total += bits;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "random 8 byte frames take %u to %u bits, %u on average, %u at worst",
+             (unsigned)shortest, (unsigned)longest, (unsigned)(total / frames), (unsigned)canFrameBits(8));
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(111, shortest);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(canFrameBits(8), longest);
+}
+
+void test_simCanArbitration(void)
+/*
+ * tests the lowest ID at the front of the mailboxes wins the bus, and frames take their length in bit times
+ */
+{
+    SimCanBus bus;
+    SimCanNode first(bus);
+    SimCanNode second(bus);
+    SimCanNode receiver(bus);
+    uint8_t data[8] = {0};
+
+    // The first node's mailboxes go in the order they were loaded, so 0x100 waits behind 0x300
+    simStartNode(first);
+    TEST_ASSERT_EQUAL_UINT32(0, CAN_TX(0x300, data));
+    TEST_ASSERT_EQUAL_UINT32(0, CAN_TX(0x100, data));
+    TEST_ASSERT_EQUAL_UINT32(1, CAN_GetTXFreeLevel());
+    simStartNode(second);
+    CAN_TX(0x200, data);
+    simStartNode(receiver);
+    setCANFilter();
+
+    uint32_t start = bus.micros();
+    bus.start();
+    uint32_t ids[3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        CAN_RX(ids[i], data);
+    }
+    uint32_t elapsed = bus.micros() - start;
+    bus.stop();
+
+    TEST_ASSERT_EQUAL_HEX32(0x200, ids[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x300, ids[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x100, ids[2]);
+    uint8_t zeros[8] = {0};
+    uint32_t bits = simCanFrameBits(0x200, zeros) + simCanFrameBits(0x300, zeros) + simCanFrameBits(0x100, zeros);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(bits * 8, elapsed);
+    TEST_ASSERT_TRUE(bus.getBusyBits() == bits);
+    TEST_ASSERT_EQUAL_UINT32(2, first.getSent());
+    TEST_ASSERT_EQUAL_UINT32(3, first.getMaxMailboxes() + second.getMaxMailboxes());
+
+    // Without a filter bank nothing is received, not even the frames of the other transmitter
+    TEST_ASSERT_EQUAL_UINT32(0, first.getReceived());
+    TEST_ASSERT_EQUAL_UINT32(3, receiver.getReceived());
+}
+
+void test_simCanFilters(void)
+/*
+ * tests frames only reach the nodes whose filter banks accept them, and a loopback node only receives its own
+ */
+{
+    SimCanBus bus;
+    SimCanNode transmitter(bus);
+    SimCanNode notes(bus);
+    SimCanNode control(bus);
+    SimCanNode loopback(bus);
+    uint8_t data[8] = {0};
+
+    simStartNode(notes);
+    setCANFilter(messageId(CLASS_NOTES, 0), CLASS_ID_MASK, 0);
+    simStartNode(control);
+    setCANFilter(messageId(CLASS_CONTROL, 0), CLASS_ID_MASK, 1);
+    simStartNode(loopback, true);
+    setCANFilter();
+    CAN_TX(messageId(CLASS_TRACE, 9), data);
+    simStartNode(transmitter);
+    CAN_TX(messageId(CLASS_NOTES, 5), data);
+    CAN_TX(messageId(CLASS_CONTROL, 5), data);
+    bus.start();
+    TEST_ASSERT_TRUE(simWaitSent(transmitter, 2));
+    TEST_ASSERT_TRUE(simWaitSent(loopback, 1));
+
+    uint32_t id;
+    notes.bind();
+    TEST_ASSERT_EQUAL_UINT32(1, CAN_CheckRXLevel());
+    CAN_RX(id, data);
+    TEST_ASSERT_EQUAL_HEX32(messageId(CLASS_NOTES, 5), id);
+    control.bind();
+    TEST_ASSERT_EQUAL_UINT32(1, CAN_CheckRXLevel());
+    CAN_RX(id, data);
+    TEST_ASSERT_EQUAL_HEX32(messageId(CLASS_CONTROL, 5), id);
+    loopback.bind();
+    TEST_ASSERT_EQUAL_UINT32(1, CAN_CheckRXLevel());
+    CAN_RX(id, data);
+    TEST_ASSERT_EQUAL_HEX32(messageId(CLASS_TRACE, 9), id);
+
+    // A cleared bank stops receiving
+    control.bind();
+    clearCANFilter(1);
+    transmitter.bind();
+    CAN_TX(messageId(CLASS_CONTROL, 5), data);
+    TEST_ASSERT_TRUE(simWaitSent(transmitter, 3));
+    bus.stop();
+    TEST_ASSERT_EQUAL_UINT32(1, control.getReceived());
+    TEST_ASSERT_EQUAL_UINT32(1, loopback.getReceived());
+    TEST_ASSERT_EQUAL_UINT32(0, transmitter.getReceived());
+
+    // Without a bound node every function fails
+    std::thread([]()
+                { TEST_ASSERT_EQUAL_UINT32(1, CAN_Start());
+                  TEST_ASSERT_EQUAL_UINT32(0, CAN_GetTXFreeLevel()); })
+        .join();
+}
+
+static uint32_t simDrained;
+
+static void simDrainIsr()
+/*
+ * Receive interrupt that empties the FIFO, counting the frames
+ */
+{
+    uint8_t data[8];
+    uint32_t id;
+    while (CAN_CheckRXLevel())
+    {
+        CAN_RX(id, data);
+        simDrained++;
+    }
+}
+
+void test_simCanLoss(void)
+/*
+ * tests frames lost at random and dropped from a full receive FIFO are counted
+ */
+{
+    // A faster bus, as only the counts matter
+    SimCanBus bus(1000000);
+    SimCanNode transmitter(bus);
+    SimCanNode receiver(bus);
+    SimCanNode stalled(bus);
+    bus.setLoss(100000);
+    simDrained = 0;
+
+    simStartNode(receiver);
+    setCANFilter();
+    CAN_RegisterRX_ISR(simDrainIsr);
+    simStartNode(stalled);
+    setCANFilter();
+    simStartNode(transmitter);
+    bus.start();
+
+    const uint32_t frames = 1000;
+    uint8_t data[8] = {0};
+    for (uint32_t n = 0; n < frames; n++)
+    {
+        data[0] = n;
+        CAN_TX(messageId(CLASS_NOTES, 1), data);
+    }
+    TEST_ASSERT_TRUE(simWaitSent(transmitter, frames));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    bus.stop();
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u frames with 10%% loss: %u lost and %u received, %u overruns on a FIFO never read",
+             (unsigned)frames, (unsigned)receiver.getLost(), (unsigned)simDrained, (unsigned)stalled.getOverruns());
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(frames, bus.getFrames());
+    TEST_ASSERT_EQUAL_UINT32(frames, receiver.getLost() + simDrained);
+    TEST_ASSERT_EQUAL_UINT32(simDrained, receiver.getReceived());
+    TEST_ASSERT_UINT32_WITHIN(30, 100, receiver.getLost());
+    TEST_ASSERT_EQUAL_UINT32(SIM_CAN_RX_FIFO, stalled.getReceived());
+    TEST_ASSERT_EQUAL_UINT8(SIM_CAN_RX_FIFO, stalled.getMaxRxLevel());
+    TEST_ASSERT_EQUAL_UINT32(frames - SIM_CAN_RX_FIFO, stalled.getLost() + stalled.getOverruns());
+}
+
+void test_simCanModules(void)
+/*
+ * benchmarks 2 to 8 modules sending key events through their transmit rings, up to an overloaded bus
+ * The runs asserted on are on the bus's virtual clock, a run on the host's threads and clock is only reported.
+ */
+{
+    const uint32_t interval = 10000; // us, a chord change every 10ms on every module
+    const uint32_t duration = 1000;  // ms
+
+    for (uint8_t count = 2; count <= 8; count += 2)
+    {
+        SimRun run;
+        simModules(count, interval, duration, run);
+
+        char msg[256];
+        snprintf(msg, sizeof(msg),
+                 "%u modules: %u frames/s, %u%% load, ring %u, mailboxes %u, rx fifo %u, latency mean %uus p99 %uus "
+                 "max %uus, lowest priority max %uus (analysed %uus, %u later)",
+                 (unsigned)count, (unsigned)run.framesPerSecond, (unsigned)run.load, (unsigned)run.maxQueued,
+                 (unsigned)run.maxMailboxes, (unsigned)run.maxRxLevel, (unsigned)simLatency.getMean(),
+                 (unsigned)simLatency.getPercentile(99), (unsigned)simLatency.getMax(),
+                 (unsigned)simLowestLatency.getMax(), (unsigned)simBound, (unsigned)simLate);
+        TEST_MESSAGE(msg);
+
+        // Every message reaches every other module, with no ring or FIFO overflowing
+        TEST_ASSERT_EQUAL_UINT32(run.messages * (count - 1), simEvents);
+        TEST_ASSERT_EQUAL_UINT32(0, run.dropped);
+        TEST_ASSERT_EQUAL_UINT32(0, run.overruns);
+
+        // The analysis bounds every frame of the lowest priority module
+        TEST_ASSERT_NOT_EQUAL(CAN_UNSCHEDULABLE, simBound);
+        TEST_ASSERT_EQUAL_UINT32(0, simLate);
+    }
+
+    // Twice the rate on 8 modules is more than the bus can carry, the lowest priority modules' rings fill up
+    SimRun run;
+    simModules(8, interval / 2, duration, run);
+    char msg[256];
+    snprintf(msg, sizeof(msg),
+             "8 modules overloaded: %u frames/s, %u%% load, %u of %u messages dropped (%u by the highest priority, %u "
+             "by the lowest), latency mean %uus max %uus",
+             (unsigned)run.framesPerSecond, (unsigned)run.load, (unsigned)run.dropped,
+             (unsigned)(run.messages + run.dropped), (unsigned)run.highestDropped, (unsigned)run.lowestDropped,
+             (unsigned)simLatency.getMean(), (unsigned)simLatency.getMax());
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(run.messages * 7, simEvents);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(90, run.load);
+    TEST_ASSERT_EQUAL_UINT32(0, run.highestDropped);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, run.lowestDropped);
+    TEST_ASSERT_EQUAL_UINT32(CAN_TX_RING_SIZE, run.maxQueued);
+
+    // The same 8 modules on the host's threads, which wake up late now and then
+    simModules(8, interval, duration, run, true);
+    snprintf(msg, sizeof(msg),
+             "8 modules on the host's clock: %u frames/s, %u%% load, %u dropped, %u overruns, latency mean %uus max "
+             "%uus, lowest priority max %uus (analysed %uus, %u later)",
+             (unsigned)run.framesPerSecond, (unsigned)run.load, (unsigned)run.dropped, (unsigned)run.overruns,
+             (unsigned)simLatency.getMean(), (unsigned)simLatency.getMax(), (unsigned)simLowestLatency.getMax(),
+             (unsigned)simBound, (unsigned)simLate);
+    TEST_MESSAGE(msg);
+}
+#endif
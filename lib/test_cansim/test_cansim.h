@@ -0,0 +1,36 @@
+#include <cstdint>
+
+#ifndef TEST_CANSIM_H
+#define TEST_CANSIM_H
+
+void test_CanSim(void);
+/*
+ * Tests all simulated CAN bus testing functions, only on the host
+ */
+
+void test_simCanFrameBits(void);
+/*
+ * tests the stuffed length of a frame is within the fixed and the worst case lengths
+ */
+
+void test_simCanArbitration(void);
+/*
+ * tests the lowest ID at the front of the mailboxes wins the bus, and frames take their length in bit times
+ */
+
+void test_simCanFilters(void);
+/*
+ * tests frames only reach the nodes whose filter banks accept them, and a loopback node only receives its own
+ */
+
+void test_simCanLoss(void);
+/*
+ * tests frames lost at random and dropped from a full receive FIFO are counted
+ */
+
+void test_simCanModules(void);
+/*
+ * benchmarks 2 to 8 modules sending key events through their transmit rings, up to an overloaded bus
+ */
+
+#endif
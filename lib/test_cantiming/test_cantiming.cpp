@@ -0,0 +1,223 @@
+#include <unity.h>
+#include <cstdio>
+#include "canproto.h"
+#include "cantiming.h"
+#include "test_random.h"
+#include "test_cantiming.h"
+
+// Bus timing of the modules, 125kbit/s, every frame is 8 bytes
+const uint32_t BIT_TIME = 8000;
+const uint8_t FRAME_BYTES = 8;
+
+// Traffic of each module: key events at most every 20ms (a fast player is ~50ms per note, snapshots are 100ms), queued
+// up to one scan (~1ms) after the keys changed; connection messages at most every 100ms
+const uint32_t NOTES_PERIOD = 20000000;
+const uint32_t CONTROL_PERIOD = 100000000;
+const uint32_t QUEUE_JITTER = 1000000;
+
+const uint8_t MAX_MODULES = 8;
+
+static uint8_t moduleStreams(CanStream streams[], uint8_t modules, uint32_t unit)
+/*
+ * Fills in a notes and a control stream for every module
+ *
+ * :param streams: set to the streams, 2 per module
+ *
+ * :param modules: number of modules on the bus
+ *
+ * :param unit: time unit of the streams in nanoseconds
+ *
+ * :return: number of streams
+ */
+{
+    uint8_t count = 0;
+    for (uint8_t module = 1; module <= modules; module++)
+    {
+        streams[count++] = CanStream{messageId(CLASS_NOTES, module), NOTES_PERIOD / unit, QUEUE_JITTER / unit, FRAME_BYTES};
+        streams[count++] = CanStream{messageId(CLASS_CONTROL, module), CONTROL_PERIOD / unit, QUEUE_JITTER / unit, FRAME_BYTES};
+    }
+    return count;
+}
+
+void test_CanTiming(void)
+/*
+ * Tests all CAN timing analysis testing functions
+ */
+{
+    RUN_TEST(test_canFrameBits);
+    RUN_TEST(test_canResponseTime);
+    RUN_TEST(test_classLatencyTable);
+    RUN_TEST(test_arbitrationSimulation);
+}
+
+void test_canFrameBits(void)
+/*
+ * tests the worst case length of frames with and without data
+ */
+{
+    TEST_ASSERT_EQUAL_UINT32(55, canFrameBits(0));
+    TEST_ASSERT_EQUAL_UINT32(135, canFrameBits(8));
+
+    // An 8 byte frame at 125kbit/s is just over 1ms
+    TEST_ASSERT_EQUAL_UINT32(1080000, canFrameBits(FRAME_BYTES) * BIT_TIME);
+}
+
+void test_canResponseTime(void)
+/*
+ * tests the response times of a small set of streams worked out by hand
+ */
+{
+    // At 1Mbit/s an 8 byte frame takes 135us
+    const uint32_t bitTime = 1000;
+    const CanStream streams[4] = {
+        {0x010, 1000000, 0, 8},
+        {0x020, 1000000, 0, 8},
+        {0x030, 2000000, 100000, 8},
+        {0x040, 500000, 0, 8},
+    };
+
+    // Highest priority: blocked by one frame, then sent
+    TEST_ASSERT_EQUAL_UINT32(270000, canResponseTime(streams, 4, 0, bitTime));
+    // Blocked, then behind one 0x010
+    TEST_ASSERT_EQUAL_UINT32(405000, canResponseTime(streams, 4, 1, bitTime));
+    // Its jitter adds to its own response, the blocking is its own previous frame
+    TEST_ASSERT_EQUAL_UINT32(640000, canResponseTime(streams, 4, 2, bitTime));
+    // Blocked and behind three frames, 675us is longer than its period
+    TEST_ASSERT_EQUAL_UINT32(CAN_UNSCHEDULABLE, canResponseTime(streams, 4, 3, bitTime));
+
+    // A stream alone still waits for its own previous frame
+    TEST_ASSERT_EQUAL_UINT32(270000, canResponseTime(&streams[3], 1, 0, bitTime));
+}
+
+void test_classLatencyTable(void)
+/*
+ * reports the worst case latency of each message class for 2 to 8 modules, notes must always beat control messages
+ */
+{
+    CanStream streams[2 * MAX_MODULES];
+    TEST_MESSAGE("modules, worst case notes, worst case control (us)");
+    for (uint8_t modules = 2; modules <= MAX_MODULES; modules++)
+    {
+        uint8_t count = moduleStreams(streams, modules, 1);
+        uint32_t worst[2] = {0, 0};
+        for (uint8_t i = 0; i < count; i++)
+        {
+            uint32_t response = canResponseTime(streams, count, i, BIT_TIME);
+            TEST_ASSERT_NOT_EQUAL(CAN_UNSCHEDULABLE, response);
+            uint8_t control = idClass(streams[i].id) == CLASS_CONTROL;
+            if (response > worst[control])
+            {
+                worst[control] = response;
+            }
+        }
+
+        char msg[128];
+        snprintf(msg, sizeof(msg), "%u, %u, %u", (unsigned)modules, (unsigned)(worst[0] / 1000), (unsigned)(worst[1] / 1000));
+        TEST_MESSAGE(msg);
+
+        TEST_ASSERT_LESS_THAN_UINT32(worst[1], worst[0]);
+    }
+
+    // The notes of 8 modules are still bounded by the jitter, one control frame and the notes of every other module
+    uint8_t count = moduleStreams(streams, MAX_MODULES, 1);
+    uint32_t frame = canFrameBits(FRAME_BYTES) * BIT_TIME;
+    TEST_ASSERT_EQUAL_UINT32(QUEUE_JITTER + MAX_MODULES * frame + frame,
+                             canResponseTime(streams, count, 2 * (MAX_MODULES - 1), BIT_TIME));
+}
+
+void test_arbitrationSimulation(void)
+/*
+ * simulates arbitration on the bus with random offsets and jitter, no message may take longer than its bound
+ */
+{
+#ifdef ARDUINO
+    const uint32_t runs = 2;
+#else
+    const uint32_t runs = 20;
+#endif
+    const uint32_t duration = 1000000; // Bit times of each run, 8s at 125kbit/s
+
+    // Simulated in bit times
+    CanStream streams[2 * MAX_MODULES];
+    uint8_t count = moduleStreams(streams, MAX_MODULES, BIT_TIME);
+    uint32_t frame = canFrameBits(FRAME_BYTES);
+
+    uint32_t bound[2 * MAX_MODULES];
+    uint32_t observed[2 * MAX_MODULES] = {0};
+    for (uint8_t i = 0; i < count; i++)
+    {
+        bound[i] = canResponseTime(streams, count, i, 1);
+    }
+
+    uint32_t random = 11;
+    uint32_t messages = 0;
+    for (uint32_t run = 0; run < runs; run++)
+    {
+        // Each stream has at most one message waiting, as every bound is shorter than the period
+        uint32_t due[2 * MAX_MODULES];
+        uint32_t queued[2 * MAX_MODULES];
+        for (uint8_t i = 0; i < count; i++)
+        {
+            // Half the runs line every stream up at once, the worst case of the analysis
+            due[i] = (run & 1) ? nextRandom(random) % streams[i].period : 0;
+            queued[i] = due[i] + nextRandom(random) % (streams[i].jitter + 1);
+        }
+
+        uint32_t now = 0;
+        while (now < duration)
+        {
+            // When the bus goes idle the lowest ID waiting wins arbitration
+            int8_t winner = -1;
+            uint32_t nextQueued = UINT32_MAX;
+            for (uint8_t i = 0; i < count; i++)
+            {
+                if (queued[i] <= now)
+                {
+                    if (winner < 0 || streams[i].id < streams[winner].id)
+                    {
+                        winner = i;
+                    }
+                }
+                else if (queued[i] < nextQueued)
+                {
+                    nextQueued = queued[i];
+                }
+            }
+            if (winner < 0)
+            {
+                now = nextQueued;
+                continue;
+            }
+
+            now += frame;
+            uint32_t response = now - due[winner];
+            if (response > observed[winner])
+            {
+                observed[winner] = response;
+            }
+            messages++;
+
+            due[winner] += streams[winner].period;
+            queued[winner] = due[winner] + nextRandom(random) % (streams[winner].jitter + 1);
+        }
+    }
+
+    uint32_t worstObserved[2] = {0, 0};
+    uint32_t worstBound[2] = {0, 0};
+    for (uint8_t i = 0; i < count; i++)
+    {
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(bound[i], observed[i]);
+        uint8_t control = idClass(streams[i].id) == CLASS_CONTROL;
+        worstObserved[control] = observed[i] > worstObserved[control] ? observed[i] : worstObserved[control];
+        worstBound[control] = bound[i] > worstBound[control] ? bound[i] : worstBound[control];
+    }
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%u messages from %u modules: notes %uus (bound %uus), control %uus (bound %uus)",
+             (unsigned)messages, (unsigned)MAX_MODULES,
+             (unsigned)(worstObserved[0] * BIT_TIME / 1000), (unsigned)(worstBound[0] * BIT_TIME / 1000),
+             (unsigned)(worstObserved[1] * BIT_TIME / 1000), (unsigned)(worstBound[1] * BIT_TIME / 1000));
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_GREATER_THAN_UINT32(0, worstObserved[0]);
+}
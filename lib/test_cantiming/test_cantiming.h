@@ -0,0 +1,31 @@
+#include <cstdint>
+
+#ifndef TEST_CANTIMING_H
+#define TEST_CANTIMING_H
+
+void test_CanTiming(void);
+/*
+ * Tests all CAN timing analysis testing functions
+ */
+
+void test_canFrameBits(void);
+/*
+ * tests the worst case length of frames with and without data
+ */
+
+void test_canResponseTime(void);
+/*
+ * tests the response times of a small set of streams worked out by hand
+ */
+
+void test_classLatencyTable(void);
+/*
+ * reports the worst case latency of each message class for 2 to 8 modules, notes must always beat control messages
+ */
+
+void test_arbitrationSimulation(void);
+/*
+ * simulates arbitration on the bus with random offsets and jitter, no message may take longer than its bound
+ */
+
+#endif
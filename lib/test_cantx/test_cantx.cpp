@@ -0,0 +1,490 @@
+#include <unity.h>
+#include <cstdio>
+#include <cstring>
+#include "cantx.h"
+#include "test_cantx.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+uint8_t FakeCanMailboxes::freeLevel()
+{
+    return CAN_TX_MAILBOXES - count;
+}
+
+void FakeCanMailboxes::add(uint32_t id, uint8_t frame[8])
+{
+    uint8_t i = (first + count) % CAN_TX_MAILBOXES;
+    memcpy(data[i], frame, 8);
+    ids[i] = id;
+    count++;
+}
+
+void FakeCanMailboxes::requestPump()
+{
+    // Called by every producer thread
+    __atomic_fetch_add(&pumpRequests, 1, __ATOMIC_RELAXED);
+}
+
+bool FakeCanMailboxes::complete(uint8_t frame[8], uint32_t &id)
+{
+    if (!count)
+    {
+        return false;
+    }
+    memcpy(frame, data[first], 8);
+    id = ids[first];
+    first = (first + 1) % CAN_TX_MAILBOXES;
+    count--;
+    return true;
+}
+
+void test_CanTx(void)
+/*
+ * Tests all CAN transmit ring testing functions
+ */
+{
+    RUN_TEST(test_txRingMailboxes);
+    RUN_TEST(test_txRingFull);
+    RUN_TEST(test_txRingTrace);
+    RUN_TEST(test_txRingTraceSlots);
+    RUN_TEST(test_txRingUpdate);
+#ifndef ARDUINO
+    RUN_TEST(test_txRingUpdateRace);
+    RUN_TEST(test_txRingProducers);
+#endif
+    RUN_TEST(test_txRingCost);
+}
+
+void test_txRingMailboxes(void)
+/*
+ * tests frames fill the empty mailboxes in order and wait in the ring for the rest
+ */
+{
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+
+    for (int8_t octave = 0; octave < 5; octave++)
+    {
+        TEST_ASSERT_TRUE(ring.send(7, DiscoveryMessage{7, 0, (uint8_t)octave, 1}));
+    }
+    TEST_ASSERT_EQUAL_UINT32(5, mailboxes.pumpRequests);
+    TEST_ASSERT_EQUAL_UINT32(5, ring.getQueued());
+
+    // Only three mailboxes, the rest stay in the ring until one completes
+    TEST_ASSERT_EQUAL_UINT8(3, ring.pump());
+    TEST_ASSERT_EQUAL_UINT8(0, ring.pump());
+    TEST_ASSERT_EQUAL_UINT32(2, ring.getQueued());
+
+    uint8_t frame[8];
+    uint32_t id;
+    for (int8_t octave = 0; octave < 5; octave++)
+    {
+        TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+        ring.pump();
+
+        // In order, numbered by their position in the ring
+        MessageHeader header = decodeHeader(frame);
+        TEST_ASSERT_EQUAL_UINT32(messageId(CLASS_CONTROL, 7), id);
+        TEST_ASSERT_EQUAL_UINT8(MSG_DISCOVERY, header.type);
+        TEST_ASSERT_EQUAL_UINT8(7, header.module);
+        TEST_ASSERT_EQUAL_UINT8(octave, header.sequence);
+        TEST_ASSERT_EQUAL_UINT8(octave, decodeMessage<DiscoveryMessage>(frame).octave);
+    }
+    TEST_ASSERT_FALSE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.getQueued());
+}
+
+void test_txRingFull(void)
+/*
+ * tests a full ring drops and counts frames without disturbing the sequence numbers
+ */
+{
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+
+    for (uint32_t i = 0; i < CAN_TX_RING_SIZE; i++)
+    {
+        TEST_ASSERT_TRUE(ring.send(1, TransmitterMessage{}));
+    }
+    TEST_ASSERT_FALSE(ring.send(1, TransmitterMessage{}));
+    TEST_ASSERT_EQUAL_UINT32(1, ring.getDropped());
+    TEST_ASSERT_EQUAL_UINT32(CAN_TX_RING_SIZE, ring.getQueued());
+
+    // Moving frames into the mailboxes frees their cells
+    TEST_ASSERT_EQUAL_UINT8(CAN_TX_MAILBOXES, ring.pump());
+    for (uint8_t i = 0; i < CAN_TX_MAILBOXES; i++)
+    {
+        TEST_ASSERT_TRUE(ring.send(1, TransmitterMessage{}));
+    }
+    TEST_ASSERT_FALSE(ring.send(1, TransmitterMessage{}));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.getDropped());
+
+    // The dropped frames never took a sequence number, so the receiver sees no gap
+    uint8_t frame[8];
+    uint32_t id;
+    uint8_t expected = 0;
+    while (mailboxes.complete(frame, id))
+    {
+        TEST_ASSERT_EQUAL_UINT8(expected++, decodeHeader(frame).sequence);
+        ring.pump();
+    }
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)(CAN_TX_RING_SIZE + CAN_TX_MAILBOXES), expected);
+}
+
+void test_txRingTrace(void)
+/*
+ * tests a traced frame is flagged and timed through the ring and the mailboxes, one at a time
+ */
+{
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+    TxTrace trace;
+
+    // Two frames ahead fill two mailboxes, the traced one takes the third
+    TEST_ASSERT_TRUE(ring.send(3, TransmitterMessage{}));
+    TEST_ASSERT_TRUE(ring.send(3, TransmitterMessage{}));
+    TEST_ASSERT_EQUAL_UINT8(2, ring.pump(100));
+    TEST_ASSERT_TRUE(ring.sendTraced(3, KeyEventsMessage{4, 0x0001, 0x0001, 0}, 50, 120));
+    TEST_ASSERT_FALSE(ring.takeTrace(trace));
+
+    // Only one key events frame is traced at a time, the next goes untraced behind it
+    TEST_ASSERT_TRUE(ring.sendTraced(3, KeyEventsMessage{4, 0x0003, 0x0002, 0}, 60, 130));
+    TEST_ASSERT_EQUAL_UINT8(1, ring.pump(140));
+
+    // Sent once both frames ahead of it and then it have emptied their mailboxes
+    uint8_t frame[8];
+    uint32_t id;
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(1, ring.pump(1000));
+    TEST_ASSERT_FALSE(ring.takeTrace(trace));
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(MSG_KEY_EVENTS, decodeHeader(frame).type);
+    TEST_ASSERT_EQUAL_UINT8(1, decodeMessage<KeyEventsMessage>(frame).traced);
+    TEST_ASSERT_EQUAL_UINT8(0, ring.pump(3000));
+    TEST_ASSERT_TRUE(ring.takeTrace(trace));
+    TEST_ASSERT_EQUAL_UINT32(50, trace.scanned);
+    TEST_ASSERT_EQUAL_UINT32(120, trace.queued);
+    TEST_ASSERT_EQUAL_UINT32(140, trace.loaded);
+    TEST_ASSERT_EQUAL_UINT32(3000, trace.sent);
+    TEST_ASSERT_EQUAL_UINT8(MSG_KEY_EVENTS, trace.type);
+    TEST_ASSERT_FALSE(ring.takeTrace(trace));
+
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(0, decodeMessage<KeyEventsMessage>(frame).traced);
+    TEST_ASSERT_EQUAL_HEX16(0x0003, decodeMessage<KeyEventsMessage>(frame).pressed);
+
+    // With the trace collected the next frame is traced again, and sent at the first pump after it completes
+    TEST_ASSERT_TRUE(ring.sendTraced(3, KeyEventsMessage{4, 0x0000, 0x0003, 0}, 4000, 4010));
+    ring.pump(4020);
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(1, decodeMessage<KeyEventsMessage>(frame).traced);
+    ring.pump(5100);
+    TEST_ASSERT_TRUE(ring.takeTrace(trace));
+    TEST_ASSERT_EQUAL_UINT32(4020, trace.loaded);
+    TEST_ASSERT_EQUAL_UINT32(5100, trace.sent);
+
+    // Any message with a traced flag can be traced, its type tells the transmit interrupt what follows it
+    TEST_ASSERT_TRUE(ring.sendTraced(3, SyncMessage{0x123456, 0}, 6000, 6000));
+    ring.pump(6010);
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(1, decodeMessage<SyncMessage>(frame).traced);
+    TEST_ASSERT_EQUAL_HEX32(0x123456, decodeMessage<SyncMessage>(frame).high);
+    ring.pump(7020);
+    TEST_ASSERT_TRUE(ring.takeTrace(trace));
+    TEST_ASSERT_EQUAL_UINT8(MSG_SYNC, trace.type);
+    TEST_ASSERT_EQUAL_UINT32(7020, trace.sent);
+}
+
+void test_txRingTraceSlots(void)
+/*
+ * tests a sync frame is traced while a key events frame is, and a message sent while its slot is busy is counted
+ */
+{
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+    TxTrace trace;
+    uint8_t frame[8];
+    uint32_t id;
+
+    // A key events trace on its way doesn't take the sync's slot
+    TEST_ASSERT_TRUE(ring.sendTraced(3, KeyEventsMessage{4, 0x0001, 0x0001, 0}, 10, 20));
+    TEST_ASSERT_TRUE(ring.sendTraced(3, SyncMessage{0x000001, 0}, 30, 30));
+    TEST_ASSERT_TRUE(ring.sendTraced(3, SyncMessage{0x000002, 0}, 40, 40));
+    TEST_ASSERT_EQUAL_UINT32(1, ring.getUntraced());
+    TEST_ASSERT_EQUAL_UINT8(3, ring.pump(50));
+
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(1, decodeMessage<KeyEventsMessage>(frame).traced);
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(1, decodeMessage<SyncMessage>(frame).traced);
+    TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+    TEST_ASSERT_EQUAL_UINT8(0, decodeMessage<SyncMessage>(frame).traced);
+
+    // Both are ready after the same pump, and are collected one call each
+    ring.pump(900);
+    TEST_ASSERT_TRUE(ring.takeTrace(trace));
+    TEST_ASSERT_EQUAL_UINT8(MSG_KEY_EVENTS, trace.type);
+    TEST_ASSERT_EQUAL_UINT32(900, trace.sent);
+    TEST_ASSERT_TRUE(ring.takeTrace(trace));
+    TEST_ASSERT_EQUAL_UINT8(MSG_SYNC, trace.type);
+    TEST_ASSERT_EQUAL_UINT32(30, trace.scanned);
+    TEST_ASSERT_FALSE(ring.takeTrace(trace));
+
+    // Both slots are free again
+    TEST_ASSERT_TRUE(ring.sendTraced(3, SyncMessage{0x000003, 0}, 1000, 1000));
+    TEST_ASSERT_TRUE(ring.sendTraced(3, KeyEventsMessage{4, 0, 0x0001, 0}, 1000, 1000));
+    TEST_ASSERT_EQUAL_UINT32(1, ring.getUntraced());
+}
+
+void test_txRingUpdate(void)
+/*
+ * tests a queued frame is replaced in place with its sequence number, and one already in a mailbox is not
+ */
+{
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+    uint32_t tickets[5];
+
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_TRUE(ring.send(1, KeyEventsMessage{4, i, 0, 0}, tickets[i]));
+    }
+    TEST_ASSERT_EQUAL_UINT8(3, ring.pump());
+
+    // The first three are in the mailboxes, the last two can still be replaced
+    TEST_ASSERT_FALSE(ring.update(tickets[0], 1, KeyEventsMessage{4, 100, 0, 0}));
+    TEST_ASSERT_TRUE(ring.update(tickets[4], 1, KeyEventsMessage{4, 104, 0, 0}));
+    TEST_ASSERT_TRUE(ring.update(tickets[4], 1, KeyEventsMessage{4, 204, 0, 0}));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.getCoalesced());
+    TEST_ASSERT_EQUAL_UINT32(2, ring.getQueued());
+
+    const uint16_t expected[5] = {0, 1, 2, 3, 204};
+    uint8_t frame[8];
+    uint32_t id;
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_TRUE(mailboxes.complete(frame, id));
+        ring.pump();
+        TEST_ASSERT_EQUAL_UINT8(i, decodeHeader(frame).sequence);
+        TEST_ASSERT_EQUAL_HEX16(expected[i], decodeMessage<KeyEventsMessage>(frame).pressed);
+    }
+    TEST_ASSERT_FALSE(mailboxes.complete(frame, id));
+
+    // Once transmitted its cell may hold another frame, which the old ticket doesn't reach
+    TEST_ASSERT_FALSE(ring.update(tickets[4], 1, KeyEventsMessage{4, 304, 0, 0}));
+    TEST_ASSERT_EQUAL_UINT32(2, ring.getCoalesced());
+}
+
+#ifndef ARDUINO
+void test_txRingUpdateRace(void)
+/*
+ * tests a thread updating its queued frame while the ring is pumped never transmits a torn or lost frame
+ */
+{
+    const uint32_t frames = 10000; // counted in the pressed and changed masks, the low 4 bits copied into the octave
+
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+    bool done = false;
+
+    // Like the scan task: replace the queued frame while it waits, else send a new one
+    std::thread producer([&ring, &done, frames]()
+                         {
+        uint32_t ticket = 0;
+        bool queued = false;
+        for (uint32_t n = 1; n <= frames; n++)
+        {
+            KeyEventsMessage message{(uint8_t)(n & 0x0F), (uint16_t)(n & 0x0FFF), (uint16_t)(n >> 12), 0};
+            if (!(queued && ring.update(ticket, 1, message)))
+            {
+                while (!ring.send(1, message, ticket))
+                {
+                    std::this_thread::yield();
+                }
+                queued = true;
+            }
+
+            // Gives the pump a turn, so some frames leave between updates
+            if (n % 4 == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE); });
+
+    // This thread plays the transmit interrupt
+    uint32_t received = 0;
+    uint32_t last = 0;
+    uint32_t torn = 0;
+    uint32_t outOfOrder = 0;
+    uint8_t expectedSequence = 0;
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE) || ring.getQueued() || mailboxes.count)
+    {
+        // Lets the producer run when both threads share a core
+        if (!ring.pump() && !mailboxes.count)
+        {
+            std::this_thread::yield();
+        }
+        uint8_t frame[8];
+        uint32_t id;
+        while (mailboxes.complete(frame, id))
+        {
+            MessageHeader header = decodeHeader(frame);
+            KeyEventsMessage message = decodeMessage<KeyEventsMessage>(frame);
+            uint32_t n = message.pressed | ((uint32_t)message.changed << 12);
+            torn += (n & 0x0F) != message.octave;
+            outOfOrder += header.sequence != expectedSequence || n <= last;
+            expectedSequence = header.sequence + 1;
+            last = n;
+            received++;
+        }
+    }
+    producer.join();
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u messages sent as %u frames, %u coalesced", (unsigned)frames, (unsigned)received,
+             (unsigned)ring.getCoalesced());
+    TEST_MESSAGE(msg);
+
+    // The latest message always goes out, and every message is either a frame or merged into one
+    TEST_ASSERT_EQUAL_UINT32(0, torn);
+    TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+    TEST_ASSERT_EQUAL_UINT32(frames, last);
+    TEST_ASSERT_EQUAL_UINT32(frames, received + ring.getCoalesced());
+}
+
+void test_txRingProducers(void)
+/*
+ * tests several threads sending at once, every frame is transmitted once in sequence order
+ */
+{
+    const uint8_t producers = 4;
+    const uint32_t frames = 5000; // per producer, counted in the pressed and changed masks
+
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+
+    std::thread threads[producers];
+    for (uint8_t p = 0; p < producers; p++)
+    {
+        threads[p] = std::thread([&ring, p, frames]()
+                                 {
+            for (uint32_t n = 0; n < frames; n++)
+            {
+                KeyEventsMessage message{p, (uint16_t)(n & 0x0FFF), (uint16_t)(n >> 12), 0};
+                while (!((p == 0 && n % 64 == 0) ? ring.sendTraced(p + 1, message, n, n) : ring.send(p + 1, message)))
+                {
+                    std::this_thread::yield();
+                }
+            } });
+    }
+
+    // This thread plays the transmit interrupt: refill the mailboxes and transmit
+    uint32_t next[producers] = {0};
+    uint32_t received = 0;
+    uint32_t outOfOrder = 0;
+    uint8_t expectedSequence = 0;
+    uint32_t traces = 0;
+    while (received < producers * frames)
+    {
+        // Lets the producers run when the threads share a core
+        if (!ring.pump() && !mailboxes.count)
+        {
+            std::this_thread::yield();
+        }
+        TxTrace trace;
+        traces += ring.takeTrace(trace);
+        uint8_t frame[8];
+        uint32_t id;
+        while (mailboxes.complete(frame, id))
+        {
+            MessageHeader header = decodeHeader(frame);
+            KeyEventsMessage message = decodeMessage<KeyEventsMessage>(frame);
+            uint32_t n = message.pressed | ((uint32_t)message.changed << 12);
+            if (header.sequence != expectedSequence || header.module != message.octave + 1 || n != next[message.octave])
+            {
+                outOfOrder++;
+            }
+            expectedSequence = header.sequence + 1;
+            next[message.octave] = n + 1;
+            received++;
+        }
+    }
+    for (uint8_t p = 0; p < producers; p++)
+    {
+        threads[p].join();
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u frames from %u threads, %u sends retried on a full ring, %u traced", (unsigned)received,
+             (unsigned)producers, (unsigned)ring.getDropped(), (unsigned)traces);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+    TEST_ASSERT_GREATER_THAN(0, traces);
+    for (uint8_t p = 0; p < producers; p++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(frames, next[p]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, ring.getQueued());
+}
+#endif
+
+void test_txRingCost(void)
+/*
+ * benchmarks the cost of sending a frame through the ring into a mailbox
+ */
+{
+#ifdef ARDUINO
+    const uint32_t frames = 1998;
+    const char *unit = "cycles";
+#else
+    const uint32_t frames = 199998;
+    const char *unit = "ns";
+#endif
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+    uint8_t frame[8];
+    uint32_t id;
+
+#ifdef ARDUINO
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t start = DWT->CYCCNT;
+#else
+    auto start = std::chrono::steady_clock::now();
+#endif
+
+    // A chord of three frames at a time, as a transmitter sends them
+    for (uint32_t i = 0; i < frames; i += 3)
+    {
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            ring.send(1, KeyEventsMessage{4, (uint16_t)i, (uint16_t)j, 0});
+        }
+        ring.pump();
+        while (mailboxes.complete(frame, id))
+        {
+        }
+    }
+
+#ifdef ARDUINO
+    uint64_t elapsed = DWT->CYCCNT - start;
+#else
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+    uint32_t cost = (uint32_t)(elapsed * 100 / frames);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s per frame sent: %u.%02u", unit, (unsigned)(cost / 100), (unsigned)(cost % 100));
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(0, ring.getDropped());
+    TEST_ASSERT_EQUAL_UINT32(0, ring.getQueued());
+}
@@ -0,0 +1,80 @@
+#include <cstdint>
+#include "cantx.h"
+
+#ifndef TEST_CANTX_H
+#define TEST_CANTX_H
+
+class FakeCanMailboxes : public CanMailboxes
+/*
+ * Model of the three transmit mailboxes, frames are transmitted in the order they were added when complete() is called
+ */
+{
+public:
+    uint8_t data[CAN_TX_MAILBOXES][8];
+    uint32_t ids[CAN_TX_MAILBOXES];
+    uint8_t first = 0;
+    uint8_t count = 0;
+    uint32_t pumpRequests = 0;
+
+    uint8_t freeLevel() override;
+    void add(uint32_t id, uint8_t frame[8]) override;
+    void requestPump() override;
+
+    bool complete(uint8_t frame[8], uint32_t &id);
+    /*
+     * Transmits the oldest frame in the mailboxes
+     *
+     * :param frame: set to the transmitted frame
+     *
+     * :param id: set to the CAN ID of the transmitted frame
+     *
+     * :return: false if the mailboxes were empty
+     */
+};
+
+void test_CanTx(void);
+/*
+ * Tests all CAN transmit ring testing functions
+ */
+
+void test_txRingMailboxes(void);
+/*
+ * tests frames fill the empty mailboxes in order and wait in the ring for the rest
+ */
+
+void test_txRingFull(void);
+/*
+ * tests a full ring drops and counts frames without disturbing the sequence numbers
+ */
+
+void test_txRingTrace(void);
+/*
+ * tests a traced frame is flagged and timed through the ring and the mailboxes, one at a time
+ */
+
+void test_txRingTraceSlots(void);
+/*
+ * tests a sync frame is traced while a key events frame is, and a message sent while its slot is busy is counted
+ */
+
+void test_txRingUpdate(void);
+/*
+ * tests a queued frame is replaced in place with its sequence number, and one already in a mailbox is not
+ */
+
+void test_txRingUpdateRace(void);
+/*
+ * tests a thread updating its queued frame while the ring is pumped never transmits a torn or lost frame
+ */
+
+void test_txRingProducers(void);
+/*
+ * tests several threads sending at once, every frame is transmitted once in sequence order
+ */
+
+void test_txRingCost(void);
+/*
+ * benchmarks the cost of sending a frame through the ring into a mailbox
+ */
+
+#endif
@@ -0,0 +1,399 @@
+#include <unity.h>
+#include <cstdio>
+#include "clocksync.h"
+#include "test_random.h"
+#include "test_clocksync.h"
+
+const uint8_t SIM_CLOCKS = 4;
+const uint32_t simSamplePeriod = 1000000 / clockSampleRate; // us, the most two clocks may disagree by
+
+struct SimClock
+/*
+ * A module's crystal and its estimate of the shared clock
+ */
+{
+    uint8_t module;
+    double offset; // local time in microseconds at true time 0
+    double ppm;    // crystal error, positive runs fast
+    ClockSync clock;
+};
+
+struct SimBus
+/*
+ * Modules on one bus, the first is the master
+ */
+{
+    SimClock clocks[SIM_CLOCKS];
+    uint8_t count;
+    uint8_t master;
+    uint32_t jitter;    // us, longest delay of an interrupt taking a timestamp
+    uint8_t dropSync;   // percent of sync frames lost on each module
+    uint8_t dropTime;   // percent of sync times lost on each module
+    uint32_t random;
+};
+
+static uint32_t simLocal(const SimClock &sim, double t)
+/*
+ * :param sim: the module
+ *
+ * :param t: true time in microseconds
+ *
+ * :return: the module's local clock, wrapping like micros()
+ */
+{
+    return (uint32_t)(uint64_t)(sim.offset + t * (1 + sim.ppm * 1e-6));
+}
+
+static void simInit(SimBus &bus, uint8_t count, const double *ppm, uint32_t jitter)
+/*
+ * :param bus: the bus to set up, with every module leading its own clock
+ *
+ * :param count: number of modules
+ *
+ * :param ppm: crystal error of each module
+ *
+ * :param jitter: longest interrupt delay in microseconds
+ */
+{
+    bus.count = count;
+    bus.master = 0;
+    bus.jitter = jitter;
+    bus.dropSync = 0;
+    bus.dropTime = 0;
+    bus.random = 42;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        bus.clocks[i].module = 0x11 * (i + 1);
+        bus.clocks[i].ppm = ppm[i];
+
+        // Powered up at different times, one close to the local clock wrapping
+        bus.clocks[i].offset = i == 1 ? 4294967296.0 - 2000000 : 1000000.0 * (i * 7 + 3);
+        bus.clocks[i].clock = ClockSync();
+        bus.clocks[i].clock.lead(simLocal(bus.clocks[i], 0));
+        if (i)
+        {
+            bus.clocks[i].clock.follow();
+        }
+    }
+}
+
+static void simSync(SimBus &bus, double t)
+/*
+ * Sends one sync frame and its sync time from the master, as main does
+ *
+ * :param bus: the bus
+ *
+ * :param t: true time in microseconds the sync frame is queued
+ */
+{
+    SimClock &master = bus.clocks[bus.master];
+    uint32_t queued = simLocal(master, t);
+    master.clock.lead(queued);
+    uint32_t high = (master.clock.getTime(queued) >> 24) & 0xFFFFFF;
+
+    // Waits behind other frames, then the transmit interrupt times it
+    double sent = t + nextRandom(bus.random) % 3000;
+    uint32_t sentTime = master.clock.getTime(simLocal(master, sent + nextRandom(bus.random) % bus.jitter));
+
+    for (uint8_t i = 0; i < bus.count; i++)
+    {
+        if (i == bus.master)
+        {
+            continue;
+        }
+        SimClock &sim = bus.clocks[i];
+        if (nextRandom(bus.random) % 100 >= bus.dropSync)
+        {
+            sim.clock.sync(master.module, high, simLocal(sim, sent + nextRandom(bus.random) % bus.jitter));
+        }
+        if (nextRandom(bus.random) % 100 >= bus.dropTime)
+        {
+            sim.clock.syncTime(master.module, sentTime, simLocal(sim, sent + 1000 + nextRandom(bus.random) % bus.jitter));
+        }
+    }
+}
+
+static int64_t simError(SimBus &bus, double t)
+/*
+ * :param bus: the bus
+ *
+ * :param t: true time in microseconds
+ *
+ * :return: largest difference from the master's shared time, in microseconds
+ */
+{
+    int64_t masterTime = bus.clocks[bus.master].clock.getTime(simLocal(bus.clocks[bus.master], t));
+    int64_t worst = 0;
+    for (uint8_t i = 0; i < bus.count; i++)
+    {
+        int64_t error = (int64_t)bus.clocks[i].clock.getTime(simLocal(bus.clocks[i], t)) - masterTime;
+        error = error < 0 ? -error : error;
+        worst = error > worst ? error : worst;
+    }
+    return worst;
+}
+
+static bool simLocked(SimBus &bus)
+/*
+ * :param bus: the bus
+ *
+ * :return: true if every module other than the master is locked
+ */
+{
+    for (uint8_t i = 0; i < bus.count; i++)
+    {
+        if (i != bus.master && bus.clocks[i].clock.getState() != CLOCK_LOCKED)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void simRun(SimBus &bus, double &t, uint32_t syncs, uint32_t &lockedAt, int64_t &worst)
+/*
+ * Runs the bus for a number of sync intervals, probing the clocks at random times in between
+ *
+ * :param bus: the bus
+ *
+ * :param t: true time in microseconds, updated
+ *
+ * :param syncs: number of sync intervals
+ *
+ * :param lockedAt: set to the sync every module was first locked at, or syncs if never
+ *
+ * :param worst: set to the largest error once every module was locked, in microseconds
+ */
+{
+    lockedAt = syncs;
+    worst = 0;
+    for (uint32_t k = 0; k < syncs; k++)
+    {
+        simSync(bus, t);
+        if (lockedAt == syncs && simLocked(bus))
+        {
+            lockedAt = k;
+        }
+        for (uint8_t probe = 0; probe < 8; probe++)
+        {
+            double at = t + 5000 + nextRandom(bus.random) % (clockSyncInterval * 1000 - 5000);
+            int64_t error = simError(bus, at);
+            if (lockedAt < syncs && error > worst)
+            {
+                worst = error;
+            }
+        }
+        t += clockSyncInterval * 1000;
+    }
+}
+
+void test_ClockSync(void)
+/*
+ * Tests all clock sync testing functions
+ */
+{
+    RUN_TEST(test_clockSyncHigh);
+    RUN_TEST(test_clockSyncPairing);
+    RUN_TEST(test_clockSyncDrift);
+    RUN_TEST(test_clockSyncLosses);
+    RUN_TEST(test_clockSyncMasterChange);
+}
+
+void test_clockSyncHigh(void)
+/*
+ * tests the full shared time is rebuilt from the sync frame and sync time, across the 32 bit wrap
+ */
+{
+    // A master leads from its own clock
+    ClockSync master;
+    master.lead(0xFFFFF000);
+    TEST_ASSERT_EQUAL_UINT8(CLOCK_MASTER, master.getState());
+    TEST_ASSERT_TRUE(master.getTime(0xFFFFF000) == 0xFFFFF000);
+
+    // Its clock wraps, the shared time carries on past 32 bits
+    TEST_ASSERT_TRUE(master.getTime(0x10) == 0x100000010);
+    master.lead(0x10);
+    TEST_ASSERT_TRUE(master.getTime(0x1010) == 0x100001010);
+
+    // Queued before the low 32 bits wrapped and sent after, the follower takes the whole time
+    ClockSync follower;
+    follower.follow();
+    follower.sync(0x5C, 0xFF, 5000);
+    TEST_ASSERT_TRUE(follower.syncTime(0x5C, 0x00000200, 6000));
+    TEST_ASSERT_EQUAL_UINT8(CLOCK_ACQUIRING, follower.getState());
+    TEST_ASSERT_EQUAL_UINT8(0x5C, follower.getMaster());
+    TEST_ASSERT_EQUAL_UINT32(1, follower.getSteps());
+    TEST_ASSERT_TRUE(follower.getTime(5000) == 0x100000200);
+    TEST_ASSERT_TRUE(follower.getTime(6000) == 0x100000200 + 1000);
+    TEST_ASSERT_TRUE(follower.getSample(5000) == 0x100000200 * clockSampleRate / 1000000);
+
+    // Not wrapped, the queued high bits are used as they are
+    follower.sync(0x5C, 0x1234, 100000);
+    TEST_ASSERT_TRUE(follower.syncTime(0x5C, 0x34000000, 101000));
+    TEST_ASSERT_TRUE(follower.getTime(100000) == 0x1234000000);
+}
+
+void test_clockSyncPairing(void)
+/*
+ * tests a sync time is only used with the sync frame it follows, from the master being followed
+ */
+{
+    ClockSync follower;
+    follower.follow();
+
+    // No sync frame yet
+    TEST_ASSERT_FALSE(follower.syncTime(0x5C, 1000000, 100));
+    follower.sync(0x5C, 0, 100);
+
+    // From another module, or too late
+    TEST_ASSERT_FALSE(follower.syncTime(0x21, 1000000, 200));
+    TEST_ASSERT_FALSE(follower.syncTime(0x5C, 1000000, 100 + clockFollowUpWindow * 1000));
+    TEST_ASSERT_EQUAL_UINT32(0, follower.getSyncs());
+
+    // Only once
+    follower.sync(0x5C, 0, 300);
+    TEST_ASSERT_TRUE(follower.syncTime(0x5C, 1000000, 400));
+    TEST_ASSERT_FALSE(follower.syncTime(0x5C, 1000000, 500));
+    TEST_ASSERT_EQUAL_UINT32(1, follower.getSyncs());
+
+    // A master ignores every sync, and only follows again once it stops leading
+    ClockSync master;
+    master.lead(0);
+    master.sync(0x5C, 0, 100);
+    TEST_ASSERT_FALSE(master.syncTime(0x5C, 1000000, 200));
+    TEST_ASSERT_EQUAL_UINT8(CLOCK_MASTER, master.getState());
+    master.follow();
+    master.sync(0x5C, 0, 300);
+    TEST_ASSERT_TRUE(master.syncTime(0x5C, 1000000, 400));
+    TEST_ASSERT_TRUE(master.getTime(300) == 1000000);
+
+    // Small errors slew the clock, large ones step it
+    master.sync(0x5C, 0, 100300);
+    TEST_ASSERT_TRUE(master.syncTime(0x5C, 1100012, 100400));
+    TEST_ASSERT_EQUAL_INT32(12, master.getError());
+    TEST_ASSERT_EQUAL_UINT32(1, master.getSteps());
+    TEST_ASSERT_TRUE(master.getTime(100300) == 1100003);
+    master.sync(0x5C, 0, 200300);
+    TEST_ASSERT_TRUE(master.syncTime(0x5C, 1200000 + 5 * clockStepLimit, 200400));
+    TEST_ASSERT_EQUAL_UINT32(2, master.getSteps());
+    TEST_ASSERT_TRUE(master.getTime(200300) == 1200000 + 5 * clockStepLimit);
+
+    // A new master is followed from the next sync frame, and only stepped to if it is far off
+    master.sync(0x21, 0, 300300);
+    TEST_ASSERT_TRUE(master.syncTime(0x21, 1300000 + 5 * clockStepLimit + 4, 300400));
+    TEST_ASSERT_EQUAL_UINT8(0x21, master.getMaster());
+    TEST_ASSERT_INT32_WITHIN(1, 4, master.getError());
+    TEST_ASSERT_EQUAL_UINT32(2, master.getSteps());
+    master.sync(0x5C, 0, 400300);
+    TEST_ASSERT_TRUE(master.syncTime(0x5C, 1400000 - 5 * clockStepLimit, 400400));
+    TEST_ASSERT_EQUAL_UINT32(3, master.getSteps());
+}
+
+void test_clockSyncDrift(void)
+/*
+ * simulates modules with drifting crystals and interrupt jitter, every module locks to the master's sample index
+ */
+{
+    const double ppm[SIM_CLOCKS] = {60, -90, 150, -200};
+    SimBus bus;
+    simInit(bus, SIM_CLOCKS, ppm, 40);
+
+    double t = 0;
+    uint32_t lockedAt;
+    int64_t worst;
+    simRun(bus, t, 300, lockedAt, worst);
+    TEST_ASSERT_LESS_THAN_UINT32(50, lockedAt);
+    TEST_ASSERT_LESS_THAN_UINT32(simSamplePeriod, (uint32_t)worst);
+
+    // The rate learnt is the difference between the crystals
+    int32_t worstRate = 0;
+    for (uint8_t i = 1; i < SIM_CLOCKS; i++)
+    {
+        int32_t expected = ((1 + ppm[0] * 1e-6) / (1 + ppm[i] * 1e-6) - 1) * 1e9;
+        int32_t error = bus.clocks[i].clock.getRate() - expected;
+        error = error < 0 ? -error : error;
+        worstRate = error > worstRate ? error : worstRate;
+
+        // Every module plays the same sample at the same time, give or take the one on either side
+        uint64_t masterSample = bus.clocks[0].clock.getSample(simLocal(bus.clocks[0], t));
+        int64_t sampleError = (int64_t)bus.clocks[i].clock.getSample(simLocal(bus.clocks[i], t)) - (int64_t)masterSample;
+        TEST_ASSERT_TRUE(sampleError >= -1 && sampleError <= 1);
+    }
+    TEST_ASSERT_LESS_THAN_UINT32(10000, (uint32_t)worstRate);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "drift up to 350ppm, 40us jitter: locked after %u syncs, worst %dus, rate within %dppb",
+             (unsigned)lockedAt, (int)worst, (int)worstRate);
+    TEST_MESSAGE(msg);
+}
+
+void test_clockSyncLosses(void)
+/*
+ * simulates lost sync frames and sync times, the clocks stay within a sample
+ */
+{
+    const double ppm[SIM_CLOCKS] = {-100, 100, 0, 200};
+    SimBus bus;
+    simInit(bus, SIM_CLOCKS, ppm, 40);
+    bus.dropSync = 20;
+    bus.dropTime = 20;
+
+    double t = 0;
+    uint32_t lockedAt;
+    int64_t worst;
+    simRun(bus, t, 300, lockedAt, worst);
+    TEST_ASSERT_LESS_THAN_UINT32(100, lockedAt);
+    TEST_ASSERT_LESS_THAN_UINT32(simSamplePeriod, (uint32_t)worst);
+
+    // Only the first sync from the master was a step, a lost sync frame never pairs its time with the one before
+    for (uint8_t i = 1; i < SIM_CLOCKS; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(1, bus.clocks[i].clock.getSteps());
+        TEST_ASSERT_LESS_THAN_UINT32(300 * 7 / 10, bus.clocks[i].clock.getSyncs());
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "20%% of sync frames and times lost: locked after %u syncs, worst %dus", (unsigned)lockedAt,
+             (int)worst);
+    TEST_MESSAGE(msg);
+}
+
+void test_clockSyncMasterChange(void)
+/*
+ * simulates the master moving to another module, the shared time carries on without a jump
+ */
+{
+    const double ppm[SIM_CLOCKS] = {80, -120, 30};
+    SimBus bus;
+    simInit(bus, 3, ppm, 40);
+
+    double t = 0;
+    uint32_t lockedAt;
+    int64_t worst;
+    simRun(bus, t, 100, lockedAt, worst);
+    TEST_ASSERT_TRUE(simLocked(bus));
+
+    // The chain is placed again with the second module westmost, the old master follows
+    ClockSync previous = bus.clocks[2].clock;
+    bus.clocks[0].clock.follow();
+    bus.master = 1;
+    simSync(bus, t);
+
+    // The new master continued the time it had, so the other modules stepped by less than a sample
+    int64_t step = (int64_t)bus.clocks[2].clock.getTime(simLocal(bus.clocks[2], t)) -
+                   (int64_t)previous.getTime(simLocal(bus.clocks[2], t));
+    step = step < 0 ? -step : step;
+    TEST_ASSERT_LESS_THAN_UINT32(simSamplePeriod, (uint32_t)step);
+    TEST_ASSERT_EQUAL_UINT32(1, bus.clocks[2].clock.getSteps());
+
+    t += clockSyncInterval * 1000;
+    simRun(bus, t, 100, lockedAt, worst);
+    TEST_ASSERT_EQUAL_UINT8(CLOCK_MASTER, bus.clocks[1].clock.getState());
+    TEST_ASSERT_EQUAL_UINT8(0x22, bus.clocks[0].clock.getMaster());
+    TEST_ASSERT_LESS_THAN_UINT32(50, lockedAt);
+    TEST_ASSERT_LESS_THAN_UINT32(simSamplePeriod, (uint32_t)worst);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "master moved: stepped %dus, locked again after %u syncs", (int)step, (unsigned)lockedAt);
+    TEST_MESSAGE(msg);
+}
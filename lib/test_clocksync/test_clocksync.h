@@ -0,0 +1,36 @@
+#include <cstdint>
+
+#ifndef TEST_CLOCKSYNC_H
+#define TEST_CLOCKSYNC_H
+
+void test_ClockSync(void);
+/*
+ * Tests all clock sync testing functions
+ */
+
+void test_clockSyncHigh(void);
+/*
+ * tests the full shared time is rebuilt from the sync frame and sync time, across the 32 bit wrap
+ */
+
+void test_clockSyncPairing(void);
+/*
+ * tests a sync time is only used with the sync frame it follows, from the master being followed
+ */
+
+void test_clockSyncDrift(void);
+/*
+ * simulates modules with drifting crystals and interrupt jitter, every module locks to the master's sample index
+ */
+
+void test_clockSyncLosses(void);
+/*
+ * simulates lost sync frames and sync times, the clocks stay within a sample
+ */
+
+void test_clockSyncMasterChange(void);
+/*
+ * simulates the master moving to another module, the shared time carries on without a jump
+ */
+
+#endif
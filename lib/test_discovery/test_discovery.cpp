@@ -0,0 +1,549 @@
+#include <unity.h>
+#include <cstdio>
+#include "discovery.h"
+#include "test_random.h"
+#include "test_discovery.h"
+
+void test_Discovery(void)
+/*
+ * Tests all chain discovery testing functions
+ */
+{
+    RUN_TEST(test_chainOctaves);
+    RUN_TEST(test_discoveryAlone);
+    RUN_TEST(test_discoveryRound);
+    RUN_TEST(test_discoveryHotPlug);
+    RUN_TEST(test_discoveryRecovery);
+    RUN_TEST(test_discoveryScaling);
+}
+
+void test_chainOctaves(void)
+/*
+ * tests the octaves given along the chain wrap round within the octave knob's range
+ */
+{
+    TEST_ASSERT_EQUAL_UINT8(5, nextChainOctave(4));
+    TEST_ASSERT_EQUAL_UINT8(CHAIN_OCTAVE_MAX, nextChainOctave(CHAIN_OCTAVE_MAX - 1));
+    TEST_ASSERT_EQUAL_UINT8(CHAIN_OCTAVE_MIN, nextChainOctave(CHAIN_OCTAVE_MAX));
+    TEST_ASSERT_EQUAL_UINT8(CHAIN_OCTAVE_MIN, nextChainOctave(0));
+}
+
+void test_discoveryAlone(void)
+/*
+ * tests a module with no neighbours takes position 0 of a chain of its own with one frame
+ */
+{
+    ChainDiscovery discovery(0x21);
+    DiscoveryMessage message;
+
+    // Nothing is sent while the debouncers settle
+    TEST_ASSERT_FALSE(discovery.update(false, false, 4, 1000, message));
+    TEST_ASSERT_FALSE(discovery.update(false, false, 4, 1000 + discoveryTimeout - 1, message));
+    TEST_ASSERT_FALSE(discovery.isSettled());
+    TEST_ASSERT_EQUAL_UINT8(POSITION_NONE, discovery.getPosition());
+
+    TEST_ASSERT_TRUE(discovery.update(false, false, 4, 1000 + discoveryTimeout, message));
+    TEST_ASSERT_EQUAL_UINT8(0x21, message.chain);
+    TEST_ASSERT_EQUAL_UINT8(0, message.position);
+    TEST_ASSERT_EQUAL_UINT8(4, message.octave);
+    TEST_ASSERT_EQUAL_UINT8(0, message.more);
+    TEST_ASSERT_TRUE(discovery.isSettled());
+    TEST_ASSERT_EQUAL_UINT8(1, discovery.getCount());
+    TEST_ASSERT_TRUE(discovery.getEastOutput());
+
+    // Nothing more while nothing changes
+    TEST_ASSERT_FALSE(discovery.update(false, false, 4, 2000, message));
+}
+
+void test_discoveryRound(void)
+/*
+ * tests modules powered up together are placed in order by one frame each, and a clash starts them again
+ */
+{
+    ChainDiscovery west(0x5C);
+    ChainDiscovery east(0x21);
+    DiscoveryMessage message;
+
+    TEST_ASSERT_FALSE(west.update(false, true, 3, 0, message));
+    TEST_ASSERT_FALSE(east.update(true, false, 6, 0, message));
+
+    // The westmost module claims position 0, holding its east output high until the claim has gone
+    TEST_ASSERT_TRUE(west.update(false, true, 3, discoveryTimeout, message));
+    TEST_ASSERT_EQUAL_UINT8(0x5C, message.chain);
+    TEST_ASSERT_EQUAL_UINT8(0, message.position);
+    TEST_ASSERT_EQUAL_UINT8(1, message.more);
+    TEST_ASSERT_EQUAL_UINT8(DISC_CLAIMED, west.getState());
+    TEST_ASSERT_TRUE(west.getEastOutput());
+    east.receive(0x5C, message, discoveryTimeout + 1);
+    TEST_ASSERT_EQUAL_UINT8(DISC_WAITING, east.getState());
+
+    // Still seeing its west neighbour, the east module waits for the token
+    TEST_ASSERT_FALSE(east.update(true, false, 6, discoveryTimeout + 2, message));
+    TEST_ASSERT_FALSE(west.update(false, true, 3, discoveryTimeout + discoveryHoldoff, message));
+    TEST_ASSERT_FALSE(west.getEastOutput());
+
+    // Given the token, it claims the next place and octave as the last of the chain
+    TEST_ASSERT_TRUE(east.update(false, false, 6, discoveryTimeout + discoveryHoldoff + 4, message));
+    TEST_ASSERT_EQUAL_UINT8(0x5C, message.chain);
+    TEST_ASSERT_EQUAL_UINT8(1, message.position);
+    TEST_ASSERT_EQUAL_UINT8(4, message.octave);
+    TEST_ASSERT_EQUAL_UINT8(0, message.more);
+    TEST_ASSERT_TRUE(east.isSettled());
+    TEST_ASSERT_EQUAL_UINT8(2, east.getCount());
+    TEST_ASSERT_EQUAL_UINT8(4, east.getOctave());
+
+    west.receive(0x21, message, discoveryTimeout + discoveryHoldoff + 5);
+    TEST_ASSERT_TRUE(west.isSettled());
+    TEST_ASSERT_EQUAL_UINT8(2, west.getCount());
+    TEST_ASSERT_TRUE(west.getEastOutput());
+
+    // A third module claiming the east module's place makes it start the discovery again, after a backoff for its
+    // position
+    east.receive(0x33, DiscoveryMessage{0x5C, 1, 4, 0}, 200);
+    TEST_ASSERT_FALSE(east.update(true, false, 4, 200 + discoveryBackoff - 1, message));
+    TEST_ASSERT_TRUE(east.update(true, false, 4, 200 + discoveryBackoff, message));
+    TEST_ASSERT_EQUAL_UINT8(POSITION_NONE, message.position);
+    TEST_ASSERT_EQUAL_UINT8(DISC_WAITING, east.getState());
+    west.receive(0x21, message, 210);
+    TEST_ASSERT_EQUAL_UINT8(POSITION_NONE, west.getPosition());
+    TEST_ASSERT_EQUAL_UINT8(0, west.getCount());
+
+    // Only the westmost module starts the new round, once the east outputs have settled
+    TEST_ASSERT_FALSE(west.update(false, true, 3, 210 + discoverySettle - 1, message));
+    TEST_ASSERT_TRUE(west.update(false, true, 3, 210 + discoverySettle, message));
+    TEST_ASSERT_EQUAL_UINT8(0, message.position);
+    TEST_ASSERT_FALSE(east.update(true, false, 4, 210 + discoverySettle, message));
+}
+
+/* --- Simulation --- */
+
+const uint8_t SIM_MODULES_MAX = 16;
+const uint8_t SIM_FRAMES_MAX = 32;
+const uint32_t simStep = 125;         // us between steps of the simulation
+const uint32_t simFrameTime = 1000;   // us an 8 byte frame takes on the bus at 125kbit/s
+const uint32_t simDebounce = 3500;    // us a detect input must be steady to pass the debouncer, 4 matrix frames
+const uint32_t simPollInterval = 2000; // us between updates of the discovery task
+
+struct SimModule
+/*
+ * A module of the discovery simulation, with the debounced detect inputs and the octave knob of main.cpp
+ */
+{
+    uint8_t id;
+    bool powered;
+    uint8_t octave;
+    ChainDiscovery discovery;
+    uint32_t nextPoll;
+
+    // Debounced detect inputs, and when the raw input last differed from them
+    bool west;
+    bool east;
+    uint32_t westSince;
+    uint32_t eastSince;
+
+    // Place last applied to the octave knob
+    uint8_t chain;
+    uint8_t position;
+};
+
+struct SimFrame
+{
+    uint8_t sender;
+    DiscoveryMessage message;
+    uint32_t ready; // Time it can win arbitration, later on a busy bus
+};
+
+struct SimChain
+/*
+ * Modules side by side, joined or not to their east neighbour, sharing a CAN bus with the modules they are joined to
+ */
+{
+    SimModule modules[SIM_MODULES_MAX];
+    bool joined[SIM_MODULES_MAX]; // joined[i]: module i and module i + 1 are plugged together
+    uint8_t count;
+
+    SimFrame pending[SIM_FRAMES_MAX];
+    uint8_t pendingCount;
+    SimFrame sending;
+    bool busy;
+    uint32_t busyUntil;
+
+    uint32_t now;
+    uint32_t random;
+    uint32_t busDelay;   // Longest extra wait for the bus, from other modules' key events
+    uint32_t frames;     // Discovery frames sent
+    uint32_t resets;     // Resets among them
+    uint32_t lastFrame;  // Time the last frame was delivered
+    uint32_t runTime;    // us from the start of the last run to its last frame, 0 if it sent none
+    int16_t dropPosition; // Claims of this position are lost once, -1 for none
+};
+
+static void simInit(SimChain &sim, uint8_t count, uint32_t seed)
+/*
+ * Sets up a row of unpowered, unjoined modules
+ */
+{
+    sim.count = count;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SimModule &module = sim.modules[i];
+        module.id = 0x10 + ((i * 37 + 11) % 0xE0);
+        module.powered = false;
+        module.octave = 4;
+        module.west = false;
+        module.east = false;
+        sim.joined[i] = false;
+    }
+    sim.pendingCount = 0;
+    sim.busy = false;
+    sim.now = 0;
+    sim.random = seed;
+    sim.busDelay = 0;
+    sim.frames = 0;
+    sim.resets = 0;
+    sim.lastFrame = 0;
+    sim.dropPosition = -1;
+}
+
+static void simPowerUp(SimChain &sim, uint8_t i)
+/*
+ * Powers up a module, its discovery task starts some time within the next 5ms
+ */
+{
+    SimModule &module = sim.modules[i];
+    module.powered = true;
+    module.octave = 4;
+    module.discovery = ChainDiscovery(module.id);
+    module.nextPoll = sim.now + nextRandom(sim.random) % 5000;
+    module.west = false;
+    module.east = false;
+    module.westSince = sim.now;
+    module.eastSince = sim.now;
+    module.chain = 0;
+    module.position = POSITION_NONE;
+}
+
+static bool simConnected(SimChain &sim, uint8_t a, uint8_t b)
+/*
+ * :return: true if the CAN bus reaches from module a to module b
+ */
+{
+    uint8_t low = a < b ? a : b;
+    uint8_t high = a < b ? b : a;
+    for (uint8_t i = low; i < high; i++)
+    {
+        if (!sim.joined[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void simFilter(SimChain &sim, bool raw, bool &level, uint32_t &since)
+/*
+ * Follows a raw detect input, which only changes the debounced level once it has been steady for simDebounce
+ */
+{
+    if (raw == level)
+    {
+        since = sim.now;
+    }
+    else if (sim.now - since >= simDebounce)
+    {
+        level = raw;
+        since = sim.now;
+    }
+}
+
+static void simStepOnce(SimChain &sim)
+/*
+ * Advances the simulation by one step: the detect inputs, the bus, then the discovery tasks due
+ */
+{
+    sim.now += simStep;
+
+    // A neighbour is seen on the west while it drives its east output high, and on the east while it is powered
+    for (uint8_t i = 0; i < sim.count; i++)
+    {
+        SimModule &module = sim.modules[i];
+        bool westRaw = i > 0 && sim.joined[i - 1] && sim.modules[i - 1].powered &&
+                       sim.modules[i - 1].discovery.getEastOutput();
+        bool eastRaw = i + 1 < sim.count && sim.joined[i] && sim.modules[i + 1].powered;
+        simFilter(sim, westRaw, module.west, module.westSince);
+        simFilter(sim, eastRaw, module.east, module.eastSince);
+    }
+
+    // Every module joined to the sender gets its frame as it completes
+    if (sim.busy && sim.now >= sim.busyUntil)
+    {
+        sim.busy = false;
+        sim.lastFrame = sim.now;
+        bool drop = sim.sending.message.position == sim.dropPosition;
+        if (drop)
+        {
+            sim.dropPosition = -1;
+        }
+        for (uint8_t i = 0; i < sim.count && !drop; i++)
+        {
+            if (i != sim.sending.sender && sim.modules[i].powered && simConnected(sim, i, sim.sending.sender))
+            {
+                sim.modules[i].discovery.receive(sim.modules[sim.sending.sender].id, sim.sending.message, sim.now / 1000);
+            }
+        }
+    }
+
+    // Arbitration picks the ready frame with the lowest ID, the sender's module ID
+    if (!sim.busy)
+    {
+        int8_t next = -1;
+        for (uint8_t f = 0; f < sim.pendingCount; f++)
+        {
+            if (sim.pending[f].ready <= sim.now &&
+                (next < 0 || sim.modules[sim.pending[f].sender].id < sim.modules[sim.pending[next].sender].id))
+            {
+                next = f;
+            }
+        }
+        if (next >= 0)
+        {
+            sim.sending = sim.pending[next];
+            sim.pending[next] = sim.pending[--sim.pendingCount];
+            sim.busy = true;
+            sim.busyUntil = sim.now + simFrameTime;
+        }
+    }
+
+    for (uint8_t i = 0; i < sim.count; i++)
+    {
+        SimModule &module = sim.modules[i];
+        if (!module.powered || sim.now < module.nextPoll)
+        {
+            continue;
+        }
+        module.nextPoll += simPollInterval;
+
+        DiscoveryMessage message;
+        if (module.discovery.update(module.west, module.east, module.octave, sim.now / 1000, message))
+        {
+            TEST_ASSERT_LESS_THAN_UINT8(SIM_FRAMES_MAX, sim.pendingCount);
+            sim.pending[sim.pendingCount++] = SimFrame{i, message, sim.now + (sim.busDelay ? nextRandom(sim.random) % sim.busDelay : 0)};
+            sim.frames++;
+            sim.resets += message.position == POSITION_NONE;
+        }
+
+        // What main.cpp does once the module has a new place
+        if (module.discovery.isSettled() &&
+            (module.discovery.getChain() != module.chain || module.discovery.getPosition() != module.position))
+        {
+            module.chain = module.discovery.getChain();
+            module.position = module.discovery.getPosition();
+            module.octave = module.discovery.getOctave();
+        }
+    }
+}
+
+static void simRun(SimChain &sim, uint32_t ms)
+/*
+ * Runs the simulation for a while, then checks every run of joined, powered modules is one placed chain
+ */
+{
+    uint32_t start = sim.now;
+    uint32_t startFrame = sim.lastFrame;
+    while (sim.now - start < ms * 1000)
+    {
+        simStepOnce(sim);
+    }
+    sim.runTime = sim.lastFrame != startFrame ? sim.lastFrame - start : 0;
+    TEST_ASSERT_EQUAL_UINT8(0, sim.pendingCount);
+    TEST_ASSERT_FALSE(sim.busy);
+
+    uint8_t first = 0;
+    while (first < sim.count)
+    {
+        if (!sim.modules[first].powered)
+        {
+            first++;
+            continue;
+        }
+        uint8_t last = first;
+        while (last + 1 < sim.count && sim.joined[last] && sim.modules[last + 1].powered)
+        {
+            last++;
+        }
+
+        // One chain from the westmost module, in order, each an octave up from its west neighbour
+        uint8_t chain = sim.modules[first].discovery.getChain();
+        for (uint8_t i = first; i <= last; i++)
+        {
+            ChainDiscovery &discovery = sim.modules[i].discovery;
+            TEST_ASSERT_TRUE(discovery.isSettled());
+            TEST_ASSERT_TRUE(discovery.getEastOutput());
+            TEST_ASSERT_EQUAL_UINT8(chain, discovery.getChain());
+            TEST_ASSERT_EQUAL_UINT8(i - first, discovery.getPosition());
+            TEST_ASSERT_EQUAL_UINT8(last - first + 1, discovery.getCount());
+            if (i > first)
+            {
+                TEST_ASSERT_EQUAL_UINT8(nextChainOctave(sim.modules[i - 1].octave), sim.modules[i].octave);
+            }
+        }
+        first = last + 1;
+    }
+}
+
+static void simChainUp(SimChain &sim, uint8_t first, uint8_t last)
+/*
+ * Joins a run of modules and powers them up together
+ */
+{
+    for (uint8_t i = first; i <= last; i++)
+    {
+        sim.joined[i] = i < last;
+        simPowerUp(sim, i);
+    }
+}
+
+void test_discoveryHotPlug(void)
+/*
+ * simulates modules plugged in and out of a chain, only the modules that have to move take new places
+ */
+{
+    static SimChain sim;
+    simInit(sim, 12, 3);
+    simChainUp(sim, 0, 4);
+    simRun(sim, 300);
+    TEST_ASSERT_EQUAL_UINT32(5, sim.frames);
+    uint8_t chain = sim.modules[0].discovery.getChain();
+    TEST_ASSERT_EQUAL_UINT8(sim.modules[0].id, chain);
+
+    // A module already running on its own joined to the east: the end of the chain claims again and passes the token
+    simPowerUp(sim, 5);
+    simRun(sim, 300);
+    sim.frames = 0;
+    sim.joined[4] = true;
+    simRun(sim, 300);
+    TEST_ASSERT_EQUAL_UINT32(2, sim.frames);
+    TEST_ASSERT_EQUAL_UINT8(chain, sim.modules[5].discovery.getChain());
+    char msg[128];
+    snprintf(msg, sizeof(msg), "module joined to the east: %u frames, %u.%ums", (unsigned)sim.frames,
+             (unsigned)(sim.runTime / 1000), (unsigned)(sim.runTime % 1000 / 100));
+    TEST_MESSAGE(msg);
+
+    // Unplugged from the east: the new end claims again as the last
+    sim.frames = 0;
+    sim.modules[5].powered = false;
+    sim.joined[4] = false;
+    simRun(sim, 300);
+    TEST_ASSERT_EQUAL_UINT32(1, sim.frames);
+
+    // Another chain of 3 joined behind it: only the joined modules are renumbered
+    simChainUp(sim, 5, 7);
+    simRun(sim, 300);
+    sim.frames = 0;
+    sim.joined[4] = true;
+    simRun(sim, 300);
+    TEST_ASSERT_EQUAL_UINT32(4, sim.frames);
+    TEST_ASSERT_EQUAL_UINT8(chain, sim.modules[7].discovery.getChain());
+    snprintf(msg, sizeof(msg), "chain of 3 joined to the east: %u frames, %u.%ums", (unsigned)sim.frames,
+             (unsigned)(sim.runTime / 1000), (unsigned)(sim.runTime % 1000 / 100));
+    TEST_MESSAGE(msg);
+
+    // Split in two: the west half claims its end again, the east half starts its own chain
+    sim.frames = 0;
+    sim.joined[2] = false;
+    simRun(sim, 300);
+    TEST_ASSERT_EQUAL_UINT32(1 + 5, sim.frames);
+    TEST_ASSERT_EQUAL_UINT8(chain, sim.modules[0].discovery.getChain());
+    TEST_ASSERT_EQUAL_UINT8(sim.modules[3].id, sim.modules[7].discovery.getChain());
+
+    // Joined back together
+    sim.frames = 0;
+    sim.joined[2] = true;
+    simRun(sim, 300);
+    TEST_ASSERT_EQUAL_UINT32(1 + 5, sim.frames);
+    TEST_ASSERT_EQUAL_UINT8(chain, sim.modules[7].discovery.getChain());
+
+    // A module powered up already joined to the east, with no reset
+    sim.frames = 0;
+    sim.joined[7] = true;
+    simPowerUp(sim, 8);
+    simRun(sim, 300);
+    TEST_ASSERT_EQUAL_UINT32(2, sim.frames);
+    TEST_ASSERT_EQUAL_UINT32(0, sim.resets);
+}
+
+void test_discoveryRecovery(void)
+/*
+ * simulates lost claims and a module unplugged mid-round, the chain is placed again with a bounded number of frames
+ */
+{
+    static SimChain sim;
+    const uint8_t count = 8;
+    uint32_t worstFrames = 0;
+    uint32_t worstResets = 0;
+    for (uint8_t lost = 1; lost < count; lost++)
+    {
+        // Lost by every other module, so the next module claims the same place and they clash
+        simInit(sim, count, 11 + lost);
+        sim.dropPosition = lost;
+        simChainUp(sim, 0, count - 1);
+        simRun(sim, 1000);
+        TEST_ASSERT_EQUAL_INT16(-1, sim.dropPosition);
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, sim.resets);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(3 * count, sim.frames);
+        worstFrames = sim.frames > worstFrames ? sim.frames : worstFrames;
+        worstResets = sim.resets > worstResets ? sim.resets : worstResets;
+    }
+    char msg[128];
+    snprintf(msg, sizeof(msg), "claim lost in a round of %u: up to %u frames, %u resets", (unsigned)count,
+             (unsigned)worstFrames, (unsigned)worstResets);
+    TEST_MESSAGE(msg);
+
+    // Unplugged as the token reaches it: the module before it ends its chain, the modules after it start their own
+    simInit(sim, count, 5);
+    simChainUp(sim, 0, count - 1);
+    while (sim.modules[3].discovery.getState() != DISC_CLAIMED)
+    {
+        simStepOnce(sim);
+    }
+    sim.modules[4].powered = false;
+    sim.joined[3] = false;
+    sim.joined[4] = false;
+    simRun(sim, 1000);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(3 * count, sim.frames);
+    TEST_ASSERT_EQUAL_UINT8(4, sim.modules[0].discovery.getCount());
+    TEST_ASSERT_EQUAL_UINT8(3, sim.modules[5].discovery.getCount());
+}
+
+void test_discoveryScaling(void)
+/*
+ * simulates chains of up to 16 modules powering up, reporting the frames and time to place every module
+ */
+{
+    static SimChain sim;
+    const uint8_t counts[5] = {2, 4, 8, 12, 16};
+    for (uint8_t busy = 0; busy < 2; busy++)
+    {
+        for (uint8_t c = 0; c < 5; c++)
+        {
+            uint8_t count = counts[c];
+            simInit(sim, count, 17 + c);
+
+            // Key events from the other modules hold up the claims, by less than the holdoff
+            sim.busDelay = busy ? (discoveryHoldoff - 2) * 1000 : 0;
+            simChainUp(sim, 0, count - 1);
+            simRun(sim, 600);
+            uint32_t time = sim.runTime;
+
+            char msg[128];
+            snprintf(msg, sizeof(msg), "%2u modules%s: %2u frames, placed in %u.%ums from power up", (unsigned)count,
+                     busy ? " (busy bus)" : "", (unsigned)sim.frames, (unsigned)(time / 1000), (unsigned)(time % 1000 / 100));
+            TEST_MESSAGE(msg);
+
+            // One frame per module, the first after the settling time and about 10ms between the rest
+            TEST_ASSERT_EQUAL_UINT32(count, sim.frames);
+            TEST_ASSERT_EQUAL_UINT32(0, sim.resets);
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32((discoveryTimeout + 10 + count * 12) * 1000, time);
+        }
+    }
+}
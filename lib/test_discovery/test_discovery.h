@@ -0,0 +1,41 @@
+#include <cstdint>
+
+#ifndef TEST_DISCOVERY_H
+#define TEST_DISCOVERY_H
+
+void test_Discovery(void);
+/*
+ * Tests all chain discovery testing functions
+ */
+
+void test_chainOctaves(void);
+/*
+ * tests the octaves given along the chain wrap round within the octave knob's range
+ */
+
+void test_discoveryAlone(void);
+/*
+ * tests a module with no neighbours takes position 0 of a chain of its own with one frame
+ */
+
+void test_discoveryRound(void);
+/*
+ * tests modules powered up together are placed in order by one frame each, and a clash starts them again
+ */
+
+void test_discoveryHotPlug(void);
+/*
+ * simulates modules plugged in and out of a chain, only the modules that have to move take new places
+ */
+
+void test_discoveryRecovery(void);
+/*
+ * simulates lost claims and a module unplugged mid-round, the chain is placed again with a bounded number of frames
+ */
+
+void test_discoveryScaling(void);
+/*
+ * simulates chains of up to 16 modules powering up, reporting the frames and time to place every module
+ */
+
+#endif
@@ -0,0 +1,320 @@
+#include <unity.h>
+#include <cstdio>
+#include <cstring>
+#include "display.h"
+#include "i2c_queue.h"
+#include "test_random.h"
+#include "test_display.h"
+
+static void drawText(uint8_t buffer[DISPLAY_BUFFER_SIZE], uint8_t x, uint8_t baseline, const char *text)
+/*
+ * Stand in for U8g2's font rendering: each character is 5 columns of a pattern of its own, 8 pixels above the
+ * baseline and 2 below, then a blank column
+ *
+ * :param buffer: frame in U8g2's full buffer layout
+ *
+ * :param x: left of the first character
+ *
+ * :param baseline: baseline of the text
+ *
+ * :param text: the text, cut off at the right edge
+ */
+{
+    for (; *text && x + 6 <= DISPLAY_WIDTH; text++, x += 6)
+    {
+        for (uint8_t column = 0; column < 5; column++)
+        {
+            uint32_t pattern = ((uint8_t)*text * 2654435761u) >> (column * 4);
+            for (uint8_t row = 0; row < 10; row++)
+            {
+                uint8_t y = baseline - 8 + row;
+                if (pattern >> row & 1)
+                {
+                    buffer[(y / 8) * DISPLAY_WIDTH + x + column] |= 1 << (y % 8);
+                }
+            }
+        }
+    }
+}
+
+static void drawFields(uint8_t buffer[DISPLAY_BUFFER_SIZE], const DisplayFields &fields)
+/*
+ * Draws the fields where the display task does
+ *
+ * :param buffer: frame in U8g2's full buffer layout, cleared first
+ *
+ * :param fields: the fields to draw
+ */
+{
+    const char *const waves[] = {"Saw", "Sin", "Sqr", "Tri"};
+    char text[24];
+    memset(buffer, 0, DISPLAY_BUFFER_SIZE);
+
+    snprintf(text, sizeof(text), "Oct: %u", fields.octave);
+    drawText(buffer, 2, 10, text);
+    if (fields.playing)
+    {
+        snprintf(text, sizeof(text), "Vol: %u", fields.volume);
+        drawText(buffer, 60, 20, text);
+        snprintf(text, sizeof(text), "%u%%%s", fields.load, fields.overrun ? "!" : "");
+        drawText(buffer, 100, 20, text);
+        snprintf(text, sizeof(text), "Wave: %s%s", waves[fields.wave], fields.bandLimited ? "*" : "");
+        drawText(buffer, 42, 10, text);
+        snprintf(text, sizeof(text), "Echo: %us", fields.echo);
+        drawText(buffer, 2, 20, text);
+        drawText(buffer, 2, 30, fields.notes);
+    }
+    if (fields.status)
+    {
+        drawText(buffer, 110, 10, fields.status);
+    }
+}
+
+void test_Display(void)
+/*
+ * Tests all display model testing functions
+ */
+{
+    RUN_TEST(test_displayUnchanged);
+    RUN_TEST(test_displayTiles);
+    RUN_TEST(test_displayBytes);
+    RUN_TEST(test_i2cQueue);
+    RUN_TEST(test_i2cQueueFrame);
+}
+
+void test_displayUnchanged(void)
+/*
+ * tests a frame is only drawn when a field changed, and the first frame always is
+ */
+{
+    DisplayModel model;
+    DisplayFields fields = {};
+    fields.octave = 4;
+    fields.playing = 1;
+    strcpy(fields.notes, "C4");
+
+    TEST_ASSERT_TRUE(model.update(fields));
+    TEST_ASSERT_FALSE(model.update(fields));
+
+    // Every field counts, the notes only up to their terminating 0
+    DisplayFields changed = fields;
+    changed.volume = 1;
+    TEST_ASSERT_TRUE(model.update(changed));
+    changed.status = "Rx";
+    TEST_ASSERT_TRUE(model.update(changed));
+    changed.overrun = 1;
+    TEST_ASSERT_TRUE(model.update(changed));
+    changed.notes[3] = 'x';
+    TEST_ASSERT_FALSE(model.update(changed));
+    strcpy(changed.notes, "C4 E4");
+    TEST_ASSERT_TRUE(model.update(changed));
+
+    TEST_ASSERT_EQUAL_UINT32(7, model.getFrames());
+    TEST_ASSERT_EQUAL_UINT32(2, model.getSkipped());
+    TEST_ASSERT_EQUAL_UINT32(0, model.getBytes());
+}
+
+void test_displayTiles(void)
+/*
+ * tests only the span of changed tiles on each row of tiles is sent, and what was sent is remembered
+ */
+{
+    DisplayModel model;
+    DisplayArea areas[DISPLAY_TILE_ROWS];
+    uint8_t buffer[DISPLAY_BUFFER_SIZE] = {0};
+
+    // The display starts cleared, so a blank frame sends nothing
+    TEST_ASSERT_EQUAL_UINT8(0, model.flush(buffer, areas));
+
+    // Pixels in tiles 2 and 5 of row 1, and the last tile of row 3
+    buffer[1 * DISPLAY_WIDTH + 2 * 8 + 3] = 0x10;
+    buffer[1 * DISPLAY_WIDTH + 5 * 8] = 0x01;
+    buffer[3 * DISPLAY_WIDTH + DISPLAY_WIDTH - 1] = 0x80;
+    TEST_ASSERT_EQUAL_UINT8(2, model.flush(buffer, areas));
+    TEST_ASSERT_EQUAL_UINT8(2, areas[0].tileX);
+    TEST_ASSERT_EQUAL_UINT8(1, areas[0].tileY);
+    TEST_ASSERT_EQUAL_UINT8(4, areas[0].tileWidth);
+    TEST_ASSERT_EQUAL_UINT8(DISPLAY_TILE_COLUMNS - 1, areas[1].tileX);
+    TEST_ASSERT_EQUAL_UINT8(3, areas[1].tileY);
+    TEST_ASSERT_EQUAL_UINT8(1, areas[1].tileWidth);
+    TEST_ASSERT_EQUAL_UINT32(5 * 8 + 2 * DISPLAY_ROW_OVERHEAD, model.getBytes());
+
+    // Sent tiles are what the display now shows
+    TEST_ASSERT_EQUAL_UINT8(0, model.flush(buffer, areas));
+    buffer[1 * DISPLAY_WIDTH + 5 * 8] = 0;
+    TEST_ASSERT_EQUAL_UINT8(1, model.flush(buffer, areas));
+    TEST_ASSERT_EQUAL_UINT8(5, areas[0].tileX);
+    TEST_ASSERT_EQUAL_UINT8(1, areas[0].tileWidth);
+}
+
+void test_displayBytes(void)
+/*
+ * benchmarks the bytes sent per second while playing, against sending every frame in full
+ */
+{
+    // A minute at 10 frames per second: the held notes change in a third of the frames, a knob in one in fifty
+    const uint32_t frames = 600;
+    const char *const names[12] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+
+    DisplayModel model;
+    DisplayArea areas[DISPLAY_TILE_ROWS];
+    uint8_t buffer[DISPLAY_BUFFER_SIZE];
+    uint32_t random = 1;
+    uint32_t drawn = 0;
+
+    DisplayFields fields = {};
+    fields.octave = 4;
+    fields.volume = 6;
+    fields.echo = 1;
+    fields.playing = 1;
+    fields.status = "Rx";
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        if (nextRandom(random) % 3 == 0)
+        {
+            // Up to three held notes
+            uint8_t held = nextRandom(random) % 4;
+            char *end = fields.notes;
+            *end = 0;
+            for (uint8_t i = 0; i < held; i++)
+            {
+                end += snprintf(end, fields.notes + DISPLAY_NOTES_LENGTH - end, "%s%u ", names[nextRandom(random) % 12],
+                                fields.octave);
+            }
+        }
+        // The load meter's report changes once a second
+        if (frame % 10 == 0)
+        {
+            fields.load = 20 + nextRandom(random) % 4;
+        }
+        switch (nextRandom(random) % 200)
+        {
+        case 0:
+            fields.volume = nextRandom(random) % 9;
+            break;
+        case 1:
+            fields.echo = nextRandom(random) % 11;
+            break;
+        case 2:
+            fields.wave = nextRandom(random) % 4;
+            break;
+        case 3:
+            fields.octave = 1 + nextRandom(random) % 7;
+            break;
+        }
+
+        if (model.update(fields))
+        {
+            drawFields(buffer, fields);
+            model.flush(buffer, areas);
+            drawn++;
+        }
+    }
+
+    uint32_t before = displayFullFrameBytes * 10;
+    uint32_t after = model.getBytes() * 10 / frames;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%u of %u frames drawn, %u unchanged: %u bytes/s sent, %u bytes/s redrawing every frame",
+             (unsigned)drawn, (unsigned)frames, (unsigned)model.getSkipped(), (unsigned)after, (unsigned)before);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(frames, model.getFrames());
+    TEST_ASSERT_LESS_THAN_UINT32(before / 4, after);
+}
+
+void test_i2cQueue(void)
+/*
+ * tests transfers come out whole and in order, a full queue refuses the next, and overlong transfers are cut
+ */
+{
+    I2cTransferQueue queue;
+    uint8_t data[I2C_TRANSFER_SIZE + 8];
+    for (uint8_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = i;
+    }
+
+    TEST_ASSERT_TRUE(queue.isEmpty());
+    TEST_ASSERT_NULL(queue.front());
+
+    // Filled in pieces, only handed over once ended
+    TEST_ASSERT_TRUE(queue.begin(0x78));
+    queue.append(data, 1);
+    queue.append(data + 1, 3);
+    TEST_ASSERT_NULL(queue.front());
+    queue.end();
+    I2cTransfer *transfer = queue.front();
+    TEST_ASSERT_NOT_NULL(transfer);
+    TEST_ASSERT_EQUAL_UINT8(0x78, transfer->address);
+    TEST_ASSERT_EQUAL_UINT8(4, transfer->length);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(data, transfer->data, 4);
+    queue.pop();
+    TEST_ASSERT_TRUE(queue.isEmpty());
+
+    // Overlong transfers keep their first bytes
+    TEST_ASSERT_TRUE(queue.begin(0x78));
+    queue.append(data, sizeof(data));
+    queue.end();
+    TEST_ASSERT_EQUAL_UINT8(I2C_TRANSFER_SIZE, queue.front()->length);
+    TEST_ASSERT_EQUAL_UINT32(1, queue.getTruncated());
+    queue.pop();
+
+    // Full once every cell is waiting, then each completion makes room for one more
+    for (uint8_t i = 0; i < I2C_TRANSFERS; i++)
+    {
+        TEST_ASSERT_TRUE(queue.begin(i));
+        queue.end();
+    }
+    TEST_ASSERT_FALSE(queue.begin(0xFF));
+    queue.end();
+    TEST_ASSERT_EQUAL_UINT8(0, queue.front()->address);
+    queue.pop();
+    TEST_ASSERT_TRUE(queue.begin(I2C_TRANSFERS));
+    queue.end();
+    for (uint8_t i = 1; i <= I2C_TRANSFERS; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(i, queue.front()->address);
+        queue.pop();
+    }
+    TEST_ASSERT_TRUE(queue.isEmpty());
+    TEST_ASSERT_EQUAL_UINT32(2 + I2C_TRANSFERS + 1, queue.getQueued());
+}
+
+void test_i2cQueueFrame(void)
+/*
+ * tests a whole frame, split into transfers as U8g2 sends it, fits in the queue so the display task never waits
+ */
+{
+    I2cTransferQueue queue;
+    const uint8_t command[4] = {0x00, 0xB0, 0x10, 0x00}; // control byte, page and column addresses
+    const uint8_t chunk = 24;
+    uint8_t data[chunk] = {0};
+    const uint8_t control = 0x40;
+    uint8_t transfers = 0;
+
+    // U8g2's SSD13xx I2C driver addresses each row of tiles, then sends its data 24 bytes at a time
+    for (uint8_t row = 0; row < DISPLAY_TILE_ROWS; row++)
+    {
+        TEST_ASSERT_TRUE(queue.begin(0x78));
+        queue.append(command, sizeof(command));
+        queue.end();
+        transfers++;
+        for (uint8_t sent = 0; sent < DISPLAY_WIDTH; sent += chunk)
+        {
+            uint8_t length = DISPLAY_WIDTH - sent < chunk ? DISPLAY_WIDTH - sent : chunk;
+            TEST_ASSERT_TRUE(queue.begin(0x78));
+            queue.append(&control, 1);
+            queue.append(data, length);
+            queue.end();
+            transfers++;
+        }
+    }
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "A full frame is %u transfers, in a queue of %u", (unsigned)transfers,
+             (unsigned)I2C_TRANSFERS);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(0, queue.getTruncated());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(I2C_TRANSFERS, transfers);
+}
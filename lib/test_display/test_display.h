@@ -0,0 +1,36 @@
+#include <cstdint>
+
+#ifndef TEST_DISPLAY_H
+#define TEST_DISPLAY_H
+
+void test_Display(void);
+/*
+ * Tests all display model testing functions
+ */
+
+void test_displayUnchanged(void);
+/*
+ * tests a frame is only drawn when a field changed, and the first frame always is
+ */
+
+void test_displayTiles(void);
+/*
+ * tests only the span of changed tiles on each row of tiles is sent, and what was sent is remembered
+ */
+
+void test_displayBytes(void);
+/*
+ * benchmarks the bytes sent per second while playing, against sending every frame in full
+ */
+
+void test_i2cQueue(void);
+/*
+ * tests transfers come out whole and in order, a full queue refuses the next, and overlong transfers are cut
+ */
+
+void test_i2cQueueFrame(void);
+/*
+ * tests a whole frame, split into transfers as U8g2 sends it, fits in the queue so the display task never waits
+ */
+
+#endif
@@ -1,8 +1,7 @@
-#include <Arduino.h>
 #include <unity.h>
 #include "joystick.h"
+#include "axis_filter.h"
 #include "test_joystick.h"
-#include "main.h"
 
 void test_Joystick(void)
 /*
@@ -11,6 +10,9 @@ void test_Joystick(void)
 {
     RUN_TEST(test_joystickButton);
     RUN_TEST(test_joystickPosition);
+    RUN_TEST(test_axisFilterCalibration);
+    RUN_TEST(test_axisFilterDeadzone);
+    RUN_TEST(test_axisFilterSmoothing);
 }
 
 void test_joystickButton(void)
@@ -23,7 +25,13 @@ void test_joystickButton(void)
     TEST_ASSERT_EQUAL_INT8(1, testJoystick.getButton());
 
     // joystick should be 1 as defualt
-    // testJoystick.updateJoystickButton();
+    testJoystick.updateJoystickButton(0xFFFFFFFF);
+    TEST_ASSERT_EQUAL_INT8(1, testJoystick.getButton());
+
+    // Only the joystick button input of the frame is decoded
+    testJoystick.updateJoystickButton(~(1u << (JOYB_ROW * 4 + JOYB_COL)));
+    TEST_ASSERT_EQUAL_INT8(0, testJoystick.getButton());
+    testJoystick.updateJoystickButton(1u << (JOYB_ROW * 4 + JOYB_COL));
     TEST_ASSERT_EQUAL_INT8(1, testJoystick.getButton());
 }
 
@@ -36,4 +44,89 @@ void test_joystickPosition(void)
     // Testing before update, x and y should be initilised to 0
     TEST_ASSERT_EQUAL_INT8(0, testJoystick.getX());
     TEST_ASSERT_EQUAL_INT8(0, testJoystick.getY());
+
+    // Calibrating with the stick at rest, off the ideal centre
+    for (uint8_t i = 0; i < 64; i++)
+    {
+        testJoystick.updateJoystickPosition(34000, 31000);
+    }
+    TEST_ASSERT_EQUAL_INT32(0, testJoystick.getX());
+    TEST_ASSERT_EQUAL_INT32(0, testJoystick.getY());
+
+    // Full left and down settle to the offset from the centre, less the deadzone, in 10 bit counts
+    for (uint8_t i = 0; i < 200; i++)
+    {
+        testJoystick.updateJoystickPosition(65535, 0);
+    }
+    TEST_ASSERT_INT32_WITHIN(1, (65535 - 34000 - joystickDeadzone) / joystickScale, testJoystick.getX());
+    TEST_ASSERT_INT32_WITHIN(1, (0 - 31000 + joystickDeadzone) / joystickScale, testJoystick.getY());
+}
+
+void test_axisFilterCalibration(void)
+/*
+ * tests the centre is learnt from the first samples.
+ */
+{
+    AxisFilter filter(100, 0, 4);
+    TEST_ASSERT_FALSE(filter.isCalibrated());
+
+    // Nothing is output while calibrating
+    TEST_ASSERT_EQUAL_INT32(0, filter.update(1000));
+    TEST_ASSERT_EQUAL_INT32(0, filter.update(1002));
+    TEST_ASSERT_EQUAL_INT32(0, filter.update(998));
+    TEST_ASSERT_FALSE(filter.isCalibrated());
+    TEST_ASSERT_EQUAL_INT32(0, filter.update(1004));
+    TEST_ASSERT_TRUE(filter.isCalibrated());
+    TEST_ASSERT_EQUAL_INT32(1001, filter.getCentre());
+
+    // Offsets are then measured from the learnt centre
+    TEST_ASSERT_EQUAL_INT32(400, filter.update(1501));
+}
+
+void test_axisFilterDeadzone(void)
+/*
+ * tests small offsets read as 0 and larger ones have the deadzone removed.
+ */
+{
+    // No smoothing, so the output follows each sample
+    AxisFilter filter(100, 0, 1);
+    filter.update(2000);
+
+    TEST_ASSERT_EQUAL_INT32(0, filter.update(2000));
+    TEST_ASSERT_EQUAL_INT32(0, filter.update(2100));
+    TEST_ASSERT_EQUAL_INT32(0, filter.update(1900));
+    TEST_ASSERT_EQUAL_INT32(1, filter.update(2101));
+    TEST_ASSERT_EQUAL_INT32(-1, filter.update(1899));
+    TEST_ASSERT_EQUAL_INT32(900, filter.update(3000));
+    TEST_ASSERT_EQUAL_INT32(-1900, filter.update(0));
+    TEST_ASSERT_EQUAL_INT32(-1900, filter.getValue());
+}
+
+void test_axisFilterSmoothing(void)
+/*
+ * tests the IIR filter step response.
+ */
+{
+    // 1/8 of the way per update
+    AxisFilter filter(0, 3, 1);
+    filter.update(0);
+
+    TEST_ASSERT_EQUAL_INT32(100, filter.update(800));
+    TEST_ASSERT_EQUAL_INT32(187, filter.update(800));
+
+    // Within 5% after 23 updates, as (7/8)^23 < 0.05
+    int32_t value = 0;
+    for (uint8_t i = 0; i < 21; i++)
+    {
+        value = filter.update(800);
+    }
+    TEST_ASSERT_INT32_WITHIN(40, 800, value);
+    TEST_ASSERT_LESS_OR_EQUAL_INT32(800, value);
+
+    // Settles back to exactly 0 inside the deadzone
+    for (uint8_t i = 0; i < 100; i++)
+    {
+        value = filter.update(0);
+    }
+    TEST_ASSERT_EQUAL_INT32(0, value);
 }
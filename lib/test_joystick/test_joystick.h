@@ -1,5 +1,4 @@
 #include <iostream>
-#include "main.h"
 
 #ifndef TEST_JOYSTICK_H
 #define TEST_JOYSTICK_H
@@ -18,4 +17,19 @@ void test_joystickPosition(void);
  * tests the joystick Position.
  */
 
-#endif
\ No newline at end of file
+void test_axisFilterCalibration(void);
+/*
+ * tests the centre is learnt from the first samples.
+ */
+
+void test_axisFilterDeadzone(void);
+/*
+ * tests small offsets read as 0 and larger ones have the deadzone removed.
+ */
+
+void test_axisFilterSmoothing(void);
+/*
+ * tests the IIR filter step response.
+ */
+
+#endif
@@ -0,0 +1,302 @@
+#include <unity.h>
+#include <cstdio>
+#include "keycodec.h"
+#include "test_keycodec.h"
+
+void test_KeyCodec(void)
+/*
+ * Tests all key codec testing functions
+ */
+{
+    RUN_TEST(test_keyEventNotes);
+    RUN_TEST(test_keyEventSender);
+    RUN_TEST(test_keyEventCoalesce);
+    RUN_TEST(test_keyStateTracker);
+    RUN_TEST(test_keyStateSenders);
+    RUN_TEST(test_keyLossRecovery);
+}
+
+void test_keyEventNotes(void)
+/*
+ * tests the changed notes are applied in ascending order
+ */
+{
+    uint16_t changed = 0x0825;
+    const uint8_t expected[4] = {0, 2, 5, 11};
+
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_NOT_EQUAL(0, changed);
+        TEST_ASSERT_EQUAL_UINT8(expected[i], keyEventNote(changed));
+    }
+    TEST_ASSERT_EQUAL_HEX16(0, changed);
+}
+
+void test_keyEventSender(void)
+/*
+ * tests messages are sent on changes and snapshots are sent in between
+ */
+{
+    KeyEventSender sender;
+    KeyEventsMessage message;
+
+    // The first update is always a snapshot
+    TEST_ASSERT_TRUE(sender.update(message, 4, 0, 1000));
+    TEST_ASSERT_EQUAL_HEX16(0, message.changed);
+
+    // Nothing new, no snapshot due
+    TEST_ASSERT_FALSE(sender.update(message, 4, 0, 1001));
+
+    // Changes are sent straight away
+    TEST_ASSERT_TRUE(sender.update(message, 4, 0x0005, 1010));
+    TEST_ASSERT_EQUAL_HEX16(0x0005, message.pressed);
+    TEST_ASSERT_EQUAL_HEX16(0x0005, message.changed);
+    TEST_ASSERT_TRUE(sender.update(message, 4, 0x0004, 1020));
+    TEST_ASSERT_EQUAL_HEX16(0x0004, message.pressed);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, message.changed);
+
+    // Snapshot once the interval has passed since the last message
+    TEST_ASSERT_FALSE(sender.update(message, 4, 0x0004, 1020 + keySnapshotInterval - 1));
+    TEST_ASSERT_TRUE(sender.update(message, 4, 0x0004, 1020 + keySnapshotInterval));
+    TEST_ASSERT_EQUAL_HEX16(0x0004, message.pressed);
+    TEST_ASSERT_EQUAL_HEX16(0, message.changed);
+
+    // An octave change resends every held key
+    TEST_ASSERT_TRUE(sender.update(message, 5, 0x0004, 1121));
+    TEST_ASSERT_EQUAL_UINT8(5, message.octave);
+    TEST_ASSERT_EQUAL_HEX16(0x0004, message.changed);
+}
+
+void test_keyEventCoalesce(void)
+/*
+ * tests a newer message merges into a queued one, superseded pairs cancel, and a dropped message is resent as a snapshot
+ */
+{
+    KeyEventSender sender;
+    KeyEventsMessage queued;
+    KeyEventsMessage message;
+
+    TEST_ASSERT_TRUE(sender.update(queued, 4, 0x0001, 1000));
+    TEST_ASSERT_TRUE(sender.update(message, 4, 0x0003, 1001));
+
+    // The merged message changes everything from the state before the queued one
+    TEST_ASSERT_TRUE(coalesceKeyEvents(queued, message));
+    TEST_ASSERT_EQUAL_HEX16(0x0003, queued.pressed);
+    TEST_ASSERT_EQUAL_HEX16(0x0003, queued.changed);
+
+    // A press and release of the same key while queued cancel out
+    TEST_ASSERT_TRUE(sender.update(message, 4, 0x0001, 1002));
+    TEST_ASSERT_TRUE(coalesceKeyEvents(queued, message));
+    TEST_ASSERT_EQUAL_HEX16(0x0001, queued.pressed);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, queued.changed);
+
+    // A different octave can't be merged
+    TEST_ASSERT_TRUE(sender.update(message, 5, 0x0001, 1003));
+    TEST_ASSERT_FALSE(coalesceKeyEvents(queued, message));
+    TEST_ASSERT_EQUAL_UINT8(4, queued.octave);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, queued.pressed);
+
+    // A dropped message is resent as a snapshot at the next update, without waiting for the interval
+    TEST_ASSERT_FALSE(sender.isResendDue());
+    sender.resend();
+    TEST_ASSERT_TRUE(sender.isResendDue());
+    TEST_ASSERT_TRUE(sender.update(message, 5, 0x0001, 1004));
+    TEST_ASSERT_EQUAL_HEX16(0x0001, message.pressed);
+    TEST_ASSERT_EQUAL_HEX16(0, message.changed);
+    TEST_ASSERT_FALSE(sender.isResendDue());
+}
+
+void test_keyStateTracker(void)
+/*
+ * tests the receiver reconciles its notes with each message and releases quiet transmitters
+ */
+{
+    KeyStateTracker tracker;
+    uint16_t toPress[KEY_OCTAVES];
+    uint16_t toRelease[KEY_OCTAVES];
+    uint16_t expired[KEY_OCTAVES];
+
+    TEST_ASSERT_TRUE(tracker.reconcile(1, 4, 0x0003, 0, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0x0003, toPress[4]);
+    TEST_ASSERT_EQUAL_HEX16(0, toRelease[4]);
+    TEST_ASSERT_EQUAL_HEX16(0, tracker.getHeld(4));
+    tracker.update(1, 4, 0x0003, 0);
+
+    // A lost release and press are both corrected by the next message
+    TEST_ASSERT_TRUE(tracker.reconcile(1, 4, 0x0006, 50, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0x0004, toPress[4]);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, toRelease[4]);
+    tracker.update(1, 4, 0x0006, 50);
+    TEST_ASSERT_EQUAL_HEX16(0x0006, tracker.getHeld(4));
+
+    // Repeated snapshots change nothing
+    TEST_ASSERT_FALSE(tracker.reconcile(1, 4, 0x0006, 150, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0, toPress[4]);
+    TEST_ASSERT_EQUAL_HEX16(0, toRelease[4]);
+    tracker.update(1, 4, 0x0006, 150);
+
+    // Transmitters are independent, and out of range octaves are ignored
+    TEST_ASSERT_TRUE(tracker.reconcile(2, 5, 0x0800, 200, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0x0800, toPress[5]);
+    TEST_ASSERT_EQUAL_HEX16(0, toRelease[4]);
+    tracker.update(2, 5, 0x0800, 200);
+    TEST_ASSERT_FALSE(tracker.reconcile(3, 9, 0x0FFF, 200, toPress, toRelease));
+    tracker.update(3, 9, 0x0FFF, 200);
+    TEST_ASSERT_EQUAL_HEX16(0, tracker.getHeld(9));
+
+    // Transmitter 1 goes quiet (e.g. it was unplugged), transmitter 2 keeps sending snapshots
+    TEST_ASSERT_FALSE(tracker.expire(150 + keySnapshotTimeout, expired));
+    tracker.update(2, 5, 0x0800, 150 + keySnapshotTimeout);
+    TEST_ASSERT_TRUE(tracker.expire(151 + keySnapshotTimeout, expired));
+    TEST_ASSERT_EQUAL_HEX16(0x0006, expired[4]);
+    TEST_ASSERT_EQUAL_HEX16(0, expired[5]);
+    TEST_ASSERT_EQUAL_HEX16(0, tracker.getHeld(4));
+    TEST_ASSERT_EQUAL_HEX16(0x0800, tracker.getHeld(5));
+}
+
+void test_keyStateSenders(void)
+/*
+ * tests transmitters sharing an octave keep each other's notes, and an octave change releases the old octave at once
+ */
+{
+    KeyStateTracker tracker;
+    uint16_t toPress[KEY_OCTAVES];
+    uint16_t toRelease[KEY_OCTAVES];
+    uint16_t expired[KEY_OCTAVES];
+
+    tracker.update(1, 4, 0x0003, 0);
+    TEST_ASSERT_TRUE(tracker.reconcile(2, 4, 0x0006, 10, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0x0004, toPress[4]);
+    TEST_ASSERT_EQUAL_HEX16(0, toRelease[4]);
+    tracker.update(2, 4, 0x0006, 10);
+    TEST_ASSERT_EQUAL_HEX16(0x0007, tracker.getHeld(4));
+
+    // A snapshot from one transmitter doesn't release the notes only the other holds, and a note held by both sounds
+    // until both release it
+    TEST_ASSERT_TRUE(tracker.reconcile(1, 4, 0x0000, 20, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0, toPress[4]);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, toRelease[4]);
+    tracker.update(1, 4, 0x0000, 20);
+    TEST_ASSERT_EQUAL_HEX16(0x0006, tracker.getHeld(4));
+
+    // Transmitter 2 moves up an octave, its old notes are released with the first message on the new one
+    TEST_ASSERT_TRUE(tracker.reconcile(2, 5, 0x0010, 30, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0x0006, toRelease[4]);
+    TEST_ASSERT_EQUAL_HEX16(0x0010, toPress[5]);
+    TEST_ASSERT_EQUAL_HEX16(0, toPress[4]);
+    tracker.update(2, 5, 0x0010, 30);
+    TEST_ASSERT_EQUAL_HEX16(0, tracker.getHeld(4));
+    TEST_ASSERT_EQUAL_HEX16(0x0010, tracker.getHeld(5));
+
+    // With every slot taken a new transmitter replaces the least recently heard one, releasing its notes
+    for (uint8_t module = 3; module < KEY_SENDERS + 2; module++)
+    {
+        tracker.update(module, 6, 1 << module, 40 + module);
+    }
+    TEST_ASSERT_TRUE(tracker.reconcile(KEY_SENDERS + 2, 6, 0x0001, 60, toPress, toRelease));
+    TEST_ASSERT_EQUAL_HEX16(0x0010, toRelease[5]);
+    TEST_ASSERT_EQUAL_HEX16(0x0001, toPress[6]);
+    TEST_ASSERT_EQUAL_HEX16(0, toRelease[6]);
+    tracker.update(KEY_SENDERS + 2, 6, 0x0001, 60);
+    TEST_ASSERT_EQUAL_HEX16(0, tracker.getHeld(5));
+
+    // Expiring one transmitter keeps the notes another still holds
+    tracker.update(3, 6, 0x0009, 100);
+    tracker.update(4, 6, 0x0011, 100 + keySnapshotTimeout);
+    TEST_ASSERT_TRUE(tracker.expire(101 + keySnapshotTimeout, expired));
+    TEST_ASSERT_EQUAL_HEX16(0x0008, expired[6] & 0x0019);
+    TEST_ASSERT_EQUAL_HEX16(0x0011, tracker.getHeld(6) & 0x0019);
+}
+
+void test_keyLossRecovery(void)
+/*
+ * simulates a transmitter and receiver over a lossy bus, checking every stuck note is recovered
+ */
+{
+    // 60s of playing in 1ms steps, 20% of frames lost at random plus a full receive queue every 10s
+    const uint32_t duration = 60000;
+    const uint32_t lossPercent = 20;
+    const uint32_t overflowPeriod = 10000;
+    const uint32_t overflowLength = 300;
+
+    KeyEventSender sender;
+    KeyStateTracker receiver;
+    uint16_t deltaOnly = 0; // a receiver that only applies the changes, without snapshots
+
+    uint32_t random = 12345;
+    uint16_t pressed = 0;
+    uint32_t sent = 0;
+    uint32_t lost = 0;
+    uint32_t wrongSince = 0;
+    bool wrong = false;
+    uint32_t longestWrong = 0;
+    uint32_t wrongTime = 0;
+    uint32_t deltaWrongTime = 0;
+
+    for (uint32_t now = 0; now < duration; now++)
+    {
+        // Every 20ms on average a key is pressed or released, keys are left alone for the last second
+        random = random * 1664525 + 1013904223;
+        if (now < duration - 1000 && (random >> 24) < 13)
+        {
+            pressed ^= 1 << ((random >> 8) % 12);
+        }
+
+        KeyEventsMessage message;
+        if (sender.update(message, 4, pressed, now))
+        {
+            Frame frame = encodeMessage(1, sent, message);
+            sent++;
+            random = random * 1664525 + 1013904223;
+            bool overflow = (now % overflowPeriod) < overflowLength;
+            if (overflow || (random >> 16) % 100 < lossPercent)
+            {
+                lost++;
+            }
+            else
+            {
+                TEST_ASSERT_TRUE(isSupported(decodeHeader(frame.data)));
+                KeyEventsMessage received = decodeMessage<KeyEventsMessage>(frame.data);
+                receiver.update(decodeHeader(frame.data).module, received.octave, received.pressed, now);
+                deltaOnly = (deltaOnly & ~received.changed) | (received.pressed & received.changed);
+            }
+        }
+
+        // Measuring how long the receiver disagrees with the keys
+        if (receiver.getHeld(4) != pressed)
+        {
+            wrongTime++;
+            if (!wrong)
+            {
+                wrong = true;
+                wrongSince = now;
+            }
+        }
+        else if (wrong)
+        {
+            wrong = false;
+            if (now - wrongSince > longestWrong)
+            {
+                longestWrong = now - wrongSince;
+            }
+        }
+        if (deltaOnly != pressed)
+        {
+            deltaWrongTime++;
+        }
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u of %u frames lost: wrong for %ums with snapshots (longest %ums), %ums without",
+             (unsigned)lost, (unsigned)sent, (unsigned)wrongTime, (unsigned)longestWrong, (unsigned)deltaWrongTime);
+    TEST_MESSAGE(msg);
+
+    // Everything recovered by the end, and no error outlived the queue overflow by more than a few snapshots
+    TEST_ASSERT_FALSE(wrong);
+    TEST_ASSERT_EQUAL_HEX16(pressed, receiver.getHeld(4));
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(overflowLength + 4 * keySnapshotInterval, longestWrong);
+
+    // Without snapshots a lost message is only corrected if the same key changes again, so notes are left droning
+    TEST_ASSERT_NOT_EQUAL(pressed, deltaOnly);
+    TEST_ASSERT_GREATER_THAN(2 * wrongTime, deltaWrongTime);
+}
@@ -0,0 +1,41 @@
+#include <cstdint>
+
+#ifndef TEST_KEYCODEC_H
+#define TEST_KEYCODEC_H
+
+void test_KeyCodec(void);
+/*
+ * Tests all key codec testing functions
+ */
+
+void test_keyEventNotes(void);
+/*
+ * tests the changed notes are applied in ascending order
+ */
+
+void test_keyEventSender(void);
+/*
+ * tests messages are sent on changes and snapshots are sent in between
+ */
+
+void test_keyEventCoalesce(void);
+/*
+ * tests a newer message merges into a queued one, superseded pairs cancel, and a dropped message is resent as a snapshot
+ */
+
+void test_keyStateTracker(void);
+/*
+ * tests the receiver reconciles its notes with each message and releases quiet transmitters
+ */
+
+void test_keyStateSenders(void);
+/*
+ * tests transmitters sharing an octave keep each other's notes, and an octave change releases the old octave at once
+ */
+
+void test_keyLossRecovery(void);
+/*
+ * simulates a transmitter and receiver over a lossy bus, checking every stuck note is recovered
+ */
+
+#endif
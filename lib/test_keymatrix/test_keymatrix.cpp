@@ -0,0 +1,302 @@
+#include <unity.h>
+#include <cstdio>
+#include "keymatrix.h"
+#include "matrix_scanner.h"
+#include "debouncer.h"
+#include "test_keymatrix.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "gpio_matrix_port.h"
+#include "main.h"
+#endif
+
+void FakeMatrixPort::selectRow(uint8_t rowIdx)
+{
+    selectedRow = rowIdx;
+    rowSelects++;
+}
+
+void FakeMatrixPort::settle()
+{
+    settles++;
+}
+
+uint8_t FakeMatrixPort::readCols()
+{
+    return rows[selectedRow];
+}
+
+void test_KeyMatrix(void)
+/*
+ * Tests all key matrix testing functions
+ */
+{
+    RUN_TEST(test_keyMatrixScan);
+    RUN_TEST(test_keyMatrixPartialScan);
+    RUN_TEST(test_matrixScannerFrames);
+    RUN_TEST(test_keyEventDetector);
+    RUN_TEST(test_debouncerBounce);
+    RUN_TEST(test_debouncerParallel);
+    RUN_TEST(test_scannerDebounce);
+#ifdef ARDUINO
+    RUN_TEST(test_gpioScanTime);
+#endif
+}
+
+void test_keyMatrixScan(void)
+/*
+ * tests a scan selects each row once and packs the columns
+ */
+{
+    FakeMatrixPort port;
+    KeyMatrix matrix(port);
+    for (uint8_t i = 0; i < MATRIX_ROWS; i++)
+    {
+        port.rows[i] = i + 1;
+    }
+
+    uint32_t state = matrix.scan();
+
+    TEST_ASSERT_EQUAL_HEX32(0xF7654321, state);
+    TEST_ASSERT_EQUAL_UINT32(MATRIX_ROWS, port.rowSelects);
+    TEST_ASSERT_EQUAL_UINT32(MATRIX_ROWS, port.settles);
+    for (uint8_t i = 0; i < MATRIX_ROWS; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(i + 1, getMatrixRow(state, i));
+    }
+    TEST_ASSERT_EQUAL_UINT8(3, matrix.readRow(2));
+
+    // Row 5 reads 6 (0b0110)
+    TEST_ASSERT_EQUAL_UINT8(0, getMatrixBit(state, 5, 0));
+    TEST_ASSERT_EQUAL_UINT8(1, getMatrixBit(state, 5, 1));
+    TEST_ASSERT_EQUAL_UINT8(1, getMatrixBit(state, 5, 2));
+    TEST_ASSERT_EQUAL_UINT8(0, getMatrixBit(state, 5, 3));
+}
+
+void test_keyMatrixPartialScan(void)
+/*
+ * tests rows outside a partial scan read as not pressed
+ */
+{
+    FakeMatrixPort port;
+    KeyMatrix matrix(port);
+    port.rows[0] = 0xE;
+    port.rows[5] = 0x0;
+
+    uint32_t state = matrix.scan(3);
+
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFE, state);
+    TEST_ASSERT_EQUAL_UINT32(3, port.rowSelects);
+}
+
+void test_matrixScannerFrames(void)
+/*
+ * tests the background scanner steps one row per tick and publishes changed frames
+ */
+{
+    FakeMatrixPort port;
+    MatrixScanner scanner(port);
+    uint32_t timestamp;
+    scanner.start();
+    TEST_ASSERT_EQUAL_UINT8(0, port.selectedRow);
+
+    // Key 1 pressed: nothing is published until the last row has been read
+    port.rows[0] = 0xD;
+    for (uint8_t i = 0; i < MATRIX_ROWS - 1; i++)
+    {
+        TEST_ASSERT_FALSE(scanner.tick(100 + i));
+        TEST_ASSERT_EQUAL_UINT8(i + 1, port.selectedRow);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, scanner.getSequence());
+    TEST_ASSERT_TRUE(scanner.tick(106));
+    TEST_ASSERT_EQUAL_UINT8(0, port.selectedRow);
+    TEST_ASSERT_EQUAL_UINT32(1, scanner.getSequence());
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFD, scanner.getFrame(timestamp));
+    TEST_ASSERT_EQUAL_UINT32(106, timestamp);
+
+    // An unchanged frame is published but does not wake the consumer
+    for (uint8_t i = 0; i < MATRIX_ROWS - 1; i++)
+    {
+        scanner.tick(200 + i);
+    }
+    TEST_ASSERT_FALSE(scanner.tick(206));
+    TEST_ASSERT_EQUAL_UINT32(2, scanner.getSequence());
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFD, scanner.getFrame(timestamp));
+    TEST_ASSERT_EQUAL_UINT32(206, timestamp);
+
+    // Every row is selected exactly once per frame
+    TEST_ASSERT_EQUAL_UINT32(1 + 2 * MATRIX_ROWS, port.rowSelects);
+    TEST_ASSERT_EQUAL_UINT32(0, port.settles);
+}
+
+void test_keyEventDetector(void)
+/*
+ * tests frame changes are converted into timestamped key events
+ */
+{
+    KeyEventDetector detector;
+    KeyEvent events[2];
+
+    // Keys 0 and 5 pressed, knob bits outside the mask ignored
+    uint8_t count = detector.update(0xFFFF0FDE, 500, events, 2, 0x00000FFF);
+    TEST_ASSERT_EQUAL_UINT8(2, count);
+    TEST_ASSERT_EQUAL_UINT8(0, events[0].key);
+    TEST_ASSERT_EQUAL_UINT8(1, events[0].pressed);
+    TEST_ASSERT_EQUAL_UINT32(500, events[0].timestamp);
+    TEST_ASSERT_EQUAL_UINT8(5, events[1].key);
+
+    // Key 0 released, keys 9 and 11 pressed: only two fit, the third is reported next time
+    count = detector.update(0xFFFFF5DF, 600, events, 2, 0x00000FFF);
+    TEST_ASSERT_EQUAL_UINT8(2, count);
+    TEST_ASSERT_EQUAL_UINT8(0, events[0].key);
+    TEST_ASSERT_EQUAL_UINT8(0, events[0].pressed);
+    TEST_ASSERT_EQUAL_UINT8(9, events[1].key);
+    count = detector.update(0xFFFFF5DF, 700, events, 2, 0x00000FFF);
+    TEST_ASSERT_EQUAL_UINT8(1, count);
+    TEST_ASSERT_EQUAL_UINT8(11, events[0].key);
+    TEST_ASSERT_EQUAL_UINT8(1, events[0].pressed);
+
+    TEST_ASSERT_EQUAL_UINT8(0, detector.update(0xFFFFF5DF, 800, events, 2, 0x00000FFF));
+}
+
+void test_debouncerBounce(void)
+/*
+ * tests a bouncing key only changes state after 4 stable samples
+ */
+{
+    Debouncer debouncer;
+
+    // Press with contact bounce: 1 0 1 0 0 1 then solid 0
+    const uint8_t press[] = {1, 0, 1, 0, 0, 1, 0, 0, 0, 0};
+    const uint8_t expected[] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 0};
+    for (uint8_t i = 0; i < sizeof(press); i++)
+    {
+        uint32_t state = debouncer.update(0xFFFFFFFE | press[i]);
+        TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFE | expected[i], state);
+    }
+
+    // A single sample glitch whilst held is ignored
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFE, debouncer.update(0xFFFFFFFF));
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFE, debouncer.update(0xFFFFFFFE));
+
+    // Clean release takes 4 samples
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFE, debouncer.update(0xFFFFFFFF));
+    }
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, debouncer.update(0xFFFFFFFF));
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, debouncer.getState());
+}
+
+void test_debouncerParallel(void)
+/*
+ * tests independent bounce sequences on every key are filtered in the same pass
+ */
+{
+    Debouncer debouncer(0x0FF00FFF);
+
+    // Key k chatters from sample 2 for a different length before settling low, the encoder rows toggle every sample
+    uint32_t lastState = 0xFFFFFFFF;
+    uint32_t pressedAt[32] = {0};
+    for (uint32_t sample = 0; sample < 40; sample++)
+    {
+        uint32_t raw = 0xFFFFFFFF;
+        for (uint8_t k = 0; k < 28; k++)
+        {
+            uint32_t bounceEnd = 2 + k % 4 * 3 + k / 4;
+            bool low = sample >= bounceEnd || (sample >= 2 && ((sample + k) & 1));
+            if (low)
+            {
+                raw &= ~(1u << k);
+            }
+        }
+        raw = (raw & ~0x000FF000) | ((sample & 1) ? 0x000FF000 : 0);
+
+        uint32_t state = debouncer.update(raw);
+
+        // Encoder rows are never filtered
+        TEST_ASSERT_EQUAL_HEX32(raw & 0x000FF000, state & 0x000FF000);
+
+        // Debounced keys only ever go from released to pressed, never back
+        uint32_t changes = (state ^ lastState) & 0x0FF00FFF;
+        TEST_ASSERT_EQUAL_HEX32(0, changes & state);
+        while (changes)
+        {
+            uint8_t k = __builtin_ctz(changes);
+            changes &= changes - 1;
+            pressedAt[k] = sample;
+        }
+        lastState = state;
+    }
+
+    // Every key ends pressed, on the 4th low sample in a row
+    for (uint8_t k = 0; k < 28; k++)
+    {
+        if ((0x0FF00FFF >> k) & 1)
+        {
+            uint32_t bounceEnd = 2 + k % 4 * 3 + k / 4;
+            uint32_t firstLow = (bounceEnd > 2 && ((bounceEnd - 1 + k) & 1)) ? bounceEnd - 1 : bounceEnd;
+            TEST_ASSERT_EQUAL_UINT32(0, (lastState >> k) & 1);
+            TEST_ASSERT_EQUAL_UINT32(firstLow + 3, pressedAt[k]);
+        }
+    }
+}
+
+void test_scannerDebounce(void)
+/*
+ * tests the scanner only publishes debounced key changes and passes the encoder rows through
+ */
+{
+    FakeMatrixPort port;
+    MatrixScanner scanner(port, 0x0FF00FFF);
+    scanner.start();
+    uint8_t published = 0;
+
+    // Key 0 bounces for a frame, the knob 3 encoder (row 3) moves
+    const uint8_t key[] = {0xE, 0xF, 0xE, 0xE, 0xE, 0xE};
+    const uint8_t encoder[] = {0xF, 0xE, 0xE, 0xE, 0xE, 0xE};
+    for (uint8_t frame = 0; frame < 6; frame++)
+    {
+        port.rows[0] = key[frame];
+        port.rows[3] = encoder[frame];
+        bool changed = false;
+        for (uint8_t i = 0; i < MATRIX_ROWS; i++)
+        {
+            changed |= scanner.tick(frame);
+        }
+        published += changed;
+
+        uint32_t state = scanner.getFrame();
+        TEST_ASSERT_EQUAL_UINT8(encoder[frame], getMatrixRow(state, 3));
+        TEST_ASSERT_EQUAL_UINT8(frame < 5 ? 0xF : 0xE, getMatrixRow(state, 0));
+    }
+
+    // One wake for the encoder, one for the debounced key
+    TEST_ASSERT_EQUAL_UINT8(2, published);
+}
+
+#ifdef ARDUINO
+void test_gpioScanTime(void)
+/*
+ * benchmarks a full 7 row scan through the GPIO registers (target only)
+ */
+{
+    GpioMatrixPort port(RA0_PIN, RA1_PIN, RA2_PIN, REN_PIN, OUT_PIN, C0_PIN, C1_PIN, C2_PIN, C3_PIN, 0);
+    KeyMatrix matrix(port);
+    port.begin();
+    char msg[96];
+
+    uint32_t start = DWT->CYCCNT;
+    for (uint8_t i = 0; i < 100; i++)
+    {
+        matrix.scan();
+    }
+    uint32_t cycles = (DWT->CYCCNT - start) / 100;
+
+    snprintf(msg, sizeof(msg), "7 row scan excluding settle time: %u cycles (%u ns)", (unsigned)cycles, (unsigned)((uint64_t)cycles * 1000000000 / SystemCoreClock));
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_LESS_THAN(SystemCoreClock / 100000, cycles);
+}
+#endif
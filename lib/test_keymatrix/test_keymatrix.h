@@ -0,0 +1,68 @@
+#include <cstdint>
+#include "keymatrix.h"
+
+#ifndef TEST_KEYMATRIX_H
+#define TEST_KEYMATRIX_H
+
+class FakeMatrixPort : public MatrixPort
+/*
+ * Key matrix port stub with fixed column values per row, used to test matrix scanning without the board
+ */
+{
+public:
+    uint8_t rows[8] = {0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF};
+    uint8_t selectedRow = 0;
+    uint32_t rowSelects = 0;
+    uint32_t settles = 0;
+
+    void selectRow(uint8_t rowIdx) override;
+    void settle() override;
+    uint8_t readCols() override;
+};
+
+void test_KeyMatrix(void);
+/*
+ * Tests all key matrix testing functions
+ */
+
+void test_keyMatrixScan(void);
+/*
+ * tests a scan selects each row once and packs the columns
+ */
+
+void test_keyMatrixPartialScan(void);
+/*
+ * tests rows outside a partial scan read as not pressed
+ */
+
+void test_matrixScannerFrames(void);
+/*
+ * tests the background scanner steps one row per tick and publishes changed frames
+ */
+
+void test_keyEventDetector(void);
+/*
+ * tests frame changes are converted into timestamped key events
+ */
+
+void test_debouncerBounce(void);
+/*
+ * tests a bouncing key only changes state after 4 stable samples
+ */
+
+void test_debouncerParallel(void);
+/*
+ * tests independent bounce sequences on every key are filtered in the same pass
+ */
+
+void test_scannerDebounce(void);
+/*
+ * tests the scanner only publishes debounced key changes and passes the encoder rows through
+ */
+
+void test_gpioScanTime(void);
+/*
+ * benchmarks a full 7 row scan through the GPIO registers (target only)
+ */
+
+#endif
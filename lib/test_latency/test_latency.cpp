@@ -0,0 +1,391 @@
+#include <unity.h>
+#include <cstdio>
+#include <cstring>
+#include "latency.h"
+#include "cantx.h"
+#include "keycodec.h"
+#include "noteevents.h"
+#include "test_cantx.h"
+#include "test_random.h"
+#include "test_latency.h"
+
+void test_Latency(void)
+/*
+ * Tests all latency tracing testing functions
+ */
+{
+    RUN_TEST(test_latencyHistogram);
+    RUN_TEST(test_clockOffset);
+    RUN_TEST(test_latencyTracer);
+    RUN_TEST(test_latencyPipeline);
+}
+
+void test_latencyHistogram(void)
+/*
+ * tests latencies land in their power of 2 bucket, with the mean, maximum and percentiles
+ */
+{
+    LatencyHistogram histogram;
+    TEST_ASSERT_EQUAL_UINT32(0, histogram.getMean());
+    TEST_ASSERT_EQUAL_UINT32(0, histogram.getPercentile(50));
+
+    histogram.record(0);
+    histogram.record(1);
+    histogram.record(2);
+    histogram.record(1000);
+    histogram.record(1023);
+    histogram.record(1024);
+    histogram.record(100000);
+    TEST_ASSERT_EQUAL_UINT32(2, histogram.getBucket(0));
+    TEST_ASSERT_EQUAL_UINT32(1, histogram.getBucket(1));
+    TEST_ASSERT_EQUAL_UINT32(2, histogram.getBucket(9));
+    TEST_ASSERT_EQUAL_UINT32(1, histogram.getBucket(10));
+    TEST_ASSERT_EQUAL_UINT32(1, histogram.getBucket(LATENCY_BUCKETS - 1));
+    TEST_ASSERT_EQUAL_UINT32(7, histogram.getCount());
+    TEST_ASSERT_EQUAL_UINT32(100000, histogram.getMax());
+    TEST_ASSERT_EQUAL_UINT32(103050 / 7, histogram.getMean());
+
+    // Percentiles are the top of the bucket they fall in, or the maximum past the last bucket
+    TEST_ASSERT_EQUAL_UINT32(1, histogram.getPercentile(20));
+    TEST_ASSERT_EQUAL_UINT32(1023, histogram.getPercentile(50));
+    TEST_ASSERT_EQUAL_UINT32(100000, histogram.getPercentile(100));
+
+    char line[96];
+    uint32_t length = histogram.format(line, sizeof(line), "total");
+    TEST_ASSERT_EQUAL_STRING("total      n=7 mean=14721us p50<=1023us p99<=100000us max=100000us", line);
+    TEST_ASSERT_EQUAL_UINT32(strlen(line), length);
+
+    // A short buffer is truncated but terminated
+    TEST_ASSERT_EQUAL_UINT32(9, histogram.format(line, 10, "total"));
+    TEST_ASSERT_EQUAL_STRING("total    ", line);
+
+    histogram.reset();
+    TEST_ASSERT_EQUAL_UINT32(0, histogram.getCount());
+    TEST_ASSERT_EQUAL_UINT32(0, histogram.getMax());
+    TEST_ASSERT_EQUAL_UINT32(0, histogram.getBucket(9));
+}
+
+void test_clockOffset(void)
+/*
+ * tests the offset estimate finds the shortest delay, across the 16 bit wrap and with the clocks drifting apart
+ */
+{
+    ClockOffset offset;
+    TEST_ASSERT_FALSE(offset.isValid());
+
+    // Delays of 5 to 500us, with the local clock 65500us ahead so every sample wraps
+    uint32_t random = 3;
+    uint32_t remote = 1000;
+    for (uint32_t i = 0; i < 40; i++)
+    {
+        uint32_t delay = (i == 30) ? 5 : 5 + nextRandom(random) % 496;
+        offset.update(remote, remote + 65500 + delay);
+        remote += 20000;
+    }
+    TEST_ASSERT_TRUE(offset.isValid());
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)(65500 + 5), offset.get());
+
+    // The local clock running 1000ppm slow: the old minimum ages out after two windows
+    ClockOffset drifting;
+    uint32_t local = 5000;
+    remote = 0;
+    for (uint32_t i = 0; i < 10 * CLOCK_OFFSET_WINDOW; i++)
+    {
+        drifting.update(remote, local + 10 + nextRandom(random) % 200);
+        remote += 20000;
+        local += 20000 + 20;
+    }
+    uint16_t expected = (uint16_t)(local - remote + 10);
+    TEST_ASSERT_INT_WITHIN(2 * CLOCK_OFFSET_WINDOW * 20 + 50, 0, (int16_t)(expected - drifting.get()));
+}
+
+void test_latencyTracer(void)
+/*
+ * tests the receiver stages of a traced frame, and that lost and replaced frames are skipped
+ */
+{
+    LatencyTracer tracer;
+
+    // Sent at 5000 by the transmitter's clock after 3000us since the scan, received at 10000 and played at 10040
+    tracer.received(9, 10000, true);
+    tracer.notePlayed(9999, 10020);
+    tracer.notePlayed(10000, 10040);
+    tracer.notePlayed(10000, 10085);
+    tracer.traced(9, 5000, 3000);
+    TEST_ASSERT_EQUAL_UINT32(1, tracer.getStage(STAGE_TRANSMIT).getCount());
+    TEST_ASSERT_EQUAL_UINT32(3000, tracer.getStage(STAGE_TRANSMIT).getMax());
+    TEST_ASSERT_EQUAL_UINT32(0, tracer.getStage(STAGE_RECEIVE).getMax());
+    TEST_ASSERT_EQUAL_UINT32(40, tracer.getStage(STAGE_NOTE_RING).getMax());
+    TEST_ASSERT_EQUAL_UINT32(3040, tracer.getStage(STAGE_TOTAL).getMax());
+
+    // The next frame takes 30us longer to be received than the shortest seen
+    tracer.received(9, 30030, true);
+    tracer.notePlayed(30030, 30050);
+    tracer.traced(9, 25000, 2000);
+    TEST_ASSERT_EQUAL_UINT32(30, tracer.getStage(STAGE_RECEIVE).getMax());
+    TEST_ASSERT_EQUAL_UINT32(2, tracer.getStage(STAGE_TOTAL).getCount());
+    TEST_ASSERT_EQUAL_UINT32((3040 + 2050) / 2, tracer.getStage(STAGE_TOTAL).getMean());
+
+    // A frame that changed no notes has no note ring or total
+    tracer.received(9, 50000, false);
+    tracer.notePlayed(50000, 50010);
+    tracer.traced(9, 45000, 1000);
+    TEST_ASSERT_EQUAL_UINT32(3, tracer.getStage(STAGE_TRANSMIT).getCount());
+    TEST_ASSERT_EQUAL_UINT32(2, tracer.getStage(STAGE_NOTE_RING).getCount());
+
+    // A trace message without its frame, or from another module than the one waiting, is ignored
+    tracer.traced(9, 65000, 1000);
+    tracer.received(9, 70000, true);
+    tracer.traced(4, 65000, 1000);
+    TEST_ASSERT_EQUAL_UINT32(3, tracer.getStage(STAGE_TRANSMIT).getCount());
+
+    // Each module has its own clock offset
+    tracer.received(4, 71000, true);
+    tracer.notePlayed(71000, 71030);
+    tracer.traced(4, 12345, 1500);
+    TEST_ASSERT_EQUAL_UINT32(4, tracer.getStage(STAGE_TRANSMIT).getCount());
+    TEST_ASSERT_EQUAL_UINT32(30, tracer.getStage(STAGE_RECEIVE).getMax());
+    TEST_ASSERT_EQUAL_UINT32(3, tracer.getStage(STAGE_TOTAL).getCount());
+    TEST_ASSERT_EQUAL_UINT32((3040 + 2050 + 1530) / 3, tracer.getStage(STAGE_TOTAL).getMean());
+
+    // The transmitter's own stages
+    tracer.sent(100, 350, 360, 1500);
+    TEST_ASSERT_EQUAL_UINT32(250, tracer.getStage(STAGE_SCAN).getMax());
+    TEST_ASSERT_EQUAL_UINT32(10, tracer.getStage(STAGE_TX_RING).getMax());
+    TEST_ASSERT_EQUAL_UINT32(1140, tracer.getStage(STAGE_TX_MAILBOX).getMax());
+}
+
+// Pipeline simulation, in microseconds of real time
+struct PendingFrame
+{
+    uint32_t at;
+    uint8_t data[8];
+};
+
+static uint32_t transmitterClock(uint32_t t)
+/*
+ * The transmitter's micros(), started earlier and running 100ppm slow
+ */
+{
+    return 1234567 + t - t / 10000;
+}
+
+static uint32_t receiverClock(uint32_t t)
+/*
+ * The receiver's micros()
+ */
+{
+    return 40000 + t;
+}
+
+void test_latencyPipeline(void)
+/*
+ * simulates a transmitter and a receiver with their own clocks on a shared bus, the traced stages must add up to the
+ * real time from key scan to sound
+ */
+{
+#ifdef ARDUINO
+    const uint32_t duration = 2000000;
+#else
+    const uint32_t duration = 30000000;
+#endif
+    const uint32_t scanFrame = 875;  // Key matrix frame, 7 ticks at 8kHz
+    const uint32_t debounce = 4;     // Frames before a change is seen
+    const uint32_t frameTime = 1080; // 8 byte frame at 125kbit/s
+    const uint32_t samplePeriod = 45;
+    const uint8_t module = 0x2A;
+
+    // Transmitter
+    FakeCanMailboxes mailboxes;
+    CanTxRing ring(mailboxes);
+    KeyEventSender keySender;
+    LatencyTracer transmitter;
+    uint16_t pressed = 0;
+    uint32_t nextKey = 20000;
+    uint32_t wakeAt = UINT32_MAX;
+    uint32_t scannedAt = 0;
+    uint32_t lastTraced = 0;
+    uint32_t pumpAt = UINT32_MAX;
+    uint32_t pumpRequests = 0;
+
+    // Bus, frames are lost to the other modules' traffic a quarter of the time
+    uint32_t busyUntil = 0;
+    bool transmitting = false;
+    PendingFrame arriving[8];
+    uint8_t arrivingCount = 0;
+
+    // Receiver
+    KeyStateTracker remoteKeys;
+    NoteEventRing noteEvents;
+    LatencyTracer receiver;
+    uint32_t lastApplied = 0;
+    uint32_t reported = 0;
+
+    // Real times of the traced frame, to check the traced stages against
+    uint32_t realScanned = 0;
+    uint32_t realReceived = 0;
+    uint32_t realPlayed = 0;
+    LatencyHistogram real;
+
+    uint32_t random = 5;
+    for (uint32_t t = 0; t < duration; t++)
+    {
+        // A key is pressed or released every 20 to 80ms, scanKeysTask sees it once debounced and then scheduled
+        if (t == nextKey)
+        {
+            pressed ^= 1 << (nextRandom(random) % 12);
+            uint32_t scanned = (t / scanFrame + debounce) * scanFrame;
+            if (wakeAt == UINT32_MAX)
+            {
+                scannedAt = scanned;
+                wakeAt = scanned + 20 + nextRandom(random) % 300;
+            }
+            nextKey = t + 20000 + nextRandom(random) % 60000;
+        }
+
+        // scanKeysTask, also woken for every snapshot
+        if (t == wakeAt || (t % (keySnapshotInterval * 1000) == 0 && wakeAt == UINT32_MAX))
+        {
+            uint32_t now = transmitterClock(t);
+            KeyEventsMessage keyEvents;
+            if (keySender.update(keyEvents, 4, pressed, now / 1000))
+            {
+                if (keyEvents.changed && now / 1000 - lastTraced >= latencyTraceInterval)
+                {
+                    lastTraced = now / 1000;
+                    ring.sendTraced(module, keyEvents, transmitterClock(scannedAt), now);
+                    realScanned = scannedAt;
+                }
+                else
+                {
+                    ring.send(module, keyEvents);
+                }
+            }
+            wakeAt = UINT32_MAX;
+        }
+
+        // The transmit interrupt, from a sender or an emptied mailbox
+        if (mailboxes.pumpRequests != pumpRequests)
+        {
+            pumpRequests = mailboxes.pumpRequests;
+            if (pumpAt == UINT32_MAX)
+            {
+                pumpAt = t + 2;
+            }
+        }
+        if (t == pumpAt)
+        {
+            pumpAt = UINT32_MAX;
+            uint32_t now = transmitterClock(t);
+            ring.pump(now);
+            TxTrace trace;
+            if (ring.takeTrace(trace))
+            {
+                transmitter.sent(trace.scanned, trace.queued, trace.loaded, trace.sent);
+                uint32_t age = trace.sent - trace.scanned;
+                ring.send(module, TraceMessage{(uint16_t)trace.sent, (uint16_t)(age < 0xFFFF ? age : 0xFFFF)});
+            }
+        }
+
+        // Arbitration, then the frame on the bus
+        if (t >= busyUntil)
+        {
+            if (transmitting)
+            {
+                transmitting = false;
+                uint32_t id;
+                PendingFrame &frame = arriving[arrivingCount++];
+                mailboxes.complete(frame.data, id);
+                frame.at = t + 3 + nextRandom(random) % 20;
+                pumpAt = t + 2;
+            }
+            if (mailboxes.count)
+            {
+                transmitting = nextRandom(random) % 4 != 0;
+                busyUntil = t + frameTime;
+            }
+        }
+
+        // The receive interrupt
+        if (arrivingCount && t == arriving[0].at)
+        {
+            uint32_t now = receiverClock(t);
+            MessageHeader header = decodeHeader(arriving[0].data);
+            if (header.type == MSG_KEY_EVENTS)
+            {
+                KeyEventsMessage message = decodeMessage<KeyEventsMessage>(arriving[0].data);
+                uint16_t toPress[KEY_OCTAVES];
+                uint16_t toRelease[KEY_OCTAVES];
+                bool changed =
+                    remoteKeys.reconcile(header.module, message.octave, message.pressed, now / 1000, toPress, toRelease);
+                bool queued = noteEvents.pushKeyChanges(message.octave, toPress[message.octave],
+                                                        toRelease[message.octave], now);
+                if (queued)
+                {
+                    remoteKeys.update(header.module, message.octave, message.pressed, now / 1000);
+                }
+                if (message.traced)
+                {
+                    receiver.received(header.module, now, queued && changed);
+                    realReceived = now;
+                    realPlayed = 0;
+                }
+            }
+            else if (header.type == MSG_TRACE)
+            {
+                TraceMessage message = decodeMessage<TraceMessage>(arriving[0].data);
+                uint32_t totals = receiver.getStage(STAGE_TOTAL).getCount();
+                receiver.traced(header.module, message.sent, message.age);
+                if (receiver.getStage(STAGE_TOTAL).getCount() != totals)
+                {
+                    real.record(realPlayed - realScanned);
+                }
+            }
+            arrivingCount--;
+            for (uint8_t i = 0; i < arrivingCount; i++)
+            {
+                arriving[i] = arriving[i + 1];
+            }
+        }
+
+        // The sample interrupt
+        if (t % samplePeriod == 0)
+        {
+            NoteEvent event;
+            while (noteEvents.pop(event))
+            {
+                lastApplied = event.timestamp;
+                if (event.timestamp == realReceived && !realPlayed)
+                {
+                    realPlayed = t;
+                }
+            }
+            if (lastApplied != reported)
+            {
+                reported = lastApplied;
+                receiver.notePlayed(lastApplied, receiverClock(t));
+            }
+        }
+    }
+
+    char line[96];
+    for (uint8_t stage = 0; stage < LATENCY_STAGES; stage++)
+    {
+        LatencyTracer &tracer = stage < STAGE_TRANSMIT ? transmitter : receiver;
+        tracer.getStage(stage).format(line, sizeof(line), latencyStageNames[stage]);
+        TEST_MESSAGE(line);
+    }
+    real.format(line, sizeof(line), "real total");
+    TEST_MESSAGE(line);
+
+    // Every traced stage was seen, and the note is played within a sample of arriving
+    LatencyHistogram &total = receiver.getStage(STAGE_TOTAL);
+    TEST_ASSERT_GREATER_THAN(10, total.getCount());
+    TEST_ASSERT_EQUAL_UINT32(real.getCount(), total.getCount());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(samplePeriod, receiver.getStage(STAGE_NOTE_RING).getMax());
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(frameTime, transmitter.getStage(STAGE_TX_MAILBOX).getPercentile(1));
+
+    // The traced total misses only the shortest receive delay and the drift of the clocks since the offset's minimum
+    TEST_ASSERT_UINT32_WITHIN(150, real.getMean(), total.getMean());
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(real.getMax() + 150, total.getMax());
+}
@@ -0,0 +1,32 @@
+#include <cstdint>
+
+#ifndef TEST_LATENCY_H
+#define TEST_LATENCY_H
+
+void test_Latency(void);
+/*
+ * Tests all latency tracing testing functions
+ */
+
+void test_latencyHistogram(void);
+/*
+ * tests latencies land in their power of 2 bucket, with the mean, maximum and percentiles
+ */
+
+void test_clockOffset(void);
+/*
+ * tests the offset estimate finds the shortest delay, across the 16 bit wrap and with the clocks drifting apart
+ */
+
+void test_latencyTracer(void);
+/*
+ * tests the receiver stages of a traced frame, and that lost and replaced frames are skipped
+ */
+
+void test_latencyPipeline(void);
+/*
+ * simulates a transmitter and a receiver with their own clocks on a shared bus, the traced stages must add up to the
+ * real time from key scan to sound
+ */
+
+#endif
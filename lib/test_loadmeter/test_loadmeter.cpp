@@ -0,0 +1,175 @@
+#include <unity.h>
+#include <cstdio>
+#include "loadmeter.h"
+#include "test_random.h"
+#include "test_loadmeter.h"
+
+static const uint32_t cpuFrequency = 80000000; // Hz, of the STM32L432
+static const uint32_t period = cpuFrequency / 22000;
+
+void test_LoadMeter(void)
+/*
+ * Tests all load meter testing functions
+ */
+{
+    RUN_TEST(test_loadMeterOverruns);
+    RUN_TEST(test_loadMeterPeak);
+    RUN_TEST(test_loadMeterSecond);
+    RUN_TEST(test_telemetryFrame);
+}
+
+void test_loadMeterOverruns(void)
+/*
+ * tests late samples are counted as overruns by the periods they missed, and jitter within half a period isn't
+ */
+{
+    LoadMeter meter;
+    meter.begin(period);
+
+    // Starting near the wrap of the cycle counter, interrupts up to 0.4 periods late
+    uint32_t now = 0xFFFF0000;
+    uint32_t state = 1;
+    for (uint16_t i = 0; i < 1000; i++)
+    {
+        uint32_t jitter = nextRandom(state) % (period * 2 / 5);
+        meter.sampled(now + jitter, now + jitter + 500, 1);
+        now += period;
+    }
+    LoadTotals totals = meter.read(now);
+    TEST_ASSERT_EQUAL_UINT32(1000, totals.samples);
+    TEST_ASSERT_EQUAL_UINT32(0, totals.overruns);
+
+    // Late by 0.4 periods, then on time
+    meter.sampled(now + period * 2 / 5, now + period * 2 / 5 + 500, 1);
+    now += period;
+    meter.sampled(now, now + 500, 1);
+    TEST_ASSERT_EQUAL_UINT32(0, meter.read(now).overruns);
+
+    // Held back past the next sample's time, which never gets an interrupt of its own
+    now += period;
+    meter.sampled(now + period * 6 / 5, now + period * 6 / 5 + 500, 1);
+    now += 2 * period;
+    meter.sampled(now, now + 500, 1);
+    TEST_ASSERT_EQUAL_UINT32(1, meter.read(now).overruns);
+
+    // Held back past two
+    now += period;
+    meter.sampled(now + period * 21 / 10, now + period * 21 / 10 + 500, 1);
+    now += 3 * period;
+    TEST_ASSERT_EQUAL_UINT32(3, meter.read(now).overruns);
+
+    // Back on time
+    meter.sampled(now, now + 500, 1);
+    totals = meter.read(now);
+    TEST_ASSERT_EQUAL_UINT32(3, totals.overruns);
+    TEST_ASSERT_EQUAL_UINT32(1006, totals.samples);
+    TEST_ASSERT_EQUAL_UINT32(1006 * 500, totals.audio);
+}
+
+void test_loadMeterPeak(void)
+/*
+ * tests the peak of the voices is kept until it is read, then starts again
+ */
+{
+    LoadMeter meter;
+    meter.begin(period);
+    const uint8_t voices[] = {2, 9, 4, 0, 3};
+    uint32_t now = 0;
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        meter.sampled(now, now + 100, voices[i]);
+        now += period;
+    }
+    TEST_ASSERT_EQUAL_UINT8(9, meter.read(now).peakVoices);
+    TEST_ASSERT_EQUAL_UINT8(0, meter.read(now).peakVoices);
+
+    meter.sampled(now, now + 100, 5);
+    meter.sampled(now + period, now + period + 100, 1);
+    TEST_ASSERT_EQUAL_UINT8(5, meter.read(now).peakVoices);
+}
+
+void test_loadMeterSecond(void)
+/*
+ * simulates a second of the sample interrupt, a task and the idle task sharing the CPU, the report must match the time
+ * each was given
+ */
+{
+    const uint32_t idlePass = 60;   // Cycles of a pass of the idle task, its loop and the hook
+    const uint32_t taskBurst = 900; // Cycles of a task's work, every fourth period
+
+    LoadMeter meter;
+    meter.begin(period);
+    uint32_t now = 12345;
+    LoadTotals from = meter.read(now);
+
+    uint32_t state = 7;
+    uint64_t audio = 0;
+    uint64_t idle = 0;
+    uint32_t lastIdle = now;
+    for (uint32_t sample = 0; sample < 22000; sample++)
+    {
+        // The interrupt costs more with more voices, up to 12 at ~100 cycles each
+        uint8_t voices = nextRandom(state) % 13;
+        uint32_t cost = 300 + voices * 100;
+        uint32_t end = now + cost;
+        meter.sampled(now, end, voices);
+        audio += cost;
+
+        // A task runs after some of the interrupts, then the idle task has the rest of the period
+        uint32_t t = end + (sample % 4 == 0 ? taskBurst : 0);
+        uint32_t next = now + period;
+        while (t + idlePass <= next)
+        {
+            t += idlePass;
+            meter.idled(t);
+            idle += t - lastIdle <= loadIdleGap ? idlePass : 0;
+            lastIdle = t;
+        }
+        now = next;
+    }
+
+    LoadReport report = loadReport(from, meter.read(now));
+    uint32_t elapsed = now - from.cycles;
+    uint16_t expectAudio = audio * LOAD_SCALE / elapsed;
+    uint16_t expectIdle = idle * LOAD_SCALE / elapsed;
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "audio %u/1000, idle %u/1000, %u samples, %u overruns, %u voices",
+             report.audio, report.idle, report.samples, report.overruns, report.peakVoices);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT16(expectAudio, report.audio);
+    TEST_ASSERT_EQUAL_UINT16(expectIdle, report.idle);
+    TEST_ASSERT_EQUAL_UINT16(22000, report.samples);
+    TEST_ASSERT_EQUAL_UINT16(0, report.overruns);
+    TEST_ASSERT_EQUAL_UINT8(12, report.peakVoices);
+
+    // What isn't the interrupt or idle is the task and the passes cut short by the interrupt, a few percent
+    uint16_t task = taskBurst * 22000 / 4 * (uint64_t)LOAD_SCALE / elapsed;
+    TEST_ASSERT_UINT32_WITHIN(30, LOAD_SCALE - task, report.audio + report.idle);
+}
+
+void test_telemetryFrame(void)
+/*
+ * tests the layout and checksum of a telemetry frame, with counts too big for it saturated
+ */
+{
+    LoadTotals from = {0xFFFFFF00, 100, 200, 300, 0, 0};
+    LoadTotals to = {from.cycles + 80000000, 100 + 20000000, 200 + 40000000, 300 + 22000, 70000, 7};
+    LoadReport report = loadReport(from, to);
+    TEST_ASSERT_EQUAL_UINT16(250, report.audio);
+    TEST_ASSERT_EQUAL_UINT16(500, report.idle);
+    TEST_ASSERT_EQUAL_UINT16(22000, report.samples);
+    TEST_ASSERT_EQUAL_UINT16(UINT16_MAX, report.overruns);
+
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    encodeTelemetry(report, 0x81, frame);
+    const uint8_t expected[TELEMETRY_FRAME_SIZE] = {0xA5, 0x5A, 0x81, 0xFA, 0x00, 0xF4, 0x01, 0xF0, 0x55, 0xFF, 0xFF, 7,
+                                                    (uint8_t)(0x81 + 0xFA + 0xF4 + 0x01 + 0xF0 + 0x55 + 0xFF + 0xFF + 7)};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, frame, TELEMETRY_FRAME_SIZE);
+
+    // A time with nothing elapsed has no load rather than dividing by 0
+    report = loadReport(to, to);
+    TEST_ASSERT_EQUAL_UINT16(0, report.audio);
+    TEST_ASSERT_EQUAL_UINT16(0, report.samples);
+}
@@ -0,0 +1,32 @@
+#include <cstdint>
+
+#ifndef TEST_LOADMETER_H
+#define TEST_LOADMETER_H
+
+void test_LoadMeter(void);
+/*
+ * Tests all load meter testing functions
+ */
+
+void test_loadMeterOverruns(void);
+/*
+ * tests late samples are counted as overruns by the periods they missed, and jitter within half a period isn't
+ */
+
+void test_loadMeterPeak(void);
+/*
+ * tests the peak of the voices is kept until it is read, then starts again
+ */
+
+void test_loadMeterSecond(void);
+/*
+ * simulates a second of the sample interrupt, a task and the idle task sharing the CPU, the report must match the time
+ * each was given
+ */
+
+void test_telemetryFrame(void);
+/*
+ * tests the layout and checksum of a telemetry frame, with counts too big for it saturated
+ */
+
+#endif
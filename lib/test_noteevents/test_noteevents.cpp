@@ -0,0 +1,233 @@
+#include <unity.h>
+#include <cstdio>
+#include "noteevents.h"
+#include "test_noteevents.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <ES_CAN.h>
+#include "canproto.h"
+#else
+#include <thread>
+#endif
+
+void test_NoteEvents(void)
+/*
+ * Tests all note event ring testing functions
+ */
+{
+    RUN_TEST(test_noteEventRing);
+    RUN_TEST(test_noteEventKeyChanges);
+#ifdef ARDUINO
+    RUN_TEST(test_canLoopbackLatency);
+#else
+    RUN_TEST(test_noteEventThreads);
+#endif
+}
+
+void test_noteEventRing(void)
+/*
+ * tests events come out in order across many laps, and a full ring drops and counts them
+ */
+{
+    NoteEventRing ring;
+    NoteEvent event;
+
+    TEST_ASSERT_FALSE(ring.pop(event));
+    for (uint32_t i = 0; i < 10 * NOTE_EVENT_RING_SIZE; i++)
+    {
+        TEST_ASSERT_TRUE(ring.push(NoteEvent{i, 4, (uint8_t)(i % 12), (uint8_t)(i & 1)}));
+        TEST_ASSERT_TRUE(ring.pop(event));
+        TEST_ASSERT_EQUAL_UINT32(i, event.timestamp);
+        TEST_ASSERT_EQUAL_UINT8(i % 12, event.note);
+        TEST_ASSERT_EQUAL_UINT8(i & 1, event.pressed);
+    }
+
+    for (uint32_t i = 0; i < NOTE_EVENT_RING_SIZE; i++)
+    {
+        TEST_ASSERT_TRUE(ring.push(NoteEvent{i, 4, 0, 1}));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, ring.getSpace());
+    TEST_ASSERT_FALSE(ring.push(NoteEvent{99, 4, 0, 1}));
+    TEST_ASSERT_EQUAL_UINT32(1, ring.getDropped());
+
+    // The dropped event never went in
+    for (uint32_t i = 0; i < NOTE_EVENT_RING_SIZE; i++)
+    {
+        TEST_ASSERT_TRUE(ring.pop(event));
+        TEST_ASSERT_EQUAL_UINT32(i, event.timestamp);
+    }
+    TEST_ASSERT_FALSE(ring.pop(event));
+    TEST_ASSERT_EQUAL_UINT32(NOTE_EVENT_RING_SIZE, ring.getSpace());
+}
+
+void test_noteEventKeyChanges(void)
+/*
+ * tests the changes of a key events message are queued releases first, all of them or none
+ */
+{
+    NoteEventRing ring;
+    NoteEvent event;
+
+    // E pressed, C and B released
+    TEST_ASSERT_TRUE(ring.pushKeyChanges(5, 0x0010, 0x0801, 1234));
+    const uint8_t notes[3] = {0, 11, 4};
+    const uint8_t pressed[3] = {0, 0, 1};
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_TRUE(ring.pop(event));
+        TEST_ASSERT_EQUAL_UINT8(5, event.octave);
+        TEST_ASSERT_EQUAL_UINT8(notes[i], event.note);
+        TEST_ASSERT_EQUAL_UINT8(pressed[i], event.pressed);
+        TEST_ASSERT_EQUAL_UINT32(1234, event.timestamp);
+    }
+    TEST_ASSERT_FALSE(ring.pop(event));
+
+    // A message that doesn't fit is dropped whole, so the caller can leave it to the next snapshot
+    for (uint32_t i = 0; i < NOTE_EVENT_RING_SIZE - 11; i++)
+    {
+        TEST_ASSERT_TRUE(ring.push(NoteEvent{i, 4, 0, 1}));
+    }
+    TEST_ASSERT_FALSE(ring.pushKeyChanges(4, 0x0FFF, 0, 0));
+    TEST_ASSERT_EQUAL_UINT32(11, ring.getSpace());
+    TEST_ASSERT_EQUAL_UINT32(1, ring.getDropped());
+    TEST_ASSERT_TRUE(ring.pushKeyChanges(4, 0x07FF, 0, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.getSpace());
+
+    // No changes always fit
+    TEST_ASSERT_TRUE(ring.pushKeyChanges(4, 0, 0, 0));
+}
+
+#ifndef ARDUINO
+void test_noteEventThreads(void)
+/*
+ * tests a producer and consumer thread running at once, every event arrives once and in order
+ */
+{
+    const uint32_t messages = 20000;
+    NoteEventRing ring;
+
+    // Producer plays the receive interrupt: alternately presses and releases a chord, retrying when the ring is full
+    std::thread producer([&ring, messages]()
+                         {
+        for (uint32_t i = 0; i < messages; i++)
+        {
+            uint16_t chord = 0x0091 << (i % 4);
+            while (!ring.pushKeyChanges(4, (i & 1) ? 0 : chord, (i & 1) ? chord : 0, i))
+            {
+                std::this_thread::yield();
+            }
+        } });
+
+    // Consumer plays the sample interrupt
+    uint32_t events = 0;
+    uint32_t errors = 0;
+    uint32_t message = 0;
+    uint8_t inMessage = 0;
+    while (events < 3 * messages)
+    {
+        NoteEvent event;
+        if (!ring.pop(event))
+        {
+            // Lets the producer run when both threads share a core
+            std::this_thread::yield();
+            continue;
+        }
+        uint16_t chord = 0x0091 << (message % 4);
+        if (event.timestamp != message || !(chord & (1 << event.note)) || event.pressed != !(message & 1))
+        {
+            errors++;
+        }
+        events++;
+        if (++inMessage == 3)
+        {
+            inMessage = 0;
+            message++;
+        }
+    }
+    producer.join();
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u events, %u messages retried on a full ring", (unsigned)events, (unsigned)ring.getDropped());
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(0, errors);
+    TEST_ASSERT_EQUAL_UINT32(messages, message);
+}
+#endif
+
+#ifdef ARDUINO
+static NoteEventRing loopbackRing;
+static MessageDispatcher loopbackDispatcher;
+static volatile uint32_t isrEntry;
+static volatile uint32_t isrExit;
+
+static void onLoopbackKeyEvents(const MessageHeader &header, const KeyEventsMessage &message)
+{
+    // Timestamped in cycles rather than microseconds, for the resolution
+    loopbackRing.pushKeyChanges(message.octave, message.pressed, 0, DWT->CYCCNT);
+}
+
+static void loopbackRxISR()
+{
+    uint8_t data[8];
+    uint32_t id;
+    isrEntry = DWT->CYCCNT;
+    while (CAN_CheckRXLevel())
+    {
+        CAN_RX(id, data);
+        loopbackDispatcher.dispatch(data);
+    }
+    isrExit = DWT->CYCCNT;
+}
+
+void test_canLoopbackLatency(void)
+/*
+ * measures the time from a key events frame being transmitted to its notes being ready for the next sample, with the
+ * CAN controller in loopback mode
+ */
+{
+    const uint32_t frames = 100;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    loopbackDispatcher.on<KeyEventsMessage, onLoopbackKeyEvents>();
+    CAN_Init(true);
+    setCANFilter();
+    CAN_RegisterRX_ISR(loopbackRxISR);
+    CAN_Start();
+
+    uint64_t queuedCycles = 0;
+    uint64_t isrCycles = 0;
+    uint32_t received = 0;
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        Frame frame = encodeMessage(1, i, KeyEventsMessage{4, 0x0001, 0x0001, 0});
+        uint32_t sent = DWT->CYCCNT;
+        CAN_TX(messageId(CLASS_NOTES, 1), frame.data);
+
+        NoteEvent event;
+        uint32_t start = millis();
+        while (!loopbackRing.pop(event) && millis() - start < 10)
+        {
+        }
+        if (millis() - start < 10)
+        {
+            received++;
+            queuedCycles += event.timestamp - sent;
+            isrCycles += isrExit - isrEntry;
+        }
+    }
+
+    uint32_t queuedUs = received ? (uint32_t)(queuedCycles / received / (SystemCoreClock / 1000000)) : 0;
+    uint32_t isr = received ? (uint32_t)(isrCycles / received) : 0;
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%u frames: %uus from transmit to notes queued (mostly the frame on the bus), %u cycles in the receive ISR",
+             (unsigned)received, (unsigned)queuedUs, (unsigned)isr);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_EQUAL_UINT32(frames, received);
+}
+#endif
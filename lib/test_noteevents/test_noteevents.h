@@ -0,0 +1,32 @@
+#include <cstdint>
+
+#ifndef TEST_NOTEEVENTS_H
+#define TEST_NOTEEVENTS_H
+
+void test_NoteEvents(void);
+/*
+ * Tests all note event ring testing functions
+ */
+
+void test_noteEventRing(void);
+/*
+ * tests events come out in order across many laps, and a full ring drops and counts them
+ */
+
+void test_noteEventKeyChanges(void);
+/*
+ * tests the changes of a key events message are queued releases first, all of them or none
+ */
+
+void test_noteEventThreads(void);
+/*
+ * tests a producer and consumer thread running at once, every event arrives once and in order
+ */
+
+void test_canLoopbackLatency(void);
+/*
+ * measures the time from a key events frame being transmitted to its notes being ready for the next sample, with the
+ * CAN controller in loopback mode
+ */
+
+#endif
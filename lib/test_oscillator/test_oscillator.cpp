@@ -0,0 +1,220 @@
+#include <unity.h>
+#include <cstdio>
+#include "oscillator.h"
+#include "test_oscillator.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#include <cmath>
+#include <vector>
+#endif
+
+// Step size of B7, the top key of the keyboard
+static const uint32_t topStepSize = 96418755u << 3;
+
+// Naive oscillators with the same signature as the band-limited ones
+static int32_t sawNaiveStep(uint32_t phase, uint32_t) { return sawNaive(phase); }
+static int32_t squareNaiveStep(uint32_t phase, uint32_t) { return squareNaive(phase); }
+
+void test_Oscillator(void)
+/*
+ * Tests all oscillator testing functions
+ */
+{
+    RUN_TEST(test_polyBlep);
+    RUN_TEST(test_bandLimitedContinuity);
+#ifndef ARDUINO
+    RUN_TEST(test_bandLimitedAliasing);
+#endif
+    RUN_TEST(test_oscillatorCost);
+}
+
+void test_polyBlep(void)
+/*
+ * tests the PolyBLEP residual is only applied next to the discontinuity
+ */
+{
+    // No correction away from the edge
+    TEST_ASSERT_EQUAL_INT32(0, polyBlep(topStepSize, topStepSize));
+    TEST_ASSERT_EQUAL_INT32(0, polyBlep(0x80000000, topStepSize));
+    TEST_ASSERT_EQUAL_INT32(0, polyBlep(0u - topStepSize, topStepSize));
+
+    // Full correction either side of the edge, in opposite directions
+    TEST_ASSERT_EQUAL_INT32(-32768, polyBlep(0, topStepSize));
+    TEST_ASSERT_INT_WITHIN(8, 32768, polyBlep(0u - 1, topStepSize));
+
+    // Halfway through the step the residual is a quarter of the jump
+    TEST_ASSERT_INT_WITHIN(8, -8192, polyBlep(topStepSize / 2, topStepSize));
+    TEST_ASSERT_INT_WITHIN(8, 8192, polyBlep(0u - topStepSize / 2, topStepSize));
+
+    // Steps above Nyquist (or negative after pitch bend) are left uncorrected
+    TEST_ASSERT_EQUAL_INT32(0, polyBlep(0, 0x90000000));
+}
+
+void test_bandLimitedContinuity(void)
+/*
+ * tests the band-limited saw and square have no full scale jumps at their edges
+ */
+{
+    // Either side of the saw wrap the naive wave jumps by the full range, the band-limited one meets in the middle
+    int32_t before = sawPolyBlep(0u - 1, topStepSize) >> 16;
+    int32_t after = sawPolyBlep(0, topStepSize) >> 16;
+    TEST_ASSERT_INT_WITHIN(16, 0, before);
+    TEST_ASSERT_INT_WITHIN(16, 0, after);
+    TEST_ASSERT_EQUAL_INT32(sawNaive(topStepSize * 3) >> 16, sawPolyBlep(topStepSize * 3, topStepSize) >> 16);
+
+    // Same at the square's falling edge
+    before = squarePolyBlep(0x7fffffff, topStepSize) >> 16;
+    after = squarePolyBlep(0x80000000, topStepSize) >> 16;
+    TEST_ASSERT_INT_WITHIN(16, 0, before);
+    TEST_ASSERT_INT_WITHIN(16, 0, after);
+    TEST_ASSERT_EQUAL_INT32(squareNaive(0x40000000) >> 16, squarePolyBlep(0x40000000, topStepSize) >> 16);
+}
+
+#ifndef ARDUINO
+static double aliasingDb(int32_t (*osc)(uint32_t, uint32_t), uint32_t bin)
+/*
+ * Measures the energy outside the true harmonics of a waveform, relative to the energy in the harmonics
+ *
+ * :param osc: oscillator to measure
+ *
+ * :param bin: fundamental as a DFT bin, the step size is chosen so that every component lands exactly on a bin
+ *
+ * :return: aliasing energy in dB relative to the wanted harmonics
+ */
+{
+    const uint32_t n = 4096;
+    const uint32_t stepSize = bin << 20; // 2^32 / n per bin
+
+    std::vector<double> samples(n);
+    std::vector<double> cosTable(n);
+    std::vector<double> sinTable(n);
+    uint32_t phase = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        samples[i] = osc(phase, stepSize) / 2147483648.0;
+        phase += stepSize;
+        cosTable[i] = std::cos(2 * M_PI * i / n);
+        sinTable[i] = std::sin(2 * M_PI * i / n);
+    }
+
+    double wanted = 0;
+    double aliased = 0;
+    for (uint32_t k = 1; k < n / 2; k++)
+    {
+        double re = 0;
+        double im = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            re += samples[i] * cosTable[(k * i) % n];
+            im -= samples[i] * sinTable[(k * i) % n];
+        }
+        double energy = re * re + im * im;
+        if (k % bin == 0)
+        {
+            wanted += energy;
+        }
+        else
+        {
+            aliased += energy;
+        }
+    }
+    return 10 * std::log10(aliased / wanted);
+}
+
+void test_bandLimitedAliasing(void)
+/*
+ * benchmarks the aliasing energy of the naive and band-limited waveforms (host only)
+ */
+{
+    // Bin 735 of 4096 at 22kHz is 3948Hz, just below B7; bin 93 is 500Hz, around B4
+    const uint32_t bins[] = {93, 735};
+    char msg[128];
+
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        double sawNaiveDb = aliasingDb(sawNaiveStep, bins[i]);
+        double sawBlepDb = aliasingDb(sawPolyBlep, bins[i]);
+        double squareNaiveDb = aliasingDb(squareNaiveStep, bins[i]);
+        double squareBlepDb = aliasingDb(squarePolyBlep, bins[i]);
+
+        snprintf(msg, sizeof(msg), "%4uHz aliasing: saw %.1fdB -> %.1fdB, square %.1fdB -> %.1fdB",
+                 (unsigned)(bins[i] * 22000 / 4096), sawNaiveDb, sawBlepDb, squareNaiveDb, squareBlepDb);
+        TEST_MESSAGE(msg);
+
+        TEST_ASSERT_LESS_THAN(sawNaiveDb - 6, sawBlepDb);
+        TEST_ASSERT_LESS_THAN(squareNaiveDb - 6, squareBlepDb);
+    }
+}
+#endif
+
+static uint32_t benchmark(int32_t (*osc)(uint32_t, uint32_t), uint32_t samples)
+/*
+ * Runs 12 voices of an oscillator for a number of samples
+ *
+ * :param osc: oscillator to run
+ *
+ * :param samples: number of samples per voice
+ *
+ * :return: cycles (on target) or nanoseconds (on host) per voice-sample, scaled by 100
+ */
+{
+    uint32_t phases[12] = {0};
+    volatile int32_t sink = 0;
+
+#ifdef ARDUINO
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t start = DWT->CYCCNT;
+#else
+    auto start = std::chrono::steady_clock::now();
+#endif
+
+    for (uint32_t s = 0; s < samples; s++)
+    {
+        int32_t vout = 0;
+        for (uint8_t v = 0; v < 12; v++)
+        {
+            uint32_t stepSize = topStepSize >> (v % 7);
+            phases[v] += stepSize;
+            vout += osc(phases[v], stepSize) >> 24;
+        }
+        sink = sink + vout;
+    }
+
+#ifdef ARDUINO
+    uint64_t elapsed = DWT->CYCCNT - start;
+#else
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+    return (uint32_t)(elapsed * 100 / (samples * 12));
+}
+
+void test_oscillatorCost(void)
+/*
+ * benchmarks the cost per voice-sample of the naive and band-limited waveforms
+ */
+{
+#ifdef ARDUINO
+    const uint32_t samples = 2000;
+    const char *unit = "cycles";
+#else
+    const uint32_t samples = 200000;
+    const char *unit = "ns";
+#endif
+    char msg[128];
+
+    uint32_t sawNaiveCost = benchmark(sawNaiveStep, samples);
+    uint32_t sawBlepCost = benchmark(sawPolyBlep, samples);
+    uint32_t squareNaiveCost = benchmark(squareNaiveStep, samples);
+    uint32_t squareBlepCost = benchmark(squarePolyBlep, samples);
+
+    snprintf(msg, sizeof(msg), "%s per voice-sample: saw %u.%02u -> %u.%02u, square %u.%02u -> %u.%02u", unit,
+             (unsigned)(sawNaiveCost / 100), (unsigned)(sawNaiveCost % 100), (unsigned)(sawBlepCost / 100), (unsigned)(sawBlepCost % 100),
+             (unsigned)(squareNaiveCost / 100), (unsigned)(squareNaiveCost % 100), (unsigned)(squareBlepCost / 100), (unsigned)(squareBlepCost % 100));
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_GREATER_THAN(0, sawBlepCost);
+}
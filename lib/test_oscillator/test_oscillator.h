@@ -0,0 +1,31 @@
+#include <cstdint>
+
+#ifndef TEST_OSCILLATOR_H
+#define TEST_OSCILLATOR_H
+
+void test_Oscillator(void);
+/*
+ * Tests all oscillator testing functions
+ */
+
+void test_polyBlep(void);
+/*
+ * tests the PolyBLEP residual is only applied next to the discontinuity
+ */
+
+void test_bandLimitedContinuity(void);
+/*
+ * tests the band-limited saw and square have no full scale jumps at their edges
+ */
+
+void test_bandLimitedAliasing(void);
+/*
+ * benchmarks the aliasing energy of the naive and band-limited waveforms (host only)
+ */
+
+void test_oscillatorCost(void);
+/*
+ * benchmarks the cost per voice-sample of the naive and band-limited waveforms
+ */
+
+#endif
@@ -0,0 +1,224 @@
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "scope.h"
+#include "test_scope.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+static const double pi = 3.14159265358979323846;
+
+static void tone(int16_t *samples, uint16_t count, double cycles, double phase, int16_t amplitude)
+/*
+ * Fills a block with a sine
+ *
+ * :param samples: set to the sine
+ *
+ * :param count: number of samples
+ *
+ * :param cycles: cycles per FFT_SIZE samples, the bin it falls in
+ *
+ * :param phase: phase of the first sample in radians
+ *
+ * :param amplitude: peak of the sine
+ */
+{
+    for (uint16_t i = 0; i < count; i++)
+    {
+        samples[i] = (int16_t)lround(amplitude * sin(2 * pi * cycles * i / FFT_SIZE + phase));
+    }
+}
+
+void test_Scope(void)
+/*
+ * Tests all oscilloscope and spectrum testing functions
+ */
+{
+    RUN_TEST(test_audioTap);
+    RUN_TEST(test_scopeTrigger);
+    RUN_TEST(test_spectrumPeaks);
+    RUN_TEST(test_spectrumCost);
+}
+
+void test_audioTap(void)
+/*
+ * tests the latest samples are read oldest first, and a read overtaken by the producer is refused
+ */
+{
+    AudioTap tap;
+    int16_t samples[SCOPE_WIDTH];
+
+    for (int16_t i = 0; i < SCOPE_WIDTH - 1; i++)
+    {
+        tap.push(i);
+    }
+    TEST_ASSERT_FALSE(tap.read(samples, SCOPE_WIDTH));
+
+    // Wrapping round the ring several times, the latest samples come out in order
+    for (int16_t i = SCOPE_WIDTH - 1; i < 3 * AUDIO_TAP_SIZE; i++)
+    {
+        tap.push(i);
+    }
+    TEST_ASSERT_TRUE(tap.read(samples, SCOPE_WIDTH));
+    for (uint8_t i = 0; i < SCOPE_WIDTH; i++)
+    {
+        TEST_ASSERT_EQUAL_INT16(3 * AUDIO_TAP_SIZE - SCOPE_WIDTH + i, samples[i]);
+    }
+}
+
+void test_scopeTrigger(void)
+/*
+ * tests traces of a steady tone start at the same phase, and noise around the middle doesn't trigger
+ */
+{
+    int16_t samples[2 * SCOPE_WIDTH];
+    uint8_t first[SCOPE_WIDTH];
+    uint8_t rows[SCOPE_WIDTH];
+
+    // 5 cycles per 128 samples, read at different phases
+    for (uint8_t n = 0; n < 8; n++)
+    {
+        tone(samples, 2 * SCOPE_WIDTH, 5, n * 0.7, 3000);
+        uint16_t trigger = findTrigger(samples, 2 * SCOPE_WIDTH, SCOPE_WIDTH);
+        TEST_ASSERT_GREATER_OR_EQUAL_INT32(0, samples[trigger]);
+        TEST_ASSERT_TRUE(samples[trigger - 1] < 0);
+
+        scopeTrace(samples + trigger, 32, n ? rows : first);
+        if (n)
+        {
+            // The trigger can only land on a sample, up to 1/25.6 of a cycle late, 4 rows where the trace is steepest
+            for (uint8_t i = 0; i < SCOPE_WIDTH; i++)
+            {
+                TEST_ASSERT_INT_WITHIN(4, first[i], rows[i]);
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT8(0, *std::min_element(first, first + SCOPE_WIDTH));
+    TEST_ASSERT_EQUAL_UINT8(30, *std::max_element(first, first + SCOPE_WIDTH));
+
+    // Noise crossing the middle doesn't arm the trigger when it's smaller than an eighth of the range
+    int16_t noise[2 * SCOPE_WIDTH];
+    for (uint16_t i = 0; i < 2 * SCOPE_WIDTH; i++)
+    {
+        noise[i] = (i % 2) ? 10 : -10;
+    }
+    noise[2 * SCOPE_WIDTH - 2] = 100;
+    noise[2 * SCOPE_WIDTH - 1] = -100;
+    TEST_ASSERT_EQUAL_UINT16(0, findTrigger(noise, 2 * SCOPE_WIDTH, SCOPE_WIDTH));
+
+    // Silence stays flat in the middle
+    int16_t silence[SCOPE_WIDTH] = {0};
+    scopeTrace(silence, 32, rows);
+    TEST_ASSERT_EQUAL_UINT8(15, rows[0]);
+}
+
+void test_spectrumPeaks(void)
+/*
+ * tests tones land in their bins at their relative levels, with the leakage of the window well below them
+ */
+{
+    Spectrum spectrum;
+    int16_t samples[FFT_SIZE];
+    int16_t second[FFT_SIZE];
+    uint16_t bins[FFT_BINS];
+
+    // A tone in every bin but the edges, shifted up 5 bits by the normalisation to 32000
+    for (uint8_t k = 2; k < FFT_BINS - 1; k++)
+    {
+        tone(samples, FFT_SIZE, k, 0.3, 1000);
+        spectrum.analyse(samples, bins);
+        uint8_t loudest = 0;
+        for (uint8_t i = 1; i < FFT_BINS; i++)
+        {
+            loudest = bins[i] > bins[loudest] ? i : loudest;
+        }
+        TEST_ASSERT_EQUAL_UINT8(k, loudest);
+        TEST_ASSERT_UINT32_WITHIN(32000 / 8, 32000, bins[k]);
+
+        // The Hann window spreads the tone over its neighbours, and nothing further than that
+        for (uint8_t i = 0; i < FFT_BINS; i++)
+        {
+            if (i + 1 < k || i > k + 1)
+            {
+                TEST_ASSERT_LESS_THAN_UINT16(bins[k] / 64, bins[i]);
+            }
+        }
+    }
+
+    // Two tones 12dB apart keep their difference
+    tone(samples, FFT_SIZE, 8, 0, 4000);
+    tone(second, FFT_SIZE, 30, 1, 1000);
+    for (uint16_t i = 0; i < FFT_SIZE; i++)
+    {
+        samples[i] += second[i];
+    }
+    spectrum.analyse(samples, bins);
+    TEST_ASSERT_UINT32_WITHIN(bins[8] / 8, bins[8] / 4, bins[30]);
+
+    // 12dB is 8 quarter doublings, 8 * 32 / 56 rows
+    TEST_ASSERT_INT_WITHIN(1, spectrumBar(bins[8], 32) - 5, spectrumBar(bins[30], 32));
+
+    // Silence has no bars
+    int16_t silence[FFT_SIZE] = {0};
+    spectrum.analyse(silence, bins);
+    for (uint8_t i = 0; i < FFT_BINS; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(0, spectrumBar(bins[i], 32));
+    }
+}
+
+void test_spectrumCost(void)
+/*
+ * benchmarks the FFT against the 100ms time slice of the display task
+ */
+{
+#ifdef ARDUINO
+    const uint32_t runs = 100;
+    const char *unit = "cycles";
+#else
+    const uint32_t runs = 20000;
+    const char *unit = "ns";
+#endif
+    Spectrum spectrum;
+    int16_t samples[FFT_SIZE];
+    uint16_t bins[FFT_BINS];
+    uint32_t total = 0;
+    tone(samples, FFT_SIZE, 11.5, 0, 2000);
+
+#ifdef ARDUINO
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t start = DWT->CYCCNT;
+#else
+    auto start = std::chrono::steady_clock::now();
+#endif
+
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        samples[i % FFT_SIZE] ^= 1;
+        spectrum.analyse(samples, bins);
+        total += bins[11];
+    }
+
+#ifdef ARDUINO
+    uint64_t elapsed = DWT->CYCCNT - start;
+#else
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+    uint32_t cost = (uint32_t)(elapsed / runs);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s per %u point spectrum: %u", unit, (unsigned)FFT_SIZE, (unsigned)cost);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_GREATER_THAN_UINT32(0, total);
+#ifdef ARDUINO
+    // Well inside a millisecond of the display task's 100ms at 80MHz
+    TEST_ASSERT_LESS_THAN_UINT32(80000, cost);
+#endif
+}
@@ -0,0 +1,31 @@
+#include <cstdint>
+
+#ifndef TEST_SCOPE_H
+#define TEST_SCOPE_H
+
+void test_Scope(void);
+/*
+ * Tests all oscilloscope and spectrum testing functions
+ */
+
+void test_audioTap(void);
+/*
+ * tests the latest samples are read oldest first, and a read overtaken by the producer is refused
+ */
+
+void test_scopeTrigger(void);
+/*
+ * tests traces of a steady tone start at the same phase, and noise around the middle doesn't trigger
+ */
+
+void test_spectrumPeaks(void);
+/*
+ * tests tones land in their bins at their relative levels, with the leakage of the window well below them
+ */
+
+void test_spectrumCost(void);
+/*
+ * benchmarks the FFT against the 100ms time slice of the display task
+ */
+
+#endif
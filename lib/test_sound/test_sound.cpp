@@ -0,0 +1,86 @@
+#include <unity.h>
+#include <cstring>
+#include "display.h"
+#include "sound.h"
+#include "test_sound.h"
+
+void test_Sound(void)
+/*
+ * Tests all sound generator testing functions
+ */
+{
+    RUN_TEST(test_soundStatus);
+    RUN_TEST(test_soundOctaves);
+}
+
+void test_soundStatus(void)
+/*
+ * tests the snapshot of the notes being played, and that their names are cut between notes to fit the display
+ */
+{
+    SoundGenerator generator;
+    SoundStatus status;
+    char names[DISPLAY_NOTES_LENGTH];
+
+    generator.getStatus(status);
+    TEST_ASSERT_EQUAL_UINT8(0, status.voices);
+    TEST_ASSERT_EQUAL_UINT8(0, formatNotes(status, names, sizeof(names)));
+    TEST_ASSERT_EQUAL_STRING("", names);
+
+    // Echoing notes use a voice but aren't held, and the names come out lowest first whatever the order of the voices
+    generator.setWaveform(2);
+    generator.setBandLimited(2, true);
+    generator.addKey(5, 4);
+    generator.addKey(4, 1);
+    generator.addKey(4, 11);
+    generator.addKey(6, 0);
+    generator.echoKey(6, 0);
+    generator.getStatus(status);
+    TEST_ASSERT_EQUAL_UINT8(4, status.voices);
+    TEST_ASSERT_EQUAL_UINT8(2, status.waveform);
+    TEST_ASSERT_TRUE(status.bandLimited);
+    TEST_ASSERT_EQUAL_HEX16(0x0802, status.held[4]);
+    TEST_ASSERT_EQUAL_HEX16(0x0010, status.held[5]);
+    TEST_ASSERT_EQUAL_HEX16(0, status.held[6]);
+    TEST_ASSERT_EQUAL_UINT8(10, formatNotes(status, names, sizeof(names)));
+    TEST_ASSERT_EQUAL_STRING("C#4 B4 E5 ", names);
+
+    // Only whole names that fit with the terminator are written
+    TEST_ASSERT_EQUAL_UINT8(7, formatNotes(status, names, 10));
+    TEST_ASSERT_EQUAL_STRING("C#4 B4 ", names);
+    TEST_ASSERT_EQUAL_UINT8(0, formatNotes(status, names, 4));
+    TEST_ASSERT_EQUAL_STRING("", names);
+
+    // Every voice held fills the field with whole names
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        generator.addKey(3, note);
+    }
+    generator.getStatus(status);
+    TEST_ASSERT_EQUAL_UINT8(12, status.voices);
+    uint8_t length = formatNotes(status, names, sizeof(names));
+    TEST_ASSERT_EQUAL_UINT8(strlen(names), length);
+    TEST_ASSERT_LESS_THAN_UINT8(DISPLAY_NOTES_LENGTH, length);
+    TEST_ASSERT_EQUAL_UINT8(' ', names[length - 1]);
+}
+
+void test_soundOctaves(void)
+/*
+ * tests the step size doubles every octave up and halves every octave down from octave 4, down to octave 0
+ */
+{
+    SoundGenerator generator;
+    const uint8_t octaves[] = {4, 0, 1, 3, 5, 7};
+    for (uint8_t octave : octaves)
+    {
+        generator.addKey(octave, 9);
+    }
+
+    int32_t a4 = generator.getStepSize(0);
+    TEST_ASSERT_TRUE(a4 > 0);
+    TEST_ASSERT_EQUAL_INT32(a4 >> 4, generator.getStepSize(1));
+    TEST_ASSERT_EQUAL_INT32(a4 >> 3, generator.getStepSize(2));
+    TEST_ASSERT_EQUAL_INT32(a4 >> 1, generator.getStepSize(3));
+    TEST_ASSERT_EQUAL_INT32(a4 << 1, generator.getStepSize(4));
+    TEST_ASSERT_EQUAL_INT32(a4 << 3, generator.getStepSize(5));
+}
@@ -0,0 +1,21 @@
+#include <cstdint>
+
+#ifndef TEST_SOUND_H
+#define TEST_SOUND_H
+
+void test_Sound(void);
+/*
+ * Tests all sound generator testing functions
+ */
+
+void test_soundStatus(void);
+/*
+ * tests the snapshot of the notes being played, and that their names are cut between notes to fit the display
+ */
+
+void test_soundOctaves(void);
+/*
+ * tests the step size doubles every octave up and halves every octave down from octave 4, down to octave 0
+ */
+
+#endif
@@ -0,0 +1,19 @@
+#include <cstdint>
+
+#ifndef TEST_RANDOM_H
+#define TEST_RANDOM_H
+
+inline uint32_t nextRandom(uint32_t &state)
+/*
+ * Linear congruential generator, so the tests are repeatable on every platform
+ *
+ * :param state: generator state, updated
+ *
+ * :return: a random number with the low bits discarded
+ */
+{
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+#endif
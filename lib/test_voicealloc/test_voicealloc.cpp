@@ -0,0 +1,391 @@
+#include <unity.h>
+#include <cstdio>
+#include "voicealloc.h"
+#include "keycodec.h"
+#include "sound.h"
+#include "test_random.h"
+#include "test_voicealloc.h"
+
+void test_VoiceAlloc(void)
+/*
+ * Tests all voice allocation testing functions
+ */
+{
+    RUN_TEST(test_voiceAllocSingle);
+    RUN_TEST(test_voiceAllocHash);
+    RUN_TEST(test_voiceAllocLeastLoaded);
+    RUN_TEST(test_voiceAllocRenderers);
+    RUN_TEST(test_distributedPolyphony);
+}
+
+void test_voiceAllocSingle(void)
+/*
+ * tests the single receiver policy plays every held note on this module
+ */
+{
+    VoiceAllocator allocator(0x21);
+    allocator.addRenderer(0x5C, 0);
+
+    TEST_ASSERT_EQUAL_UINT8(ALLOC_SINGLE, allocator.getPolicy());
+    TEST_ASSERT_EQUAL_HEX16(0x0891, allocator.assign(4, 0xF891, 0));
+    TEST_ASSERT_EQUAL_UINT8(0x21, allocator.getOwner(4, 0));
+    TEST_ASSERT_EQUAL_UINT8(0, allocator.getOwner(4, 1));
+
+    // Messages for octaves that don't exist are ignored
+    TEST_ASSERT_EQUAL_HEX16(0, allocator.assign(KEY_OCTAVES, 0x0FFF, 0));
+
+    // Unknown policies fall back to a single receiver
+    allocator.setPolicy(ALLOC_POLICIES);
+    TEST_ASSERT_EQUAL_UINT8(ALLOC_SINGLE, allocator.getPolicy());
+}
+
+void test_voiceAllocHash(void)
+/*
+ * tests every module hashes every key to the same one renderer, and the keys spread over the renderers
+ */
+{
+    const uint8_t ids[3] = {0xA7, 0x21, 0x5C};
+    VoiceAllocator allocators[3];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        allocators[i].setSelf(ids[i]);
+        allocators[i].setPolicy(ALLOC_HASH);
+        for (uint8_t j = 0; j < 3; j++)
+        {
+            // Heard from in a different order on each module
+            allocators[i].addRenderer(ids[(i + j) % 3], 0);
+        }
+        TEST_ASSERT_EQUAL_UINT8(3, allocators[i].getRendererCount());
+    }
+
+    uint8_t counts[3] = {0};
+    for (uint8_t octave = 0; octave < KEY_OCTAVES; octave++)
+    {
+        uint16_t shares[3];
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            shares[i] = allocators[i].assign(octave, KEY_MASK, 0);
+            counts[i] += __builtin_popcount(shares[i]);
+        }
+
+        // Each key is played by exactly one module, the one every module agrees owns it
+        TEST_ASSERT_EQUAL_HEX16(KEY_MASK, shares[0] | shares[1] | shares[2]);
+        TEST_ASSERT_EQUAL_HEX16(0, (shares[0] & shares[1]) | (shares[0] & shares[2]) | (shares[1] & shares[2]));
+        for (uint8_t note = 0; note < 12; note++)
+        {
+            uint8_t owner = allocators[0].getOwner(octave, note);
+            for (uint8_t i = 0; i < 3; i++)
+            {
+                TEST_ASSERT_EQUAL_UINT8(owner, allocators[i].getOwner(octave, note));
+                TEST_ASSERT_EQUAL(owner == ids[i], (shares[i] >> note) & 1);
+            }
+        }
+    }
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "96 keys hashed over 3 renderers: %u, %u, %u", (unsigned)counts[0], (unsigned)counts[1],
+             (unsigned)counts[2]);
+    TEST_MESSAGE(msg);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT8(28, counts[i]);
+    }
+
+    // Without state, a released and pressed key goes back to the same renderer
+    uint8_t owner = allocators[1].getOwner(4, 9);
+    allocators[1].assign(4, 0, 0);
+    TEST_ASSERT_EQUAL_UINT8(0, allocators[1].getOwner(4, 9));
+    allocators[1].assign(4, 0x0200, 0);
+    TEST_ASSERT_EQUAL_UINT8(owner, allocators[1].getOwner(4, 9));
+}
+
+void test_voiceAllocLeastLoaded(void)
+/*
+ * tests new notes go to the least loaded renderer of their octave, and held notes never move
+ */
+{
+    VoiceAllocator allocator(0x5C);
+    allocator.setPolicy(ALLOC_LEAST_LOADED);
+    allocator.addRenderer(0x21, 0);
+    allocator.addRenderer(0xA7, 0);
+    const uint8_t ids[3] = {0x21, 0x5C, 0xA7};
+
+    // Pressed one at a time, octave 4 starts from the second renderer and takes them in turn
+    uint16_t pressed = 0;
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        pressed |= 1 << note;
+        allocator.assign(4, pressed, 0);
+        TEST_ASSERT_EQUAL_UINT8(ids[(note + 1) % 3], allocator.getOwner(4, note));
+    }
+    TEST_ASSERT_EQUAL_HEX16(0x0249, allocator.assign(4, pressed, 0));
+
+    // Releasing the notes of one renderer sends the next new notes to it, the rest stay where they are
+    uint8_t before[12];
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        before[note] = allocator.getOwner(4, note);
+    }
+    TEST_ASSERT_EQUAL_HEX16(0, allocator.assign(4, pressed & ~0x0249, 0));
+    TEST_ASSERT_EQUAL_UINT8(before[1], allocator.getOwner(4, 1));
+    TEST_ASSERT_EQUAL_HEX16(0x0249, allocator.assign(4, pressed, 0));
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(before[note], allocator.getOwner(4, note));
+    }
+
+    // A chord in one message is spread as evenly as one note at a time, and another octave starts elsewhere
+    TEST_ASSERT_EQUAL_HEX16(0x0004, allocator.assign(5, 0x0007, 0));
+    TEST_ASSERT_EQUAL_UINT8(0xA7, allocator.getOwner(5, 0));
+    TEST_ASSERT_EQUAL_UINT8(0x21, allocator.getOwner(5, 1));
+    TEST_ASSERT_EQUAL_UINT8(0x5C, allocator.getOwner(5, 2));
+
+    // Changing the policy picks the owners again
+    allocator.setPolicy(ALLOC_HASH);
+    allocator.setPolicy(ALLOC_LEAST_LOADED);
+    TEST_ASSERT_EQUAL_UINT8(0, allocator.getOwner(5, 0));
+    allocator.assign(5, 0x0007, 0);
+    TEST_ASSERT_EQUAL_UINT8(0xA7, allocator.getOwner(5, 0));
+}
+
+void test_voiceAllocRenderers(void)
+/*
+ * tests renderers are dropped when they go quiet, and their notes are given to the ones left
+ */
+{
+    VoiceAllocator allocator(0x5C);
+    allocator.setPolicy(ALLOC_LEAST_LOADED);
+    TEST_ASSERT_TRUE(allocator.addRenderer(0x21, 0));
+    TEST_ASSERT_FALSE(allocator.addRenderer(0x21, 50));
+    TEST_ASSERT_FALSE(allocator.addRenderer(0, 50));
+    TEST_ASSERT_EQUAL_UINT8(2, allocator.getRendererCount());
+
+    TEST_ASSERT_EQUAL_HEX16(0x000A, allocator.assign(4, 0x000F, 100));
+    TEST_ASSERT_EQUAL_UINT8(0x21, allocator.getOwner(4, 0));
+
+    // Heard from within the timeout, so it is kept
+    TEST_ASSERT_FALSE(allocator.expire(50 + keySnapshotTimeout - 1));
+    TEST_ASSERT_EQUAL_UINT8(2, allocator.getRendererCount());
+
+    // Quiet for the timeout, it is dropped but this module never is
+    TEST_ASSERT_TRUE(allocator.expire(50 + keySnapshotTimeout));
+    TEST_ASSERT_EQUAL_UINT8(1, allocator.getRendererCount());
+    TEST_ASSERT_EQUAL_UINT8(0, allocator.getOwner(4, 0));
+    TEST_ASSERT_EQUAL_UINT8(0x5C, allocator.getOwner(4, 1));
+
+    // The next message of the octave gives its notes to this module
+    TEST_ASSERT_EQUAL_HEX16(0x000F, allocator.assign(4, 0x000F, 400));
+    TEST_ASSERT_EQUAL_UINT8(0x5C, allocator.getOwner(4, 0));
+
+    // An octave that has gone quiet is forgotten
+    allocator.expire(400 + keySnapshotTimeout);
+    TEST_ASSERT_EQUAL_UINT8(0, allocator.getOwner(4, 1));
+
+    // Renderers beyond the table are ignored
+    for (uint8_t i = 1; i <= RENDERERS_MAX; i++)
+    {
+        allocator.addRenderer(i, 1000);
+    }
+    TEST_ASSERT_EQUAL_UINT8(RENDERERS_MAX, allocator.getRendererCount());
+    TEST_ASSERT_FALSE(allocator.addRenderer(0xF0, 1000));
+}
+
+const uint8_t SIM_MODULES = 3;
+
+struct SimModule
+/*
+ * A module of the distributed polyphony simulation, playing the keys of one octave and its share of every octave
+ */
+{
+    uint8_t id;
+    uint8_t octave;
+    uint16_t pressed;
+    KeyEventSender sender;
+    VoiceAllocator allocator;
+    KeyStateTracker tracker;
+    SoundGenerator generator;
+
+    // Frames from each module waiting to be received, in the order they were sent
+    KeyEventsMessage inbox[SIM_MODULES][8];
+    uint8_t inboxHead[SIM_MODULES];
+    uint8_t inboxTail[SIM_MODULES];
+};
+
+static void receiveKeyEvents(SimModule &module, uint8_t sender, const KeyEventsMessage &message, uint32_t now)
+/*
+ * What the receive interrupt does with a key events message, and the next sample
+ */
+{
+    module.allocator.addRenderer(sender, now);
+    uint16_t share = module.allocator.assign(message.octave, message.pressed, now);
+    uint16_t toPress[KEY_OCTAVES];
+    uint16_t toRelease[KEY_OCTAVES];
+    module.tracker.reconcile(sender, message.octave, share, now, toPress, toRelease);
+    if (module.generator.queueKeyChanges(message.octave, toPress[message.octave], toRelease[message.octave], now))
+    {
+        module.tracker.update(sender, message.octave, share, now);
+    }
+    module.generator.getVout();
+}
+
+static void simulatePolyphony(uint8_t policy, uint32_t seed, uint32_t results[5])
+/*
+ * Runs 20 seconds of the modules pressing and releasing keys at random, with their frames received in a different
+ * order by each module, and checks who plays every held key whenever every frame has been received
+ *
+ * :param results: set to the most keys held at once, the most voices in use on one module, the held keys played by no
+ * module (their owner had no free voice when they were pressed), the keys played by more than one module or played
+ * after being released, and the owners the modules disagreed on
+ */
+{
+    const uint8_t ids[SIM_MODULES] = {0xA7, 0x21, 0x5C};
+    const uint8_t maxHeld = 9;
+    static SimModule modules[SIM_MODULES];
+    for (uint8_t m = 0; m < SIM_MODULES; m++)
+    {
+        modules[m].id = ids[m];
+        modules[m].octave = 3 + m;
+        modules[m].pressed = 0;
+        modules[m].sender = KeyEventSender();
+        modules[m].allocator = VoiceAllocator(ids[m]);
+        modules[m].allocator.setPolicy(policy);
+        modules[m].tracker = KeyStateTracker();
+        modules[m].generator = SoundGenerator();
+        modules[m].generator.setGlobalLifeTime(0);
+        for (uint8_t s = 0; s < SIM_MODULES; s++)
+        {
+            modules[m].inboxHead[s] = 0;
+            modules[m].inboxTail[s] = 0;
+        }
+    }
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        results[i] = 0;
+    }
+
+    uint32_t random = seed;
+    for (uint32_t now = 0; now < 20000; now += 5)
+    {
+        // Keys change from 200ms in, once every module knows the others from their snapshots
+        for (uint8_t m = 0; m < SIM_MODULES; m++)
+        {
+            SimModule &module = modules[m];
+            if (now >= 200 && nextRandom(random) % 8 == 0)
+            {
+                uint8_t note = nextRandom(random) % 12;
+                uint8_t held = __builtin_popcount(module.pressed);
+                if ((module.pressed & (1 << note)) || held < maxHeld)
+                {
+                    module.pressed ^= 1 << note;
+                }
+            }
+
+            // A module plays its share of its own keys as it sends them, the others get them off the bus later
+            KeyEventsMessage message;
+            if (module.sender.update(message, module.octave, module.pressed, now))
+            {
+                receiveKeyEvents(module, module.id, message, now);
+                for (uint8_t r = 0; r < SIM_MODULES; r++)
+                {
+                    if (r != m)
+                    {
+                        SimModule &receiver = modules[r];
+                        receiver.inbox[m][receiver.inboxTail[m]++ & 7] = message;
+                    }
+                }
+            }
+        }
+
+        // Each module takes waiting frames from random senders, a full drain every 20ms
+        bool drain = now % 20 == 0;
+        for (uint8_t r = 0; r < SIM_MODULES; r++)
+        {
+            SimModule &receiver = modules[r];
+            uint8_t waiting = 0;
+            for (uint8_t s = 0; s < SIM_MODULES; s++)
+            {
+                waiting += (uint8_t)(receiver.inboxTail[s] - receiver.inboxHead[s]);
+            }
+            uint8_t take = drain ? waiting : nextRandom(random) % (waiting + 1);
+            while (take)
+            {
+                uint8_t s = nextRandom(random) % SIM_MODULES;
+                if (receiver.inboxHead[s] != receiver.inboxTail[s])
+                {
+                    receiveKeyEvents(receiver, modules[s].id, receiver.inbox[s][receiver.inboxHead[s]++ & 7], now);
+                    take--;
+                }
+            }
+        }
+        if (!drain)
+        {
+            continue;
+        }
+
+        // Every held key must be played by its owner alone, unless the owner had run out of voices
+        uint32_t held = 0;
+        for (uint8_t m = 0; m < SIM_MODULES; m++)
+        {
+            held += __builtin_popcount(modules[m].pressed);
+            results[1] = modules[m].generator.getVoiceCount() > results[1] ? modules[m].generator.getVoiceCount() : results[1];
+            for (uint8_t note = 0; note < 12; note++)
+            {
+                uint8_t octave = modules[m].octave;
+                uint8_t owner = modules[0].allocator.getOwner(octave, note);
+                uint8_t playing = 0;
+                for (uint8_t r = 0; r < SIM_MODULES; r++)
+                {
+                    playing += modules[r].generator.isPlaying(octave, note);
+                    if (modules[r].allocator.getOwner(octave, note) != owner)
+                    {
+                        results[4]++;
+                    }
+                }
+
+                if (!(modules[m].pressed & (1 << note)))
+                {
+                    results[3] += playing;
+                }
+                else if (playing > 1)
+                {
+                    results[3]++;
+                }
+                else if (!playing)
+                {
+                    results[2]++;
+                }
+            }
+        }
+        results[0] = held > results[0] ? held : results[0];
+    }
+}
+
+void test_distributedPolyphony(void)
+/*
+ * simulates modules sharing their voices with a SoundGenerator each, every held key must play on exactly one of them
+ */
+{
+    const char *names[2] = {"hash", "least-loaded"};
+    const uint8_t policies[2] = {ALLOC_HASH, ALLOC_LEAST_LOADED};
+    for (uint8_t p = 0; p < 2; p++)
+    {
+        uint32_t results[5];
+        simulatePolyphony(policies[p], 7 + p, results);
+
+        char msg[160];
+        snprintf(msg, sizeof(msg), "%s: up to %u keys held on 3 modules, up to %u voices on one, %u checks found a held key silent",
+                 names[p], (unsigned)results[0], (unsigned)results[1], (unsigned)results[2]);
+        TEST_MESSAGE(msg);
+
+        // More keys than one module has voices for
+        TEST_ASSERT_GREATER_THAN_UINT32(12, results[0]);
+        TEST_ASSERT_EQUAL_UINT32(0, results[3]);
+        TEST_ASSERT_EQUAL_UINT32(0, results[4]);
+        if (policies[p] == ALLOC_LEAST_LOADED)
+        {
+            // At most 3 of the 9 keys of an octave on each module, so no module ever runs out of voices
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(9, results[1]);
+            TEST_ASSERT_EQUAL_UINT32(0, results[2]);
+        }
+    }
+}
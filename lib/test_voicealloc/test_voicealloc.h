@@ -0,0 +1,36 @@
+#include <cstdint>
+
+#ifndef TEST_VOICEALLOC_H
+#define TEST_VOICEALLOC_H
+
+void test_VoiceAlloc(void);
+/*
+ * Tests all voice allocation testing functions
+ */
+
+void test_voiceAllocSingle(void);
+/*
+ * tests the single receiver policy plays every held note on this module
+ */
+
+void test_voiceAllocHash(void);
+/*
+ * tests every module hashes every key to the same one renderer, and the keys spread over the renderers
+ */
+
+void test_voiceAllocLeastLoaded(void);
+/*
+ * tests new notes go to the least loaded renderer of their octave, and held notes never move
+ */
+
+void test_voiceAllocRenderers(void);
+/*
+ * tests renderers are dropped when they go quiet, and their notes are given to the ones left
+ */
+
+void test_distributedPolyphony(void);
+/*
+ * simulates modules sharing their voices with a SoundGenerator each, every held key must play on exactly one of them
+ */
+
+#endif
@@ -0,0 +1,301 @@
+#include "voicealloc.h"
+
+const char *const allocationPolicyNames[ALLOC_POLICIES] = {"Rx", "Hash", "Load"};
+
+VoiceAllocator::VoiceAllocator(uint8_t module)
+/*
+ * Initialiser for the VoiceAllocator class
+ *
+ * :param module: module ID of this module, 0 if it isn't known yet
+ */
+{
+    setSelf(module);
+}
+
+void VoiceAllocator::setSelf(uint8_t module)
+/*
+ * Sets this module's ID, which is always one of the renderers
+ *
+ * :param module: module ID of this module
+ */
+{
+    self = module;
+    if (module)
+    {
+        addRenderer(module, 0);
+    }
+}
+
+uint8_t VoiceAllocator::getPolicy()
+/*
+ * :return: the selected AllocationPolicy
+ */
+{
+    return policy;
+}
+
+void VoiceAllocator::setPolicy(uint8_t value)
+/*
+ * Selects the policy, the owners of held notes are picked again by the next message of their octave
+ *
+ * :param value: an AllocationPolicy, unknown values select ALLOC_SINGLE
+ */
+{
+    policy = value < ALLOC_POLICIES ? value : (uint8_t)ALLOC_SINGLE;
+    for (uint8_t octave = 0; octave < KEY_OCTAVES; octave++)
+    {
+        for (uint8_t note = 0; note < 12; note++)
+        {
+            owners[octave][note] = 0;
+        }
+    }
+}
+
+bool VoiceAllocator::addRenderer(uint8_t module, uint32_t now)
+/*
+ * Records a message from a module, which becomes a renderer if it wasn't one
+ *
+ * :param module: module ID of the sender
+ *
+ * :param now: current time in ms
+ *
+ * :return: true if the module is a new renderer
+ */
+{
+    uint8_t i = 0;
+    while (i < rendererCount && renderers[i] < module)
+    {
+        i++;
+    }
+    if (i < rendererCount && renderers[i] == module)
+    {
+        lastSeen[i] = now;
+        return false;
+    }
+    if (rendererCount == RENDERERS_MAX || !module)
+    {
+        return false;
+    }
+
+    // Kept in order of module ID, so every module numbers the renderers the same way
+    for (uint8_t j = rendererCount; j > i; j--)
+    {
+        renderers[j] = renderers[j - 1];
+        lastSeen[j] = lastSeen[j - 1];
+    }
+    renderers[i] = module;
+    lastSeen[i] = now;
+    rendererCount++;
+    return true;
+}
+
+bool VoiceAllocator::expire(uint32_t now)
+/*
+ * Drops the renderers and forgets the held notes of the octaves that haven't had a message for keySnapshotTimeout,
+ * the notes a dropped renderer owned are given to the others by the next message of their octave
+ *
+ * :param now: current time in ms
+ *
+ * :return: true if a renderer was dropped
+ */
+{
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < rendererCount; i++)
+    {
+        if (renderers[i] == self || now - lastSeen[i] < keySnapshotTimeout)
+        {
+            renderers[kept] = renderers[i];
+            lastSeen[kept] = lastSeen[i];
+            kept++;
+        }
+    }
+    bool dropped = kept != rendererCount;
+    rendererCount = kept;
+
+    for (uint8_t octave = 0; octave < KEY_OCTAVES; octave++)
+    {
+        if (held[octave] && now - lastAssigned[octave] >= keySnapshotTimeout)
+        {
+            held[octave] = 0;
+            for (uint8_t note = 0; note < 12; note++)
+            {
+                owners[octave][note] = 0;
+            }
+        }
+    }
+    return dropped;
+}
+
+uint8_t VoiceAllocator::getRendererCount()
+/*
+ * :return: number of renderers, including this module
+ */
+{
+    return rendererCount;
+}
+
+bool VoiceAllocator::isRenderer(uint8_t module)
+/*
+ * :param module: module ID
+ *
+ * :return: true if the module is one of the renderers
+ */
+{
+    for (uint8_t i = 0; i < rendererCount; i++)
+    {
+        if (renderers[i] == module)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t VoiceAllocator::hashOwner(uint8_t octave, uint8_t note)
+/*
+ * :param octave: the octave of the note
+ *
+ * :param note: the note (0-11)
+ *
+ * :return: module ID of the renderer the note hashes to
+ */
+{
+    if (!rendererCount)
+    {
+        return 0;
+    }
+
+    // Fibonacci hashing of the key number, so the regular intervals of a chord don't line up with the renderer count,
+    // scaled to the renderers by its top 16 bits
+    uint32_t key = octave * 12 + note;
+    return renderers[(((key * 2654435769u) >> 16) * rendererCount) >> 16];
+}
+
+uint8_t VoiceAllocator::leastLoaded(uint8_t octave)
+/*
+ * :param octave: the octave of the new note
+ *
+ * :return: module ID of the renderer playing the fewest notes of the octave
+ */
+{
+    if (!rendererCount)
+    {
+        return 0;
+    }
+
+    uint8_t loads[RENDERERS_MAX] = {0};
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        for (uint8_t i = 0; i < rendererCount; i++)
+        {
+            if (owners[octave][note] == renderers[i])
+            {
+                loads[i]++;
+            }
+        }
+    }
+
+    // Ties go to the renderers in turn from one picked by the octave, so each octave's first note lands elsewhere
+    uint8_t start = octave % rendererCount;
+    uint8_t best = start;
+    for (uint8_t i = 1; i < rendererCount; i++)
+    {
+        uint8_t index = (start + i) % rendererCount;
+        if (loads[index] < loads[best])
+        {
+            best = index;
+        }
+    }
+    return renderers[best];
+}
+
+uint16_t VoiceAllocator::assign(uint8_t octave, uint16_t pressed, uint32_t now)
+/*
+ * Updates the notes held on an octave from a key events message, picking the owners of the new ones
+ *
+ * :param octave: the octave of the message, messages for octaves outside 0-7 are ignored
+ *
+ * :param pressed: mask of the notes held down
+ *
+ * :param now: current time in ms
+ *
+ * :return: mask of the held notes this module must play, every held note under ALLOC_SINGLE
+ */
+{
+    if (octave >= KEY_OCTAVES)
+    {
+        return 0;
+    }
+    pressed &= KEY_MASK;
+    held[octave] = pressed;
+    lastAssigned[octave] = now;
+
+    // Released notes free their renderer before the new ones are placed
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        if (!(pressed & (1 << note)))
+        {
+            owners[octave][note] = 0;
+        }
+    }
+
+    if (policy == ALLOC_SINGLE)
+    {
+        return pressed;
+    }
+
+    uint16_t share = 0;
+    for (uint8_t note = 0; note < 12; note++)
+    {
+        if (!(pressed & (1 << note)))
+        {
+            continue;
+        }
+
+        uint8_t owner;
+        if (policy == ALLOC_HASH)
+        {
+            owner = hashOwner(octave, note);
+        }
+        else
+        {
+            // New notes, and notes of a renderer that has gone, go to the least loaded renderer
+            if (!isRenderer(owners[octave][note]))
+            {
+                owners[octave][note] = leastLoaded(octave);
+            }
+            owner = owners[octave][note];
+        }
+
+        if (owner && owner == self)
+        {
+            share |= 1 << note;
+        }
+    }
+    return share;
+}
+
+uint8_t VoiceAllocator::getOwner(uint8_t octave, uint8_t note)
+/*
+ * :param octave: the octave of the note (0-7)
+ *
+ * :param note: the note (0-11)
+ *
+ * :return: module ID of the renderer playing a held note (this module under ALLOC_SINGLE), 0 if it isn't held or there
+ * is no renderer
+ */
+{
+    if (octave >= KEY_OCTAVES || note >= 12 || !(held[octave] & (1 << note)))
+    {
+        return 0;
+    }
+    switch (policy)
+    {
+    case ALLOC_HASH:
+        return hashOwner(octave, note);
+    case ALLOC_LEAST_LOADED:
+        return isRenderer(owners[octave][note]) ? owners[octave][note] : 0;
+    default:
+        return self;
+    }
+}
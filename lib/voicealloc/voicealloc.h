@@ -0,0 +1,153 @@
+#include <cstdint>
+#include "keycodec.h"
+
+#ifndef VOICEALLOC_H
+#define VOICEALLOC_H
+
+/*
+ * Sharing of the notes held on every module between several rendering modules, hardware independent
+ *
+ * Every module keeps its own copy of the allocator and feeds it every key events message, its own and the ones it
+ * receives, so no messages are needed to agree on which module plays a note: each one works out the same owner for
+ * every held note and only starts the notes it owns. The renderers are the modules heard from recently, kept in order
+ * of module ID so every copy numbers them the same way.
+ *
+ * A hash of the octave and note needs no state at all, so it survives lost messages and restarts, but a chord can land
+ * unevenly. Least-loaded gives each new note to the renderer playing the fewest notes of its octave and keeps it there
+ * until it is released. Loads are counted per octave because each octave's messages come from one transmitter in
+ * order, so every copy makes the same choices however the transmitters' frames interleave on the bus; ties go to the
+ * renderers in turn starting from one picked by the octave, so the octaves spread over different renderers.
+ */
+
+const uint8_t RENDERERS_MAX = 8; // Modules sharing the voices at once, any more are ignored
+
+enum AllocationPolicy : uint8_t
+{
+    ALLOC_SINGLE,       // Every note is played by the receiver, the other modules only transmit
+    ALLOC_HASH,         // Each note is played by the renderer picked by a hash of its octave and note
+    ALLOC_LEAST_LOADED, // Each new note is played by the renderer with the fewest notes of its octave
+    ALLOC_POLICIES
+};
+
+extern const char *const allocationPolicyNames[ALLOC_POLICIES];
+
+class VoiceAllocator
+/*
+ * Owner of every held note under the selected policy, and this module's share of them
+ * Not thread safe, must only be used from one context at a time
+ */
+{
+    uint8_t self = 0;
+    uint8_t policy = ALLOC_SINGLE;
+
+    // Renderers in order of module ID, including this module
+    uint8_t renderers[RENDERERS_MAX] = {0};
+    uint32_t lastSeen[RENDERERS_MAX] = {0};
+    uint8_t rendererCount = 0;
+
+    // Held notes of every octave, and their owners under least-loaded (module ID, 0 for none)
+    uint16_t held[KEY_OCTAVES] = {0};
+    uint32_t lastAssigned[KEY_OCTAVES] = {0};
+    uint8_t owners[KEY_OCTAVES][12] = {{0}};
+
+    bool isRenderer(uint8_t module);
+    /*
+     * :param module: module ID
+     *
+     * :return: true if the module is one of the renderers
+     */
+
+    uint8_t hashOwner(uint8_t octave, uint8_t note);
+    /*
+     * :param octave: the octave of the note
+     *
+     * :param note: the note (0-11)
+     *
+     * :return: module ID of the renderer the note hashes to
+     */
+
+    uint8_t leastLoaded(uint8_t octave);
+    /*
+     * :param octave: the octave of the new note
+     *
+     * :return: module ID of the renderer playing the fewest notes of the octave
+     */
+
+public:
+    VoiceAllocator(uint8_t module = 0);
+    /*
+     * Initialiser for the VoiceAllocator class
+     *
+     * :param module: module ID of this module, 0 if it isn't known yet
+     */
+
+    void setSelf(uint8_t module);
+    /*
+     * Sets this module's ID, which is always one of the renderers
+     *
+     * :param module: module ID of this module
+     */
+
+    uint8_t getPolicy();
+    /*
+     * :return: the selected AllocationPolicy
+     */
+
+    void setPolicy(uint8_t value);
+    /*
+     * Selects the policy, the owners of held notes are picked again by the next message of their octave
+     *
+     * :param value: an AllocationPolicy, unknown values select ALLOC_SINGLE
+     */
+
+    bool addRenderer(uint8_t module, uint32_t now);
+    /*
+     * Records a message from a module, which becomes a renderer if it wasn't one
+     *
+     * :param module: module ID of the sender
+     *
+     * :param now: current time in ms
+     *
+     * :return: true if the module is a new renderer
+     */
+
+    bool expire(uint32_t now);
+    /*
+     * Drops the renderers and forgets the held notes of the octaves that haven't had a message for
+     * keySnapshotTimeout, the notes a dropped renderer owned are given to the others by the next message of their octave
+     *
+     * :param now: current time in ms
+     *
+     * :return: true if a renderer was dropped
+     */
+
+    uint8_t getRendererCount();
+    /*
+     * :return: number of renderers, including this module
+     */
+
+    uint16_t assign(uint8_t octave, uint16_t pressed, uint32_t now);
+    /*
+     * Updates the notes held on an octave from a key events message, picking the owners of the new ones
+     *
+     * :param octave: the octave of the message, messages for octaves outside 0-7 are ignored
+     *
+     * :param pressed: mask of the notes held down
+     *
+     * :param now: current time in ms
+     *
+     * :return: mask of the held notes this module must play, every held note under ALLOC_SINGLE
+     */
+
+    uint8_t getOwner(uint8_t octave, uint8_t note);
+    /*
+     * :param octave: the octave of the note (0-7)
+     *
+     * :param note: the note (0-11)
+     *
+     * :return: module ID of the renderer playing a held note (this module under ALLOC_SINGLE), 0 if it isn't held or
+     * there is no renderer
+     */
+};
+
+#endif
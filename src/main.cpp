@@ -3,41 +3,142 @@
 #include "knob.h"
 #include "sound.h"
 #include "joystick.h"
+#include "keymatrix.h"
+#include "gpio_matrix_port.h"
+#include "matrix_scanner.h"
+#include "keycodec.h"
+#include "canproto.h"
+#include "cantx.h"
+#include "hal_can_mailboxes.h"
+#include "latency.h"
+#include "voicealloc.h"
+#include "discovery.h"
+#include "clocksync.h"
+#include "display.h"
+#include "u8g2_dma_i2c.h"
+#include "scope.h"
+#include "loadmeter.h"
 #include "main.h"
 
 // Key Array
 volatile uint32_t keyArray[7];
 
 // Wave types
-const std::string waveType[] = {"Saw", "Sin", "Sqr", "Tri"};
+const char *const waveType[] = {"Saw", "Sin", "Sqr", "Tri"};
 
 // Mutex
 SemaphoreHandle_t keyArrayMutex;
 SemaphoreHandle_t connectionMutex;
-SemaphoreHandle_t CAN_TX_Semaphore;
 
 // CAN network
 QueueHandle_t msgInQ;
-QueueHandle_t msgOutQ;
 volatile uint8_t receiver = 1;
+volatile uint8_t polyphony = ALLOC_SINGLE; // AllocationPolicy of every connected module
 volatile uint8_t connected = 0;
-volatile uint8_t eastConnection = 0;
-volatile uint8_t westConnection = 0;
+uint8_t moduleId = 0;           // Sender ID in the header of every message, from the unique ID of the MCU
+MessageDispatcher dispatcher;        // Only used by CAN_RX_ISR
+MessageDispatcher controlDispatcher; // Only used by the decodeTask, for the messages deferred by CAN_RX_ISR
+KeyStateTracker remoteKeys;          // Notes held by the transmitters, used by CAN_RX_ISR or with it masked
+VoiceAllocator voiceAlloc;           // Owner of every held note, used by CAN_RX_ISR or with it masked
+BaseType_t rxTaskWoken = pdFALSE;    // Set by CAN_RX_ISR if deferring a message woke the decodeTask
+HalCanMailboxes canMailboxes;
+CanTxRing txRing(canMailboxes);      // Emptied into the mailboxes by CAN_TX_ISR
+LatencyTracer latency;               // Stages of the traced key events messages, sent and received
+ChainDiscovery discovery;            // Place of this module in the chain, used with connectionMutex taken
+ClockSync sharedClock;               // Clock shared by the modules, used by the CAN interrupts or with them masked
 
 // Knobs
-Knob knob0(0, 0, 10); // Rotation: Echo || Button: Sound wave
-Knob knob1(1);
-Knob knob2(2, 1, 7);  // Rotation: Octave || Button: Tx/Rx
-Knob knob3(3, 0, 16); // Volume
+Knob knob0(0, 0, 10);                       // Rotation: Echo || Button: Sound wave
+Knob knob1(1, 0, DISPLAY_VIEWS - 1, false); // Rotation: Display view || Button: Band-limited saw/square
+Knob knob2(2, 1, 7, false);                 // Rotation: Octave || Button: Tx/Rx, no acceleration so octaves step one at a time
+Knob knob3(3, 0, 16);                       // Rotation: Volume || Button: Polyphony (shared voices)
 
 // Joystick
 Joystick joystick;
 
+// Key matrix
+GpioMatrixPort matrixPort(RA0_PIN, RA1_PIN, RA2_PIN, REN_PIN, OUT_PIN, C0_PIN, C1_PIN, C2_PIN, C3_PIN);
+MatrixScanner matrixScanner(matrixPort, debounceMask);
+TaskHandle_t scanKeysHandle = NULL;
+
 // Sound Gen
 SoundGenerator soundGen;
 
-// Display driver object
-U8G2_SSD1305_128X32_NONAME_F_HW_I2C u8g2(U8G2_R0);
+// Display driver object, sending its frames by DMA
+U8G2_SSD1305_128X32_NONAME_F_DMA_I2C u8g2(U8G2_R0);
+DisplayModel displayModel; // Only used by the displayUpdateTask
+AudioTap audioTap;         // Every output sample, written by sampleISR and read by the displayUpdateTask
+Spectrum spectrum;         // Only used by the displayUpdateTask
+int16_t viewSamples[2 * SCOPE_WIDTH]; // Latest output samples drawn, only used by the displayUpdateTask
+LoadMeter loadMeter;       // Written by sampleISR and the idle hook, read by the displayUpdateTask
+bool telemetry = false;    // Load reports streamed over Serial, only used by the displayUpdateTask
+
+// Timers, set up in setup()
+HardwareTimer sampleTimer; // TIM1, calls sampleISR at the sample rate
+HardwareTimer scanTimer;   // TIM7, calls scanISR at the key matrix row rate
+
+// RTOS objects, all created by createRtosObjects() with their memory reserved below rather than taken from the heap.
+// Each stack is an estimate of its task's deepest call path (from GCC's -fcallgraph-info, with the library calls it
+// can't see) and the 50 words of a context switch with the FPU in use. Until they have been measured on the board the
+// stacks are nearly twice the estimate, as the library calls are guessed. Send 's' over Serial for the most each task
+// has really used, a task that overflows stops the module (vApplicationStackOverflowHook).
+constexpr TaskConfig taskConfigs[] = {
+  // Function, name, stack words, priority, handle
+  {scanKeysTask, "scanKeys", 384, 6, &scanKeysHandle},   // ~800 bytes, playing and sending a scan's key events
+  {discoveryTask, "discovery", 288, 4, nullptr},         // ~500 bytes, stepping the chain and the shared clock
+  {displayUpdateTask, "displayUpdate", 768, 2, nullptr}, // ~1.1kB, printing the shared clock with printf
+  {decodeTask, "decode", 384, 5, nullptr},               // ~700 bytes, a discovery message resetting the filters
+};
+constexpr QueueConfig queueConfigs[] = {
+  // Name, length, item size, handle
+  {"msgInQ", 36, 8, &msgInQ}, // Connection messages deferred by CAN_RX_ISR
+};
+constexpr MutexConfig mutexConfigs[] = {
+  {"keyArray", &keyArrayMutex},
+  {"connection", &connectionMutex},
+};
+const uint8_t TASKS = sizeof(taskConfigs) / sizeof(taskConfigs[0]);
+const uint8_t QUEUES = sizeof(queueConfigs) / sizeof(queueConfigs[0]);
+const uint8_t MUTEXES = sizeof(mutexConfigs) / sizeof(mutexConfigs[0]);
+
+constexpr uint32_t taskStackWords(uint8_t first = 0)
+/*
+ * :param first: index of the first task counted
+ *
+ * :return: stack words of the tasks from the first on
+ */
+{
+  return first < TASKS ? taskConfigs[first].stackWords + taskStackWords(first + 1) : 0;
+}
+
+constexpr uint32_t queueStorageBytes(uint8_t first = 0)
+/*
+ * :param first: index of the first queue counted
+ *
+ * :return: bytes of the items of the queues from the first on
+ */
+{
+  return first < QUEUES ? queueConfigs[first].length * queueConfigs[first].itemSize + queueStorageBytes(first + 1) : 0;
+}
+
+StackType_t taskStacks[taskStackWords()];
+StaticTask_t taskBuffers[TASKS];
+TaskHandle_t taskHandles[TASKS];
+uint8_t queueStorage[queueStorageBytes()];
+StaticQueue_t queueBuffers[QUEUES];
+StaticSemaphore_t mutexBuffers[MUTEXES];
+
+// The tasks FreeRTOS creates itself
+StackType_t idleStack[configMINIMAL_STACK_SIZE];
+StaticTask_t idleBuffer;
+#if configUSE_TIMERS == 1
+StackType_t timerStack[configTIMER_TASK_STACK_DEPTH];
+StaticTask_t timerBuffer;
+#endif
+
+// Set by vApplicationStackOverflowHook(), for a debugger to read after a stack overflow has stopped the module
+volatile TaskHandle_t overflowedTask = NULL;
+const char *volatile overflowedTaskName = NULL;
 
 // Function to set outputs using key matrix
 void setOutMuxBit(const uint8_t bitIdx, const bool value)
@@ -54,44 +155,6 @@ void setOutMuxBit(const uint8_t bitIdx, const bool value)
 
 /* --- my code --- */
 
-uint8_t readCols()
-/*
- * Reads from all columns and returns a single integer value of all bits in form 0b bit0 bit1 bit2 bit3
- *
- * :return: single integer value of columns
- */
-{
-  uint8_t bit0;
-  uint8_t bit1;
-  uint8_t bit2;
-  uint8_t bit3;
-  bit0 = digitalRead(C0_PIN);
-  bit1 = digitalRead(C1_PIN);
-  bit2 = digitalRead(C2_PIN);
-  bit3 = digitalRead(C3_PIN);
-
-  return bit0 + (bit1 << 1) + (bit2 << 2) + (bit3 << 3);
-}
-
-void setRow(uint8_t rowIdx)
-/*
- * Writes to mux to select certain row that can then be read from using readCols()
- *
- * :param rowIdx: index of row to be read from
- */
-{
-  // Disabling row select
-  digitalWrite(REN_PIN, LOW);
-
-  // Writing to pins
-  digitalWrite(RA0_PIN, (rowIdx & 0x01));
-  digitalWrite(RA1_PIN, (rowIdx & 0x02) >> 1);
-  digitalWrite(RA2_PIN, (rowIdx & 0x04) >> 2);
-
-  // Enabling row select
-  digitalWrite(REN_PIN, HIGH);
-}
-
 uint8_t getIndx(uint8_t key)
 /*
  * Given a specific key value from readCols() it will return a indx value for accessing stepSizes array
@@ -133,27 +196,252 @@ void cpyKeyArray(volatile uint32_t localKeyArray[7])
   xSemaphoreGive(keyArrayMutex);
 }
 
+void applyKeyChanges(uint8_t octave, uint16_t toPress, uint16_t toRelease)
+/*
+ * Starts and releases notes of another module in the SoundGenerator
+ *
+ * :param octave: the octave of the notes
+ *
+ * :param toPress: mask of the notes to start
+ *
+ * :param toRelease: mask of the notes to release, they echo like a local key release
+ */
+{
+  while (toPress)
+  {
+    soundGen.addKey(octave, keyEventNote(toPress));
+  }
+  while (toRelease)
+  {
+    soundGen.echoKey(octave, keyEventNote(toRelease));
+  }
+}
+
+bool playKeyEvents(uint8_t module, const KeyEventsMessage &message, uint32_t now)
+/*
+ * Reconciles the sender's share of the notes with a key events message, queuing the notes that differ for the next
+ * sample, must be called from CAN_RX_ISR or with it masked
+ *
+ * :param module: module ID of the sender
+ *
+ * :param message: the key events message
+ *
+ * :param now: current time in microseconds, the timestamp of the queued notes
+ *
+ * :return: true if notes were queued, false if none changed or the queue was full
+ */
+{
+  uint32_t nowMs = millis();
+  voiceAlloc.addRenderer(module, nowMs);
+  uint16_t share = voiceAlloc.assign(message.octave, message.pressed, nowMs);
+  uint16_t toPress[KEY_OCTAVES];
+  uint16_t toRelease[KEY_OCTAVES];
+  if (!remoteKeys.reconcile(module, message.octave, share, nowMs, toPress, toRelease))
+  {
+    remoteKeys.update(module, message.octave, share, nowMs);
+    return false;
+  }
+  // The message's octave goes last, so the releases of an octave the sender left are queued before its new notes;
+  // if the queue fills part way the state isn't recorded and the next message queues the changes again
+  for (uint8_t i = 1; i <= KEY_OCTAVES; i++)
+  {
+    uint8_t octave = (message.octave + i) % KEY_OCTAVES;
+    if ((toPress[octave] | toRelease[octave]) &&
+        !soundGen.queueKeyChanges(octave, toPress[octave], toRelease[octave], now))
+    {
+      return false;
+    }
+  }
+  remoteKeys.update(module, message.octave, share, nowMs);
+  return true;
+}
+
+uint8_t getModuleId()
+/*
+ * Folds the 96 bit unique ID of the MCU into the module ID used in the message headers
+ *
+ * :return: the module ID, never 0
+ */
+{
+  uint32_t uid = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2();
+  uid ^= uid >> 16;
+  uid ^= uid >> 8;
+  uint8_t id = uid & 0xFF;
+  return id ? id : 1;
+}
+
+bool isRendering()
+/*
+ * :return: true if this module plays notes, as the receiver or as one of the modules sharing the voices
+ */
+{
+  return __atomic_load_n(&receiver, __ATOMIC_RELAXED) || __atomic_load_n(&polyphony, __ATOMIC_RELAXED) != ALLOC_SINGLE;
+}
+
+void updateFilters()
+/*
+ * Sets the CAN filters of the note and trace classes to match the role, must be called in a critical section
+ */
+{
+  if (isRendering())
+  {
+    setCANFilter(messageId(CLASS_NOTES, 0), CLASS_ID_MASK, 0);
+    setCANFilter(messageId(CLASS_TRACE, 0), CLASS_ID_MASK, 2);
+  }
+  else
+  {
+    clearCANFilter(0);
+    clearCANFilter(2);
+  }
+}
+
+void setReceiver(uint8_t value)
+/*
+ * Makes this module a receiver or a transmitter, and sets the CAN filters to match
+ * Only a module that plays the notes of other modules accepts the note and trace classes of IDs; a transmitter's
+ * hardware filter rejects them without interrupting, unless the modules share the voices. The control and clock
+ * classes are always accepted.
+ *
+ * :param value: 1 to become a receiver, 0 to become a transmitter
+ */
+{
+  // The flag and the filter change together, so two tasks switching at once can't leave them disagreeing
+  taskENTER_CRITICAL();
+  if (__atomic_exchange_n(&receiver, value, __ATOMIC_RELAXED) != value)
+  {
+    updateFilters();
+  }
+  taskEXIT_CRITICAL();
+}
+
+void setPolyphony(uint8_t policy)
+/*
+ * Selects how the voices are shared between the modules, and sets the CAN filters to match
+ * Under a shared policy every module sends its keys and plays its share of every module's notes, so every module
+ * accepts the note class of IDs whether it is the receiver or not. Like the octave, it should be changed with no keys
+ * held: notes held across the change are moved to their new owners by the next message of their octave.
+ *
+ * :param policy: an AllocationPolicy
+ */
+{
+  taskENTER_CRITICAL();
+  voiceAlloc.setPolicy(policy);
+  if (__atomic_exchange_n(&polyphony, voiceAlloc.getPolicy(), __ATOMIC_RELAXED) != voiceAlloc.getPolicy())
+  {
+    updateFilters();
+  }
+  taskEXIT_CRITICAL();
+}
+
+template <typename T>
+void sendMessage(const T &message)
+/*
+ * Encodes a message with this module's ID straight into the transmit ring, without blocking
+ * If the ring is full the message is dropped and counted, key events are recovered by the next snapshot
+ *
+ * :param message: the typed message
+ */
+{
+  txRing.send(moduleId, message);
+}
+
 /* ####################### */
 /* ###### Interupts ###### */
 /* ####################### */
 
 void CAN_RX_ISR(void)
 /*
- * Receives a message from the CAN bus and places it on the message in queue
+ * Receives every message waiting in the CAN receive FIFO
+ * Key events are decoded here and their notes queued for the next sample, the connection messages are placed on the
+ * message in queue for the decodeTask
  */
 {
   uint8_t RX_MESSAGE_ISR[8];
   uint32_t ID;
-  CAN_RX(ID, RX_MESSAGE_ISR);
-  xQueueSendFromISR(msgInQ, RX_MESSAGE_ISR, NULL);
+  rxTaskWoken = pdFALSE;
+  while (CAN_CheckRXLevel())
+  {
+    CAN_RX(ID, RX_MESSAGE_ISR);
+    dispatcher.dispatch(RX_MESSAGE_ISR);
+  }
+  portYIELD_FROM_ISR(rxTaskWoken);
+}
+
+void deferMessage(const MessageHeader &header, const uint8_t *data)
+/*
+ * Passes a connection message from CAN_RX_ISR on to the decodeTask, switching to it straight after the interrupt
+ */
+{
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(msgInQ, data, &woken);
+  rxTaskWoken |= woken;
 }
 
 void CAN_TX_ISR(void)
 /*
- * Releases the CAN_TX semaphore, which can then be taken in the CAN_TX_Task
+ * Called when a mailbox has been transmitted or a sender has added to the ring, refills the empty mailboxes from the
+ * transmit ring
+ */
+{
+  uint32_t now = micros();
+  txRing.pump(now);
+
+  // Once a traced frame has gone, its times follow it: to the receiver for key events, to every module for a sync
+  TxTrace trace;
+  while (txRing.takeTrace(trace))
+  {
+    if (trace.type == MSG_SYNC)
+    {
+      txRing.send(moduleId, SyncTimeMessage{(uint32_t)sharedClock.getTime(trace.sent)});
+    }
+    else
+    {
+      latency.sent(trace.scanned, trace.queued, trace.loaded, trace.sent);
+      uint32_t age = trace.sent - trace.scanned;
+      txRing.send(moduleId, TraceMessage{(uint16_t)trace.sent, (uint16_t)(age < 0xFFFF ? age : 0xFFFF)});
+    }
+  }
+}
+
+void scanISR()
+/*
+ * Function that gets called by the scan timer interrupt
+ * Steps the key matrix scanner by one row, decodes the knob rotations and joystick on every completed frame
+ * and wakes scanKeysTask when a frame has changed
  */
 {
-  xSemaphoreGiveFromISR(CAN_TX_Semaphore, NULL);
+  uint32_t now = micros();
+  uint32_t sequence = matrixScanner.getSequence();
+  bool changed = matrixScanner.tick(now);
+
+  // Decode the knobs on every completed frame, so no quadrature transition is missed while the tasks are busy
+  if (matrixScanner.getSequence() != sequence)
+  {
+    uint32_t frame = matrixScanner.getFrame();
+
+    // Only update the volume and echo if the module plays notes
+    if (isRendering())
+    {
+      knob3.updateRotationValue(frame, now);
+      knob0.updateRotationValue(frame, now);
+    }
+
+    // Update the octave - user guidance: don't change the octave whilst keys are being pressed!!
+    knob2.updateRotationValue(frame, now);
+    knob1.updateRotationValue(frame, now);
+
+    // The ADC samples the joystick in the background, so filtering the latest samples never blocks
+    joystick.updateJoystickPosition();
+    joystick.updateJoystickButton(frame);
+    soundGen.setPitchBend(joystick.getX());
+  }
+
+  if (changed && scanKeysHandle)
+  {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(scanKeysHandle, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+  }
 }
 
 void sampleISR()
@@ -162,19 +450,34 @@ void sampleISR()
  * Updates phase accumulator, sets correct volume and sets the analogue output voltage at each sample interval
  */
 {
+  uint32_t start = DWT->CYCCNT;
 
   int32_t Vout = soundGen.getVout();
 
+  // The scope and spectrum show the sound before the volume, so they keep their scale as it is turned
+  audioTap.push(Vout > INT16_MAX ? INT16_MAX : (Vout < INT16_MIN ? INT16_MIN : Vout));
+
   // Setting volume
   Vout = Vout >> (8 - knob3.getRotation() / 2);
 
   // seting analogue output voltage
   analogWrite(OUTR_PIN, Vout + 128);
+
+  // The first sample playing the notes of a traced frame ends its latency
+  static uint32_t lastApplied = 0;
+  uint32_t applied = soundGen.getLastApplied();
+  if (applied != lastApplied)
+  {
+    lastApplied = applied;
+    latency.notePlayed(applied, micros());
+  }
+
+  loadMeter.sampled(start, DWT->CYCCNT, soundGen.getVoicesPlaying());
 }
 
 void scanKeysTask(void *pvParameters)
 /*
- * Function to be run on its own thread that:
+ * Function to be run on its own thread, woken by scanISR whenever the key matrix changes, that:
  *   reads from all keys and knobs,
  *   stores relevant data in global variables
  *   produces correct note at the correct volume
@@ -182,90 +485,118 @@ void scanKeysTask(void *pvParameters)
  * :param pvParameters: Thread parameter information
  */
 {
-  const TickType_t xFrequency = 20 / portTICK_PERIOD_MS;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
   volatile uint32_t localKeyArray[7];
   uint8_t prevKnob2Button = 1;
   uint8_t prevKnob0Button = 1;
+  uint8_t prevKnob1Button = 1;
+  uint8_t prevKnob3Button = 1;
+  KeyEventDetector keyEvents;
+  KeyEvent events[12];
+  KeyEventSender keySender;
+  uint32_t lastTraced = 0;
+  KeyEventsMessage queuedKeys;
+  uint32_t queuedTicket = 0;
+  bool coalescable = false;
   while (1)
   {
-    vTaskDelayUntil(&xLastWakeTime, xFrequency);
+    // Also wakes when a key snapshot is due, or sooner to resend a message the full ring dropped
+    uint32_t wait = keySender.isResendDue() ? keyResendInterval : keySnapshotInterval;
+    ulTaskNotifyTake(pdTRUE, wait / portTICK_PERIOD_MS);
+
+    uint32_t timestamp;
+    uint32_t matrix = matrixScanner.getFrame(timestamp);
     for (uint8_t i = 0; i < 4; i++)
     {
-      setRow(i);
-      delayMicroseconds(3);
-      uint8_t keys = readCols();
-      localKeyArray[i] = keys;
+      localKeyArray[i] = getMatrixRow(matrix, i);
     }
     uint8_t localReceiver = __atomic_load_n(&receiver, __ATOMIC_RELAXED);
+    uint8_t localPolyphony = __atomic_load_n(&polyphony, __ATOMIC_RELAXED);
+
+    // Under a shared policy the receiver's keys go on the bus too, so the other modules can play their share
+    bool sendKeys = !localReceiver || localPolyphony != ALLOC_SINGLE;
 
     xSemaphoreTake(keyArrayMutex, portMAX_DELAY);
 
+    // Only the 12 keys (rows 0-2) produce key events
     uint8_t octave = knob2.getRotation();
-    for (uint8_t i = 0; i < 3; i++)
+    uint8_t eventCount = keyEvents.update(matrix, timestamp, events, 12, KEY_MASK);
+    for (uint8_t i = 0; i < eventCount; i++)
+    {
+      uint8_t key = events[i].key;
+      if (sendKeys)
+      {
+        // Sent together below
+        continue;
+      }
+      if (!events[i].pressed)
+      {
+        // Key has been released
+        // soundGen.removeKey(octave, key);
+        soundGen.echoKey(octave, key);
+      }
+      else
+      {
+        // Key has been pressed
+        soundGen.addKey(octave, key);
+      }
+    }
+
+    // Every transition of the scan goes in one message, so a chord is a single frame on the bus
+    // Snapshots of the held keys are sent in between, so the receiver recovers from lost messages
+    // A key change is traced every so often, timed from the scan of the frame that changed
+    // While the last message is still waiting in the ring the new one is merged into it, so a congested bus sends the
+    // latest state rather than a backlog, and if the ring is full a snapshot follows as soon as there is room
+    KeyEventsMessage outgoing;
+    if (sendKeys && keySender.update(outgoing, octave, ~matrix & KEY_MASK, millis()))
     {
-      uint8_t keys = localKeyArray[i];
-      uint8_t oldKeys = keyArray[i];
-      for (uint8_t j = 0; j < 4; j++)
+      KeyEventsMessage merged = queuedKeys;
+      if (outgoing.changed && millis() - lastTraced >= latencyTraceInterval)
       {
-        uint8_t mask = 1 << j;
-        if ((keys & mask) ^ (oldKeys & mask))
+        lastTraced = millis();
+        coalescable = false;
+        if (!txRing.sendTraced(moduleId, outgoing, timestamp, micros()))
         {
-          if (keys & mask)
-          {
-            // Key has been released
-            if (localReceiver)
-            {
-              // soundGen.removeKey(octave, i * 4 + j);
-              soundGen.echoKey(octave, i * 4 + j);
-            }
-            else
-            {
-              uint8_t TX_Message[8];
-              TX_Message[0] = 'R';
-              TX_Message[1] = knob2.getRotation();
-              TX_Message[2] = i * 4 + j;
-              xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
-            }
-          }
-          else
-          {
-            // Key has been pressed
-            if (localReceiver)
-            {
-              soundGen.addKey(octave, i * 4 + j);
-            }
-            else
-            {
-              uint8_t TX_Message[8];
-              TX_Message[0] = 'P';
-              TX_Message[1] = knob2.getRotation();
-              TX_Message[2] = i * 4 + j;
-              xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
-            }
-          }
+          keySender.resend();
         }
       }
+      else if (coalescable && coalesceKeyEvents(merged, outgoing) && txRing.update(queuedTicket, moduleId, merged))
+      {
+        queuedKeys = merged;
+      }
+      else
+      {
+        queuedKeys = outgoing;
+        coalescable = txRing.send(moduleId, outgoing, queuedTicket);
+        if (!coalescable)
+        {
+          keySender.resend();
+        }
+      }
+
+      // A module doesn't receive its own frames, so it plays its share of its keys as it sends them
+      if (localPolyphony != ALLOC_SINGLE)
+      {
+        taskENTER_CRITICAL();
+        playKeyEvents(moduleId, outgoing, micros());
+        taskEXIT_CRITICAL();
+      }
     }
 
     xSemaphoreGive(keyArrayMutex);
 
     cpyKeyArray(localKeyArray);
 
-    // Only update the volume and sound wave if the module is configured to be a receiver
-    if (localReceiver)
+    // Only update the volume and sound wave if the module plays notes
+    if (localReceiver || localPolyphony != ALLOC_SINGLE)
     {
-      knob3.updateRotationValue();
-      knob3.updateButtonValue();
-
-      knob0.updateRotationValue();
       soundGen.setGlobalLifeTime(knob0.getRotation());
-      knob0.updateButtonValue();
+      knob0.updateButtonValue(matrix);
+
+      knob1.updateButtonValue(matrix);
     }
 
-    // Update the octave - user guidance: don't change the octave whilst keys are being pressed!!
-    knob2.updateRotationValue();
-    knob2.updateButtonValue();
+    knob2.updateButtonValue(matrix);
+    knob3.updateButtonValue(matrix);
 
     uint8_t knob2Button = knob2.getButton();
     uint8_t localConnected = __atomic_load_n(&connected, __ATOMIC_RELAXED);
@@ -275,10 +606,8 @@ void scanKeysTask(void *pvParameters)
     {
       if (!localReceiver)
       {
-        __atomic_store_n(&receiver, 1, __ATOMIC_RELAXED);
-        uint8_t TX_Message[8];
-        TX_Message[0] = 'T';
-        xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
+        setReceiver(1);
+        sendMessage(TransmitterMessage{});
       }
     }
     prevKnob2Button = knob2Button;
@@ -300,107 +629,311 @@ void scanKeysTask(void *pvParameters)
       soundGen.setWaveform(localSoundWave);
     }
     prevKnob0Button = knob0Button;
+
+    uint8_t knob1Button = knob1.getButton();
+
+    // Check to see if knob1 (band-limit) has been pressed (i.e. gone from 1 -> 0), toggles the current waveform
+    if (!knob1Button && prevKnob1Button)
+    {
+      uint8_t localSoundWave = soundGen.getWaveform();
+      soundGen.setBandLimited(localSoundWave, !soundGen.getBandLimited(localSoundWave));
+    }
+    prevKnob1Button = knob1Button;
+
+    uint8_t knob3Button = knob3.getButton();
+
+    // Check to see if knob3 (polyphony) has been pressed (i.e. gone from 1 -> 0), every connected module follows
+    if (localConnected && !knob3Button && prevKnob3Button)
+    {
+      uint8_t policy = (localPolyphony + 1) % ALLOC_POLICIES;
+      setPolyphony(policy);
+      sendMessage(PolyphonyMessage{policy});
+    }
+    prevKnob3Button = knob3Button;
+  }
+}
+
+void applyTopology()
+/*
+ * Takes the role and octave of this module's place in the chain once the discovery has settled, connectionMutex must
+ * be taken
+ * The westmost module is the receiver and the rest transmit, each at the octave given along the chain; the role and
+ * octave are only set when the place changes, so Tx/Rx and the octave knob still work between rounds.
+ */
+{
+  static uint8_t appliedChain = 0;
+  static uint8_t appliedPosition = POSITION_NONE;
+
+  if (!discovery.isSettled())
+  {
+    return;
+  }
+
+  uint8_t count = discovery.getCount();
+  if (count <= 1)
+  {
+    // On its own
+    if (__atomic_exchange_n(&connected, 0, __ATOMIC_RELAXED))
+    {
+      setReceiver(1);
+      setPolyphony(ALLOC_SINGLE);
+    }
+  }
+  else
+  {
+    __atomic_store_n(&connected, 1, __ATOMIC_RELAXED);
+  }
+
+  if (discovery.getChain() != appliedChain || discovery.getPosition() != appliedPosition)
+  {
+    appliedChain = discovery.getChain();
+    appliedPosition = discovery.getPosition();
+    setReceiver(appliedPosition == 0);
+    knob2.setRotation(discovery.getOctave());
   }
 }
 
-void autoMultiSynthTask(void *pvParameters)
+void updateSharedClock()
 /*
- * Task to detect other keyboards and put the appropriate messages on the queue
+ * Leads or follows the shared clock by this module's place in the chain, connectionMutex must be taken
+ * The westmost module, or a module on its own, leads; in a chain it sends a traced sync frame, and CAN_TX_ISR follows it
+ * with the time it was sent.
+ */
+{
+  bool leads = discovery.getPosition() == 0 || discovery.getCount() <= 1;
+  uint32_t high = 0;
+
+  // The CAN interrupts use the clock too
+  taskENTER_CRITICAL();
+  if (leads)
+  {
+    uint32_t now = micros();
+    sharedClock.lead(now);
+    high = (sharedClock.getTime(now) >> 24) & 0xFFFFFF;
+  }
+  else
+  {
+    sharedClock.follow();
+  }
+  taskEXIT_CRITICAL();
+
+  if (leads && discovery.getCount() > 1)
+  {
+    uint32_t now = micros();
+    txRing.sendTraced(moduleId, SyncMessage{high, 0}, now, now);
+  }
+}
+
+uint64_t getSharedSample()
+/*
+ * :return: index of the sample playing now on the clock shared by the modules, the same on every module in the chain
+ */
+{
+  taskENTER_CRITICAL();
+  uint64_t sample = sharedClock.getSample(micros());
+  taskEXIT_CRITICAL();
+  return sample;
+}
+
+void discoveryTask(void *pvParameters)
+/*
+ * Task to find this module's place in the chain from the handshake inputs, and pass the discovery token east
+ * Also leads or follows the shared clock every clockSyncInterval
  *
  * :param pvParameters: Thread parameter information
  */
 {
-  // Initiation interval
-  const TickType_t xFrequency = 500 / portTICK_PERIOD_MS;
+  // Initiation interval, well inside the holdoff so the token is passed on time
+  const TickType_t xFrequency = 2 / portTICK_PERIOD_MS;
 
   // Tick count of last initiation
   TickType_t xLastWakeTime = xTaskGetTickCount();
+  uint32_t lastSync = millis();
 
   while (1)
   {
     vTaskDelayUntil(&xLastWakeTime, xFrequency);
 
-    xSemaphoreTake(connectionMutex, portMAX_DELAY);
+    // West and east detect come from the same debounced matrix frame, low with a neighbour
+    uint32_t inputs = matrixScanner.getFrame();
+    bool west = !getMatrixBit(inputs, HKIW_ROW, HKIW_COL);
+    bool east = !getMatrixBit(inputs, HKIE_ROW, HKIE_COL);
 
-    // Check if the west is connected
-    uint8_t localWestConnection = __atomic_load_n(&westConnection, __ATOMIC_RELAXED);
-
-    // Select the fifth row, 3rd column for West Detect
-    setRow(5);
-    delayMicroseconds(3);
-    int8_t west = digitalRead(C3_PIN);
+    xSemaphoreTake(connectionMutex, portMAX_DELAY);
 
-    if (!localWestConnection && !west)
+    DiscoveryMessage message;
+    if (discovery.update(west, east, knob2.getRotation(), millis(), message))
     {
-      // New connection to the west identified
-      // Transmit connection message with octave - 1
-      uint8_t TX_Message[8];
-      TX_Message[0] = 'C';
-      TX_Message[1] = knob2.getRotation() - 1;
-      xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
-      __atomic_store_n(&westConnection, 1, __ATOMIC_RELAXED);
+      sendMessage(message);
     }
+    matrixPort.setOutBit(HKOE_BIT, discovery.getEastOutput());
+    applyTopology();
 
-    uint8_t localConnected = __atomic_load_n(&connected, __ATOMIC_RELAXED);
-    if (localConnected)
+    if (millis() - lastSync >= clockSyncInterval)
     {
-      // Check to see if the synth has been disconnected
-      // Select the sixth row, 3rd column for East Detect
-      setRow(6);
-      delayMicroseconds(3);
-      int8_t east = digitalRead(C3_PIN);
-
-      if (east)
-      {
-        // No east synth
-        __atomic_store_n(&eastConnection, 0, __ATOMIC_RELAXED);
-      }
-      if (west)
-      {
-        // No west synth
-        __atomic_store_n(&westConnection, 0, __ATOMIC_RELAXED);
-      }
-      if (east && west)
-      {
-        // Synth is disconnected
-        __atomic_store_n(&connected, 0, __ATOMIC_RELAXED);
-        __atomic_store_n(&receiver, 1, __ATOMIC_RELAXED);
-      }
+      lastSync += clockSyncInterval;
+      updateSharedClock();
     }
 
     xSemaphoreGive(connectionMutex);
   }
 }
 
-void joystickTask(void *pvParameters)
+void printLatency()
 /*
- * Function to be run on its own thread that:
- *   updates joystick global variables ,
- *   for now: serial prints results
- *
- * :param pvParameters: Thread parameter information
+ * Prints the latency histogram of every stage over Serial, blocking until it has been sent
  */
 {
-  // Initiation interval
-  const TickType_t xFrequency = 30 / portTICK_PERIOD_MS;
+  char line[96];
+  Serial.println("Latency (transmitter stages on a transmitter, the rest on the receiver):");
+  for (uint8_t stage = 0; stage < LATENCY_STAGES; stage++)
+  {
+    latency.getStage(stage).format(line, sizeof(line), latencyStageNames[stage]);
+    Serial.println(line);
+  }
+}
 
-  // Tick count of last initiation
-  TickType_t xLastWakeTime = xTaskGetTickCount();
+void printTransmit()
+/*
+ * Prints the counters of the transmit ring over Serial, blocking until it has been sent
+ */
+{
+  char line[96];
+  snprintf(line, sizeof(line), "Transmit ring: %lu queued, %lu dropped, %lu coalesced, %lu untraced",
+           (unsigned long)txRing.getQueued(), (unsigned long)txRing.getDropped(), (unsigned long)txRing.getCoalesced(),
+           (unsigned long)txRing.getUntraced());
+  Serial.println(line);
+}
 
-  while (1)
+void printDisplay()
+/*
+ * Prints how much has been sent to the display over Serial, blocking until it has been sent
+ * Must be called from the displayUpdateTask
+ */
+{
+  uint32_t seconds = millis() / 1000;
+  uint32_t frames = displayModel.getFrames();
+  uint32_t bytes = displayModel.getBytes();
+  char line[96];
+  snprintf(line, sizeof(line), "Display: %lu frames, %lu unchanged, %lu bytes/s (%lu bytes/s redrawing every frame)",
+           (unsigned long)frames, (unsigned long)displayModel.getSkipped(),
+           (unsigned long)(seconds ? bytes / seconds : bytes),
+           (unsigned long)(seconds ? frames * displayFullFrameBytes / seconds : frames * displayFullFrameBytes));
+  Serial.println(line);
+  snprintf(line, sizeof(line), "Display DMA: %lu transfers, %lu waits for room, %lu errors",
+           (unsigned long)getDisplayI2cTransfers(), (unsigned long)getDisplayI2cWaits(),
+           (unsigned long)getDisplayI2cErrors());
+  Serial.println(line);
+}
+
+void sendDisplay()
+/*
+ * Sends the tiles of the frame drawn in the U8g2 buffer that differ from what the display shows
+ * Must be called from the displayUpdateTask
+ */
+{
+  DisplayArea areas[DISPLAY_TILE_ROWS];
+  uint8_t areaCount = displayModel.flush(u8g2.getBufferPtr(), areas);
+  for (uint8_t i = 0; i < areaCount; i++)
   {
-    vTaskDelayUntil(&xLastWakeTime, xFrequency);
+    u8g2.updateDisplayArea(areas[i].tileX, areas[i].tileY, areas[i].tileWidth, 1);
+  }
+}
 
-    // Updating joystick data
-    joystick.updateJoystickPosition();
+void drawAudioView(uint8_t view)
+/*
+ * Draws and sends the latest output samples as an oscilloscope trace or a spectrum
+ * Must be called from the displayUpdateTask
+ *
+ * :param view: VIEW_SCOPE or VIEW_SPECTRUM
+ */
+{
+  // Twice the width is read for the scope, so a trigger can be found with a whole trace after it
+  int16_t *samples = viewSamples;
+  uint16_t count = view == VIEW_SCOPE ? 2 * SCOPE_WIDTH : FFT_SIZE;
+  if (!audioTap.read(samples, count))
+  {
+    // Too few samples yet, or overtaken by sampleISR while copying, the last frame stays until the next
+    return;
+  }
 
-    // Updating joystick button data
-    joystick.updateJoystickButton();
+  u8g2.clearBuffer();
+  if (view == VIEW_SCOPE)
+  {
+    uint8_t rows[SCOPE_WIDTH];
+    scopeTrace(samples + findTrigger(samples, count, SCOPE_WIDTH), DISPLAY_HEIGHT, rows);
+    for (uint8_t x = 1; x < SCOPE_WIDTH; x++)
+    {
+      u8g2.drawLine(x - 1, rows[x - 1], x, rows[x]);
+    }
+  }
+  else
+  {
+    uint16_t bins[FFT_BINS];
+    spectrum.analyse(samples, bins);
 
-    // for testing
-    // double shift = sin(joystick.getX());
-    // Serial.println(joystick.getX());
+    // A column per bin with a gap after it, 0Hz on the left
+    for (uint8_t k = 0; k < FFT_BINS; k++)
+    {
+      uint8_t bar = spectrumBar(bins[k], DISPLAY_HEIGHT);
+      if (bar)
+      {
+        u8g2.drawVLine(2 * k, DISPLAY_HEIGHT - bar, bar);
+      }
+    }
+  }
+  sendDisplay();
+}
+
+bool updateLoad(LoadReport &report)
+/*
+ * Reads the load meter once a second, and streams the report of the second over Serial if telemetry is on
+ * Must be called from the displayUpdateTask
+ *
+ * :param report: set to the report of the last second, if a second has passed
+ *
+ * :return: true if the report was set
+ */
+{
+  static LoadTotals last = loadMeter.read(DWT->CYCCNT);
+  static uint8_t sequence = 0;
+
+  uint32_t now = DWT->CYCCNT;
+  if (now - last.cycles < SystemCoreClock)
+  {
+    return false;
+  }
+  LoadTotals totals = loadMeter.read(now);
+  report = loadReport(last, totals);
+  last = totals;
+
+  // 13 bytes a second fit in the Serial transmit buffer, so this doesn't wait
+  if (telemetry)
+  {
+    uint8_t frame[TELEMETRY_FRAME_SIZE];
+    encodeTelemetry(report, sequence++, frame);
+    Serial.write(frame, TELEMETRY_FRAME_SIZE);
   }
+  return true;
+}
+
+void printClock()
+/*
+ * Prints the state of the shared clock over Serial, blocking until it has been sent
+ */
+{
+  taskENTER_CRITICAL();
+  ClockSync clock = sharedClock;
+  taskEXIT_CRITICAL();
+
+  const char *const states[] = {"master", "acquiring", "locked"};
+  char line[96];
+  snprintf(line, sizeof(line), "Clock %s, master %u, error %ldus, rate %ldppb, %lu syncs, %lu steps",
+           states[clock.getState()], clock.getMaster(), (long)clock.getError(), (long)clock.getRate(),
+           (unsigned long)clock.getSyncs(), (unsigned long)clock.getSteps());
+  Serial.println(line);
+  snprintf(line, sizeof(line), "Shared sample %lu", (unsigned long)getSharedSample());
+  Serial.println(line);
 }
 
 void displayUpdateTask(void *pvParameters)
@@ -420,9 +953,13 @@ void displayUpdateTask(void *pvParameters)
 
   // Local variables for temporary storage
   volatile uint32_t localKeyArray[7];
+  LoadReport load = {};
 
   while (1)
   {
+    // The full frame transfer used to pace the task, unchanged frames now send nothing
+    vTaskDelayUntil(&xLastWakeTime, xFrequency);
+
     static uint32_t next = millis();
     static uint32_t count = 0;
     // scanKeysTask(NULL);
@@ -439,171 +976,341 @@ void displayUpdateTask(void *pvParameters)
     localKeyArray[6] = keyArray[6];*/
     xSemaphoreGive(keyArrayMutex);
 
-    // Update display
-    u8g2.clearBuffer();                 // clear the internal memory
-    u8g2.setFont(u8g2_font_ncenB08_tr); // choose a suitable font
-
-    u8g2.setCursor(2, 10);
-    u8g2.print("Oct: ");
-    u8g2.print(knob2.getRotation());
-
     uint8_t localReceiver = __atomic_load_n(&receiver, __ATOMIC_RELAXED);
     uint8_t localConnected = __atomic_load_n(&connected, __ATOMIC_RELAXED);
 
-    if (!localConnected || (localConnected && localReceiver))
-    {
-      u8g2.setCursor(60, 20);
-      u8g2.print("Vol: ");
-      u8g2.print(knob3.getRotation());
-
-      u8g2.setCursor(42, 10);
-      u8g2.print("Wave: ");
-      u8g2.print(waveType[soundGen.getWaveform()].c_str());
+    uint8_t localPolyphony = __atomic_load_n(&polyphony, __ATOMIC_RELAXED);
 
-      u8g2.setCursor(2, 20);
-      u8g2.print("Echo: ");
-      u8g2.print(knob0.getRotation());
-      u8g2.print("s");
+    updateLoad(load);
 
-      u8g2.setCursor(2, 30);
-      u8g2.print(soundGen.getCurrentNotes().c_str());
+    DisplayFields fields = {};
+    fields.octave = knob2.getRotation();
+    fields.playing = !localConnected || localReceiver || localPolyphony != ALLOC_SINGLE;
+    if (fields.playing)
+    {
+      fields.volume = knob3.getRotation();
+      fields.echo = knob0.getRotation();
+      fields.load = load.audio / (LOAD_SCALE / 100);
+      fields.overrun = load.overruns > 0;
+
+      // The snapshot is formatted straight into the fields, nothing is allocated
+      SoundStatus status;
+      soundGen.getStatus(status);
+      fields.wave = status.waveform;
+      fields.bandLimited = status.bandLimited;
+      formatNotes(status, fields.notes, DISPLAY_NOTES_LENGTH);
     }
-
-    if (localConnected && localReceiver)
+    if (localConnected && localPolyphony != ALLOC_SINGLE)
+    {
+      // Every module plays its share, so Rx/Tx gives way to the policy
+      fields.status = allocationPolicyNames[localPolyphony];
+    }
+    else if (localConnected)
     {
-      u8g2.setCursor(110, 10);
-      u8g2.print("Rx");
+      fields.status = localReceiver ? "Rx" : "Tx";
     }
 
-    if (localConnected && !localReceiver)
+    // knob1 picks the view, the scope and spectrum change with every frame so they are always redrawn
+    uint8_t view = knob1.getRotation();
+    if (view != VIEW_STATUS)
     {
-      u8g2.setCursor(110, 10);
-      u8g2.print("Tx");
+      drawAudioView(view);
+      displayModel.invalidate();
     }
+    // Only redrawn when something changed, and only the tiles that changed are sent
+    else if (displayModel.update(fields))
+    {
+      u8g2.clearBuffer();                 // clear the internal memory
+      u8g2.setFont(u8g2_font_ncenB08_tr); // choose a suitable font
+
+      u8g2.setCursor(2, 10);
+      u8g2.print("Oct: ");
+      u8g2.print(fields.octave);
+
+      if (fields.playing)
+      {
+        u8g2.setCursor(60, 20);
+        u8g2.print("Vol: ");
+        u8g2.print(fields.volume);
+
+        u8g2.setCursor(100, 20);
+        u8g2.print(fields.load);
+        u8g2.print(fields.overrun ? "%!" : "%");
+
+        u8g2.setCursor(42, 10);
+        u8g2.print("Wave: ");
+        u8g2.print(waveType[fields.wave]);
+        if (fields.bandLimited)
+        {
+          u8g2.print("*");
+        }
 
-    u8g2.sendBuffer(); // transfer internal memory to the display
+        u8g2.setCursor(2, 20);
+        u8g2.print("Echo: ");
+        u8g2.print(fields.echo);
+        u8g2.print("s");
+
+        u8g2.setCursor(2, 30);
+        u8g2.print(fields.notes);
+      }
+
+      if (fields.status)
+      {
+        u8g2.setCursor(localPolyphony != ALLOC_SINGLE ? 104 : 110, 10);
+        u8g2.print(fields.status);
+      }
+
+      sendDisplay();
+    }
 
     // Toggle LED
     digitalToggle(LED_BUILTIN);
+
+    // Send 'l' over Serial for the latency histograms, 'c' for the shared clock, 't' for the transmit ring, 'd' for
+    // the display, 'm' to start or stop the load meter's telemetry, 's' for the stack used by each task
+    int command = Serial.available() ? Serial.read() : -1;
+    if (command == 'l')
+    {
+      printLatency();
+    }
+    else if (command == 'c')
+    {
+      printClock();
+    }
+    else if (command == 't')
+    {
+      printTransmit();
+    }
+    else if (command == 'd')
+    {
+      printDisplay();
+    }
+    else if (command == 'm')
+    {
+      telemetry = !telemetry;
+    }
+    else if (command == 's')
+    {
+      printStacks();
+    }
   }
 }
 
-void CAN_TX_Task(void *pvParameters)
+void onKeyEvents(const MessageHeader &header, const KeyEventsMessage &message)
+/*
+ * Key events or snapshot of another module, runs in CAN_RX_ISR
+ * The notes of this module's share that differ from the held notes are queued for the next sample, so lost messages
+ * are corrected. If the queue is full the message is ignored and the next one reconciles the notes.
+ */
 {
-  uint8_t msgOut[8];
-  while (1)
+  if (!isRendering() || message.octave >= KEY_OCTAVES)
   {
-    xQueueReceive(msgOutQ, msgOut, portMAX_DELAY);
-    xSemaphoreTake(CAN_TX_Semaphore, portMAX_DELAY);
-    CAN_TX(0x123, msgOut);
+    return;
+  }
+
+  uint32_t now = micros();
+  bool queued = playKeyEvents(header.module, message, now);
+  if (message.traced)
+  {
+    latency.received(header.module, now, queued);
   }
 }
 
-void decodeTask(void *pvParameters)
+void onTrace(const MessageHeader &header, const TraceMessage &message)
+/*
+ * Times of a traced key events message from its transmitter, runs in CAN_RX_ISR
+ */
 {
-  uint8_t RX_Message[8] = {0};
-  while (1)
+  latency.traced(header.module, message.sent, message.age);
+}
+
+void onSync(const MessageHeader &header, const SyncMessage &message)
+/*
+ * Sync frame of the clock master, runs in CAN_RX_ISR so its arrival is timed as closely as it can be
+ */
+{
+  if (message.traced)
   {
-    xQueueReceive(msgInQ, RX_Message, portMAX_DELAY);
+    sharedClock.sync(header.module, message.high, micros());
+  }
+}
 
-    xSemaphoreTake(connectionMutex, portMAX_DELAY);
+void onSyncTime(const MessageHeader &header, const SyncTimeMessage &message)
+/*
+ * Time the clock master's last sync frame was sent, runs in CAN_RX_ISR
+ */
+{
+  sharedClock.syncTime(header.module, message.sent, micros());
+}
 
-    uint8_t localReceiver = __atomic_load_n(&receiver, __ATOMIC_RELAXED);
-    uint8_t localConnected = __atomic_load_n(&connected, __ATOMIC_RELAXED);
-    uint8_t action = RX_Message[0];
+void onDiscovery(const MessageHeader &header, const DiscoveryMessage &message)
+/*
+ * A claim or reset of the chain discovery from another module
+ */
+{
+  discovery.receive(header.module, message, millis());
+  applyTopology();
+}
 
-    if (action == 0x50)
-    {
-      // Key pressed
-      if (localReceiver)
-      {
-        uint8_t octave = RX_Message[1];
-        uint8_t note = RX_Message[2];
-        soundGen.addKey(octave, note);
-      }
-    }
-    else if (action == 0x52)
-    {
-      // Key released
-      if (localReceiver)
-      {
-        uint8_t octave = RX_Message[1];
-        uint8_t note = RX_Message[2];
-        soundGen.echoKey(octave, note);
-      }
-    }
-    else if (action == 0x43)
-    {
-      // Connect
-      // Check to see if synth is already connected
-      if (localConnected)
-      {
-        // Synth is already connected
-        // Check to see if there is a new east connection
-        uint8_t localEastConnection = __atomic_load_n(&eastConnection, __ATOMIC_RELAXED);
-        if (!localEastConnection)
-        {
-          setRow(6);
-          delayMicroseconds(3);
-          int8_t east = digitalRead(C3_PIN);
-
-          if (!east)
-          {
-            // New east connection found
-            __atomic_store_n(&eastConnection, 1, __ATOMIC_RELAXED);
-
-            // Return a master message, with the required octave
-            uint8_t TX_Message[8];
-            TX_Message[0] = 'M';
-            TX_Message[1] = knob2.getRotation() + 1;
-            xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
-          }
-        }
-      }
-      else
-      {
-        // Synth is unconnected - update octave, Tx/Rx, connected
-        int8_t octave = RX_Message[1];
-        knob2.setRotation(octave);
-        __atomic_store_n(&receiver, 0, __ATOMIC_RELAXED);
-        __atomic_store_n(&connected, 1, __ATOMIC_RELAXED);
-        __atomic_store_n(&eastConnection, 1, __ATOMIC_RELAXED);
-
-        // Return a "slave success" message
-        uint8_t TX_Message[8];
-        TX_Message[0] = 'S';
-        xQueueSend(msgOutQ, TX_Message, portMAX_DELAY);
-      }
-    }
-    else if (action == 0x53)
+void onTransmitter(const MessageHeader &header, const TransmitterMessage &message)
+/*
+ * Synth should become a transmitter
+ */
+{
+  setReceiver(0);
+}
+
+void onPolyphony(const MessageHeader &header, const PolyphonyMessage &message)
+/*
+ * Another module has selected how the voices are shared
+ */
+{
+  setPolyphony(message.policy);
+}
+
+void decodeTask(void *pvParameters)
+/*
+ * Function to be run on its own thread that handles the connection messages deferred by CAN_RX_ISR, and releases the
+ * notes of octaves that have gone quiet
+ *
+ * :param pvParameters: Thread parameter information
+ */
+{
+  uint8_t RX_Message[8] = {0};
+  while (1)
+  {
+    // Wakes at least every snapshot interval, to release the notes of octaves that have gone quiet
+    BaseType_t received = xQueueReceive(msgInQ, RX_Message, keySnapshotInterval / portTICK_PERIOD_MS);
+
+    // CAN_RX_ISR (and the sample ISR) are masked, so no note of an expired octave can be waiting in the queue
+    uint16_t expired[KEY_OCTAVES];
+    taskENTER_CRITICAL();
+    voiceAlloc.expire(millis());
+    if (remoteKeys.expire(millis(), expired))
     {
-      // Slave
-      // Slave successfully connected - this synth is receiver
-      if (!localConnected)
+      for (uint8_t octave = 0; octave < KEY_OCTAVES; octave++)
       {
-        __atomic_store_n(&connected, 1, __ATOMIC_RELAXED);
+        applyKeyChanges(octave, 0, expired[octave]);
       }
     }
-    else if (action == 0x4d)
+    taskEXIT_CRITICAL();
+    if (received != pdTRUE)
     {
-      // Master
-      // Synth should be transmitter, update octave
-      if (!localConnected)
-      {
-        int8_t octave = RX_Message[1];
-        knob2.setRotation(octave);
-        __atomic_store_n(&receiver, 0, __ATOMIC_RELAXED);
-        __atomic_store_n(&connected, 1, __ATOMIC_RELAXED);
-      }
+      continue;
     }
-    else if (action == 0x54)
+
+    // Only connection messages reach the queue, already checked for their version and duplicates by CAN_RX_ISR
+    xSemaphoreTake(connectionMutex, portMAX_DELAY);
+    controlDispatcher.handle(RX_Message);
+    xSemaphoreGive(connectionMutex);
+  }
+}
+
+/* --- RTOS objects ---*/
+
+void createRtosObjects()
+/*
+ * Creates every task, queue and mutex in the tables, from statically allocated memory
+ * Must be called before the scheduler starts
+ */
+{
+  for (uint8_t i = 0; i < MUTEXES; i++)
+  {
+    *mutexConfigs[i].handle = xSemaphoreCreateMutexStatic(&mutexBuffers[i]);
+    vQueueAddToRegistry(*mutexConfigs[i].handle, mutexConfigs[i].name);
+  }
+
+  uint8_t *storage = queueStorage;
+  for (uint8_t i = 0; i < QUEUES; i++)
+  {
+    const QueueConfig &config = queueConfigs[i];
+    *config.handle = xQueueCreateStatic(config.length, config.itemSize, storage, &queueBuffers[i]);
+    vQueueAddToRegistry(*config.handle, config.name);
+    storage += config.length * config.itemSize;
+  }
+
+  StackType_t *stack = taskStacks;
+  for (uint8_t i = 0; i < TASKS; i++)
+  {
+    const TaskConfig &config = taskConfigs[i];
+    taskHandles[i] = xTaskCreateStatic(config.function, config.name, config.stackWords, NULL, config.priority, stack,
+                                       &taskBuffers[i]);
+    if (config.handle)
     {
-      // Transmitter
-      // Synth should become a transmitter
-      __atomic_store_n(&receiver, 0, __ATOMIC_RELAXED);
+      *config.handle = taskHandles[i];
     }
+    stack += config.stackWords;
+  }
+}
 
-    xSemaphoreGive(connectionMutex);
+extern "C" void vApplicationStackOverflowHook(TaskHandle_t task, char *name)
+/*
+ * Called by FreeRTOS when it finds a task has overflowed its stack, as it switches away from the task
+ * Whatever lies past the stack may already be overwritten, so the module stops here with the LED lit, for a debugger
+ * to read the task from overflowedTask and overflowedTaskName
+ *
+ * :param task: the task
+ *
+ * :param name: its name
+ */
+{
+  taskDISABLE_INTERRUPTS();
+  overflowedTask = task;
+  overflowedTaskName = name;
+  digitalWrite(LED_BUILTIN, HIGH);
+  while (1)
+  {
+  }
+}
+
+extern "C" void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *stackWords)
+/*
+ * Called by vTaskStartScheduler() for the memory of the idle task
+ *
+ * :param tcb: set to the idle task's control block
+ *
+ * :param stack: set to the idle task's stack
+ *
+ * :param stackWords: set to the size of the stack in words
+ */
+{
+  *tcb = &idleBuffer;
+  *stack = idleStack;
+  *stackWords = configMINIMAL_STACK_SIZE;
+}
+
+#if configUSE_TIMERS == 1
+extern "C" void vApplicationGetTimerTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *stackWords)
+/*
+ * Called by vTaskStartScheduler() for the memory of the timer service task
+ *
+ * :param tcb: set to the timer task's control block
+ *
+ * :param stack: set to the timer task's stack
+ *
+ * :param stackWords: set to the size of the stack in words
+ */
+{
+  *tcb = &timerBuffer;
+  *stack = timerStack;
+  *stackWords = configTIMER_TASK_STACK_DEPTH;
+}
+#endif
+
+void printStacks()
+/*
+ * Prints the most stack every task has used over Serial, blocking until it has been sent
+ */
+{
+  char line[64];
+  for (uint8_t i = 0; i <= TASKS; i++)
+  {
+    const char *name = i < TASKS ? taskConfigs[i].name : "idle";
+    uint32_t words = i < TASKS ? taskConfigs[i].stackWords : configMINIMAL_STACK_SIZE;
+    TaskHandle_t handle = i < TASKS ? taskHandles[i] : xTaskGetIdleTaskHandle();
+    uint32_t used = words - uxTaskGetStackHighWaterMark(handle);
+    snprintf(line, sizeof(line), "Stack %s: %lu of %lu words used", name, (unsigned long)used, (unsigned long)words);
+    Serial.println(line);
   }
 }
 
@@ -613,70 +1320,19 @@ void setup()
 {
   // put your setup code here, to run once:
 
-  keyArrayMutex = xSemaphoreCreateMutex();
-  connectionMutex = xSemaphoreCreateMutex();
-  CAN_TX_Semaphore = xSemaphoreCreateCounting(3, 3);
-
-  TIM_TypeDef *Instance = TIM1;
-  HardwareTimer *sampleTimer = new HardwareTimer(Instance);
-
-  TaskHandle_t scanKeysHandle = NULL;
-  xTaskCreate(
-      scanKeysTask,     /* Function that implements the task */
-      "scanKeys",       /* Text name for the task */
-      64,               /* Stack size in words, not bytes */
-      NULL,             /* Parameter passed into the task */
-      6,                /* Task priority */
-      &scanKeysHandle); /* Pointer to store the task handle */
-
-  TaskHandle_t joystickHandle = NULL;
-  xTaskCreate(
-      joystickTask,     /* Function that implements the task */
-      "joystick",       /* Text name for the task */
-      64,               /* Stack size in words, not bytes */
-      NULL,             /* Parameter passed into the task */
-      4,                /* Task priority */
-      &joystickHandle); /* Pointer to store the task handle */
-
-  TaskHandle_t autoMultiSynthHandle = NULL;
-  xTaskCreate(
-      autoMultiSynthTask,     /* Function that implements the task */
-      "autoMultiSynth",       /* Text name for the task */
-      64,                     /* Stack size in words, not bytes */
-      NULL,                   /* Parameter passed into the task */
-      1,                      /* Task priority */
-      &autoMultiSynthHandle); /* Pointer to store the task handle */
-
-  TaskHandle_t displayUpdateTaskHandle = NULL;
-  xTaskCreate(
-      displayUpdateTask,         /* Function that implements the task */
-      "displayUpdate",           /* Text name for the task */
-      256,                       /* Stack size in words, not bytes */
-      NULL,                      /* Parameter passed into the task */
-      2,                         /* Task priority */
-      &displayUpdateTaskHandle); /* Pointer to store the task handle */
-
-  TaskHandle_t decodeTaskHandle = NULL;
-  xTaskCreate(
-      decodeTask,         /* Function that implements the task */
-      "decode",           /* Text name for the task */
-      64,                 /* Stack size in words, not bytes */
-      NULL,               /* Parameter passed into the task */
-      5,                  /* Task priority */
-      &decodeTaskHandle); /* Pointer to store the task handle */
-
-  TaskHandle_t CAN_TX_TaskHandle = NULL;
-  xTaskCreate(
-      CAN_TX_Task,         /* Function that implements the task */
-      "CAN_TX",            /* Text name for the task */
-      256,                 /* Stack size in words, not bytes */
-      NULL,                /* Parameter passed into the task */
-      3,                   /* Task priority */
-      &CAN_TX_TaskHandle); /* Pointer to store the task handle */
-
-  sampleTimer->setOverflow(22000, HERTZ_FORMAT);
-  sampleTimer->attachInterrupt(sampleISR);
-  sampleTimer->resume();
+  createRtosObjects();
+
+  sampleTimer.setup(TIM1);
+  scanTimer.setup(TIM7);
+
+  // Cycle counter for the load meter, started before the first sample
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  loadMeter.begin(SystemCoreClock / sampleFrequency);
+
+  sampleTimer.setOverflow(sampleFrequency, HERTZ_FORMAT);
+  sampleTimer.attachInterrupt(sampleISR);
+  sampleTimer.resume();
   // Set pin directions
   pinMode(RA0_PIN, OUTPUT);
   pinMode(RA1_PIN, OUTPUT);
@@ -691,8 +1347,6 @@ void setup()
   pinMode(C1_PIN, INPUT);
   pinMode(C2_PIN, INPUT);
   pinMode(C3_PIN, INPUT);
-  pinMode(JOYX_PIN, INPUT);
-  pinMode(JOYY_PIN, INPUT);
 
   // Initialise display
   setOutMuxBit(DRST_BIT, LOW); // Assert display logic reset
@@ -701,15 +1355,43 @@ void setup()
   u8g2.begin();
   setOutMuxBit(DEN_BIT, HIGH); // Enable display power supply
 
+  // Start sampling the joystick, it is calibrated from the first frames so must be at rest
+  joystick.begin();
+
+  // Start the background key matrix scan, from here on only the scanner touches the mux
+  matrixPort.begin();
+  matrixScanner.start();
+  scanTimer.setOverflow(scanTickFrequency, HERTZ_FORMAT);
+  scanTimer.attachInterrupt(scanISR);
+  scanTimer.resume();
+
   // Initialise UART
   Serial.begin(9600);
   Serial.println("Hello World");
 
-  msgInQ = xQueueCreate(36, 8);
-  msgOutQ = xQueueCreate(36, 8);
+  moduleId = getModuleId();
+  voiceAlloc.setSelf(moduleId);
+  discovery.setSelf(moduleId);
+
+  // Key events and clock syncs are handled in the receive interrupt, connection messages are deferred to the decodeTask
+  dispatcher.on<KeyEventsMessage, onKeyEvents>();
+  dispatcher.on<TraceMessage, onTrace>();
+  dispatcher.on<SyncMessage, onSync>();
+  dispatcher.on<SyncTimeMessage, onSyncTime>();
+  dispatcher.on(MSG_DISCOVERY, deferMessage);
+  dispatcher.on(MSG_TRANSMITTER, deferMessage);
+  dispatcher.on(MSG_POLYPHONY, deferMessage);
+  controlDispatcher.on<DiscoveryMessage, onDiscovery>();
+  controlDispatcher.on<TransmitterMessage, onTransmitter>();
+  controlDispatcher.on<PolyphonyMessage, onPolyphony>();
 
   CAN_Init(false);
-  setCANFilter(0x123, 0x7ff);
+  // Banks 0 and 2 take the note and trace classes while this module is a receiver, banks 1 and 3 always take the
+  // control and clock classes
+  setCANFilter(messageId(CLASS_NOTES, 0), CLASS_ID_MASK, 0);
+  setCANFilter(messageId(CLASS_CONTROL, 0), CLASS_ID_MASK, 1);
+  setCANFilter(messageId(CLASS_TRACE, 0), CLASS_ID_MASK, 2);
+  setCANFilter(messageId(CLASS_CLOCK, 0), CLASS_ID_MASK, 3);
   CAN_RegisterRX_ISR(CAN_RX_ISR);
   CAN_RegisterTX_ISR(CAN_TX_ISR);
 
@@ -722,7 +1404,10 @@ void setup()
   vTaskStartScheduler();
 }
 
-// empty loop function
 void loop()
+/*
+ * Called on every pass of the idle task, as STM32FreeRTOS's idle hook, whenever no task is ready to run
+ */
 {
+  loadMeter.idled(DWT->CYCCNT);
 }
@@ -1,8 +1,28 @@
-#include <Arduino.h>
 #include <unity.h>
+#include "test_oscillator.h"
+#include "test_keymatrix.h"
 #include "knob.h"
 #include "test_joystick.h"
+#include "test_keycodec.h"
+#include "test_canproto.h"
+#include "test_cantiming.h"
+#include "test_cantx.h"
+#include "test_noteevents.h"
+#include "test_latency.h"
+#include "test_voicealloc.h"
+#include "test_discovery.h"
+#include "test_clocksync.h"
+#include "test_cansim.h"
+#include "test_display.h"
+#include "test_sound.h"
+#include "test_scope.h"
+#include "test_loadmeter.h"
+
+// Tests that need the board are only built for the target, the rest also run on the host (pio test -e native)
+#ifdef ARDUINO
+#include <Arduino.h>
 #include "main.h"
+#endif
 
 // void setUp(void) {
 // // set stuff up here
@@ -39,22 +59,21 @@ void test_calculateAndAssignval(void)
 
     // TODO: Testing all possible combinations of inputs using truth table from notes
     /*
-       All the test cases work as expected apart from impossible transition (expect 2 output 0)
-       solution: change "return prevStep * 2;" in knob.cpp
+       Impossible transitions (both bits changed) are a missed step in the direction of the previous change
     */
     TEST_ASSERT_EQUAL_INT8(0, knobTest.calculateAndAssignval(0, 0, 0, 0, 1));
     TEST_ASSERT_EQUAL_INT8(-1, knobTest.calculateAndAssignval(0, 0, 0, 1, 1));
     TEST_ASSERT_EQUAL_INT8(+1, knobTest.calculateAndAssignval(0, 0, 1, 0, 1));
-    // TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(0, 0, 1, 1, 1));
+    TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(0, 0, 1, 1, 1));
     TEST_ASSERT_EQUAL_INT8(+1, knobTest.calculateAndAssignval(0, 1, 0, 0, 1));
     TEST_ASSERT_EQUAL_INT8(0, knobTest.calculateAndAssignval(0, 1, 0, 1, 1));
-    // TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(0, 1, 1, 0, 1));
+    TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(0, 1, 1, 0, 1));
     TEST_ASSERT_EQUAL_INT8(-1, knobTest.calculateAndAssignval(0, 1, 1, 1, 1));
     TEST_ASSERT_EQUAL_INT8(-1, knobTest.calculateAndAssignval(1, 0, 0, 0, 1));
-    // TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(1, 0, 0, 1, 1));
+    TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(1, 0, 0, 1, 1));
     TEST_ASSERT_EQUAL_INT8(0, knobTest.calculateAndAssignval(1, 0, 1, 0, 1));
     TEST_ASSERT_EQUAL_INT8(+1, knobTest.calculateAndAssignval(1, 0, 1, 1, 1));
-    // TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(1, 1, 0, 0, 1));
+    TEST_ASSERT_EQUAL_INT8(+2, knobTest.calculateAndAssignval(1, 1, 0, 0, 1));
     TEST_ASSERT_EQUAL_INT8(+1, knobTest.calculateAndAssignval(1, 1, 0, 1, 1));
     TEST_ASSERT_EQUAL_INT8(-1, knobTest.calculateAndAssignval(1, 1, 1, 0, 1));
     TEST_ASSERT_EQUAL_INT8(0, knobTest.calculateAndAssignval(1, 1, 1, 1, 1));
@@ -68,29 +87,156 @@ void test_calculateAndAssignval(void)
     TEST_ASSERT_EQUAL_INT8(0, knobTest.calculateAndAssignval(2, 2, 2, 2, 1));
     TEST_ASSERT_EQUAL_INT8(2, knobTest.calculateAndAssignval(2, 0, 0, 0, 1));
 
+    // Missed steps follow the direction of the previous change, and are ignored when there is none
+    TEST_ASSERT_EQUAL_INT8(-2, knobTest.calculateAndAssignval(0, 0, 1, 1, -1));
+    TEST_ASSERT_EQUAL_INT8(0, knobTest.calculateAndAssignval(0, 0, 1, 1, 0));
+
     // TODO: add other cases you can think of
 }
 
-void setup()
+void test_knobAcceleration(void)
 /*
- * Function to set up testing enviroment and call all test we only want to run once and not continously in the loop
+ * Unit tests for the knob class function applyAcceleration
  */
 {
-    // Delaying until device is ready
-    delay(2000);
+    Knob knobTest(0);
 
-    // Starting testing
-    UNITY_BEGIN(); // IMPORTANT LINE!
+    // First step, and steps after a pause, are not scaled
+    TEST_ASSERT_EQUAL_INT8(1, knobTest.applyAcceleration(1, 100000));
+    TEST_ASSERT_EQUAL_INT8(1, knobTest.applyAcceleration(1, 100000 + knobMediumInterval));
+
+    // Quick steps in the same direction are scaled
+    TEST_ASSERT_EQUAL_INT8(2, knobTest.applyAcceleration(1, 100000 + 2 * knobMediumInterval - 1));
+    TEST_ASSERT_EQUAL_INT8(4, knobTest.applyAcceleration(1, 100000 + 2 * knobMediumInterval));
+    TEST_ASSERT_EQUAL_INT8(8, knobTest.applyAcceleration(2, 100000 + 2 * knobMediumInterval + 1000));
 
+    // Reversing is never scaled
+    TEST_ASSERT_EQUAL_INT8(-1, knobTest.applyAcceleration(-1, 100000 + 2 * knobMediumInterval + 2000));
+    TEST_ASSERT_EQUAL_INT8(-4, knobTest.applyAcceleration(-1, 100000 + 2 * knobMediumInterval + 3000));
+
+    // Disabled acceleration leaves every step unchanged
+    Knob knobNoAccel(2, 1, 7, false);
+    TEST_ASSERT_EQUAL_INT8(1, knobNoAccel.applyAcceleration(1, 0));
+    TEST_ASSERT_EQUAL_INT8(1, knobNoAccel.applyAcceleration(1, 100));
+}
+
+void test_knobUpdateRotation(void)
+/*
+ * Unit tests for the knob class function updateRotation, decoding a sequence of matrix rows
+ */
+{
+    // Knob 3 is on columns 0 and 1, gray code sequence for clockwise rotation
+    const uint8_t clockwise[4] = {0x0, 0x1, 0x3, 0x2};
+    Knob knobTest(3, 0, 4);
+    uint32_t now = 0;
+
+    // Slow rotation moves one transition (half a detent) at a time, and is clamped at the upper limit
+    for (uint8_t i = 1; i <= 12; i++)
+    {
+        now += 2 * knobMediumInterval;
+        knobTest.updateRotation(clockwise[i & 3], now);
+    }
+    TEST_ASSERT_EQUAL_INT8(8, knobTest.knobRotation);
+    TEST_ASSERT_EQUAL(4, knobTest.getRotation());
+
+    // Fast rotation the other way accelerates after the first transition, and is clamped at the lower limit
+    knobTest.updateRotation(clockwise[3], now += 2 * knobMediumInterval);
+    TEST_ASSERT_EQUAL_INT8(7, knobTest.knobRotation);
+    knobTest.updateRotation(clockwise[2], now += 1000);
+    TEST_ASSERT_EQUAL_INT8(3, knobTest.knobRotation);
+    knobTest.updateRotation(clockwise[1], now += 1000);
+    TEST_ASSERT_EQUAL_INT8(0, knobTest.knobRotation);
+
+    // Unchanged readings leave the rotation alone
+    knobTest.updateRotation(clockwise[1], now += 1000);
+    TEST_ASSERT_EQUAL_INT8(0, knobTest.knobRotation);
+
+    // Knob 3 button is on column 1
+    knobTest.updateButton(0xD);
+    TEST_ASSERT_EQUAL(0, knobTest.getButton());
+    knobTest.updateButton(0x2);
+    TEST_ASSERT_EQUAL(1, knobTest.getButton());
+}
+
+void runTests()
+/*
+ * Runs every test available on the current platform
+ */
+{
     RUN_TEST(test_example);
 
-    // Knob example
+    // knob
     RUN_TEST(test_calculateAndAssignval);
+    RUN_TEST(test_knobAcceleration);
+    RUN_TEST(test_knobUpdateRotation);
 
     // joystick
     test_Joystick();
 
+    // oscillator
+    test_Oscillator();
+
+    // key matrix
+    test_KeyMatrix();
+
+    // key codec
+    test_KeyCodec();
+
+    // CAN protocol
+    test_CanProto();
+
+    // CAN timing analysis
+    test_CanTiming();
+
+    // CAN transmit ring
+    test_CanTx();
+
+    // note events
+    test_NoteEvents();
+
+    // latency tracing
+    test_Latency();
+
+    // distributed polyphony
+    test_VoiceAlloc();
+
+    // chain discovery
+    test_Discovery();
+
+    // shared clock
+    test_ClockSync();
+
+    // simulated CAN bus
+    test_CanSim();
+
+    // display updates
+    test_Display();
+
+    // sound status
+    test_Sound();
+
+    // audio views
+    test_Scope();
+
+    // load meter
+    test_LoadMeter();
+
     // TODO: Add test here
+}
+
+#ifdef ARDUINO
+void setup()
+/*
+ * Function to set up testing enviroment and call all test we only want to run once and not continously in the loop
+ */
+{
+    // Delaying until device is ready
+    delay(2000);
+
+    // Starting testing
+    UNITY_BEGIN(); // IMPORTANT LINE!
+
+    runTests();
 
     UNITY_END(); // stop unit testing
 }
@@ -98,3 +244,16 @@ void setup()
 void loop()
 {
 }
+#else
+int main(void)
+/*
+ * Entry point for the host test build
+ */
+{
+    UNITY_BEGIN();
+
+    runTests();
+
+    return UNITY_END();
+}
+#endif
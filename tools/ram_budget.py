@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""
+Prints the RAM taken by each subsystem of the firmware, from the linker map
+
+Run by PlatformIO after every build of the board (extra_scripts in platformio.ini), or by hand on a map file:
+    python3 tools/ram_budget.py .pio/build/nucleo_l432kc/firmware.map
+
+Every input section the linker placed in a writable memory region is added to the subsystem it came from: its library
+under lib/ (or a library dependency), the framework, the C library, or main for src/. The RTOS objects main.cpp
+reserves for its tasks, queues and mutexes are listed on their own, as are the heap and main stack reserved by the
+linker script.
+"""
+
+import os
+import re
+import sys
+from collections import defaultdict
+
+# Memory reserved by main.cpp for the RTOS objects in its tables
+RTOS_SYMBOLS = {
+    'taskStacks': 'task stacks',
+    'taskBuffers': 'task control blocks',
+    'taskHandles': 'task handles',
+    'queueStorage': 'queue items',
+    'queueBuffers': 'queue control blocks',
+    'mutexBuffers': 'mutex control blocks',
+    'idleStack': 'idle task stack',
+    'idleBuffer': 'idle task control block',
+    'timerStack': 'timer task stack',
+    'timerBuffer': 'timer task control block',
+}
+
+RAM_SECTIONS = ('.data', '.bss', 'COMMON', '.noinit')
+HEAP_STACK_SECTION = '._user_heap_stack'
+
+MEMORY_LINE = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s*(\S*)')
+INPUT_LINE = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+INPUT_NAME = re.compile(r'^ (\S+)$')
+INPUT_REST = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+OUTPUT_LINE = re.compile(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+OUTPUT_NAME = re.compile(r'^(\S+)$')
+OUTPUT_REST = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+ARCHIVE = re.compile(r'lib([^/\\()]+)\.a\(')
+
+
+def subsystem(path):
+    """
+    :param path: object file of an input section, as the map names it
+
+    :return: name of the subsystem it belongs to
+    """
+    archive = ARCHIVE.search(path)
+    if archive:
+        name = archive.group(1)
+        if name.startswith('FrameworkArduino'):
+            return 'arduino core'
+        if name.startswith('c_nano') or name in ('c', 'm', 'nosys', 'stdc++_nano', 'stdc++'):
+            return 'C library'
+        if name == 'gcc':
+            return 'compiler runtime'
+        return name
+    if '/src/' in path.replace('\\', '/') or path.startswith('src/'):
+        return 'main'
+    return os.path.basename(path)
+
+
+def parse(lines):
+    """
+    Reads a GNU ld map
+
+    :param lines: lines of the map
+
+    :return: (list of (name, size) of the writable memory regions, list of (section, address, size, object file) in
+             them, size of the heap and stack reserve)
+    """
+    regions = []
+    sections = []
+    reserve = 0
+    state = None
+    pending = None
+    pending_output = None
+
+    for line in lines:
+        line = line.rstrip('\n')
+        if line.startswith('Memory Configuration'):
+            state = 'memory'
+            continue
+        if line.startswith('Linker script and memory map'):
+            state = 'map'
+            continue
+
+        if state == 'memory':
+            match = MEMORY_LINE.match(line)
+            if match and match.group(1) != '*default*' and 'w' in match.group(4):
+                regions.append((match.group(1), int(match.group(2), 16), int(match.group(3), 16)))
+            continue
+        if state != 'map':
+            continue
+
+        # Output sections start in the first column, only the heap and stack reserve is wanted
+        if pending_output:
+            match = OUTPUT_REST.match(line)
+            if match:
+                reserve = int(match.group(2), 16)
+            pending_output = None
+            continue
+        if line.startswith(HEAP_STACK_SECTION):
+            match = OUTPUT_LINE.match(line)
+            if match:
+                reserve = int(match.group(3), 16)
+            elif OUTPUT_NAME.match(line):
+                pending_output = True
+            continue
+
+        # Input sections are indented by one space, with long names on a line of their own
+        if pending:
+            match = INPUT_REST.match(line)
+            if match:
+                sections.append((pending, int(match.group(1), 16), int(match.group(2), 16), match.group(3).strip()))
+            pending = None
+            continue
+        match = INPUT_LINE.match(line)
+        if match:
+            sections.append((match.group(1), int(match.group(2), 16), int(match.group(3), 16),
+                             match.group(4).strip()))
+            continue
+        match = INPUT_NAME.match(line)
+        if match and match.group(1).startswith(RAM_SECTIONS):
+            pending = match.group(1)
+
+    def in_ram(address):
+        return any(origin <= address < origin + length for _, origin, length in regions)
+
+    ram = [s for s in sections if s[0].startswith(RAM_SECTIONS) and s[2] and in_ram(s[1])]
+    return [(name, length) for name, _, length in regions], ram, reserve
+
+
+def report(path, out=sys.stdout):
+    """
+    Prints the RAM budget of a build
+
+    :param path: the linker map
+
+    :param out: where to print it
+    """
+    with open(path) as map_file:
+        regions, sections, reserve = parse(map_file)
+
+    data = defaultdict(int)
+    bss = defaultdict(int)
+    rtos = defaultdict(int)
+    for name, _, size, path in sections:
+        symbol = name.split('.', 2)[-1]
+        if subsystem(path) == 'main' and symbol in RTOS_SYMBOLS:
+            rtos[RTOS_SYMBOLS[symbol]] += size
+            owner = 'RTOS objects'
+        else:
+            owner = subsystem(path)
+        if name.startswith('.data'):
+            data[owner] += size
+        else:
+            bss[owner] += size
+
+    owners = sorted(set(data) | set(bss), key=lambda o: -(data[o] + bss[o]))
+    total = sum(data.values()) + sum(bss.values())
+    capacity = sum(length for _, length in regions)
+
+    out.write('RAM budget (bytes)\n')
+    out.write('  {:<28} {:>7} {:>7} {:>7}\n'.format('subsystem', 'data', 'bss', 'total'))
+    for owner in owners:
+        out.write('  {:<28} {:>7} {:>7} {:>7}\n'.format(owner, data[owner], bss[owner], data[owner] + bss[owner]))
+        if owner == 'RTOS objects':
+            for part, size in sorted(rtos.items(), key=lambda p: -p[1]):
+                out.write('    {:<26} {:>23}\n'.format(part, size))
+    out.write('  {:<28} {:>23}\n'.format('heap and main stack reserve', reserve))
+    used = total + reserve
+    out.write('  {:<28} {:>23}\n'.format('used', used))
+    if capacity:
+        regions_text = ', '.join('{} {}'.format(name, length) for name, length in regions)
+        out.write('  {:<28} {:>23}  ({})\n'.format('free', capacity - used, regions_text))
+
+
+try:
+    Import('env')  # noqa: F821, defined when PlatformIO runs this as an extra script
+except NameError:
+    env = None
+
+if env is not None:
+    def after_build(source, target, env):
+        report(os.path.join(env.subst('$BUILD_DIR'), 'firmware.map'))
+
+    env.AddPostAction('$BUILD_DIR/${PROGNAME}.elf', after_build)
+elif __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    report(sys.argv[1])
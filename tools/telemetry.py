@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+Decodes the load meter's telemetry from a module's Serial port, and optionally plots it
+
+The module streams a 13 byte frame once a second after it is sent 'm' (lib/loadmeter/loadmeter.h). Frames are found
+by their sync bytes and checksum, so text the module prints in between is skipped.
+
+Usage:
+    python3 tools/telemetry.py /dev/ttyACM0            print a line per second
+    python3 tools/telemetry.py /dev/ttyACM0 --plot     also plot the last minute live
+    python3 tools/telemetry.py capture.bin             decode a saved capture
+"""
+
+import argparse
+import os
+import struct
+import sys
+from collections import deque
+
+SYNC = bytes([0xA5, 0x5A])
+FRAME_SIZE = 13
+LOAD_SCALE = 10  # Tenths of a percent to percent
+
+
+def decode(buffer):
+    """
+    Takes every whole frame from the start of a buffer
+
+    :param buffer: bytearray of received bytes, the decoded frames and anything before them are removed
+
+    :return: list of (sequence, audio %, idle %, samples, overruns, peak voices)
+    """
+    frames = []
+    while True:
+        start = buffer.find(SYNC)
+        if start < 0:
+            # Keep a trailing first sync byte, the second may be in the next read
+            del buffer[:max(0, len(buffer) - 1)]
+            return frames
+        if len(buffer) - start < FRAME_SIZE:
+            del buffer[:start]
+            return frames
+
+        frame = buffer[start:start + FRAME_SIZE]
+        if sum(frame[2:FRAME_SIZE - 1]) & 0xFF != frame[FRAME_SIZE - 1]:
+            # Not a frame, the sync bytes were in text or a corrupted frame
+            del buffer[:start + 1]
+            continue
+
+        sequence, audio, idle, samples, overruns, voices = struct.unpack('<BHHHHB', bytes(frame[2:FRAME_SIZE - 1]))
+        frames.append((sequence, audio / LOAD_SCALE, idle / LOAD_SCALE, samples, overruns, voices))
+        del buffer[:start + FRAME_SIZE]
+
+
+def open_source(path, baud):
+    """
+    :param path: Serial port, or a file of captured bytes
+
+    :param baud: Serial baud rate
+
+    :return: object with read(size), and whether it is a Serial port
+    """
+    if os.path.isfile(path):
+        return open(path, 'rb'), False
+    import serial
+    port = serial.Serial(path, baud, timeout=0.2)
+    port.write(b'm')
+    return port, True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', help='Serial port or capture file')
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--plot', action='store_true', help='plot the last minute live (needs matplotlib)')
+    args = parser.parse_args()
+
+    source, live = open_source(args.source, args.baud)
+    history = deque(maxlen=60)
+    if args.plot:
+        import matplotlib.pyplot as plt
+        plt.ion()
+        figure, (loads, counts) = plt.subplots(2, 1, sharex=True)
+
+    buffer = bytearray()
+    last = None
+    print('seq  audio%  idle%  samples  overruns  voices')
+    try:
+        while True:
+            data = source.read(64)
+            if not data and not live:
+                break
+            buffer += data
+            for frame in decode(buffer):
+                sequence = frame[0]
+                if last is not None and sequence != (last + 1) & 0xFF:
+                    print('({} frames lost)'.format((sequence - last - 1) & 0xFF))
+                last = sequence
+                print('{:3d}  {:6.1f}  {:5.1f}  {:7d}  {:8d}  {:6d}'.format(*frame))
+                history.append(frame)
+
+                if args.plot:
+                    seconds = range(-len(history) + 1, 1)
+                    loads.clear()
+                    loads.plot(seconds, [f[1] for f in history], label='audio')
+                    loads.plot(seconds, [f[2] for f in history], label='idle')
+                    loads.set_ylabel('% of CPU')
+                    loads.set_ylim(0, 100)
+                    loads.legend(loc='upper left')
+                    counts.clear()
+                    counts.step(seconds, [f[5] for f in history], where='post', label='peak voices')
+                    counts.bar(seconds, [f[4] for f in history], color='red', label='overruns')
+                    counts.set_xlabel('seconds')
+                    counts.legend(loc='upper left')
+                    plt.pause(0.01)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if live:
+            source.write(b'm')
+        source.close()
+
+
+if __name__ == '__main__':
+    sys.exit(main())